@@ -15,7 +15,9 @@
 #include <linux/videodev2.h>
 #include <sys/time.h>
 
+#include <memory>
 #include <unordered_map>
+#include <vector>
 #include <utils/KeyedVector.h>
 #include <cutils/properties.h>
 #include <sys/types.h>
@@ -28,6 +30,15 @@
 #include "sideband/RTSidebandWindow.h"
 #include "common/RgaCropScale.h"
 #include "common/HandleImporter.h"
+#include "common/EpollReactor.h"
+#include "common/CaptureBackend.h"
+#include "common/StageBackends.h"
+#include "common/IndexRing.h"
+#include "common/TvInputConfig.h"
+#include "common/GraphicBufferPool.h"
+#include "common/PipelineStats.h"
+#include "common/FrameDumper.h"
+#include "common/V4L2DeviceRegistry.h"
 #include "common/rk_hdmirx_config.h"
 #include "common/rk-camera-module.h"
 #include <rkpq.h>
@@ -53,12 +64,13 @@ typedef struct source_buffer_info {
 struct HinNodeInfo {
     struct v4l2_capability cap;
     struct v4l2_format format;
-    struct v4l2_plane planes[SIDEBAND_WINDOW_BUFF_CNT];
+    // capture slots, sized to the stream's capture depth by init()
+    std::vector<struct v4l2_plane> planes;
     struct v4l2_buffer onceBuff;
     struct v4l2_requestbuffers reqBuf;
-    struct v4l2_buffer bufferArray[SIDEBAND_WINDOW_BUFF_CNT];
-    buffer_handle_t buffer_handle_poll[SIDEBAND_WINDOW_BUFF_CNT];
-    vt_buffer_t *vt_buffers[SIDEBAND_WINDOW_BUFF_CNT];
+    std::vector<struct v4l2_buffer> bufferArray;
+    std::vector<buffer_handle_t> buffer_handle_poll;
+    std::vector<vt_buffer_t *> vt_buffers;
 //    long *mem[SIDEBAND_WINDOW_BUFF_CNT];
 //    unsigned reservedData[SIDEBAND_WINDOW_BUFF_CNT];
 //    unsigned refcount[SIDEBAND_WINDOW_BUFF_CNT];
@@ -81,6 +93,17 @@ typedef struct tv_record_buffer_info {
     bool isCoding;
 } tv_record_buffer_info_t;
 
+// queue depths of one stream, 0 takes the TV_INPUT_*_BUFF_CNT property
+// or the default of the stream's mode
+typedef struct tv_buffer_depths {
+    int capture = 0;
+    int pq = 0;
+    int iep = 0;
+    int record = 0;
+    // game mode, lets the capture ring go down to 2 while pq is off
+    bool lowLatency = false;
+} tv_buffer_depths_t;
+
 typedef struct tv_pq_buffer_info {
     buffer_handle_t srcHandle = NULL;
     buffer_handle_t outHandle = NULL;
@@ -89,6 +112,19 @@ typedef struct tv_pq_buffer_info {
     bool isFilled;
 } tv_pq_buffer_info_t;
 
+// who owns a dmabuf fd seen on the vtunnel/v4l2 path
+enum BufferSlotOwner {
+    BUFFER_SLOT_CAPTURE = 0,
+    BUFFER_SLOT_PQ,
+    BUFFER_SLOT_IEP,
+};
+
+typedef struct buffer_slot {
+    int owner;
+    int index;    // v4l2 index, or index in mPqBufferHandle/mIepBufferHandle
+    vt_buffer_t *vtBuffer;
+} buffer_slot_t;
+
 enum State {
     START,
     PAUSE,
@@ -116,11 +152,12 @@ typedef struct tv_input_command{
     int command_id;
 } tv_input_command_t;
 
-typedef void (*NotifyQueueDataCallback)(tv_input_capture_result_t result, uint64_t buff_id);
+// user is the pointer given along with the callback to HinDevImpl
+typedef void (*NotifyQueueDataCallback)(void *user, tv_input_capture_result_t result, uint64_t buff_id);
 
 typedef void (*app_data_callback)(void *user, source_buffer_info_t *buff_info);
 
-typedef void (*NotifyCommandCallback)(tv_input_command command);
+typedef void (*NotifyCommandCallback)(void *user, tv_input_command command);
 
 #define HIN_GRALLOC_USAGE  GRALLOC_USAGE_HW_TEXTURE | \
                                     GRALLOC_USAGE_HW_RENDER | \
@@ -132,15 +169,43 @@ typedef void (*NotifyCommandCallback)(tv_input_command command);
     (type *)((char*)(ptr) - offsetof(type, member))
 #endif
 
-static std::vector<tv_record_buffer_info_t> mRecordHandle;
-//static std::mutex mRecordMutex;
+
+// wakes a pipeline stage, a signal sent while the stage is busy is kept
+// for its next wait
+class StageSignal {
+    public:
+        void signal() {
+            Mutex::Autolock autoLock(mLock);
+            mPending = true;
+            mCond.signal();
+        }
+        // returns true if signalled, false on timeout
+        bool wait(nsecs_t timeout) {
+            Mutex::Autolock autoLock(mLock);
+            if (!mPending) {
+                mCond.waitRelative(mLock, timeout);
+            }
+            bool signalled = mPending;
+            mPending = false;
+            return signalled;
+        }
+    private:
+        Mutex mLock;
+        Condition mCond;
+        bool mPending = false;
+};
 
 class HinDevImpl {
     public:
         HinDevImpl();
         ~HinDevImpl();
         int init(int id,int type, int& initWidth, int& initHeight,int& initFormat);
+        // id is the capture input, 0 for the first rk_hdmirx or HDMI-MIPI bridge
         int findDevice(int id, int& initWidth, int& initHeight,int& initFormat);
+        // capture from backend instead of a /dev node, takes ownership
+        int openCapture(tvinput::CaptureBackend *backend, int& initWidth, int& initHeight, int& initFormat);
+        // capture inputs of the configured hdmiin type on the board
+        static int countInputs();
         int start();
         int stop();
         int pause();
@@ -154,11 +219,12 @@ class HinDevImpl {
         int aquire_buffer();
         // int inc_buffer_refcount(int* ptr);
         int release_buffer();
-        int set_preview_callback(NotifyQueueDataCallback callback);
-        int set_data_callback(V4L2EventCallBack callback);
-        int set_command_callback(NotifyCommandCallback callback);
+        int set_preview_callback(NotifyQueueDataCallback callback, void *user);
+        int set_data_callback(V4L2EventCallBack callback, void *user);
+        int set_command_callback(NotifyCommandCallback callback, void *user);
         int set_frame_rate(int frameRate);
         int get_current_sourcesize(int&  width,int&  height,int& format);
+        int reconfigure(int& width, int& height, int& format);
         int start_device();
         int stop_device();
         int set_mode(int display_mode);
@@ -169,13 +235,20 @@ class HinDevImpl {
         bool check_zme(int src_width, int src_height, int* dst_width, int* dst_height);
         int check_interlaced();
         void set_interlaced(int interlaced);
+        // shared with the other opens of this device, outlives HinDevImpl
+        void set_buffer_pool(tvinput::GraphicBufferPool *pool);
+        // stand-ins for the display, pq/iep and record encoder, before init()
+        void set_stage_backends(const tvinput::StageBackends &backends);
+        // per stream queue depths, before init()
+        void set_buffer_depths(const tv_buffer_depths_t &depths);
 
         const tv_input_callback_ops_t* mTvInputCB;
 
     //Just for first start encoding thread control
     bool mEncodeThreadRunning = false;
-    MppEncodeServer *gMppEnCodeServer=nullptr;
     private:
+        // one encoder per input, two inputs record side by side
+        MppEncodeServer *mMppEncodeServer = nullptr;
         int workThread();
         int pqBufferThread();
         int iepBufferThread();
@@ -188,15 +261,42 @@ class HinDevImpl {
         void doPQCmd(const map<string, string> data);
         int getRecordBufferFd(int previewHandlerIndex);
         int init_encodeserver(MppEncodeServer::MetaInfo* info);
+        static void onRecordInputAvailable(void *user, int32_t index);
     void deinit_encodeserver();
         void stopRecord();
+        bool isRecording();
+        bool sendRecordFrame(int index, buffer_handle_t captureHandle);
         void buffDataTransfer(buffer_handle_t srcHandle, int srcFmt, int srcWidth, int srcHeight,
             buffer_handle_t dstHandle, int dstFmt, int dstWidth, int dstHeight, int dstWStride, int dstHStride);
-        int getOutRange(char* value);
+        int getOutRange(const char* value);
         int get_extfmt_info();
         void showVTunnel(vt_buffer_t* vt_buffer);
         bool needShowPqFrame(int pqMode);
         bool qBuf(int fd, bool noFoundLog);
+        void doPq(int srcFd, int dstFd, int pqMode);
+        void doIep(int src0Fd, int src1Fd, int src2Fd, int dstFd, int dst2Fd, int *dilOrder);
+        int dumpStats(const map<string, string> data);
+        void registerBufferSlot(int fd, int owner, int index, vt_buffer_t *vtBuffer);
+        void unregisterBufferSlots(int owner);
+        bool findBufferSlot(int fd, buffer_slot_t *slot);
+        void holdDisplayBuffer(int index, int releaseFence);
+        void releaseDisplayBuffers();
+        void dropReleaseFence(int index);
+        void flushDisplayBuffers();
+        void resetDisplayBuffers();
+        int presentCaptureBuffer(int index, int *releaseFence);
+        int showStageFrame(buffer_handle_t handle, int displayRatio);
+        int showSignalFrame();
+        void deferPresent(int index);
+        void presentDeferred();
+        int findReplayDevice(int& initWidth, int& initHeight, int& initFormat);
+        int captureIoctl(unsigned long request, void *arg);
+        void closeDevice();
+        void releasePqBuffers();
+        void markParked(bool *parked);
+        void waitStagesIdleLocked();
+        void endStageFrame();
+        int abortReconfigureLocked();
     private:
         class WorkThread : public Thread {
             HinDevImpl* mSource;
@@ -261,6 +361,10 @@ class HinDevImpl {
         //KeyedVector<long *, long> mBufs;
         //KeyedVector<long *, long> mTemp_Bufs;
         int mBufferCount;
+        int mPqBufferCount = SIDEBAND_PQ_BUFF_CNT;
+        int mIepBufferCount = SIDEBAND_IEP_BUFF_CNT;
+        int mRecordBufferCount = SIDEBAND_RECORD_BUFF_CNT;
+        tv_buffer_depths_t mBufferDepths;
         int mSrcFrameWidth;
         int mSrcFrameHeight;
         int mDstFrameWidth;
@@ -278,7 +382,9 @@ class HinDevImpl {
         int m_displaymode;
         volatile int mState;
         NotifyQueueDataCallback mNotifyQueueCb;
+        void *mNotifyQueueUser = NULL;
         NotifyCommandCallback mNotifyCommandCb = NULL;
+        void *mNotifyCommandUser = NULL;
         int mPixelFormat;
         int mNativeWindowPixelFormat;
         sp<ANativeWindow> mANativeWindow;
@@ -288,8 +394,19 @@ class HinDevImpl {
         // sp<PreviewBuffThread>   mPreviewBuffThread;
         mutable Mutex mLock;
         Mutex mBufferLock;
+        // pq/iep frames claimed under mBufferLock and still running without
+        // it, rkpq and the stage buffers outlive them, see waitStagesIdleLocked()
+        int mStagesInFlight = 0;
+        Condition mStagesIdleCond;
+        // fd of mCapture, polled by workThread
         int mHinDevHandle;
         int mHinDevEventHandle = -1;
+        v4l2_buf_type mBufType = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        std::unique_ptr<tvinput::CaptureBackend> mCapture;
+        // cached /dev probe results shared by every open, findDevice() only
+        // opens the chosen nodes
+        static tvinput::V4L2DeviceRegistry& devices();
+        int mCaptureInput = 0;
         struct HinNodeInfo *mHinNodeInfo;
         sp<V4L2DeviceEvent>     mV4l2Event;
         sp<V4L2DeviceEvent>     mCsiV4l2Event;
@@ -299,11 +416,16 @@ class HinDevImpl {
         buffer_handle_t         mSidebandHandle;
         buffer_handle_t         mSidebandCancelHandle = NULL;
         sp<RTSidebandWindow>    mSidebandWindow;
+        // per frame presents, mSidebandWindow unless set_stage_backends() replaced it
+        tvinput::DisplaySink   *mDisplay;
+        tvinput::StageBackends  mStageBackends;
         int mFrameType;
         bool mOpen;
         int mDebugLevel;
         int mSkipFrame;
         int mDumpFrameCount;
+        // armed by a dump property change, workThread opens the session
+        bool mDumpPending = false;
         void *mUser;
         bool mV4L2DataFormatConvert;
         int mPreviewBuffIndex = 0;
@@ -312,17 +434,18 @@ class HinDevImpl {
         std::vector<tv_preview_buff_app_t> mPreviewRawHandle;
         std::vector<tv_pq_buffer_info_t> mIepBufferHandle;
         tv_pq_buffer_info_t mIepTempHandle;
-        std::vector<int> mIepPrepareList;
-        std::vector<int> mIepDoneList;
+        tvinput::IndexRing mIepPrepareList{SIDEBAND_IEP_BUFF_CNT};
+        tvinput::IndexRing mIepDoneList{SIDEBAND_IEP_BUFF_CNT};
         int mRecordCodingBuffIndex = 0;
+        std::vector<tv_record_buffer_info_t> mRecordHandle;
         int mDisplayRatio = FULL_SCREEN;
         int mPqMode = PQ_OFF;
         bool mIsLastPqShowFrameMode = false;
         int mOutRange = HDMIRX_DEFAULT_RANGE;
         int mLastOutRange = mOutRange;
         std::vector<tv_pq_buffer_info_t> mPqBufferHandle;
-        std::vector<int> mPqPrepareList;
-        std::vector<int> mPqDoneList;
+        tvinput::IndexRing mPqPrepareList{SIDEBAND_PQ_BUFF_CNT};
+        tvinput::IndexRing mPqDoneList{SIDEBAND_PQ_BUFF_CNT};
         int mPqBuffIndex = 0;
         int mPqBuffOutIndex = 0;
         rkpq *mRkpq=nullptr;
@@ -341,5 +464,35 @@ class HinDevImpl {
         bool mUpdateColorSpace = false;
         struct v4l2_plane mCurrentPlanes;
         struct v4l2_buffer mCurrentBufferArray;
+        // sideband window capture buffers still scanned out, see holdDisplayBuffer()
+        int mDisplayIndex = -1;
+        // per capture buffer, the fence that frees it, watched by mWorkReactor
+        std::vector<int> mReleaseFences;
+        // vsync pacing, at most one frame waits for the commit in flight
+        bool mVsyncPacing = false;
+        int mPendingShowIndex = -1;
+        uint64_t mPacingDropCount = 0;
+        // dmabuf fd -> slot, filled when capture/pq/iep buffers are allocated
+        Mutex mBufferSlotLock;
+        std::unordered_map<int, buffer_slot_t> mBufferSlots;
+        // per stage latency, fps and drops, see the "stats" priv command
+        tvinput::PipelineStats mStats;
+        tvinput::FrameDumper mFrameDumper;
+        // TV_INPUT_* properties polled by the streaming threads
+        tvinput::TvInputConfig mConfig;
+        // handoff between workThread and the pq/iep threads
+        StageSignal mPqSignal;
+        StageSignal mIepSignal;
+        StageSignal mPqSlotSignal;
+        // capture fd and present fence for workThread, woken on start/stop/capture request
+        tvinput::EpollReactor mWorkReactor;
+        // work/pq/iep threads acknowledge a pause, see reconfigure()
+        Mutex mWorkParkLock;
+        Condition mWorkParkCond;
+        bool mWorkParked = false;
+        bool mPqParked = false;
+        bool mIepParked = false;
+        // a failed reconfigure() left no stream, only stop()/start() recovers
+        bool mNeedsReopen = false;
         // std::vector<tv_input_preview_buff_t> mPreviewBuff;
 };
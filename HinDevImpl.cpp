@@ -15,17 +15,24 @@
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <linux/videodev2.h>
 #include <linux/media.h>
 #include <sys/time.h>
 #include <utils/Timers.h>
 
 #include <cutils/properties.h>
+#include <sync/sync.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
 
 #include "HinDev.h"
+#include "common/ReplayCaptureBackend.h"
+#include "common/PixelConvert.h"
+#include "sideband/DrmVopRender.h"
 #include <ui/GraphicBufferMapper.h>
 #include <ui/GraphicBuffer.h>
 #include <linux/videodev2.h>
@@ -49,24 +56,51 @@
 #define ALIGN_32(x) ((x + (BOUNDRY) - 1)& ~((BOUNDRY) - 1))
 #define ALIGN(b,w) (((b)+((w)-1))/(w)*(w))
 
-const int kMaxDevicePathLen = 256;
-const char* kDevicePath = "/dev/";
-constexpr char kPrefix[] = "video";
-constexpr int kPrefixLen = sizeof(kPrefix) - 1;
-constexpr char kCsiPrefix[] = "v4l-subdev";
-constexpr int kCsiPrefixLen = sizeof(kCsiPrefix) - 1;
-//constexpr int kDevicePrefixLen = sizeof(kDevicePath) + kPrefixLen + 1;
-constexpr char kHdmiNodeName[] = "rk_hdmirx";
-constexpr char kCsiPreSubDevModule[] = "HDMI-MIPI";
-constexpr int kCsiPreSubDevModuleLen = sizeof(kCsiPreSubDevModule) - 1;
-constexpr char kCsiPreBusInfo[] = "platform:rkcif-mipi-lvds";
+// a commit lands within a vblank, this only bounds a stuck display for
+// the no-signal frame, the frame paths never wait for the display
+constexpr int PRESENT_BUSY_TIMEOUT_MS = 50;
+// pq/iep threads are woken per frame, the idle timeout only paces the
+// property polling in pqBufferThread while no frames flow
+constexpr int PQ_IDLE_TIMEOUT_MS = 100;
+constexpr int PQ_SLOT_TIMEOUT_MS = 16;
+// a sideband frame can be on screen, waiting for release and waiting for
+// vsync at once, fewer capture buffers would starve the driver
+constexpr int MIN_CAPTURE_BUFF_CNT = 3;
+// game mode without pq, the driver fills one buffer while the other is
+// on screen and drops a frame rather than queue one up behind it
+constexpr int LOW_LATENCY_CAPTURE_BUFF_CNT = 2;
+// vtunnel buffers the consumer holds before one is dequeued back
+constexpr int VTUNNEL_HELD_BUFF_CNT = 2;
+// vtunnel iep deinterlaces from three pq outputs
+constexpr int MIN_PQ_BUFF_CNT = 3;
+constexpr int MIN_IEP_BUFF_CNT = 4;
+constexpr int MIN_RECORD_BUFF_CNT = 2;
+// one frame time plus a pq/iep present bounds the wait for the threads
+constexpr int RECONFIGURE_PARK_TIMEOUT_MS = 200;
+// frames of a dump session when TV_INPUT_DEBUG_DUMPNUM is unset
+constexpr int DEFAULT_DUMP_FRAME_CNT = 30;
+
+// dump properties serial a session was last started for, shared by every
+// open so a dump stays set across streams without dumping each of them
+static std::atomic<uint32_t> sDumpSerial(0);
+
+static nsecs_t v4l2BufferTime(const struct timeval &ts) {
+    return (nsecs_t)ts.tv_sec * 1000000000LL + (nsecs_t)ts.tv_usec * 1000LL;
+}
+
+// streamCount, if set, wins over the property
+static int getBufferCount(int streamCount, const char *prop, int defaultCount, int minCount) {
+    int count = streamCount > 0 ? streamCount : property_get_int32(prop, defaultCount);
+    if (count < minCount) {
+        count = minCount;
+    } else if (count > TV_INPUT_MAX_BUFF_CNT) {
+        count = TV_INPUT_MAX_BUFF_CNT;
+    }
+    return count;
+}
 
-nsecs_t now = 0;
-nsecs_t mLastTime = 0;
-nsecs_t diff = 0;
 
 
-static v4l2_buf_type TVHAL_V4L2_BUF_TYPE = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
 static size_t getBufSize(int format, int width, int height)
 {
     size_t buf_size = 0;
@@ -142,7 +176,8 @@ HinDevImpl::HinDevImpl()
                     mHinDevEventHandle(-1),
                     mHinNodeInfo(NULL),
                     mSidebandHandle(NULL),
-                    mDumpFrameCount(30),
+                    mFrameType(0),
+                    mDumpFrameCount(0),
                     mFirstRequestCapture(true),
                     mPqMode(0),
                     mUseZme(false)
@@ -162,6 +197,8 @@ HinDevImpl::HinDevImpl()
 
     mV4l2Event = new V4L2DeviceEvent();
     mSidebandWindow = new RTSidebandWindow();
+    mDisplay = mSidebandWindow.get();
+    mWorkReactor.init();
 }
 
 int HinDevImpl::init(int id,int initType, int& initWidth, int& initHeight,int& initFormat) {
@@ -176,36 +213,21 @@ int HinDevImpl::init(int id,int initType, int& initWidth, int& initHeight,int& i
             mV4l2Event->closeEventThread();
             //mV4l2Event = nullptr;
         }
-        if (mHinDevHandle >= 0) {
-            close(mHinDevHandle);
-            mHinDevHandle = -1;
-        }
-        if (mHinDevEventHandle >= 0) {
-            close(mHinDevEventHandle);
-            mHinDevEventHandle = -1;
-        }
-        findDevice(0, initWidth, initHeight, initFormat);
+        closeDevice();
+        findDevice(mCaptureInput, initWidth, initHeight, initFormat);
     }
     ALOGE("%s mHdmiInType=%d, id=%d, initType=%d", __FUNCTION__, mHdmiInType, id, initType);
     if(get_HdmiIn(true) <= 0 || getNativeWindowFormat(mPixelFormat) == -1){
 	DEBUG_PRINT(3, "[%s %d] hdmi isnt in", __FUNCTION__, __LINE__);
         return -1;
     }
-    mHinNodeInfo = (struct HinNodeInfo *) calloc (1, sizeof (struct HinNodeInfo));
+    mHinNodeInfo = new (std::nothrow) HinNodeInfo();
     if (mHinNodeInfo == NULL)
     {
         DEBUG_PRINT(3, "[%s %d] no memory for mHinNodeInfo", __FUNCTION__, __LINE__);
-        if (mHinDevHandle > -1) {
-            close(mHinDevHandle);
-            mHinDevHandle = -1;
-        }
-        if (mHinDevEventHandle > -1) {
-            close(mHinDevEventHandle);
-            mHinDevEventHandle = -1;
-        }
+        closeDevice();
         return NO_MEMORY;
     }
-    memset(mHinNodeInfo, 0, sizeof(struct HinNodeInfo));
     mHinNodeInfo->currBufferHandleIndex = 0;
     mHinNodeInfo->currBufferHandleFd = 0;
 
@@ -231,6 +253,13 @@ int HinDevImpl::init(int id,int initType, int& initWidth, int& initHeight,int& i
     property_get(TV_INPUT_SKIP_FRAME, prop_value, "0");
     mSkipFrame = (int)atoi(prop_value);
     DEBUG_PRINT(3, "[%s %d] mSkipFrame=%d", __FUNCTION__, __LINE__, mSkipFrame);
+    mVsyncPacing = property_get_int32(TV_INPUT_VSYNC_PACING, 0) > 0;
+    mPqBufferCount = getBufferCount(mBufferDepths.pq, TV_INPUT_PQ_BUFF_CNT,
+        SIDEBAND_PQ_BUFF_CNT, MIN_PQ_BUFF_CNT);
+    mIepBufferCount = getBufferCount(mBufferDepths.iep, TV_INPUT_IEP_BUFF_CNT,
+        SIDEBAND_IEP_BUFF_CNT, MIN_IEP_BUFF_CNT);
+    mRecordBufferCount = getBufferCount(mBufferDepths.record, TV_INPUT_RECORD_BUFF_CNT,
+        SIDEBAND_RECORD_BUFF_CNT, MIN_RECORD_BUFF_CNT);
 
     /**
      *  init RTSidebandWindow
@@ -273,11 +302,24 @@ int HinDevImpl::init(int id,int initType, int& initWidth, int& initHeight,int& i
             }
             info.compress_mode = 0;
             info.transform = 0;
-            info.buffer_cnt = SIDEBAND_WINDOW_BUFF_CNT;
+        }
+        // pq/iep absorb dopq jitter with a deeper capture ring, game mode wants a short one
+        bool pqEnable = property_get_int32(TV_INPUT_PQ_ENABLE, 0) != 0;
+        bool lowLatency = !pqEnable
+            && (mBufferDepths.lowLatency || property_get_int32(TV_INPUT_LOW_LATENCY, 0) > 0);
+        int minCount = lowLatency ? LOW_LATENCY_CAPTURE_BUFF_CNT : MIN_CAPTURE_BUFF_CNT;
+        mBufferCount = getBufferCount(mBufferDepths.capture, TV_INPUT_CAPTURE_BUFF_CNT,
+            lowLatency ? LOW_LATENCY_CAPTURE_BUFF_CNT : SIDEBAND_WINDOW_BUFF_CNT, minCount);
+        if (pqEnable && mBufferDepths.capture <= 0) {
+            mBufferCount = getBufferCount(0, TV_INPUT_CAPTURE_PQ_BUFF_CNT, mBufferCount, minCount);
+        }
+        if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
+            info.buffer_cnt = mBufferCount;
             info.remain_cnt = 0;
             info.usage |= MALI_GRALLOC_USAGE_NO_AFBC;
         }
-        mBufferCount = SIDEBAND_WINDOW_BUFF_CNT;
+        ALOGD("buffer count capture=%d pq=%d iep=%d record=%d lowLatency=%d",
+            mBufferCount, mPqBufferCount, mIepBufferCount, mRecordBufferCount, lowLatency);
         mPqIniting = false;
         mFirstRequestCapture = false;
         mRequestCaptureCount = 1;
@@ -285,6 +327,12 @@ int HinDevImpl::init(int id,int initType, int& initWidth, int& initHeight,int& i
         mFrameType |= TYPE_STREAM_BUFFER_PRODUCER;
         mBufferCount = APP_PREVIEW_BUFF_CNT;
     }
+    // a smaller REQBUFS grant only lowers mBufferCount, the slots stay
+    mHinNodeInfo->planes.resize(mBufferCount);
+    mHinNodeInfo->bufferArray.resize(mBufferCount);
+    mHinNodeInfo->buffer_handle_poll.resize(mBufferCount, NULL);
+    mHinNodeInfo->vt_buffers.resize(mBufferCount, nullptr);
+    mReleaseFences.assign(mBufferCount, -1);
     if (mHdmiInType == HDMIIN_TYPE_MIPICSI) {
         info.usage |= RK_GRALLOC_USAGE_ALLOC_HEIGHT_ALIGN_16;
         if (mFrameType & TYPE_SIDEBAND_WINDOW) {
@@ -304,194 +352,89 @@ int HinDevImpl::init(int id,int initType, int& initWidth, int& initHeight,int& i
     return NO_ERROR;
 }
 
+// one inotify watch for the process, every HinDevImpl and countInputs()
+// read the same cache
+tvinput::V4L2DeviceRegistry& HinDevImpl::devices() {
+    static tvinput::V4L2DeviceRegistry registry;
+    return registry;
+}
+
+int HinDevImpl::countInputs() {
+    int hdmiInType = property_get_int32(TV_INPUT_HDMIIN_TYPE, 0);
+    return devices().countInputs(hdmiInType == HDMIIN_TYPE_MIPICSI);
+}
+
 int HinDevImpl::findDevice(int id, int& initWidth, int& initHeight,int& initFormat ) {
-    ALOGD("%s called", __func__);
-    // Find existing /dev/video* devices
-    DIR* devdir = opendir(kDevicePath);
-    int videofd,ret;
-    string strCsiNum = "";
-    if(devdir == 0) {
-        ALOGE("%s: cannot open %s! Exiting threadloop", __FUNCTION__, kDevicePath);
-        return -1;
-    }
-    struct dirent* de;
-    while ((de = readdir(devdir)) != 0) {
-        // Find external v4l devices that's existing before we start watching and add them
-        if (mHdmiInType == HDMIIN_TYPE_HDMIRX && !strncmp(kPrefix, de->d_name, kPrefixLen)) {
-		std::string deviceId(de->d_name + kPrefixLen);
-		ALOGD(" v4l device %s found", de->d_name);
-		char v4l2DevicePath[kMaxDevicePathLen];
-		char v4l2DeviceDriver[16];
-		char gadget_video[100] = {0};
-
-		sprintf(gadget_video, "/sys/class/video4linux/%s/function_name", de->d_name);
-		if (access(gadget_video, F_OK) == 0) {
-			ALOGW("/dev/%s is uvc gadget device, don't open it!", de->d_name);
-			continue;
-		}
-
-		snprintf(v4l2DevicePath, kMaxDevicePathLen,"%s%s", kDevicePath, de->d_name);
-		videofd = open(v4l2DevicePath, O_RDWR);
-		if (videofd < 0){
-			DEBUG_PRINT(3, "[%s %d] mHinDevHandle:%x [%s]", __FUNCTION__, __LINE__, videofd,strerror(errno));
-			continue;
-		} else {
-			DEBUG_PRINT(1, "%s open device %s successful.", __FUNCTION__, v4l2DevicePath);
-			struct v4l2_capability cap;
-			ret = ioctl(videofd, VIDIOC_QUERYCAP, &cap);
-			if (ret < 0) {
-				DEBUG_PRINT(3, "VIDIOC_QUERYCAP Failed, error: %s", strerror(errno));
-				close(videofd);
-				continue;
-		}
-		snprintf(v4l2DeviceDriver, 16,"%s",cap.driver);
-		DEBUG_PRINT(3, "VIDIOC_QUERYCAP driver=%s,%s", cap.driver,v4l2DeviceDriver);
-		DEBUG_PRINT(3, "VIDIOC_QUERYCAP card=%s", cap.card);
-		DEBUG_PRINT(3, "VIDIOC_QUERYCAP version=%d", cap.version);
-		DEBUG_PRINT(3, "VIDIOC_QUERYCAP capabilities=0x%08x,0x%08x", cap.capabilities,V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
-		DEBUG_PRINT(3, "VIDIOC_QUERYCAP device_caps=0x%08x", cap.device_caps);
-		if(!strncmp(kHdmiNodeName, v4l2DeviceDriver, sizeof(kHdmiNodeName)-1)){
-			mHinDevHandle =  videofd;
-                mHinDevEventHandle = mHinDevHandle;
-			if ((cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
-				ALOGE("V4L2_CAP_VIDEO_CAPTURE is  a video capture device, capabilities: %x\n", cap.capabilities);
-					TVHAL_V4L2_BUF_TYPE = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		}else if ((cap.capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE)) {
-				ALOGE("V4L2_CAP_VIDEO_CAPTURE_MPLANE is  a video capture device, capabilities: %x\n", cap.capabilities);
-				TVHAL_V4L2_BUF_TYPE = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-			}
-			break;
-		}else{
-			close(videofd);
-			DEBUG_PRINT(3, "isnot hdmirx,VIDIOC_QUERYCAP driver=%s", cap.driver);
-		}
-            }
-        } else if (mHdmiInType == HDMIIN_TYPE_MIPICSI && !strncmp(kCsiPrefix, de->d_name, kCsiPrefixLen)) {
-            ALOGD(" v4l device %s found", de->d_name);
-            char v4l2SubDevPath[kMaxDevicePathLen];
-            snprintf(v4l2SubDevPath, kMaxDevicePathLen,"%s%s", kDevicePath, de->d_name);
-            videofd = open(v4l2SubDevPath, O_RDWR);
-            if (videofd < 0) {
-                ALOGE("[%s %d] mHinDevEventHandle:%x [%s]", __FUNCTION__, __LINE__, videofd,strerror(errno));
+    ALOGD("%s called, input %d", __func__, id);
+    mCaptureInput = id;
+    char replayPath[PROPERTY_VALUE_MAX] = {0};
+    if (property_get(TV_INPUT_REPLAY_PATH, replayPath, "") > 0) {
+        return findReplayDevice(initWidth, initHeight, initFormat);
+    }
+    // probe results are cached, only the chosen nodes are opened
+    std::string videoPath;
+    std::string subdevPath;
+    bool opened = false;
+    for (int attempt = 0; attempt < 2 && !opened; attempt++) {
+        uint32_t capabilities = 0;
+        bool found = false;
+        if (mHdmiInType == HDMIIN_TYPE_HDMIRX) {
+            found = devices().findHdmiRx(mCaptureInput, &videoPath, &capabilities);
+        } else if (mHdmiInType == HDMIIN_TYPE_MIPICSI) {
+            found = devices().findHdmiCsi(mCaptureInput, &subdevPath, &videoPath);
+        }
+        if (!found) {
+            break;
+        }
+        if (!subdevPath.empty()) {
+            mHinDevEventHandle = open(subdevPath.c_str(), O_RDWR);
+            if (mHinDevEventHandle < 0) {
+                ALOGE("[%s %d] %s [%s]", __FUNCTION__, __LINE__, subdevPath.c_str(), strerror(errno));
+                devices().invalidate(subdevPath);
                 continue;
-            } else {
-                DEBUG_PRINT(1, "%s open device %s successful.", __FUNCTION__, v4l2SubDevPath);
-                uint32_t ishdmi = 0;
-                ret = ioctl(videofd, RKMODULE_GET_HDMI_MODE, (void*)&ishdmi);
-                if (ret < 0 || !ishdmi) {
-                    ALOGE("RKMODULE_GET_HDMI_MODE %s Failed, error: %s, ret=%d, ishdmi=%d", v4l2SubDevPath, strerror(errno), ret, ishdmi);
-                    close(videofd);
-                    continue;
-                }
-                struct rkmodule_inf minfo;
-                memset(&minfo, 0, sizeof(struct rkmodule_inf));
-                ret = ioctl(videofd, RKMODULE_GET_MODULE_INFO, &minfo);
-                if (ret < 0) {
-                    close(videofd);
-                    continue;
-                }
-                ALOGE("sensor name: %s, module name: %s", minfo.base.sensor, minfo.base.module);
-                if (strstr(minfo.base.module, kCsiPreSubDevModule)) {
-                    string temp(1,minfo.base.module[kCsiPreSubDevModuleLen]);
-                    if (strcmp(temp.c_str(), "0") != 0) {
-                        strCsiNum = minfo.base.module[kCsiPreSubDevModuleLen];
-                    }
-                    ALOGE("csiNum=%s", strCsiNum.c_str());
-                } else {
-                    close(videofd);
-                    continue;
-                }
-                mHinDevEventHandle = videofd;
-                break;
             }
         }
-    }
-    if (mHinDevEventHandle > 0 && mHinDevHandle < 0) {
-        rewinddir(devdir);
-        int minVideoPathIndex = 999999;
-        int tempVideoFd = -1;
-        while ((de = readdir(devdir)) != 0) {
-            if (!strncmp(kPrefix, de->d_name, kPrefixLen)) {
-                char gadget_video[100] = {0};
-                sprintf(gadget_video, "/sys/class/video4linux/%s/function_name", de->d_name);
-                if (access(gadget_video, F_OK) == 0) {
-                    ALOGW("/dev/%s is uvc gadget device, don't open it!", de->d_name);
-                    continue;
-                }
-                char videoPath[kMaxDevicePathLen];
-                snprintf(videoPath, kMaxDevicePathLen,"%s%s", kDevicePath, de->d_name);
-                videofd = open(videoPath, O_RDWR);
-                if (videofd < 0){
-                    ALOGE("[%s %d] %s %x [%s]", __FUNCTION__, __LINE__, videoPath, videofd,strerror(errno));
-                    continue;
-                } else {
-                    struct v4l2_capability cap;
-                    memset(&cap, 0, sizeof(struct v4l2_capability));
-                    ret = ioctl(videofd, VIDIOC_QUERYCAP, &cap);
-                    if (ret < 0) {
-                        ALOGE("VIDIOC_QUERYCAP %s Failed, error: %s", videoPath, strerror(errno));
-                        close(videofd);
-                        continue;
-                    } else {
-                        ALOGE("VIDIOC_QUERYCAP %s cap.bus_info=%s", videoPath, cap.bus_info);
-                    }
-                    char standard_bus_info[kMaxDevicePathLen];
-                    snprintf(standard_bus_info, kMaxDevicePathLen,"%s%s", kCsiPreBusInfo, strCsiNum.c_str());
-                    char cur_bus_info[kMaxDevicePathLen];
-                    snprintf(cur_bus_info, 32,"%s",cap.bus_info);
-                    if (strcmp(standard_bus_info, cur_bus_info) == 0) {
-                        int tempVideoPathIndex = 0;
-                        if (1 == sscanf(videoPath, "/dev/video%d", &tempVideoPathIndex)
-                                && minVideoPathIndex > tempVideoPathIndex) {
-                            minVideoPathIndex = tempVideoPathIndex;
-                            if (tempVideoFd > -1) {
-                                close(tempVideoFd);
-                            }
-                            tempVideoFd = videofd;
-                        } else {
-                            close(videofd);
-                        }
-                    } else {
-                        close(videofd);
-                    }
-                }
+        mHinDevHandle = open(videoPath.c_str(), O_RDWR);
+        if (mHinDevHandle < 0) {
+            ALOGE("[%s %d] %s [%s]", __FUNCTION__, __LINE__, videoPath.c_str(), strerror(errno));
+            // stale cache entry, probe again
+            devices().invalidate(videoPath);
+            if (mHinDevEventHandle > -1) {
+                close(mHinDevEventHandle);
+                mHinDevEventHandle = -1;
             }
+            continue;
         }
-        if (tempVideoFd > -1) {
-            mHinDevHandle = tempVideoFd;
-            ALOGE("min /dev/video%d", minVideoPathIndex);
+        if (subdevPath.empty()) {
+            mHinDevEventHandle = mHinDevHandle;
+            if ((capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
+                ALOGE("V4L2_CAP_VIDEO_CAPTURE is  a video capture device, capabilities: %x\n", capabilities);
+                mBufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            } else if ((capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE)) {
+                ALOGE("V4L2_CAP_VIDEO_CAPTURE_MPLANE is  a video capture device, capabilities: %x\n", capabilities);
+                mBufType = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+            }
         }
+        ALOGD("%s capture %s event %s", __FUNCTION__, videoPath.c_str(),
+            subdevPath.empty() ? videoPath.c_str() : subdevPath.c_str());
+        opened = true;
     }
-    closedir(devdir);
-    if (mHinDevHandle < 0) {
+    if (!opened) {
         DEBUG_PRINT(3, "[%s %d] mHinDevHandle:%x mHinDevEventHandle:%x", __FUNCTION__, __LINE__, mHinDevHandle, mHinDevEventHandle);
         return -1;
     }
+    mCapture.reset(new tvinput::V4L2CaptureBackend(mHinDevHandle));
     mV4l2Event->initialize(mHinDevEventHandle);
     if (mHinDevHandle == mHinDevEventHandle) {
         if (get_format(0, initWidth, initHeight, initFormat) == 0) {
             DEBUG_PRINT(3, "[%s %d] get_format fail ", __FUNCTION__, __LINE__);
-            if (mHinDevHandle > -1) {
-                close(mHinDevHandle);
-                mHinDevHandle = -1;
-            }
-            if (mHinDevEventHandle > -1) {
-                close(mHinDevEventHandle);
-                mHinDevEventHandle = -1;
-            }
+            closeDevice();
             return -1;
         }
     } else {
         if (get_csi_format(mHinDevEventHandle, initWidth, initHeight, initFormat) == 0) {
             DEBUG_PRINT(3, "[%s %d] get_format fail ", __FUNCTION__, __LINE__);
-            if (mHinDevHandle > -1) {
-                close(mHinDevHandle);
-                mHinDevHandle = -1;
-            }
-            if (mHinDevEventHandle > -1) {
-                close(mHinDevEventHandle);
-                mHinDevEventHandle = -1;
-            }
+            closeDevice();
             return -1;
         }
     }
@@ -514,6 +457,71 @@ int HinDevImpl::findDevice(int id, int& initWidth, int& initHeight,int& initForm
     mBufferSize = mSrcFrameWidth * mSrcFrameHeight * 3/2;
     return 0;
 }
+int HinDevImpl::findReplayDevice(int& initWidth, int& initHeight, int& initFormat) {
+    char path[PROPERTY_VALUE_MAX] = {0};
+    char value[PROPERTY_VALUE_MAX] = {0};
+    property_get(TV_INPUT_REPLAY_PATH, path, "");
+    property_get(TV_INPUT_REPLAY_SIZE, value, "1920x1080");
+    int width = 0, height = 0;
+    if (sscanf(value, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+        ALOGE("%s invalid %s=%s", __FUNCTION__, TV_INPUT_REPLAY_SIZE, value);
+        return -1;
+    }
+    property_get(TV_INPUT_REPLAY_FORMAT, value, "NV12");
+    if (strlen(value) != 4) {
+        ALOGE("%s invalid %s=%s", __FUNCTION__, TV_INPUT_REPLAY_FORMAT, value);
+        return -1;
+    }
+    uint32_t format = v4l2_fourcc(value[0], value[1], value[2], value[3]);
+    int fps = property_get_int32(TV_INPUT_REPLAY_FPS, 60);
+
+    tvinput::ReplayCaptureBackend *replay = new tvinput::ReplayCaptureBackend(path, width, height, format, fps);
+    if (!replay->open()) {
+        delete replay;
+        return -1;
+    }
+    ALOGW("%s capture replayed from %s", __FUNCTION__, path);
+    return openCapture(replay, initWidth, initHeight, initFormat);
+}
+
+int HinDevImpl::openCapture(tvinput::CaptureBackend *backend, int& initWidth, int& initHeight, int& initFormat) {
+    closeDevice();
+    mCapture.reset(backend);
+    // no hotplug or source change events without a driver
+    mHinDevHandle = mCapture->fd();
+    mHinDevEventHandle = mHinDevHandle;
+    mBufType = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+
+    if (get_format(0, initWidth, initHeight, initFormat) == 0) {
+        closeDevice();
+        return -1;
+    }
+    mSrcFrameWidth = initWidth;
+    mSrcFrameHeight = initHeight;
+    mDstFrameWidth = mSrcFrameWidth;
+    mDstFrameHeight = mSrcFrameHeight;
+    mBufferSize = mSrcFrameWidth * mSrcFrameHeight * 3/2;
+    return 0;
+}
+
+int HinDevImpl::captureIoctl(unsigned long request, void *arg) {
+    if (!mCapture) {
+        errno = EBADF;
+        return -1;
+    }
+    return mCapture->ioctl(request, arg);
+}
+
+void HinDevImpl::closeDevice() {
+    if (mHinDevEventHandle > -1 && mHinDevEventHandle != mHinDevHandle) {
+        close(mHinDevEventHandle);
+    }
+    mHinDevEventHandle = -1;
+    // owns and closes mHinDevHandle
+    mCapture.reset();
+    mHinDevHandle = -1;
+}
+
 int HinDevImpl::makeHwcSidebandHandle() {
     ALOGW("%s %d", __FUNCTION__, __LINE__);
     buffer_handle_t buffer = NULL;
@@ -554,17 +562,11 @@ HinDevImpl::~HinDevImpl()
         mV4l2Event = nullptr;
     }
     if (mHinNodeInfo) {
-        free (mHinNodeInfo);
-        //mHinNodeInfo = nullptr;
-    }
-    if (mHinDevHandle > -1) {
-        close(mHinDevHandle);
-        mHinDevHandle = -1;
-    }
-    if (mHinDevEventHandle > -1) {
-        close(mHinDevEventHandle);
-        mHinDevEventHandle = -1;
+        delete mHinNodeInfo;
+        mHinNodeInfo = nullptr;
     }
+    closeDevice();
+    mWorkReactor.deinit();
 }
 
 int HinDevImpl::start_device()
@@ -578,7 +580,7 @@ int HinDevImpl::start_device()
     DEBUG_PRINT(1, "[%s %d] mHinDevHandle:%x", __FUNCTION__, __LINE__, mHinDevHandle);
 
     get_extfmt_info();
-    int ret = ioctl(mHinDevHandle, VIDIOC_QUERYCAP, &mHinNodeInfo->cap);
+    int ret = captureIoctl(VIDIOC_QUERYCAP, &mHinNodeInfo->cap);
     if (ret < 0) {
         DEBUG_PRINT(3, "VIDIOC_QUERYCAP Failed, error: %s", strerror(errno));
         return ret;
@@ -589,28 +591,36 @@ int HinDevImpl::start_device()
     DEBUG_PRINT(1, "VIDIOC_QUERYCAP capabilities=0x%08x,0x%08x", mHinNodeInfo->cap.capabilities,V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
     DEBUG_PRINT(1, "VIDIOC_QUERYCAP device_caps=0x%08x", mHinNodeInfo->cap.device_caps);
 
-    mHinNodeInfo->reqBuf.type = TVHAL_V4L2_BUF_TYPE;
+    mHinNodeInfo->reqBuf.type = mBufType;
     mHinNodeInfo->reqBuf.memory = TVHAL_V4L2_BUF_MEMORY_TYPE;
     mHinNodeInfo->reqBuf.count = mBufferCount;
 
-    ret = ioctl(mHinDevHandle, VIDIOC_REQBUFS, &mHinNodeInfo->reqBuf);
+    ret = captureIoctl(VIDIOC_REQBUFS, &mHinNodeInfo->reqBuf);
     if (ret < 0) {
         DEBUG_PRINT(3, "VIDIOC_REQBUFS Failed, error: %s", strerror(errno));
         return ret;
     } else {
         ALOGD("VIDIOC_REQBUFS successful.");
     }
+    if (mHinNodeInfo->reqBuf.count < (unsigned int)mBufferCount) {
+        ALOGW("VIDIOC_REQBUFS granted %u of %d buffers", mHinNodeInfo->reqBuf.count, mBufferCount);
+        mBufferCount = mHinNodeInfo->reqBuf.count;
+    }
 
+    if (mFrameType & TYPE_SIDEBAND_WINDOW) {
+        // every capture, pq and iep buffer may reach the plane
+        mSidebandWindow->reserveFbCache(mBufferCount + mPqBufferCount + mIepBufferCount);
+    }
     aquire_buffer();
     if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
         memset(&mCurrentPlanes, 0, sizeof(struct v4l2_plane));
         memset(&mCurrentBufferArray, 0, sizeof(struct v4l2_buffer));
         mCurrentBufferArray.index = 0;
-        mCurrentBufferArray.type = TVHAL_V4L2_BUF_TYPE;
+        mCurrentBufferArray.type = mBufType;
         mCurrentBufferArray.memory = TVHAL_V4L2_BUF_MEMORY_TYPE;
         mCurrentBufferArray.m.planes = &mCurrentPlanes;
         mCurrentBufferArray.length = PLANES_NUM;
-        ret = ioctl(mHinDevHandle, VIDIOC_QUERYBUF, &mCurrentBufferArray);
+        ret = captureIoctl(VIDIOC_QUERYBUF, &mCurrentBufferArray);
         if (ret < 0) {
             DEBUG_PRINT(3, "VIDIOC_QUERYBUF Failed, error: %s", strerror(errno));
             return ret;
@@ -620,6 +630,7 @@ int HinDevImpl::start_device()
             mCurrentBufferArray.m.planes[i].length = 0;
         }
     }
+    resetDisplayBuffers();
     for (int i = 0; i < mBufferCount; i++) {
         DEBUG_PRINT(mDebugLevel, "bufferArray index = %d", mHinNodeInfo->bufferArray[i].index);
         DEBUG_PRINT(mDebugLevel, "bufferArray type = %d", mHinNodeInfo->bufferArray[i].type);
@@ -630,7 +641,7 @@ int HinDevImpl::start_device()
 
  	//mHinNodeInfo->bufferArray[i].flags = V4L2_BUF_FLAG_NO_CACHE_INVALIDATE |
         //                 V4L2_BUF_FLAG_NO_CACHE_CLEAN;
-        ret = ioctl(mHinDevHandle, VIDIOC_QBUF, &mHinNodeInfo->bufferArray[i]);
+        ret = captureIoctl(VIDIOC_QBUF, &mHinNodeInfo->bufferArray[i]);
         if (ret < 0) {
             DEBUG_PRINT(3, "VIDIOC_QBUF Failed, error: %s", strerror(errno));
             return -1;
@@ -639,8 +650,8 @@ int HinDevImpl::start_device()
     ALOGD("[%s %d] VIDIOC_QBUF successful", __FUNCTION__, __LINE__);
 
     v4l2_buf_type bufType;
-    bufType = TVHAL_V4L2_BUF_TYPE;
-    ret = ioctl(mHinDevHandle, VIDIOC_STREAMON, &bufType);
+    bufType = mBufType;
+    ret = captureIoctl(VIDIOC_STREAMON, &bufType);
     if (ret < 0) {
         DEBUG_PRINT(3, "VIDIOC_STREAMON Failed, error: %s", strerror(errno));
         return -1;
@@ -654,12 +665,13 @@ int HinDevImpl::stop_device()
 {
     DEBUG_PRINT(3, "%s %d", __FUNCTION__, __LINE__);
     int ret;
-    enum v4l2_buf_type bufType = TVHAL_V4L2_BUF_TYPE;
+    enum v4l2_buf_type bufType = mBufType;
 
-    ret = ioctl (mHinDevHandle, VIDIOC_STREAMOFF, &bufType);
+    ret = captureIoctl(VIDIOC_STREAMOFF, &bufType);
     if (ret < 0) {
         DEBUG_PRINT(3, "StopStreaming: Unable to stop capture: %s", strerror(errno));
     }
+    resetDisplayBuffers();
     return ret;
 }
 
@@ -677,6 +689,8 @@ int HinDevImpl::start()
         DEBUG_PRINT(3, "Start v4l2 device failed:%d",ret);
         return ret;
     }
+    mNeedsReopen = false;
+    mWorkReactor.addFd(mHinDevHandle, EPOLLIN);
 
     if (mFrameType & TYPE_SIDEBAND_WINDOW) {
         mSidebandWindow->allocateSidebandHandle(&mSignalHandle, -1, -1, HAL_PIXEL_FORMAT_BGR_888, RK_GRALLOC_USAGE_STRIDE_ALIGN_64);
@@ -712,8 +726,10 @@ int HinDevImpl::start()
     property_set(TV_INPUT_PQ_MODE, "0");
     property_set(TV_INPUT_HDMIIN, "1");
 
+    mStats.reset();
     mWorkThread = new WorkThread(this);
     mState = START;
+    mWorkReactor.wake();
     mPqBufferThread = new PqBufferThread(this);
     mIepBufferThread = new IepBufferThread(this);
     /*property_get(TV_INPUT_PQ_STATUS, prop_value, "0");
@@ -746,18 +762,25 @@ int HinDevImpl::stop()
     property_set(TV_INPUT_HDMIIN, "0");
     Mutex::Autolock autoLock(mBufferLock);
     ALOGD("%s %d enter mBufferLock", __FUNCTION__, __LINE__);
+    waitStagesIdleLocked();
 
-    if(gMppEnCodeServer != nullptr) {
+    if(mMppEncodeServer != nullptr) {
         ALOGD("zj add file: %s func %s line %d \n",__FILE__,__FUNCTION__,__LINE__);
-        gMppEnCodeServer->stop();
+        mMppEncodeServer->stop();
+    }
+    if (mStageBackends.encoder) {
+        mStageBackends.encoder->stop();
     }
     if(mWorkThread != NULL){
         mWorkThread->requestExit();
+        mWorkReactor.wake();
         mWorkThread.clear();
         mWorkThread = NULL;
     }
+    mPqSlotSignal.signal();
     if(mPqBufferThread != NULL){
         mPqBufferThread->requestExit();
+        mPqSignal.signal();
         mPqBufferThread.clear();
         mPqBufferThread = NULL;
     }
@@ -769,6 +792,7 @@ int HinDevImpl::stop()
 
     if (mIepBufferThread != NULL) {
         mIepBufferThread->requestExit();
+        mIepSignal.signal();
          mIepBufferThread.clear();
          mIepBufferThread = NULL;
     }
@@ -798,22 +822,32 @@ int HinDevImpl::stop()
     }
 
     if (mFrameType & TYPE_SIDEBAND_WINDOW) {
+        PresentStats_t presentStats;
+        memset(&presentStats, 0, sizeof(presentStats));
+        if (mSidebandWindow->getPresentStats(&presentStats) == 0) {
+            ALOGD("presented=%" PRIu64 " pacing drops=%" PRIu64 " latency avg=%" PRId64 "us max=%" PRId64 "us",
+                presentStats.presented, mPacingDropCount,
+                (int64_t)(presentStats.avgLatency / 1000), (int64_t)(presentStats.maxLatency / 1000));
+        }
         mSidebandWindow->clearVopArea();
     }
-    enum v4l2_buf_type bufType = TVHAL_V4L2_BUF_TYPE;
-    ret = ioctl (mHinDevHandle, VIDIOC_STREAMOFF, &bufType);
+    ALOGD("stats %s", mStats.toJson().c_str());
+    enum v4l2_buf_type bufType = mBufType;
+    ret = captureIoctl(VIDIOC_STREAMOFF, &bufType);
     if (ret < 0) {
         DEBUG_PRINT(3, "StopStreaming: Unable to stop capture: %s", strerror(errno));
     } else {
         DEBUG_PRINT(3, "StopStreaming: successful.");
     }
+    mWorkReactor.removeFd(mHinDevHandle);
+    resetDisplayBuffers();
 
     // cancel request buff
     v4l2_requestbuffers req_buffers{};
-    req_buffers.type = TVHAL_V4L2_BUF_TYPE;
+    req_buffers.type = mBufType;
     req_buffers.memory = TVHAL_V4L2_BUF_MEMORY_TYPE;
     req_buffers.count = 0;
-    ret = ioctl(mHinDevHandle, VIDIOC_REQBUFS, &req_buffers);
+    ret = captureIoctl(VIDIOC_REQBUFS, &req_buffers);
     if (ret < 0) {
         ALOGE("%s: cancel REQBUFS failed: %s", __FUNCTION__, strerror(errno));
     } else {
@@ -824,29 +858,30 @@ int HinDevImpl::stop()
         mSidebandWindow->stop();
     }
     release_buffer();
-    mDumpFrameCount = 3;
+    mFrameDumper.stop();
+    if (mFrameDumper.dropped() > 0) {
+        ALOGW("%s frame dumps dropped %llu, written %llu", __FUNCTION__,
+            (unsigned long long)mFrameDumper.dropped(), (unsigned long long)mFrameDumper.written());
+    }
+    mDumpFrameCount = 0;
+    mDumpPending = false;
 
     mOpen = false;
     mFrameType = 0;
 
     if (mHinNodeInfo) {
-        free(mHinNodeInfo);
-        //mHinNodeInfo = nullptr;
+        delete mHinNodeInfo;
+        mHinNodeInfo = nullptr;
     }
 
     if (mV4l2Event) {
+        // close_stream deletes this device next, the event callback must be done
         mV4l2Event->closePipe();
+        mV4l2Event->closeEventThread();
         mV4l2Event = nullptr;
     }
 
-    if (mHinDevHandle > -1) {
-        close(mHinDevHandle);
-        mHinDevHandle = -1;
-    }
-    if (mHinDevEventHandle > -1) {
-        close(mHinDevEventHandle);
-        mHinDevEventHandle = -1;
-    }
+    closeDevice();
 
     mFirstRequestCapture = true;
     mRequestCaptureCount = 0;
@@ -857,34 +892,338 @@ int HinDevImpl::stop()
     return ret;
 }
 
-int HinDevImpl::set_preview_callback(NotifyQueueDataCallback callback)
+// Follows a source timing change without the stop()/start() teardown.
+// Threads, rkpq state and the event pipe stay up; capture buffers are
+// kept while the new frame fits them at their stride, otherwise only they
+// are reallocated. pq/iep are dropped on any geometry change for
+// pqBufferThread to rebuild at the new size. INVALID_OPERATION means nothing was touched and the caller
+// falls back to get_current_sourcesize(); DEAD_OBJECT means the stream is
+// gone and has to be reopened.
+int HinDevImpl::reconfigure(int& width, int& height, int& format)
+{
+    if (mNeedsReopen) {
+        return DEAD_OBJECT;
+    }
+    if (!mOpen || mState != START || !(mFrameType & TYPE_SIDEBAND_WINDOW)
+            || mHdmiInType != HDMIIN_TYPE_HDMIRX) {
+        return INVALID_OPERATION;
+    }
+    nsecs_t startTime = systemTime();
+    {
+        Mutex::Autolock autoLock(mWorkParkLock);
+        mWorkParked = false;
+        mPqParked = false;
+        mIepParked = false;
+    }
+    mState = PAUSE;
+    mWorkReactor.wake();
+    mPqSlotSignal.signal();
+    mPqSignal.signal();
+    mIepSignal.signal();
+    {
+        // workThread and the sideband iep path hold no lock across a frame,
+        // wait for every stage to go idle before its buffers go away
+        Mutex::Autolock autoLock(mWorkParkLock);
+        while (!mWorkParked || !mPqParked || !mIepParked) {
+            if (mWorkParkCond.waitRelative(mWorkParkLock, ms2ns(RECONFIGURE_PARK_TIMEOUT_MS)) != NO_ERROR) {
+                ALOGE("%s threads did not pause work=%d pq=%d iep=%d", __FUNCTION__,
+                    mWorkParked, mPqParked, mIepParked);
+                // nothing was torn down yet, let the stream run on
+                mState = START;
+                mWorkReactor.wake();
+                return INVALID_OPERATION;
+            }
+        }
+    }
+    Mutex::Autolock autoLock(mBufferLock);
+    if (!mOpen || mState != PAUSE) {
+        return INVALID_OPERATION;
+    }
+
+    enum v4l2_buf_type bufType = mBufType;
+    if (captureIoctl(VIDIOC_STREAMOFF, &bufType) < 0) {
+        ALOGE("%s VIDIOC_STREAMOFF failed: %s", __FUNCTION__, strerror(errno));
+        return abortReconfigureLocked();
+    }
+    resetDisplayBuffers();
+
+    struct v4l2_format fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = mBufType;
+    if (captureIoctl(VIDIOC_G_FMT, &fmt) < 0) {
+        ALOGE("%s VIDIOC_G_FMT failed: %s", __FUNCTION__, strerror(errno));
+        return abortReconfigureLocked();
+    }
+    int newWidth = fmt.fmt.pix.width;
+    int newHeight = fmt.fmt.pix.height;
+    int newFormat = fmt.fmt.pix.pixelformat;
+    if (getNativeWindowFormat(newFormat) == -1) {
+        ALOGE("%s unsupported format 0x%x", __FUNCTION__, newFormat);
+        return abortReconfigureLocked();
+    }
+    bool sameGeometry = newWidth == mSrcFrameWidth && newHeight == mSrcFrameHeight
+        && newFormat == mPixelFormat;
+    int lastColorRange = mFrameColorRange;
+    int lastColorSpace = mFrameColorSpace;
+    bool lastUseIep = mUseIep;
+    get_extfmt_info();
+    mUseIep = check_interlaced() > 0;
+    // check_zme() asks rkpq for the panel size, decide before it goes away
+    int dstWidth = newWidth;
+    int dstHeight = newHeight;
+    bool useZme = sameGeometry ? mUseZme : check_zme(newWidth, newHeight, &dstWidth, &dstHeight);
+
+    if (sameGeometry && lastUseIep == mUseIep && lastColorRange == mFrameColorRange
+            && lastColorSpace == mFrameColorSpace) {
+        // the rings refer to capture buffers about to be queued again
+        for (size_t i = 0; i < mPqBufferHandle.size(); i++) {
+            mPqBufferHandle[i].isFilled = false;
+        }
+        for (size_t i = 0; i < mIepBufferHandle.size(); i++) {
+            mIepBufferHandle[i].isFilled = false;
+        }
+        mPqBuffIndex = 0;
+        mPqBuffOutIndex = 0;
+        mIepBuffIndex = 0;
+        mIepBuffOutIndex = 0;
+    } else {
+        // pqBufferThread sees PQ_OFF and builds rkpq/rkiep for the new stream
+        if (mRkpq != nullptr) {
+            delete mRkpq;
+            mRkpq = nullptr;
+        }
+        if (mRkiep != nullptr) {
+            delete mRkiep;
+            mRkiep = nullptr;
+        }
+        releasePqBuffers();
+        mPqPrepareList.clear();
+        mPqDoneList.clear();
+        mIepPrepareList.clear();
+        mIepDoneList.clear();
+        mPqMode = PQ_OFF;
+        mIsLastPqShowFrameMode = false;
+    }
+
+    bool keepBuffers = sameGeometry;
+    if (!sameGeometry) {
+        v4l2_requestbuffers reqBuf{};
+        reqBuf.type = mBufType;
+        reqBuf.memory = TVHAL_V4L2_BUF_MEMORY_TYPE;
+        reqBuf.count = 0;
+        if (captureIoctl(VIDIOC_REQBUFS, &reqBuf) < 0) {
+            ALOGE("%s release REQBUFS failed: %s", __FUNCTION__, strerror(errno));
+            return abortReconfigureLocked();
+        }
+        mFrameDumper.end();
+
+        int lastFormat = mPixelFormat;
+        mSrcFrameWidth = newWidth;
+        mSrcFrameHeight = newHeight;
+        mPixelFormat = newFormat;
+        mUseZme = useZme;
+        mDstFrameWidth = useZme ? dstWidth : mSrcFrameWidth;
+        mDstFrameHeight = useZme ? dstHeight : mSrcFrameHeight;
+        mBufferSize = mSrcFrameWidth * mSrcFrameHeight * 3/2;
+        mHinNodeInfo->width = newWidth;
+        mHinNodeInfo->height = newHeight;
+        mHinNodeInfo->formatIn = mPixelFormat;
+        mHinNodeInfo->format = fmt;
+        // a frame that fits the current buffers at their stride is captured
+        // into them, the plane then keeps showing the last frame meanwhile
+        bool mplane = mHinNodeInfo->cap.device_caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE;
+        int keptStride = mBufferCount > 0 && mHinNodeInfo->buffer_handle_poll[0]
+            ? mSidebandWindow->getBufferStride(mHinNodeInfo->buffer_handle_poll[0]) : -1;
+        keepBuffers = newFormat == lastFormat && keptStride > 0;
+        bool strideForced = keepBuffers;
+        if (keepBuffers) {
+            if (mplane) {
+                mHinNodeInfo->format.fmt.pix_mp.plane_fmt[0].bytesperline = keptStride;
+            } else {
+                mHinNodeInfo->format.fmt.pix.bytesperline = keptStride;
+            }
+        }
+        if (captureIoctl(VIDIOC_S_FMT, &mHinNodeInfo->format) < 0) {
+            ALOGE("%s VIDIOC_S_FMT failed: %s", __FUNCTION__, strerror(errno));
+            return abortReconfigureLocked();
+        }
+        if (keepBuffers) {
+            int bytesPerLine = mplane ? mHinNodeInfo->format.fmt.pix_mp.plane_fmt[0].bytesperline
+                : mHinNodeInfo->format.fmt.pix.bytesperline;
+            int sizeImage = mplane ? mHinNodeInfo->format.fmt.pix_mp.plane_fmt[0].sizeimage
+                : mHinNodeInfo->format.fmt.pix.sizeimage;
+            keepBuffers = bytesPerLine == keptStride;
+            for (int i = 0; keepBuffers && i < mBufferCount; i++) {
+                buffer_handle_t handle = mHinNodeInfo->buffer_handle_poll[i];
+                keepBuffers = handle != NULL
+                    && mSidebandWindow->getBufferLength(handle) >= sizeImage
+                    && mSidebandWindow->setContentSize(handle, newWidth, newHeight) == 0;
+            }
+            ALOGD("%s stride %d/%d size %d: buffers %s", __FUNCTION__, bytesPerLine, keptStride,
+                sizeImage, keepBuffers ? "fit" : "do not fit");
+        }
+        if (strideForced && !keepBuffers) {
+            // the new buffers get the driver's own stride, not the one forced
+            // for the old ones; S_FMT hands back the bytesperline it picked
+            if (mplane) {
+                mHinNodeInfo->format.fmt.pix_mp.plane_fmt[0].bytesperline = 0;
+            } else {
+                mHinNodeInfo->format.fmt.pix.bytesperline = 0;
+            }
+            if (captureIoctl(VIDIOC_S_FMT, &mHinNodeInfo->format) < 0) {
+                ALOGE("%s VIDIOC_S_FMT without stride failed: %s", __FUNCTION__, strerror(errno));
+                return abortReconfigureLocked();
+            }
+            ALOGD("%s stride back to %d", __FUNCTION__, mplane
+                ? mHinNodeInfo->format.fmt.pix_mp.plane_fmt[0].bytesperline
+                : mHinNodeInfo->format.fmt.pix.bytesperline);
+        }
+        mSidebandWindow->setBufferGeometry(mSrcFrameWidth, mSrcFrameHeight, getNativeWindowFormat(mPixelFormat));
+        if (!keepBuffers) {
+            // the plane may still scan out a buffer freed below
+            mSidebandWindow->clearVopArea();
+            for (int i = 0; i < mBufferCount; i++) {
+                mSidebandWindow->freeBuffer(&mHinNodeInfo->buffer_handle_poll[i], 0);
+                mHinNodeInfo->buffer_handle_poll[i] = NULL;
+            }
+        }
+
+        int lastBufferCount = mBufferCount;
+        mHinNodeInfo->reqBuf.type = mBufType;
+        mHinNodeInfo->reqBuf.memory = TVHAL_V4L2_BUF_MEMORY_TYPE;
+        mHinNodeInfo->reqBuf.count = mBufferCount;
+        if (captureIoctl(VIDIOC_REQBUFS, &mHinNodeInfo->reqBuf) < 0) {
+            ALOGE("%s VIDIOC_REQBUFS failed: %s", __FUNCTION__, strerror(errno));
+            return abortReconfigureLocked();
+        }
+        if (mHinNodeInfo->reqBuf.count < (unsigned int)mBufferCount) {
+            ALOGW("VIDIOC_REQBUFS granted %u of %d buffers", mHinNodeInfo->reqBuf.count, mBufferCount);
+            mBufferCount = mHinNodeInfo->reqBuf.count;
+        }
+        if (keepBuffers) {
+            unregisterBufferSlots(BUFFER_SLOT_CAPTURE);
+            for (int i = mBufferCount; i < lastBufferCount; i++) {
+                mSidebandWindow->freeBuffer(&mHinNodeInfo->buffer_handle_poll[i], 0);
+                mHinNodeInfo->buffer_handle_poll[i] = NULL;
+            }
+            for (int i = 0; i < mBufferCount; i++) {
+                // the fbs of the old size age out of the cache
+                mSidebandWindow->prepareFb(mHinNodeInfo->buffer_handle_poll[i], mHdmiInType);
+                registerBufferSlot(mHinNodeInfo->bufferArray[i].m.planes[0].m.fd, BUFFER_SLOT_CAPTURE, i,
+                    mHinNodeInfo->vt_buffers[i]);
+            }
+        } else {
+            aquire_buffer();
+            for (int i = 0; i < mBufferCount; i++) {
+                if (mHinNodeInfo->buffer_handle_poll[i] == NULL) {
+                    ALOGE("%s capture buffer %d not allocated", __FUNCTION__, i);
+                    return abortReconfigureLocked();
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < mBufferCount; i++) {
+        if (captureIoctl(VIDIOC_QBUF, &mHinNodeInfo->bufferArray[i]) < 0) {
+            ALOGE("%s VIDIOC_QBUF %d failed: %s", __FUNCTION__, i, strerror(errno));
+            return abortReconfigureLocked();
+        }
+    }
+    mHinNodeInfo->currBufferHandleIndex = 0;
+    bufType = mBufType;
+    if (captureIoctl(VIDIOC_STREAMON, &bufType) < 0) {
+        ALOGE("%s VIDIOC_STREAMON failed: %s", __FUNCTION__, strerror(errno));
+        return abortReconfigureLocked();
+    }
+    mState = START;
+    mWorkReactor.wake();
+
+    width = mSrcFrameWidth;
+    height = mSrcFrameHeight;
+    format = getNativeWindowFormat(mPixelFormat);
+    ALOGI("%s %dx%d fmt=0x%x interlaced=%d, buffers %s in %" PRId64 "ms", __FUNCTION__,
+        mSrcFrameWidth, mSrcFrameHeight, mPixelFormat, mUseIep,
+        keepBuffers ? "kept" : "reallocated", (int64_t)ns2ms(systemTime() - startTime));
+    return NO_ERROR;
+}
+
+// Called with mBufferLock held and the threads parked, after a step of
+// reconfigure() failed somewhere between STREAMOFF and STREAMON. Drops the
+// stream to what stop() expects to find: not streaming, no capture or pq
+// buffers queued or on the plane, threads idle. mState stays out of START
+// until the stream is reopened.
+int HinDevImpl::abortReconfigureLocked()
+{
+    enum v4l2_buf_type bufType = mBufType;
+    captureIoctl(VIDIOC_STREAMOFF, &bufType);
+    resetDisplayBuffers();
+    mSidebandWindow->clearVopArea();
+    if (mRkpq != nullptr) {
+        delete mRkpq;
+        mRkpq = nullptr;
+    }
+    if (mRkiep != nullptr) {
+        delete mRkiep;
+        mRkiep = nullptr;
+    }
+    releasePqBuffers();
+    mPqPrepareList.clear();
+    mPqDoneList.clear();
+    mIepPrepareList.clear();
+    mIepDoneList.clear();
+    mPqMode = PQ_OFF;
+    mIsLastPqShowFrameMode = false;
+
+    v4l2_requestbuffers reqBuf{};
+    reqBuf.type = mBufType;
+    reqBuf.memory = TVHAL_V4L2_BUF_MEMORY_TYPE;
+    reqBuf.count = 0;
+    captureIoctl(VIDIOC_REQBUFS, &reqBuf);
+    unregisterBufferSlots(BUFFER_SLOT_CAPTURE);
+    for (int i = 0; i < mBufferCount; i++) {
+        if (mHinNodeInfo->buffer_handle_poll[i] != NULL) {
+            mSidebandWindow->freeBuffer(&mHinNodeInfo->buffer_handle_poll[i], 0);
+            mHinNodeInfo->buffer_handle_poll[i] = NULL;
+        }
+    }
+    mFrameDumper.end();
+
+    mNeedsReopen = true;
+    mState = STOPED;
+    ALOGE("%s stream dropped, waiting for a reopen", __FUNCTION__);
+    return DEAD_OBJECT;
+}
+
+int HinDevImpl::set_preview_callback(NotifyQueueDataCallback callback, void *user)
 {
     if (!callback) {
         DEBUG_PRINT(3, "NULL state callback pointer");
         return BAD_VALUE;
     }
     mNotifyQueueCb = callback;
+    mNotifyQueueUser = user;
     return NO_ERROR;
 }
 
-int HinDevImpl::set_data_callback(V4L2EventCallBack callback)
+int HinDevImpl::set_data_callback(V4L2EventCallBack callback, void *user)
 {
     ALOGD("%s %d", __FUNCTION__, __LINE__);
     if (callback == NULL){
         DEBUG_PRINT(3, "NULL data callback pointer");
         return BAD_VALUE;
     }
-    mV4l2Event->RegisterEventvCallBack(callback);
+    mV4l2Event->RegisterEventvCallBack(callback, user);
     return NO_ERROR;
 }
 
-int HinDevImpl::set_command_callback(NotifyCommandCallback callback)
+int HinDevImpl::set_command_callback(NotifyCommandCallback callback, void *user)
 {
     if (!callback) {
         DEBUG_PRINT(3, "NULL state callback pointer");
         return BAD_VALUE;
     }
     mNotifyCommandCb = callback;
+    mNotifyCommandUser = user;
     return NO_ERROR;
 }
 
@@ -920,20 +1259,20 @@ int HinDevImpl::get_format(int fd, int &hdmi_in_width, int &hdmi_in_height,int&
     std::vector<int> formatList;
     struct v4l2_fmtdesc fmtdesc;
     fmtdesc.index = 0;
-    fmtdesc.type = TVHAL_V4L2_BUF_TYPE;
+    fmtdesc.type = mBufType;
 
-    while (ioctl(mHinDevHandle, VIDIOC_ENUM_FMT, &fmtdesc) != -1)
+    while (captureIoctl(VIDIOC_ENUM_FMT, &fmtdesc) != -1)
     {
         formatList.push_back( fmtdesc.pixelformat);
         DEBUG_PRINT(3, "   V4L2 driver: idx=%d, \t desc:%s,format:0x%x", fmtdesc.index + 1, fmtdesc.description, fmtdesc.pixelformat);
         fmtdesc.index++;
     }
     v4l2_format format;
-    format.type = TVHAL_V4L2_BUF_TYPE;
+    format.type = mBufType;
     vector<int>::iterator it;
     for(it = formatList.begin();it != formatList.end();it++){
     	format.fmt.pix.pixelformat = (int)*it;
-    	if (ioctl(mHinDevHandle, VIDIOC_TRY_FMT, &format) != -1)
+    	if (captureIoctl(VIDIOC_TRY_FMT, &format) != -1)
     	{
     		DEBUG_PRINT(3, "V4L2 driver try: width:%d,height:%d,format:0x%x", format.fmt.pix.width, format.fmt.pix.height,format.fmt.pix.pixelformat);
     		hdmi_in_width =  format.fmt.pix.width;
@@ -943,7 +1282,7 @@ int HinDevImpl::get_format(int fd, int &hdmi_in_width, int &hdmi_in_height,int&
     		break;
     	}
     }
-    int err = ioctl(mHinDevHandle, VIDIOC_G_FMT, &format);
+    int err = captureIoctl(VIDIOC_G_FMT, &format);
     if (err < 0)
     {
         DEBUG_PRINT(3, "[%s %d] failed, VIDIOC_G_FMT %d, %s", __FUNCTION__, __LINE__, err, strerror(err));
@@ -961,7 +1300,7 @@ int HinDevImpl::get_format(int fd, int &hdmi_in_width, int &hdmi_in_height,int&
 }
 
 int HinDevImpl::get_extfmt_info() {
-    int err = ioctl(mHinDevHandle, RK_HDMIRX_CMD_GET_FPS, &mFrameFps);
+    int err = captureIoctl(RK_HDMIRX_CMD_GET_FPS, &mFrameFps);
     if (err < 0) {
         DEBUG_PRINT(3, "[%s %d] failed, RK_HDMIRX_CMD_GET_FPS %d, %s", __FUNCTION__, __LINE__, err, strerror(err));
         mFrameFps = 60;
@@ -969,7 +1308,7 @@ int HinDevImpl::get_extfmt_info() {
         DEBUG_PRINT(3, "[%s %d] RK_HDMIRX_CMD_GET_FPS %d", __FUNCTION__, __LINE__, mFrameFps);
     }
 
-    err = ioctl(mHinDevHandle, RK_HDMIRX_CMD_GET_COLOR_RANGE, &mFrameColorRange);
+    err = captureIoctl(RK_HDMIRX_CMD_GET_COLOR_RANGE, &mFrameColorRange);
     if (err < 0) {
         DEBUG_PRINT(3, "[%s %d] failed, RK_HDMIRX_CMD_GET_COLOR_RANGE %d, %s", __FUNCTION__, __LINE__, err, strerror(err));
         mFrameColorRange = HDMIRX_DEFAULT_RANGE;
@@ -977,7 +1316,7 @@ int HinDevImpl::get_extfmt_info() {
         DEBUG_PRINT(3, "[%s %d] RK_HDMIRX_CMD_GET_COLOR_RANGE %d", __FUNCTION__, __LINE__, mFrameColorRange);
     }
 
-    err = ioctl(mHinDevHandle, RK_HDMIRX_CMD_GET_COLOR_SPACE, &mFrameColorSpace);
+    err = captureIoctl(RK_HDMIRX_CMD_GET_COLOR_SPACE, &mFrameColorSpace);
     if (err < 0) {
         DEBUG_PRINT(3, "[%s %d] failed, RK_HDMIRX_CMD_GET_COLOR_SPACE %d, %s", __FUNCTION__, __LINE__, err, strerror(err));
         mFrameColorSpace = HDMIRX_XVYCC709;
@@ -992,21 +1331,22 @@ int HinDevImpl::get_HdmiIn(bool enforce){
     struct v4l2_control control;
     memset(&control, 0, sizeof(struct v4l2_control));
     control.id = V4L2_CID_DV_RX_POWER_PRESENT;
-    int err = ioctl(mHinDevEventHandle, VIDIOC_G_CTRL, &control);
+    int err = mHinDevEventHandle == mHinDevHandle ?
+        captureIoctl(VIDIOC_G_CTRL, &control) : ioctl(mHinDevEventHandle, VIDIOC_G_CTRL, &control);
     if (err < 0) {
         ALOGE("Set POWER_PRESENT failed ,%d(%s)", errno, strerror(errno));
         return UNKNOWN_ERROR;
     }
     mIsHdmiIn = control.value;
-    //enum v4l2_buf_type bufType = TVHAL_V4L2_BUF_TYPE;
+    //enum v4l2_buf_type bufType = mBufType;
 
     if(mIsHdmiIn && mState == START){
-       /*err = ioctl(mHinDevHandle, VIDIOC_STREAMON, &bufType);
+       /*err = captureIoctl(VIDIOC_STREAMON, &bufType);
        if (err < 0) {
           DEBUG_PRINT(3, "VIDIOC_STREAMON Failed, error: %s", strerror(errno));
        }
        for (int i = 0; i < mBufferCount; i++) {
-          err = ioctl(mHinDevHandle, VIDIOC_QBUF, &mHinNodeInfo->bufferArray[i]);
+          err = captureIoctl(VIDIOC_QBUF, &mHinNodeInfo->bufferArray[i]);
           if (err < 0) {
             DEBUG_PRINT(3, "VIDIOC_QBUF Failed, error: %s", strerror(errno));
           }
@@ -1014,7 +1354,7 @@ int HinDevImpl::get_HdmiIn(bool enforce){
        ALOGD("[%s %d] VIDIOC_STREAMON return=:%d", __FUNCTION__, __LINE__, err);*/
        //mState = START;
     }else{
-       /*err = ioctl (mHinDevHandle, VIDIOC_STREAMOFF, &bufType);
+       /*err = captureIoctl(VIDIOC_STREAMOFF, &bufType);
        if (err < 0) {
           DEBUG_PRINT(3, "StopStreaming: Unable to stop capture: %s", strerror(errno));
        }*/
@@ -1046,12 +1386,12 @@ int HinDevImpl::set_format(int width, int height, int color_format)
     mHinNodeInfo->width = width;
     mHinNodeInfo->height = height;
     mHinNodeInfo->formatIn = mPixelFormat;
-    mHinNodeInfo->format.type = TVHAL_V4L2_BUF_TYPE;
+    mHinNodeInfo->format.type = mBufType;
     mHinNodeInfo->format.fmt.pix.width = width;
     mHinNodeInfo->format.fmt.pix.height = height;
     mHinNodeInfo->format.fmt.pix.pixelformat = mPixelFormat;
 
-    ret = ioctl(mHinDevHandle, VIDIOC_S_FMT, &mHinNodeInfo->format);
+    ret = captureIoctl(VIDIOC_S_FMT, &mHinNodeInfo->format);
     if (ret < 0) {
         DEBUG_PRINT(3, "[%s %d] failed, set VIDIOC_S_FMT %d, %s", __FUNCTION__, __LINE__, ret, strerror(ret));
         return ret;
@@ -1080,11 +1420,11 @@ int HinDevImpl::set_frame_rate(int frameRate)
 
     struct v4l2_streamparm sparm;
     memset(&sparm, 0, sizeof( sparm ));
-    sparm.type = TVHAL_V4L2_BUF_TYPE;//stream_flag;
+    sparm.type = mBufType;//stream_flag;
     sparm.parm.output.timeperframe.denominator = frameRate;
     sparm.parm.output.timeperframe.numerator = 1;
 
-    ret = ioctl(mHinDevHandle, VIDIOC_S_PARM, &sparm);
+    ret = captureIoctl(VIDIOC_S_PARM, &sparm);
     if(ret < 0){
         DEBUG_PRINT(3, "Set frame rate fail: %s. ret=%d", strerror(errno),ret);
     }
@@ -1102,8 +1442,8 @@ int HinDevImpl::get_current_sourcesize(int& width,  int& height,int& pixelformat
         v4l2_format format;
         memset(&format, 0,sizeof(struct v4l2_format));
 
-        format.type = TVHAL_V4L2_BUF_TYPE;
-        ret = ioctl(mHinDevHandle, VIDIOC_G_FMT, &format);
+        format.type = mBufType;
+        ret = captureIoctl(VIDIOC_G_FMT, &format);
         if (ret < 0) {
             DEBUG_PRINT(3, "Open: VIDIOC_G_FMT Failed: %s", strerror(errno));
             return ret;
@@ -1120,9 +1460,14 @@ int HinDevImpl::get_current_sourcesize(int& width,  int& height,int& pixelformat
     mUseZme = check_zme(mSrcFrameWidth, mSrcFrameHeight, &mDstFrameWidth, &mDstFrameHeight);
     mBufferSize = mSrcFrameWidth * mSrcFrameHeight * 3/2;
 
+    if (mNeedsReopen) {
+        // no buffers are queued, START would only spin workThread
+        return ret;
+    }
+
     /*if(mIsHdmiIn){
-       enum v4l2_buf_type bufType = TVHAL_V4L2_BUF_TYPE;
-       ret = ioctl(mHinDevHandle, VIDIOC_STREAMON, &bufType);
+       enum v4l2_buf_type bufType = mBufType;
+       ret = captureIoctl(VIDIOC_STREAMON, &bufType);
     ALOGD("[%s %d] VIDIOC_STREAMON return=:%d", __FUNCTION__, __LINE__, ret);
        if (ret < 0) {
           DEBUG_PRINT(3, "VIDIOC_STREAMON Failed, error: %s", strerror(errno));
@@ -1130,6 +1475,7 @@ int HinDevImpl::get_current_sourcesize(int& width,  int& height,int& pixelformat
        mState = START;
     }*/
     mState = START;
+    mWorkReactor.wake();
     return ret;
 }
 
@@ -1137,20 +1483,21 @@ int HinDevImpl::aquire_buffer()
 {
     int ret = UNKNOWN_ERROR;
     DEBUG_PRINT(3, "%s %d", __FUNCTION__, __LINE__);
-    memset(&mHinNodeInfo->vt_buffers, 0, sizeof(mHinNodeInfo->vt_buffers));
+    std::fill(mHinNodeInfo->vt_buffers.begin(), mHinNodeInfo->vt_buffers.end(), nullptr);
+    unregisterBufferSlots(BUFFER_SLOT_CAPTURE);
     for (int i = 0; i < mBufferCount; i++) {
         memset(&mHinNodeInfo->planes[i], 0, sizeof(struct v4l2_plane));
         memset(&mHinNodeInfo->bufferArray[i], 0, sizeof(struct v4l2_buffer));
 
         mHinNodeInfo->bufferArray[i].index = i;
-        mHinNodeInfo->bufferArray[i].type = TVHAL_V4L2_BUF_TYPE;
+        mHinNodeInfo->bufferArray[i].type = mBufType;
         mHinNodeInfo->bufferArray[i].memory = TVHAL_V4L2_BUF_MEMORY_TYPE;
         if (mHinNodeInfo->cap.device_caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
             mHinNodeInfo->bufferArray[i].m.planes = &mHinNodeInfo->planes[i];
             mHinNodeInfo->bufferArray[i].length = PLANES_NUM;
         }
 
-        ret = ioctl(mHinDevHandle, VIDIOC_QUERYBUF, &mHinNodeInfo->bufferArray[i]);
+        ret = captureIoctl(VIDIOC_QUERYBUF, &mHinNodeInfo->bufferArray[i]);
         if (ret < 0) {
             DEBUG_PRINT(3, "VIDIOC_QUERYBUF Failed, error: %s", strerror(errno));
             return ret;
@@ -1163,6 +1510,7 @@ int HinDevImpl::aquire_buffer()
                 DEBUG_PRINT(3, "mSidebandWindow->allocateBuffer failed !!!");
                 return ret;
             }
+            mSidebandWindow->prepareFb(mHinNodeInfo->buffer_handle_poll[i], mHdmiInType);
         } else if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
             int fence = -1;
             ret = mSidebandWindow->dequeueBuffer(&mHinNodeInfo->vt_buffers[i], -1, &fence);
@@ -1193,6 +1541,8 @@ int HinDevImpl::aquire_buffer()
                 }
                 mHinNodeInfo->bufferArray[i].m.planes[j].length = 0;
             }
+            registerBufferSlot(mHinNodeInfo->bufferArray[i].m.planes[0].m.fd, BUFFER_SLOT_CAPTURE, i,
+                mHinNodeInfo->vt_buffers[i]);
         }
     }
 
@@ -1203,6 +1553,10 @@ int HinDevImpl::aquire_buffer()
 int HinDevImpl::release_buffer()
 {
     ALOGE("%s %d", __FUNCTION__, __LINE__);
+    {
+        Mutex::Autolock autoLock(mBufferSlotLock);
+        mBufferSlots.clear();
+    }
     if (mSidebandHandle) {
         mSidebandWindow->freeBuffer(&mSidebandHandle, 0);
         mSidebandHandle = NULL;
@@ -1223,6 +1577,50 @@ int HinDevImpl::release_buffer()
         mRecordHandle.clear();
     }
 
+    releasePqBuffers();
+
+    if (mFrameType & TYPE_STREAM_BUFFER_PRODUCER) {
+        if (!mPreviewRawHandle.empty()) {
+            for (int i=0; i<mPreviewRawHandle.size(); i++) {
+                mSidebandWindow->freeBuffer(&mPreviewRawHandle[i].outHandle, 1);
+                mPreviewRawHandle[i].outHandle = NULL;
+            }
+            mPreviewRawHandle.clear();
+        }
+        if (mSignalPreviewHandle) {
+            mSidebandWindow->freeBuffer(&mSignalPreviewHandle, 1);
+            mSignalPreviewHandle = NULL;
+        }
+        for (int i=0; i < mBufferCount; i++) {
+            mSidebandWindow->freeBuffer(&mHinNodeInfo->buffer_handle_poll[i], 0);
+            mHinNodeInfo->buffer_handle_poll[i] = NULL;
+        }
+    } else {
+        for (int i=0; i<mBufferCount; i++) {
+            if (mSidebandWindow) {
+                if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
+                    if (mHinNodeInfo->vt_buffers[i]) {
+                        mSidebandWindow->cancelBuffer(mHinNodeInfo->vt_buffers[i]);
+                        mHinNodeInfo->vt_buffers[i]->handle = NULL;
+                        mHinNodeInfo->vt_buffers[i] = nullptr;
+                    } else {
+                        ALOGE("%s %d vt_buffers %d is nullptr not need release", __FUNCTION__, __LINE__, i);
+                    }
+                } else {
+                    mSidebandWindow->freeBuffer(&mHinNodeInfo->buffer_handle_poll[i], 0);
+                    mHinNodeInfo->buffer_handle_poll[i] = NULL;
+                }
+            }
+        }
+        if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
+            mSidebandWindow->release();
+        }
+    }
+    return 0;
+}
+
+// pq/iep in/out buffers, sized for the stream geometry
+void HinDevImpl::releasePqBuffers() {
     if (!mPqBufferHandle.empty()) {
         for (int i=0; i<mPqBufferHandle.size(); i++) {
             //mSidebandWindow->freeBuffer(&mPqBufferHandle[i].srcHandle, 1);
@@ -1264,45 +1662,8 @@ int HinDevImpl::release_buffer()
             mSidebandWindow->freeBuffer(&mIepTempHandle.out_vt_buffer);
         }
     }
-
-    if (mFrameType & TYPE_STREAM_BUFFER_PRODUCER) {
-        if (!mPreviewRawHandle.empty()) {
-            for (int i=0; i<mPreviewRawHandle.size(); i++) {
-                mSidebandWindow->freeBuffer(&mPreviewRawHandle[i].outHandle, 1);
-                mPreviewRawHandle[i].outHandle = NULL;
-            }
-            mPreviewRawHandle.clear();
-        }
-        if (mSignalPreviewHandle) {
-            mSidebandWindow->freeBuffer(&mSignalPreviewHandle, 1);
-            mSignalPreviewHandle = NULL;
-        }
-        for (int i=0; i < mBufferCount; i++) {
-            mSidebandWindow->freeBuffer(&mHinNodeInfo->buffer_handle_poll[i], 0);
-            mHinNodeInfo->buffer_handle_poll[i] = NULL;
-        }
-    } else {
-        for (int i=0; i<mBufferCount; i++) {
-            if (mSidebandWindow) {
-                if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
-                    if (mHinNodeInfo->vt_buffers[i]) {
-                        mSidebandWindow->cancelBuffer(mHinNodeInfo->vt_buffers[i]);
-                        mHinNodeInfo->vt_buffers[i]->handle = NULL;
-                        mHinNodeInfo->vt_buffers[i] = nullptr;
-                    } else {
-                        ALOGE("%s %d vt_buffers %d is nullptr not need release", __FUNCTION__, __LINE__, i);
-                    }
-                } else {
-                    mSidebandWindow->freeBuffer(&mHinNodeInfo->buffer_handle_poll[i], 0);
-                    mHinNodeInfo->buffer_handle_poll[i] = NULL;
-                }
-            }
-        }
-        if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
-            mSidebandWindow->release();
-        }
-    }
-    return 0;
+    unregisterBufferSlots(BUFFER_SLOT_PQ);
+    unregisterBufferSlots(BUFFER_SLOT_IEP);
 }
 
 int HinDevImpl::set_preview_info(int top, int left, int width, int height) {
@@ -1377,6 +1738,7 @@ int HinDevImpl::request_capture(buffer_handle_t rawHandle, uint64_t bufferId) {
     }
 
     mRequestCaptureCount++;
+    mWorkReactor.wake();
 
     //ALOGD("rawHandle = %p, bufferId=%" PRIu64, rawHandle, bufferId);
     for (int i=0; i<mPreviewRawHandle.size(); i++) {
@@ -1388,7 +1750,7 @@ int HinDevImpl::request_capture(buffer_handle_t rawHandle, uint64_t bufferId) {
             }
         }
     }
-    int ret = ioctl(mHinDevHandle, VIDIOC_QBUF, &mHinNodeInfo->bufferArray[bufferIndex]);
+    int ret = captureIoctl(VIDIOC_QBUF, &mHinNodeInfo->bufferArray[bufferIndex]);
     if (ret != 0) {
         ALOGE("VIDIOC_QBUF Buffer failed err=%s bufferIndex %d requestFd=%d %" PRIu64,
             strerror(errno), bufferIndex, requestFd, bufferId);
@@ -1412,47 +1774,55 @@ void HinDevImpl::wrapCaptureResultAndNotify(uint64_t buffId,buffer_handle_t hand
     //ALOGD("%s %lld,end.", __FUNCTION__,(long long)buffId);
     // result.buffer = handle;  //if need
     if(mNotifyQueueCb != NULL) {
-        mNotifyQueueCb(result, buffId);
+        mNotifyQueueCb(mNotifyQueueUser, result, buffId);
     }
 }
 
-void OnInputAvailableCB(int32_t index){
+void HinDevImpl::onRecordInputAvailable(void *user, int32_t index){
     //ALOGD("InputAvailable index = %d",index);
-    if (!mRecordHandle.empty()){
-        if (!mRecordHandle[index].isCoding) {
+    HinDevImpl *dev = (HinDevImpl *)user;
+    if (!dev->mRecordHandle.empty()){
+        if (!dev->mRecordHandle[index].isCoding) {
             DEBUG_PRINT(3, "%d not send to coding but return it???", index);
         }
-        mRecordHandle[index].isCoding = false;
+        dev->mRecordHandle[index].isCoding = false;
     }
 }
 
 int HinDevImpl::init_encodeserver(MppEncodeServer::MetaInfo* info) {
-    if (gMppEnCodeServer == nullptr) {
-        gMppEnCodeServer = new MppEncodeServer();
+    if (mStageBackends.encoder) {
+        return mStageBackends.encoder->start(info->width, info->height, info->fps,
+            onRecordInputAvailable, this) ? 0 : -1;
+    }
+    if (mMppEncodeServer == nullptr) {
+        mMppEncodeServer = new MppEncodeServer();
     }
 
-    if (!gMppEnCodeServer->init(info)) {
-        ALOGE("Failed to init gMppEnCodeServer");
+    if (!mMppEncodeServer->init(info)) {
+        ALOGE("Failed to init mMppEncodeServer");
         return -1;
     }
-    NotifyCallback cB = {OnInputAvailableCB};
-    gMppEnCodeServer->setNotifyCallback(cB,this);
-    // gMppEnCodeServer->start();
+    NotifyCallback cB = {onRecordInputAvailable};
+    mMppEncodeServer->setNotifyCallback(cB,this);
+    // mMppEncodeServer->start();
 
     return 0;
 }
 
 void HinDevImpl::deinit_encodeserver() {
     ALOGD("deinit_encodeserver enter");
-    if(gMppEnCodeServer!=nullptr){
-        delete gMppEnCodeServer;
-        gMppEnCodeServer = nullptr;
+    if(mMppEncodeServer!=nullptr){
+        delete mMppEncodeServer;
+        mMppEncodeServer = nullptr;
     }
 }
 
 void HinDevImpl::stopRecord() {
-    if (gMppEnCodeServer != nullptr) {
-        gMppEnCodeServer->stop();
+    if (mStageBackends.encoder) {
+        mStageBackends.encoder->stop();
+    }
+    if (mMppEncodeServer != nullptr) {
+        mMppEncodeServer->stop();
     }
     deinit_encodeserver();
     if (!mRecordHandle.empty()){
@@ -1464,6 +1834,30 @@ void HinDevImpl::stopRecord() {
     }
 }
 
+bool HinDevImpl::isRecording() {
+    if (mStageBackends.encoder) {
+        return mStageBackends.encoder->isRunning();
+    }
+    return mMppEncodeServer != nullptr && mMppEncodeServer->mThreadEnabled.load();
+}
+
+// record buffer index holds the NV12 copy of captureHandle
+bool HinDevImpl::sendRecordFrame(int index, buffer_handle_t captureHandle) {
+    int fd = mRecordHandle[index].outHandle->data[0];
+    size_t size = getBufSize(V4L2_PIX_FMT_NV12, mSrcFrameWidth, mSrcFrameHeight);
+    if (mStageBackends.encoder) {
+        return mStageBackends.encoder->sendFrame(fd, index, size, systemTime());
+    }
+    RKMppEncApi::MyDmaBuffer_t inDmaBuf;
+    memset(&inDmaBuf, 0, sizeof(RKMppEncApi::MyDmaBuffer_t));
+    inDmaBuf.fd = fd;
+    inDmaBuf.size = mMppEncodeServer->mEncoder->mHorStride *
+                    mMppEncodeServer->mEncoder->mVerStride * 3 / 2;
+    inDmaBuf.handler = (void *)captureHandle;
+    inDmaBuf.index = index;
+    return mMppEncodeServer->mEncoder->sendFrame(inDmaBuf, size, systemTime(), 0);
+}
+
 void HinDevImpl::doRecordCmd(const map<string, string> data) {
     Mutex::Autolock autoLock(mBufferLock);
     if (mState != START) {
@@ -1472,7 +1866,7 @@ void HinDevImpl::doRecordCmd(const map<string, string> data) {
     int width = mSrcFrameWidth;
     int height = mSrcFrameHeight;
     if (mFrameFps < 1) {
-        ioctl(mHinDevHandle, RK_HDMIRX_CMD_GET_FPS, &mFrameFps);
+        captureIoctl(RK_HDMIRX_CMD_GET_FPS, &mFrameFps);
         ALOGD("%s RK_HDMIRX_CMD_GET_FPS %d", __FUNCTION__, mFrameFps);
     }
     int fps = mFrameFps;
@@ -1486,7 +1880,7 @@ void HinDevImpl::doRecordCmd(const map<string, string> data) {
                 allowRecord = false;
             } else if (it.second.compare("1") == 0) {
                 if (mRecordHandle.empty()) {
-                    mRecordHandle.resize(SIDEBAND_RECORD_BUFF_CNT);
+                    mRecordHandle.resize(mRecordBufferCount);
                     for (int i=0; i<mRecordHandle.size(); i++) {
                         mSidebandWindow->allocateSidebandHandle(&mRecordHandle[i].outHandle,
                             width, height, HAL_PIXEL_FORMAT_YCrCb_NV12, RK_GRALLOC_USAGE_STRIDE_ALIGN_64);
@@ -1531,19 +1925,24 @@ void HinDevImpl::doRecordCmd(const map<string, string> data) {
     ALOGD("%s %dx%d fps=%d %s", __FUNCTION__, width, height, fps, storePath.c_str());
 
     if (allowRecord && init_encodeserver(&info) != -1) {
+        if (mMppEncodeServer == nullptr) {
+            // a stand-in encoder, nothing is written
+            return;
+        }
         if (storePath.compare("") != 0) {
-            gMppEnCodeServer->mOutputFile = fopen(storePath.c_str(), "w+b");
+            mMppEncodeServer->mOutputFile = fopen(storePath.c_str(), "w+b");
         }
-        if (gMppEnCodeServer->mOutputFile == nullptr) {
+        if (mMppEncodeServer->mOutputFile == nullptr) {
             ALOGD("%s mOutputFile is null %s " , __FUNCTION__, strerror(errno));
         }
-        gMppEnCodeServer->start();
+        mMppEncodeServer->start();
     } else {
         stopRecord();
     }
 }
 
 void HinDevImpl::doPQCmd(const map<string, string> data) {
+    waitStagesIdleLocked();
     if (mState != START || mFrameType & TYPE_STREAM_BUFFER_PRODUCER) {
         mPqMode = PQ_OFF;
         return;
@@ -1661,10 +2060,13 @@ void HinDevImpl::doPQCmd(const map<string, string> data) {
               }
           }
           mPqBufferHandle.clear();
+          unregisterBufferSlots(BUFFER_SLOT_PQ);
       }
     } else if(mPqMode == PQ_OFF) {
         if (mPqBufferHandle.empty()) {
-            mPqBufferHandle.resize(SIDEBAND_PQ_BUFF_CNT);
+            mPqBufferHandle.resize(mPqBufferCount);
+            mPqPrepareList.reset(mPqBufferCount);
+            mPqDoneList.reset(mPqBufferCount);
             if (!mPqPrepareList.empty()) {
                 DEBUG_PRINT(3, "clear mPqPrepareList");
                 mPqPrepareList.clear();
@@ -1677,10 +2079,15 @@ void HinDevImpl::doPQCmd(const map<string, string> data) {
                 if (mFrameType & TYPE_SIDEBAND_WINDOW) {
                     mSidebandWindow->allocateSidebandHandle(&mPqBufferHandle[i].outHandle, mDstFrameWidth, mDstFrameHeight,
                         HAL_PIXEL_FORMAT_YCBCR_444_888, RK_GRALLOC_USAGE_STRIDE_ALIGN_64);
+                    mSidebandWindow->prepareFb(mPqBufferHandle[i].outHandle, mHdmiInType);
                 } else if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
                     mSidebandWindow->allocateBuffer(&mPqBufferHandle[i].out_vt_buffer, mDstFrameWidth, mDstFrameHeight,
                         HAL_PIXEL_FORMAT_YCBCR_444_888,
                         RK_GRALLOC_USAGE_STRIDE_ALIGN_64 | MALI_GRALLOC_USAGE_NO_AFBC);
+                    if (mPqBufferHandle[i].out_vt_buffer != nullptr) {
+                        registerBufferSlot(mPqBufferHandle[i].out_vt_buffer->handle->data[0], BUFFER_SLOT_PQ, i,
+                            mPqBufferHandle[i].out_vt_buffer);
+                    }
                     mPqPrepareList.push_back(i);
                 }
             }
@@ -1690,17 +2097,24 @@ void HinDevImpl::doPQCmd(const map<string, string> data) {
         if (mUseIep) {
             if (mIepBufferHandle.empty()) {
                 DEBUG_PRINT(3, "mIepBufferHandle empty, init it");
-                mIepBufferHandle.resize(SIDEBAND_IEP_BUFF_CNT);
+                mIepBufferHandle.resize(mIepBufferCount);
+                mIepPrepareList.reset(mIepBufferCount);
+                mIepDoneList.reset(mIepBufferCount);
                 for (int i=0; i<mIepBufferHandle.size(); i++) {
                     mSidebandWindow->allocateSidebandHandle(&mIepBufferHandle[i].srcHandle, mDstFrameWidth, mDstFrameHeight,
                     HAL_PIXEL_FORMAT_YCbCr_422_SP, RK_GRALLOC_USAGE_STRIDE_ALIGN_64);
                     if (mFrameType & TYPE_SIDEBAND_WINDOW) {
                         mSidebandWindow->allocateSidebandHandle(&mIepBufferHandle[i].outHandle, mDstFrameWidth, mDstFrameHeight,
                         HAL_PIXEL_FORMAT_YCbCr_422_SP, RK_GRALLOC_USAGE_STRIDE_ALIGN_64);
+                        mSidebandWindow->prepareFb(mIepBufferHandle[i].outHandle, mHdmiInType);
                     } else if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
                         mSidebandWindow->allocateBuffer(&mIepBufferHandle[i].out_vt_buffer, mDstFrameWidth, mDstFrameHeight,
                             HAL_PIXEL_FORMAT_YCbCr_422_SP,
                             RK_GRALLOC_USAGE_STRIDE_ALIGN_64 | MALI_GRALLOC_USAGE_NO_AFBC);
+                        if (mIepBufferHandle[i].out_vt_buffer != nullptr) {
+                            registerBufferSlot(mIepBufferHandle[i].out_vt_buffer->handle->data[0], BUFFER_SLOT_IEP, i,
+                                mIepBufferHandle[i].out_vt_buffer);
+                        }
                     }
                 }
                 if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
@@ -1845,7 +2259,7 @@ int HinDevImpl::getPqFmt(int V4L2Fmt) {
     return RKPQ_IMG_FMT_NV12;
 }
 
-int HinDevImpl::getOutRange(char* value) {
+int HinDevImpl::getOutRange(const char* value) {
     int ret = HDMIRX_DEFAULT_RANGE;
     if (!strcmp(value, "limit")) {
         ret = HDMIRX_LIMIT_RANGE;
@@ -1868,22 +2282,35 @@ int HinDevImpl::deal_priv_message(const std::string action, const std::map<std::
         doPQCmd(data);
         return 1;
     } else if (action.compare("hdmiinout") == 0) {
+        vt_buffer_t *signalBuffer = nullptr;
+        {
         Mutex::Autolock autoLock(mBufferLock);
         if (mFrameType & TYPE_SIDEBAND_WINDOW && NULL != mSidebandHandle) {
             //mSidebandWindow->clearVopArea();
             stopRecord();
             if (mSignalHandle != NULL && mWorkThread != NULL) {
-                mSidebandWindow->show(mSignalHandle, FULL_SCREEN, mHdmiInType);
+                showSignalFrame();
             }
         } else if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
             stopRecord();
-            showVTunnel(mSignalVTBuffer);
+            // showVTunnel() takes mBufferLock for the rings itself
+            signalBuffer = mSignalVTBuffer;
+            if (signalBuffer != nullptr) {
+                mStagesInFlight++;
+            }
         } else if (mFrameType & TYPE_STREAM_BUFFER_PRODUCER) {
             stopRecord();
             wrapCaptureResultAndNotify(0,
                 mPreviewRawHandle[mHinNodeInfo->currBufferHandleIndex].outHandle, true);
         }
+        }
+        if (signalBuffer != nullptr) {
+            showVTunnel(signalBuffer);
+            endStageFrame();
+        }
         return 1;
+    } else if (action.compare("stats") == 0) {
+        return dumpStats(data);
     } else if (action.compare("refresh_hotcfg") == 0) {
         char prop_value[PROPERTY_VALUE_MAX] = {0};
         property_get(TV_INPUT_DISPLAY_RATIO, prop_value, "0");
@@ -1893,8 +2320,36 @@ int HinDevImpl::deal_priv_message(const std::string action, const std::map<std::
     return 0;
 }
 
+// "stats" priv command: logs the pipeline stats as json, data "path" also
+// writes them to that file and "reset"="1" starts a new window
+int HinDevImpl::dumpStats(const map<string, string> data) {
+    std::string json = mStats.toJson();
+    // tag the run so dumps from different modes can be compared
+    ALOGI("stats frameType=0x%x %dx%d fmt=0x%x pq=%d iep=%d record=%d replay=%d",
+        mFrameType, mSrcFrameWidth, mSrcFrameHeight, mPixelFormat, mPqMode, mUseIep,
+        isRecording(),
+        mCapture && mCapture->isReplay());
+    ALOGI("stats %s", json.c_str());
+    if (mFrameDumper.written() > 0 || mFrameDumper.dropped() > 0) {
+        ALOGI("stats frame dumps written=%llu dropped=%llu",
+            (unsigned long long)mFrameDumper.written(), (unsigned long long)mFrameDumper.dropped());
+    }
+    for (auto it : data) {
+        if (it.first.compare("path") == 0 && !it.second.empty()) {
+            mStats.dumpJson(it.second.c_str());
+        }
+    }
+    auto reset = data.find("reset");
+    if (reset != data.end() && reset->second.compare("1") == 0) {
+        mStats.reset();
+    }
+    return 1;
+}
+
 void HinDevImpl::buffDataTransfer(buffer_handle_t srcHandle, int srcFmt, int srcWidth, int srcHeight,
         buffer_handle_t dstHandle, int dstFmt, int dstWidth, int dstHeight, int dstWStride, int dstHStride) {
+    // the cpu paths do not scale
+    bool sameSize = srcWidth == dstWidth && srcHeight == dstHeight;
     if (V4L2_PIX_FMT_BGR24 == srcFmt
             || V4L2_PIX_FMT_NV12 == srcFmt
             || V4L2_PIX_FMT_NV16 == srcFmt) {
@@ -1934,12 +2389,22 @@ void HinDevImpl::buffDataTransfer(buffer_handle_t srcHandle, int srcFmt, int src
         }
         dst.fmt = rgaDstFormat;
         dst.mirror = false;
-        RgaCropScale::CropScaleNV12Or21(&src, &dst);
-    } else if (V4L2_PIX_FMT_NV24 == srcFmt
-            && V4L2_PIX_FMT_NV12 == dstFmt) {
-        mSidebandWindow->NV24ToNV12(srcHandle, dstHandle, srcWidth, srcHeight);
-    } else if (srcFmt == dstFmt) {
-        mSidebandWindow->buffDataTransfer2(srcHandle, dstHandle);
+        if (RgaCropScale::CropScaleNV12Or21(&src, &dst) == 0) {
+            return;
+        }
+        DEBUG_PRINT(3, "rga %dx%d -> %dx%d failed%s", srcWidth, srcHeight, dstWidth, dstHeight,
+            sameSize ? ", trying cpu" : "");
+        if (!sameSize) {
+            return;
+        }
+    }
+    // same format too: a flat copy shears when the dst stride is padded
+    if (sameSize && tvinput::PixelConvert::isSupported(srcFmt, dstFmt)) {
+        mSidebandWindow->convertBuffer(srcHandle, srcFmt, dstHandle, dstFmt,
+            srcWidth, srcHeight, dstWStride, dstHStride);
+    } else {
+        DEBUG_PRINT(mDebugLevel, "no conversion 0x%x %dx%d -> 0x%x %dx%d",
+            srcFmt, srcWidth, srcHeight, dstFmt, dstWidth, dstHeight);
     }
 }
 
@@ -1951,58 +2416,96 @@ int HinDevImpl::workThread()
  	//mHinNodeInfo->bufferArray[mHinNodeInfo->currBufferHandleIndex].flags = V4L2_BUF_FLAG_NO_CACHE_INVALIDATE |
         //                 V4L2_BUF_FLAG_NO_CACHE_CLEAN;
         if (mFrameType & TYPE_SIDEBAND_WINDOW || mFrameType & TYPE_SIDEBAND_VTUNNEL) {
-            if (mHinNodeInfo->currBufferHandleIndex == SIDEBAND_WINDOW_BUFF_CNT)
-                mHinNodeInfo->currBufferHandleIndex = mHinNodeInfo->currBufferHandleIndex % SIDEBAND_WINDOW_BUFF_CNT;
+            if (mHinNodeInfo->currBufferHandleIndex == mBufferCount)
+                mHinNodeInfo->currBufferHandleIndex = mHinNodeInfo->currBufferHandleIndex % mBufferCount;
         } else {
-            if (mHinNodeInfo->currBufferHandleIndex == APP_PREVIEW_BUFF_CNT)
-                mHinNodeInfo->currBufferHandleIndex = mHinNodeInfo->currBufferHandleIndex % APP_PREVIEW_BUFF_CNT;
+            if (mHinNodeInfo->currBufferHandleIndex == mBufferCount)
+                mHinNodeInfo->currBufferHandleIndex = mHinNodeInfo->currBufferHandleIndex % mBufferCount;
             mRequestCaptureCount--;
         }
 
         int ret;
         int ts;
-        fd_set fds;
-        struct timeval tv;
-        FD_ZERO(&fds);
-        FD_SET(mHinDevHandle, &fds);
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
-        ts = select(mHinDevHandle + 1, &fds, NULL, NULL, &tv);
+        bool woken = false;
+        // capture fd, present fence and the release fences
+        struct epoll_event events[TV_INPUT_MAX_BUFF_CNT + 2];
+        int presentFence = -1;
+        if (mFrameType & TYPE_SIDEBAND_WINDOW) {
+            releaseDisplayBuffers();
+            presentDeferred();
+            if (mPendingShowIndex >= 0) {
+                presentFence = mDisplay->getPresentFence();
+            }
+        }
+        if (presentFence >= 0) {
+            mWorkReactor.addFd(presentFence, EPOLLIN);
+        }
+        // no fence to wait for means a deferred frame is polled at vsync rate
+        ts = mWorkReactor.wait(events, TV_INPUT_MAX_BUFF_CNT + 2,
+                (mPendingShowIndex >= 0 && presentFence < 0) ? 16 : -1, &woken);
+        if (presentFence >= 0) {
+            mWorkReactor.removeFd(presentFence);
+            close(presentFence);
+        }
         if (mDebugLevel) {
             tid = pthread_self();
-            for (int i = 0; i < SIDEBAND_WINDOW_BUFF_CNT; i++) {
+            for (int i = 0; i < mBufferCount; i++) {
                DEBUG_PRINT(mDebugLevel, "==now tid=%lu, i=%d, index=%d, fd=%d", tid, i, mHinNodeInfo->bufferArray[i].index, mHinNodeInfo->bufferArray[i].m.planes[0].m.fd);
             }
         }
-        if(ts == 0 || mState != START) {
+        if(ts <= 0 || mState != START) {
+            if (ts < 0) {
+                DEBUG_PRINT(3, "epoll wait failed: %s", strerror(-ts));
+            }
+            return 0;
+        }
+        bool captureReady = false;
+        for (int i = 0; i < ts; i++) {
+            if (events[i].data.fd == mHinDevHandle) {
+                captureReady = true;
+            }
+        }
+        if (!captureReady) {
+            // only fences fired, free the released buffers and show the
+            // frame that waited for the commit
+            releaseDisplayBuffers();
+            presentDeferred();
             return 0;
         }
 
         int currDqbufHandleIndex = mHinNodeInfo->currBufferHandleIndex;
         int currentDqBufFd = 0;
+        uint32_t dqSequence = 0;
+        nsecs_t dqCaptureTime = 0;
         if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
             DEBUG_PRINT(mDebugLevel, "start VIDIOC_DQBUF");
-            ret = ioctl(mHinDevHandle, VIDIOC_DQBUF, &mCurrentBufferArray);
+            ret = captureIoctl(VIDIOC_DQBUF, &mCurrentBufferArray);
         } else {
-            ret = ioctl(mHinDevHandle, VIDIOC_DQBUF, &mHinNodeInfo->bufferArray[currDqbufHandleIndex]);
+            ret = captureIoctl(VIDIOC_DQBUF, &mHinNodeInfo->bufferArray[currDqbufHandleIndex]);
         }
         if (ret < 0) {
             DEBUG_PRINT(3, "VIDIOC_DQBUF Failed, error: %s", strerror(errno));
+            mStats.recordDrop(tvinput::DROP_DQBUF_ERROR);
             return 0;
         } else {
+            nsecs_t dqbufTime = systemTime();
+            const struct v4l2_buffer &dqBuf = (mFrameType & TYPE_SIDEBAND_VTUNNEL) ?
+                mCurrentBufferArray : mHinNodeInfo->bufferArray[currDqbufHandleIndex];
+            nsecs_t captureTime = v4l2BufferTime(dqBuf.timestamp);
+            mStats.recordFrame(dqbufTime);
+            mStats.recordSequence(dqBuf.sequence, captureTime);
+            mStats.recordStage(tvinput::STAGE_CAPTURE, captureTime, dqbufTime);
+            dqSequence = dqBuf.sequence;
+            dqCaptureTime = captureTime;
             if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
-                bool findCorrectFd = false;
+                buffer_slot_t slot;
                 currentDqBufFd = mCurrentBufferArray.m.planes[0].m.fd;
-                for (int i = 0; i < SIDEBAND_WINDOW_BUFF_CNT; i++) {
-                    if (currentDqBufFd == mHinNodeInfo->vt_buffers[i]->handle->data[0]) {
-                        currDqbufHandleIndex = i;
-                        findCorrectFd = true;
-                        break;
-                    }
-                }
-                if (!findCorrectFd) {
+                bool findCorrectFd = findBufferSlot(currentDqBufFd, &slot) && slot.owner == BUFFER_SLOT_CAPTURE;
+                if (findCorrectFd) {
+                    currDqbufHandleIndex = slot.index;
+                } else {
                     ALOGE("VIDIOC_DQBUF happen uncorrect err fd=%d", currentDqBufFd);
-                    for (int i = 0; i < SIDEBAND_WINDOW_BUFF_CNT; i++) {
+                    for (int i = 0; i < mBufferCount; i++) {
                         ALOGE("err vtunnel bufferArray fd=%d", mHinNodeInfo->vt_buffers[i]->handle->data[0]);
                     }
                 }
@@ -2023,12 +2526,23 @@ int HinDevImpl::workThread()
 
         if (mEnableDump == 1) {
             if (mDumpFrameCount > 0) {
-                char fileName[128] = {0};
-                sprintf(fileName, "/data/system/dumpimage/tv_input_dump_%dx%d_%d.yuv", mSrcFrameWidth, mSrcFrameHeight, mDumpFrameCount);
+                buffer_handle_t dumpHandle = NULL;
                 if (mFrameType & TYPE_SIDEBAND_WINDOW) {
-                    mSidebandWindow->dumpImage(mHinNodeInfo->buffer_handle_poll[currDqbufHandleIndex], fileName, 0);
+                    dumpHandle = mHinNodeInfo->buffer_handle_poll[currDqbufHandleIndex];
                 } else if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
-                    mSidebandWindow->dumpImage(mHinNodeInfo->vt_buffers[currDqbufHandleIndex]->handle, fileName, 0);
+                    dumpHandle = mHinNodeInfo->vt_buffers[currDqbufHandleIndex]->handle;
+                }
+                if (dumpHandle) {
+                    // only a copy here, the file is written by the dumper thread
+                    int dumpLength = mSidebandWindow->getBufferLength(dumpHandle);
+                    if (dumpLength > 0 && mDumpPending && !mFrameDumper.isActive()) {
+                        mDumpPending = !mFrameDumper.begin(TV_INPUT_DUMP_DIR, mSrcFrameWidth,
+                            mSrcFrameHeight, mPixelFormat, dumpLength, mDumpFrameCount);
+                    }
+                    if (dumpLength > 0) {
+                        mFrameDumper.submit(mSidebandWindow->getBufferHandleFd(dumpHandle),
+                            dumpLength, dqSequence, dqCaptureTime);
+                    }
                 }
                 mDumpFrameCount--;
             }
@@ -2037,8 +2551,10 @@ int HinDevImpl::workThread()
         if (mFrameType & TYPE_SIDEBAND_WINDOW) {
             // add flushCache to prevent image tearing and ghosting caused by
             // cache consistency issues
+            nsecs_t flushStart = systemTime();
             ret = mSidebandWindow->flushCache(
                 mHinNodeInfo->buffer_handle_poll[currDqbufHandleIndex]);
+            mStats.recordStage(tvinput::STAGE_FLUSH_CACHE, flushStart, systemTime());
             if (ret != 0) {
                 DEBUG_PRINT(3, "mSidebandWindow->flushCache failed !!!");
                 return ret;
@@ -2047,37 +2563,49 @@ int HinDevImpl::workThread()
             if (mPqMode != PQ_OFF && !mPqBufferHandle.empty()) {
                 if (mPqBufferHandle[mPqBuffIndex].isFilled) {
                     DEBUG_PRINT(mDebugLevel, "skip pq buffer");
+                    mStats.recordDrop(tvinput::DROP_PQ_BUSY);
                 } else {
                     mPqBufferHandle[mPqBuffIndex].srcHandle = mHinNodeInfo->buffer_handle_poll[currDqbufHandleIndex];
                     mPqBufferHandle[mPqBuffIndex].isFilled = true;
                     mPqBuffIndex++;
-                    if (mPqBuffIndex == SIDEBAND_PQ_BUFF_CNT) {
+                    if (mPqBuffIndex == mPqBufferCount) {
                         mPqBuffIndex = 0;
                     }
+                    mPqSignal.signal();
                 }
             }
 
+            int releaseFence = -1;
+            bool deferred = false;
             if (((mPqMode & PQ_LF_RANGE) == PQ_LF_RANGE && mPixelFormat == V4L2_PIX_FMT_BGR24)
                     || (mPqMode & PQ_NORMAL) == PQ_NORMAL || mPqIniting) {
                     if(mDebugLevel == 3)
                         ALOGE("workThread mSidebandWindow no show, mPqMode %d mPixelFormat %d mPqIniting %d", mPqMode, V4L2_PIX_FMT_BGR24, mPqIniting);
+                    // pq output owns the plane now
+                    flushDisplayBuffers();
             } else {
                 if (mSkipFrame > 0) {
                     mSkipFrame--;
+                    mStats.recordDrop(tvinput::DROP_SKIP_FRAME);
                     DEBUG_PRINT(3, "mSkipFrame not to show %d", mSkipFrame);
+                } else if (mVsyncPacing && mDisplay->isPresentPending()) {
+                    deferPresent(currDqbufHandleIndex);
+                    deferred = true;
                 } else {
                     if (mDebugLevel == 3) {
                         ALOGE("sidebandwindow show index=%d", currDqbufHandleIndex);
                     }
-                    mSidebandWindow->show(mHinNodeInfo->buffer_handle_poll[currDqbufHandleIndex], mDisplayRatio, mHdmiInType);
+                    if (presentCaptureBuffer(currDqbufHandleIndex, &releaseFence) == -EBUSY) {
+                        // the last commit has not landed, show this one after it
+                        deferPresent(currDqbufHandleIndex);
+                        deferred = true;
+                    }
                 }
             }
 
 //encode:sendFrame
-            if (gMppEnCodeServer != nullptr && gMppEnCodeServer->mThreadEnabled.load()) {
-                RKMppEncApi::MyDmaBuffer_t inDmaBuf;
-                memset(&inDmaBuf, 0, sizeof(RKMppEncApi::MyDmaBuffer_t));
-                inDmaBuf.fd = -1;
+            if (isRecording()) {
+                int recordIndex = -1;
                 if(!mRecordHandle.empty()) {
                     tv_record_buffer_info_t recordBuffer = mRecordHandle[mRecordCodingBuffIndex];
                     if (!recordBuffer.isCoding) {
@@ -2085,58 +2613,57 @@ int HinDevImpl::workThread()
                             mSrcFrameWidth, mSrcFrameHeight,
                             recordBuffer.outHandle, V4L2_PIX_FMT_NV12,
                             recordBuffer.width, recordBuffer.height, recordBuffer.verStride, recordBuffer.horStride);
-                        inDmaBuf.fd = recordBuffer.outHandle->data[0];
+                        recordIndex = mRecordCodingBuffIndex;
                     }
                 }
-                if (inDmaBuf.fd == -1) {
+                if (recordIndex < 0) {
                     DEBUG_PRINT(3, "skip record");
-                } else if (gMppEnCodeServer != nullptr) {
-                inDmaBuf.size = gMppEnCodeServer->mEncoder->mHorStride *
-                                gMppEnCodeServer->mEncoder->mVerStride * 3 / 2;
-                inDmaBuf.handler =
-                    (void *)mHinNodeInfo
-                    ->buffer_handle_poll[currDqbufHandleIndex];
-                inDmaBuf.index = mRecordCodingBuffIndex;
-                mRecordHandle[mRecordCodingBuffIndex].isCoding = true;
-                mRecordCodingBuffIndex++;
-                if (mRecordCodingBuffIndex == SIDEBAND_RECORD_BUFF_CNT) {
-                    mRecordCodingBuffIndex = 0;
-                }
-                mLastTime = systemTime();
-                bool enc_ret = gMppEnCodeServer->mEncoder->sendFrame(
-                                   (RKMppEncApi::MyDmaBuffer_t)inDmaBuf,
-                                   getBufSize(V4L2_PIX_FMT_NV12, mSrcFrameWidth, mSrcFrameHeight),
-                                   systemTime(), 0);
-
-                now = systemTime();
-                diff = now - mLastTime;
-
-                if (!enc_ret) {
-                    DEBUG_PRINT(3, "sendFrame failed");
-                }
+                    if (!mRecordHandle.empty()) {
+                        mStats.recordDrop(tvinput::DROP_RECORD_BUSY);
+                    }
+                } else {
+                    mRecordHandle[recordIndex].isCoding = true;
+                    mRecordCodingBuffIndex++;
+                    if (mRecordCodingBuffIndex == (int)mRecordHandle.size()) {
+                        mRecordCodingBuffIndex = 0;
+                    }
+                    nsecs_t encodeStart = systemTime();
+                    bool enc_ret = sendRecordFrame(recordIndex,
+                        mHinNodeInfo->buffer_handle_poll[currDqbufHandleIndex]);
+                    mStats.recordStage(tvinput::STAGE_ENCODE, encodeStart, systemTime());
+                    if (!enc_ret) {
+                        DEBUG_PRINT(3, "sendFrame failed");
+                    }
                 }
             }
 //start encode threads
-             if (gMppEnCodeServer != nullptr && !mEncodeThreadRunning) {
-                gMppEnCodeServer->start();
+             if (mMppEncodeServer != nullptr && !mEncodeThreadRunning) {
+                mMppEncodeServer->start();
                 mEncodeThreadRunning = true;
              }
-            ret = ioctl(mHinDevHandle, VIDIOC_QBUF, &mHinNodeInfo->bufferArray[currDqbufHandleIndex]);
-            if (ret != 0) {
-                DEBUG_PRINT(3, "VIDIOC_QBUF Buffer failed %s", strerror(errno));
+            if (deferred) {
+                // queued once it is shown or replaced, see presentDeferred()
+            } else if (releaseFence >= 0) {
+                holdDisplayBuffer(currDqbufHandleIndex, releaseFence);
             } else {
-                DEBUG_PRINT(mDebugLevel, "VIDIOC_QBUF %d successful.", currDqbufHandleIndex);
+                ret = captureIoctl(VIDIOC_QBUF, &mHinNodeInfo->bufferArray[currDqbufHandleIndex]);
+                if (ret != 0) {
+                    DEBUG_PRINT(3, "VIDIOC_QBUF Buffer failed %s", strerror(errno));
+                } else {
+                    DEBUG_PRINT(mDebugLevel, "VIDIOC_QBUF %d successful.", currDqbufHandleIndex);
+                }
             }
         } else if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
             if (mSkipFrame > 0) {
-                ret = ioctl(mHinDevHandle, VIDIOC_QBUF, &mHinNodeInfo->bufferArray[currDqbufHandleIndex]);
+                ret = captureIoctl(VIDIOC_QBUF, &mHinNodeInfo->bufferArray[currDqbufHandleIndex]);
                 mSkipFrame--;
+                mStats.recordDrop(tvinput::DROP_SKIP_FRAME);
                 DEBUG_PRINT(3, "mSkipFrame not to show %d", mSkipFrame);
                 return NO_ERROR;
             }
 
             if (mUseZme && mPqMode == PQ_OFF) {
-                ret = ioctl(mHinDevHandle, VIDIOC_QBUF, &mHinNodeInfo->bufferArray[currDqbufHandleIndex]);
+                ret = captureIoctl(VIDIOC_QBUF, &mHinNodeInfo->bufferArray[currDqbufHandleIndex]);
                 DEBUG_PRINT(3, "wait zme prepared");
                 return NO_ERROR;
             }
@@ -2165,9 +2692,11 @@ int HinDevImpl::workThread()
                         }
                     }
                     if (fillFinish) {
+                        mPqSignal.signal();
                         break;
                     }
-                    usleep(1000);
+                    // freed by showVTunnel() or the iep thread
+                    mPqSlotSignal.wait(ms2ns(PQ_SLOT_TIMEOUT_MS));
                     long waitTime = (long)((systemTime() - startTime)/1000000);
                     if (waitTime > 10) {
                         DEBUG_PRINT(3, "wait availe mPqPrepareList waitTime=%ld", waitTime);
@@ -2176,13 +2705,15 @@ int HinDevImpl::workThread()
             } else if (mPqMode != PQ_OFF) {
                 if (mPqBufferHandle[mPqBuffIndex].isFilled) {
                     DEBUG_PRINT(mDebugLevel, "skip pq luma buffer");
+                    mStats.recordDrop(tvinput::DROP_PQ_BUSY);
                 } else {
                     mPqBufferHandle[mPqBuffIndex].src_vt_fd = currentDqBufFd;
                     mPqBufferHandle[mPqBuffIndex].isFilled = true;
                     mPqBuffIndex++;
-                    if (mPqBuffIndex == SIDEBAND_PQ_BUFF_CNT) {
+                    if (mPqBuffIndex == mPqBufferCount) {
                         mPqBuffIndex = 0;
                     }
+                    mPqSignal.signal();
                 }
             }
             if (!showPqFrame && mState == START) {
@@ -2193,22 +2724,55 @@ int HinDevImpl::workThread()
             if (mV4L2DataFormatConvert) {
                 mSidebandWindow->buffDataTransfer(mHinNodeInfo->buffer_handle_poll[currDqbufHandleIndex], mPreviewRawHandle[mPreviewBuffIndex].outHandle);
             }
-            if (mRkpq == nullptr) {
-            } else {
+            bool runPq = false;
+            {
                 Mutex::Autolock autoLock(mBufferLock);
-                mRkpq->dopq(mHinNodeInfo->bufferArray[currDqbufHandleIndex].m.planes[0].m.fd,
+                if (mRkpq != nullptr && mState == START) {
+                    mStagesInFlight++;
+                    runPq = true;
+                }
+            }
+            if (runPq) {
+                doPq(mHinNodeInfo->bufferArray[currDqbufHandleIndex].m.planes[0].m.fd,
                     mPreviewRawHandle[currDqbufHandleIndex].bufferFd, PQ_LF_RANGE);
-                wrapCaptureResultAndNotify(mPreviewRawHandle[currDqbufHandleIndex].bufferId,
-                    mPreviewRawHandle[currDqbufHandleIndex].outHandle, false);
+                {
+                    Mutex::Autolock autoLock(mBufferLock);
+                    wrapCaptureResultAndNotify(mPreviewRawHandle[currDqbufHandleIndex].bufferId,
+                        mPreviewRawHandle[currDqbufHandleIndex].outHandle, false);
+                }
+                endStageFrame();
             }
         }
         mHinNodeInfo->currBufferHandleIndex++;
     } else {
-        usleep(500);
+        markParked(&mWorkParked);
+        // idle until start()/request_capture()/stop() wake us, the timeout only bounds a missed wake
+        mWorkReactor.waitForWake(100);
     }
     return NO_ERROR;
 }
 
+void HinDevImpl::markParked(bool *parked) {
+    Mutex::Autolock autoLock(mWorkParkLock);
+    *parked = true;
+    mWorkParkCond.broadcast();
+}
+
+// Called with mBufferLock held before rkpq, rkiep or the pq/iep buffers go
+// away. A stage thread runs rkpq and the vtunnel queue/dequeue with the lock
+// dropped and takes it again to publish, the wait releases it meanwhile.
+void HinDevImpl::waitStagesIdleLocked() {
+    while (mStagesInFlight > 0) {
+        mStagesIdleCond.wait(mBufferLock);
+    }
+}
+
+void HinDevImpl::endStageFrame() {
+    Mutex::Autolock autoLock(mBufferLock);
+    mStagesInFlight--;
+    mStagesIdleCond.broadcast();
+}
+
 bool HinDevImpl::needShowPqFrame(int pqMode) {
     if ((pqMode & PQ_LF_RANGE) == PQ_LF_RANGE
             || (pqMode & PQ_NORMAL) == PQ_NORMAL) {
@@ -2218,20 +2782,40 @@ bool HinDevImpl::needShowPqFrame(int pqMode) {
     return false;
 }
 
+void HinDevImpl::doPq(int srcFd, int dstFd, int pqMode) {
+    nsecs_t startTime = systemTime();
+    if (mStageBackends.pq) {
+        mStageBackends.pq->pq(srcFd, dstFd, pqMode);
+    } else {
+        mRkpq->dopq(srcFd, dstFd, pqMode);
+    }
+    mStats.recordStage(tvinput::STAGE_PQ, startTime, systemTime());
+}
+
+void HinDevImpl::doIep(int src0Fd, int src1Fd, int src2Fd, int dstFd, int dst2Fd, int *dilOrder) {
+    nsecs_t startTime = systemTime();
+    if (mStageBackends.pq) {
+        mStageBackends.pq->iep(src0Fd, src1Fd, src2Fd, dstFd, dst2Fd, dilOrder);
+    } else {
+        mRkiep->iep2_deinterlace(src0Fd, src1Fd, src2Fd, dstFd, dst2Fd, dilOrder);
+    }
+    mStats.recordStage(tvinput::STAGE_IEP, startTime, systemTime());
+}
+
 bool HinDevImpl::qBuf(int fd, bool noFoundLog) {
     if (mState != START || fd < 0) {
         return true;
     }
-    for (int i=0; i < SIDEBAND_WINDOW_BUFF_CNT; i++) {
-        if (fd == mHinNodeInfo->bufferArray[i].m.planes[0].m.fd) {
-            int ret = ioctl(mHinDevHandle, VIDIOC_QBUF, &mHinNodeInfo->bufferArray[i]);
-            if (ret != 0) {
-                ALOGE("%s %d VIDIOC_QBUF index=%d, fd=%d failed %s", __FUNCTION__, __LINE__, i, fd, strerror(errno));
-                return false;
-            } else {
-                DEBUG_PRINT(mDebugLevel, "VIDIOC_QBUF index=%d, fd=%d successful.", i, fd);
-                return true;
-            }
+    buffer_slot_t slot;
+    if (findBufferSlot(fd, &slot) && slot.owner == BUFFER_SLOT_CAPTURE) {
+        int i = slot.index;
+        int ret = captureIoctl(VIDIOC_QBUF, &mHinNodeInfo->bufferArray[i]);
+        if (ret != 0) {
+            ALOGE("%s %d VIDIOC_QBUF index=%d, fd=%d failed %s", __FUNCTION__, __LINE__, i, fd, strerror(errno));
+            return false;
+        } else {
+            DEBUG_PRINT(mDebugLevel, "VIDIOC_QBUF index=%d, fd=%d successful.", i, fd);
+            return true;
         }
     }
     if (noFoundLog) {
@@ -2240,6 +2824,185 @@ bool HinDevImpl::qBuf(int fd, bool noFoundLog) {
     return false;
 }
 
+void HinDevImpl::registerBufferSlot(int fd, int owner, int index, vt_buffer_t *vtBuffer) {
+    if (fd < 0) {
+        return;
+    }
+    Mutex::Autolock autoLock(mBufferSlotLock);
+    buffer_slot_t &slot = mBufferSlots[fd];
+    slot.owner = owner;
+    slot.index = index;
+    slot.vtBuffer = vtBuffer;
+}
+
+void HinDevImpl::unregisterBufferSlots(int owner) {
+    Mutex::Autolock autoLock(mBufferSlotLock);
+    for (auto it = mBufferSlots.begin(); it != mBufferSlots.end();) {
+        if (it->second.owner == owner) {
+            it = mBufferSlots.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool HinDevImpl::findBufferSlot(int fd, buffer_slot_t *slot) {
+    Mutex::Autolock autoLock(mBufferSlotLock);
+    auto it = mBufferSlots.find(fd);
+    if (it == mBufferSlots.end()) {
+        return false;
+    }
+    *slot = it->second;
+    return true;
+}
+
+// The shown capture buffer stays on screen until the next commit lands,
+// releaseFence of that commit tells when the previous one can be queued.
+// The fence goes to mWorkReactor, workThread queues the buffer once it
+// fires instead of waiting for it here.
+void HinDevImpl::holdDisplayBuffer(int index, int releaseFence) {
+    if (mDisplayIndex >= 0 && releaseFence >= 0) {
+        dropReleaseFence(mDisplayIndex);
+        mReleaseFences[mDisplayIndex] = releaseFence;
+        if (!mWorkReactor.addFd(releaseFence, EPOLLIN)) {
+            // still released, by the sweep in the next workThread loop
+            DEBUG_PRINT(3, "watch release fence of index=%d failed", mDisplayIndex);
+        }
+    } else if (releaseFence >= 0) {
+        close(releaseFence);
+    }
+    mDisplayIndex = index;
+}
+
+void HinDevImpl::releaseDisplayBuffers() {
+    for (int i = 0; i < mBufferCount; i++) {
+        if (mReleaseFences[i] < 0 || sync_wait(mReleaseFences[i], 0) < 0) {
+            continue;
+        }
+        dropReleaseFence(i);
+        if (mState == START) {
+            int ret = captureIoctl(VIDIOC_QBUF, &mHinNodeInfo->bufferArray[i]);
+            if (ret != 0) {
+                DEBUG_PRINT(3, "VIDIOC_QBUF release index=%d failed %s", i, strerror(errno));
+            } else {
+                DEBUG_PRINT(mDebugLevel, "VIDIOC_QBUF release index=%d successful.", i);
+            }
+        }
+    }
+}
+
+void HinDevImpl::dropReleaseFence(int index) {
+    if (mReleaseFences[index] >= 0) {
+        mWorkReactor.removeFd(mReleaseFences[index]);
+        close(mReleaseFences[index]);
+        mReleaseFences[index] = -1;
+    }
+}
+
+// buffers waiting for their release fence stay with mWorkReactor
+void HinDevImpl::flushDisplayBuffers() {
+    if (mPendingShowIndex >= 0) {
+        if (mState == START) {
+            captureIoctl(VIDIOC_QBUF, &mHinNodeInfo->bufferArray[mPendingShowIndex]);
+        }
+        mPendingShowIndex = -1;
+    }
+    if (mDisplayIndex >= 0) {
+        if (mState == START) {
+            int ret = captureIoctl(VIDIOC_QBUF, &mHinNodeInfo->bufferArray[mDisplayIndex]);
+            if (ret != 0) {
+                DEBUG_PRINT(3, "VIDIOC_QBUF display index=%d failed %s", mDisplayIndex, strerror(errno));
+            }
+        }
+        mDisplayIndex = -1;
+    }
+}
+
+void HinDevImpl::resetDisplayBuffers() {
+    for (int i = 0; i < (int)mReleaseFences.size(); i++) {
+        dropReleaseFence(i);
+    }
+    mDisplayIndex = -1;
+    mPendingShowIndex = -1;
+}
+
+// 0 with the release fence of the commit, the caller then holds index;
+// -EBUSY while the last commit is in flight, the caller defers index
+int HinDevImpl::presentCaptureBuffer(int index, int *releaseFence) {
+    *releaseFence = -1;
+    nsecs_t captureTime = v4l2BufferTime(mHinNodeInfo->bufferArray[index].timestamp);
+    nsecs_t startTime = systemTime();
+    int ret = mDisplay->show(mHinNodeInfo->buffer_handle_poll[index],
+        mDisplayRatio, mHdmiInType, releaseFence, captureTime);
+    if (ret == -EBUSY) {
+        return ret;
+    }
+    mStats.recordStage(tvinput::STAGE_PRESENT, startTime, systemTime());
+    if (ret == 0 && *releaseFence < 0) {
+        // legacy setplane has already replaced the old buffer
+        flushDisplayBuffers();
+    }
+    return ret;
+}
+
+// pq/iep outputs have no deferral slot, one that finds the last commit
+// still in flight is dropped, the next output follows within a frame
+int HinDevImpl::showStageFrame(buffer_handle_t handle, int displayRatio) {
+    nsecs_t showStart = systemTime();
+    int ret = mDisplay->show(handle, displayRatio, mHdmiInType);
+    mStats.recordStage(tvinput::STAGE_PRESENT, showStart, systemTime());
+    if (ret == -EBUSY) {
+        mStats.recordDrop(tvinput::DROP_DISPLAY_BUSY);
+        DEBUG_PRINT(mDebugLevel, "%s display busy, stage frame dropped", __FUNCTION__);
+    }
+    return ret;
+}
+
+// nothing comes after the no-signal frame to replace it, this one waits
+// for the commit in flight and tries once more
+int HinDevImpl::showSignalFrame() {
+    int ret = mDisplay->show(mSignalHandle, FULL_SCREEN, mHdmiInType);
+    if (ret == -EBUSY) {
+        int fence = mDisplay->getPresentFence();
+        if (fence >= 0) {
+            sync_wait(fence, PRESENT_BUSY_TIMEOUT_MS);
+            close(fence);
+        }
+        ret = mDisplay->show(mSignalHandle, FULL_SCREEN, mHdmiInType);
+    }
+    return ret;
+}
+
+// a frame arriving while the last commit is in flight waits for the
+// vblank, if a newer one comes first the older frame is dropped
+void HinDevImpl::deferPresent(int index) {
+    if (mPendingShowIndex >= 0) {
+        mPacingDropCount++;
+        mStats.recordDrop(tvinput::DROP_DISPLAY_BUSY);
+        DEBUG_PRINT(mDebugLevel, "pacing drop index=%d, total=%" PRIu64, mPendingShowIndex, mPacingDropCount);
+        if (captureIoctl(VIDIOC_QBUF, &mHinNodeInfo->bufferArray[mPendingShowIndex]) != 0) {
+            DEBUG_PRINT(3, "VIDIOC_QBUF pacing index=%d failed %s", mPendingShowIndex, strerror(errno));
+        }
+    }
+    mPendingShowIndex = index;
+}
+
+void HinDevImpl::presentDeferred() {
+    if (mPendingShowIndex < 0 || mDisplay->isPresentPending()) {
+        return;
+    }
+    int index = mPendingShowIndex;
+    mPendingShowIndex = -1;
+    int releaseFence = -1;
+    if (presentCaptureBuffer(index, &releaseFence) == -EBUSY) {
+        mPendingShowIndex = index;
+    } else if (releaseFence >= 0) {
+        holdDisplayBuffer(index, releaseFence);
+    } else if (captureIoctl(VIDIOC_QBUF, &mHinNodeInfo->bufferArray[index]) != 0) {
+        DEBUG_PRINT(3, "VIDIOC_QBUF index=%d failed %s", index, strerror(errno));
+    }
+}
+
 void HinDevImpl::showVTunnel(vt_buffer_t* vt_buffer) {
     if (vt_buffer == nullptr) {
         ALOGE("%s buffer is nullptr", __FUNCTION__);
@@ -2249,21 +3012,33 @@ void HinDevImpl::showVTunnel(vt_buffer_t* vt_buffer) {
     if (mDebugLevel == 3) {
         ALOGW("%s %d vtQueueFd=%d", __FUNCTION__, __LINE__, vt_buffer->handle->data[0]);
     }
-    ret = mSidebandWindow->queueBuffer(vt_buffer, -1, 0);
+    nsecs_t queueStart = systemTime();
+    ret = mDisplay->queueBuffer(vt_buffer, -1, 0);
+    mStats.recordStage(tvinput::STAGE_PRESENT, queueStart, systemTime());
     if (mState != START) {
         ALOGE("%s after vtunnel queueBuffer mState != START", __FUNCTION__);
         return;
     }
-    mQbufCount++;
-    DEBUG_PRINT(mDebugLevel, "queueBuffer ret=%d, mQbufCount=%d", ret, mQbufCount);
-    if (mQbufCount > 2) {
+    bool dequeue;
+    {
+        // work, pq and iep threads all queue here
+        Mutex::Autolock autoLock(mBufferLock);
+        mQbufCount++;
+        DEBUG_PRINT(mDebugLevel, "queueBuffer ret=%d, mQbufCount=%d", ret, mQbufCount);
+        // a capture ring of two leaves one of them with the driver
+        dequeue = mQbufCount > std::min(VTUNNEL_HELD_BUFF_CNT, mBufferCount - 1);
+        if (dequeue) {
+            mQbufCount--;
+        }
+    }
+    if (dequeue) {
         vt_buffer_t *vtBuf;
         //memset(vtBuf, 0, sizeof(vt_buffer_t));
         int fence_id = -1;
         int vtDqbufFd = -1;
         int timeout_ms = 1000;
         nsecs_t startDqbufTime = systemTime();
-        ret = mSidebandWindow->dequeueBuffer(&vtBuf, timeout_ms, &fence_id);
+        ret = mDisplay->dequeueBuffer(&vtBuf, timeout_ms, &fence_id);
         /*if (ret < 0) {
             long usedDqBufTime = (long)((systemTime() - startDqbufTime)/1000000);
             DEBUG_PRINT(3, "dqBuf failed ret=%d, usedDqBufTime=%ld", ret, usedDqBufTime);
@@ -2283,37 +3058,35 @@ void HinDevImpl::showVTunnel(vt_buffer_t* vt_buffer) {
             DEBUG_PRINT(3, "dqBuf but not find displayDqbufFd ret=%d, usedDqBufTime=%ld",
                 ret, (long)((systemTime() - startDqbufTime)/1000000));
         }
-        mQbufCount--;
 
-        if (qBuf(vtDqbufFd, false)) {
+        buffer_slot_t slot;
+        if (vtDqbufFd < 0 || !findBufferSlot(vtDqbufFd, &slot)) {
+            DEBUG_PRINT(3, "dqBuf fd=%d has no buffer slot", vtDqbufFd);
             return;
         }
-        if (mState == START && vtDqbufFd > -1 && !mPqDoneList.empty()) {
-            for (int i = 0; i < mPqDoneList.size(); i++) {
-                int pqBufIndex = mPqDoneList[i];
-                if (vtDqbufFd == mPqBufferHandle[pqBufIndex].out_vt_buffer->handle->data[0]) {
-                    DEBUG_PRINT(mDebugLevel, "pqDoneList listIndex=%d, pqBufIndex=%d, fd=%d to pqPrepareList",
-                        i, pqBufIndex, vtDqbufFd);
-                    //mPqDoneList[i].src_vt_fd;
-                    mPqBufferHandle[pqBufIndex].src_vt_fd = -1;
-                    mPqBufferHandle[pqBufIndex].isFilled = false;
-                    mPqDoneList.erase(mPqDoneList.begin() + i);
-                    mPqPrepareList.push_back(pqBufIndex);
-                    return;
-                }
+        if (slot.owner == BUFFER_SLOT_CAPTURE) {
+            qBuf(vtDqbufFd, false);
+            return;
+        }
+        Mutex::Autolock autoLock(mBufferLock);
+        if (mState == START && slot.owner == BUFFER_SLOT_PQ) {
+            if (mPqDoneList.remove(slot.index)) {
+                int pqBufIndex = slot.index;
+                DEBUG_PRINT(mDebugLevel, "pqDoneList pqBufIndex=%d, fd=%d to pqPrepareList",
+                    pqBufIndex, vtDqbufFd);
+                mPqBufferHandle[pqBufIndex].src_vt_fd = -1;
+                mPqBufferHandle[pqBufIndex].isFilled = false;
+                mPqPrepareList.push_back(pqBufIndex);
+                mPqSlotSignal.signal();
+                return;
             }
         }
-        if (mState == START && vtDqbufFd > -1 && !mIepDoneList.empty()) {
-            for (int i = 0; i < mIepDoneList.size(); i++) {
-                int iepBufIndex = mIepDoneList[i];
-                if (vtDqbufFd == mIepBufferHandle[iepBufIndex].out_vt_buffer->handle->data[0]) {
-                    DEBUG_PRINT(mDebugLevel, "iepDoneList listIndex=%d, iepBufIndex=%d, fd=%d to iepPreparelist",
-                        i, iepBufIndex, vtDqbufFd);
-                    //mIepDoneList[i].src_vt_fd = -1;
-                    mIepDoneList.erase(mIepDoneList.begin() + i);
-                    mIepPrepareList.push_back(iepBufIndex);
-                    return;
-                }
+        if (mState == START && slot.owner == BUFFER_SLOT_IEP) {
+            if (mIepDoneList.remove(slot.index)) {
+                DEBUG_PRINT(mDebugLevel, "iepDoneList iepBufIndex=%d, fd=%d to iepPreparelist",
+                    slot.index, vtDqbufFd);
+                mIepPrepareList.push_back(slot.index);
+                return;
             }
         }
         if (mState != START || vtDqbufFd < 0 || ret != 0) {
@@ -2324,35 +3097,44 @@ void HinDevImpl::showVTunnel(vt_buffer_t* vt_buffer) {
 }
 
 int HinDevImpl::pqBufferThread() {
-    char debugInfoValue[PROPERTY_VALUE_MAX] = {0};
-    property_get(TV_INPUT_DEBUG_LEVEL, debugInfoValue, "0");
-    mDebugLevel = (int)atoi(debugInfoValue);
-    property_get(TV_INPUT_DEBUG_DUMP, debugInfoValue, "0");
-    mEnableDump = (int)atoi(debugInfoValue);
-    if (mEnableDump == 1) {
-        property_get(TV_INPUT_DEBUG_DUMPNUM, debugInfoValue, "0");
-        int dumpFrameCount = (int)atoi(debugInfoValue);
-        if (dumpFrameCount > 0) {
-            mDumpFrameCount = dumpFrameCount;
-        }
+    std::shared_ptr<const tvinput::TvInputConfigSnapshot> config = mConfig.get();
+    mDebugLevel = config->debugLevel;
+    mEnableDump = config->enableDump;
+    // one session per write of the dump properties, not one per loop
+    uint32_t dumpSerial = sDumpSerial.load();
+    if (config->dumpSerial != dumpSerial
+            && sDumpSerial.compare_exchange_strong(dumpSerial, config->dumpSerial)
+            && mEnableDump == 1) {
+        mDumpFrameCount = config->dumpFrameCount > 0 ? config->dumpFrameCount : DEFAULT_DUMP_FRAME_CNT;
+        mDumpPending = true;
     }
     if (mFrameType & TYPE_STREAM_BUFFER_PRODUCER || mState != START) {
-        usleep(500);
+        if (mState != START) {
+            markParked(&mPqParked);
+        }
+        mPqSignal.wait(ms2ns(PQ_IDLE_TIMEOUT_MS));
         return NO_ERROR;
     }
+    // a frame is claimed under mBufferLock, run through rkpq without it and
+    // published under it again, workThread and doPQCmd() are not held up
+    int claimed = -1;
+    int iepIndex = -1;
+    int srcFd = -1;
+    int dstFd = -1;
+    int runMode = PQ_OFF;
+    bool vtunnel = false;
+    bool lumaOnly = false;
+    bool showPqFrame = false;
     {
     Mutex::Autolock autoLock(mBufferLock);
     if (mState != START) {
         return NO_ERROR;
     }
-    char prop_value[PROPERTY_VALUE_MAX] = {0};
     int pqMode = PQ_OFF;
     int value = 0;
-    int auto_detection = property_get_int32(TV_INPUT_PQ_AUTO_DETECTION, 0);
-    property_get(TV_INPUT_PQ_RANGE, prop_value, "auto");
-    mOutRange = getOutRange(prop_value);
-    property_get(TV_INPUT_PQ_ENABLE, prop_value, "0");
-    value = (int)atoi(prop_value);
+    int auto_detection = config->pqAutoDetection;
+    mOutRange = getOutRange(config->pqRange);
+    value = config->pqEnable;
     if (value != 0)  {
         pqMode |= PQ_NORMAL;
     } 
@@ -2369,20 +3151,18 @@ int HinDevImpl::pqBufferThread() {
             tv_input_command command;
             command.command_id = CMD_HDMIIN_RESET;
             if(mNotifyCommandCb != NULL) {
-                mNotifyCommandCb(command);
+                mNotifyCommandCb(mNotifyCommandUser, command);
             }
         //}
         mLastZmeStatus = mUseZme;
         mLastPqStatus = value;
     }
-    property_get(TV_INPUT_PQ_LUMA, prop_value, "0");
-    value = (int)atoi(prop_value);
+    value = config->pqLuma;
     if (value != 0) {
         pqMode |= PQ_CACL_LUMA;
     } else if (auto_detection != 0) {
-        property_get(TV_INPUT_HDMI_RANGE, prop_value, "auto");
         int fmt = getPqFmt(mPixelFormat);
-      if (!strcmp(prop_value, "auto") && fmt == RKPQ_IMG_FMT_BG24 &&
+      if (!strcmp(config->pqRange, "auto") && fmt == RKPQ_IMG_FMT_BG24 &&
            mFrameColorRange != HDMIRX_FULL_RANGE) {
             pqMode |= PQ_LF_RANGE;
       }
@@ -2442,111 +3222,144 @@ int HinDevImpl::pqBufferThread() {
 
     if (mState == START && mPqMode != PQ_OFF && !mPqBufferHandle.empty()) {
         if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
+            vtunnel = true;
             if (mPqMode == PQ_CACL_LUMA) {
                 if (mPqBufferHandle[mPqBuffOutIndex].isFilled) {
                     DEBUG_PRINT(mDebugLevel, "dopq luma %d", mPqBufferHandle[mPqBuffOutIndex].src_vt_fd);
-                    mRkpq->dopq(mPqBufferHandle[mPqBuffOutIndex].src_vt_fd,
-                        mPqBufferHandle[mPqBuffOutIndex].out_vt_buffer->handle->data[0], PQ_CACL_LUMA);
-                    mPqBufferHandle[mPqBuffOutIndex].isFilled = false;
-                    mPqBuffOutIndex++;
-                    if (mPqBuffOutIndex == SIDEBAND_PQ_BUFF_CNT) {
-                        mPqBuffOutIndex = 0;
-                    }
+                    claimed = mPqBuffOutIndex;
+                    lumaOnly = true;
+                    runMode = PQ_CACL_LUMA;
                 }
             } else if (!mPqPrepareList.empty()) {
                 int pqBufIndex = mPqPrepareList[0];
                 if (mPqBufferHandle[pqBufIndex].isFilled) {
                     bool enableLuma = (mPqMode & PQ_CACL_LUMA) == PQ_CACL_LUMA;
                     bool enablePqNormal = (mPqMode & PQ_NORMAL) == PQ_NORMAL;
+                    claimed = pqBufIndex;
                     if (enablePqNormal && mUseIep) {
-                        mRkpq->dopq(mPqBufferHandle[pqBufIndex].src_vt_fd,
-                            mPqBufferHandle[pqBufIndex].out_vt_buffer->handle->data[0],
-                            enableLuma?(PQ_CACL_LUMA|PQ_IEP):PQ_IEP);
+                        runMode = enableLuma?(PQ_CACL_LUMA|PQ_IEP):PQ_IEP;
                     } else if (enablePqNormal) {
-                        mRkpq->dopq(mPqBufferHandle[pqBufIndex].src_vt_fd,
-                            mPqBufferHandle[pqBufIndex].out_vt_buffer->handle->data[0],
-                            enableLuma?(PQ_CACL_LUMA|PQ_NORMAL):PQ_NORMAL);
+                        runMode = enableLuma?(PQ_CACL_LUMA|PQ_NORMAL):PQ_NORMAL;
                     } else if ((mPqMode & PQ_LF_RANGE) == PQ_LF_RANGE) {
-                        mRkpq->dopq(mPqBufferHandle[pqBufIndex].src_vt_fd,
-                            mPqBufferHandle[pqBufIndex].out_vt_buffer->handle->data[0],
-                            enableLuma?(PQ_CACL_LUMA|PQ_LF_RANGE):PQ_LF_RANGE);
-                    }
-                    qBuf(mPqBufferHandle[pqBufIndex].src_vt_fd, true);
-                    mPqPrepareList.erase(mPqPrepareList.begin());
-                    mPqDoneList.push_back(pqBufIndex);
-                    if (!mUseIep) {
-                        showVTunnel(mPqBufferHandle[pqBufIndex].out_vt_buffer);
+                        runMode = enableLuma?(PQ_CACL_LUMA|PQ_LF_RANGE):PQ_LF_RANGE;
                     }
                 }
             }
+            if (claimed >= 0) {
+                srcFd = mPqBufferHandle[claimed].src_vt_fd;
+                dstFd = mPqBufferHandle[claimed].out_vt_buffer->handle->data[0];
+            }
         } else if (mFrameType & TYPE_SIDEBAND_WINDOW
                 && mPqBufferHandle[mPqBuffOutIndex].isFilled) {
-            bool showPqFrame = false;
             bool enableLuma = (mPqMode & PQ_CACL_LUMA) == PQ_CACL_LUMA;
+            claimed = mPqBuffOutIndex;
+            srcFd = mPqBufferHandle[claimed].srcHandle->data[0];
+            dstFd = mPqBufferHandle[claimed].outHandle->data[0];
             if ((mPqMode & PQ_NORMAL) == PQ_NORMAL) {
                 if (mUseIep) {
                     if (!mIepBufferHandle.empty()) {
                         if (mIepBufferHandle[mIepBuffIndex].isFilled) {
                              mIepBuffIndex++;
-                             if (mIepBuffIndex == SIDEBAND_IEP_BUFF_CNT) {
+                             if (mIepBuffIndex == mIepBufferCount) {
                                 mIepBuffIndex = 0;
                              }
                          } else {
-                            mRkpq->dopq(mPqBufferHandle[mPqBuffOutIndex].srcHandle->data[0],
-                                mIepBufferHandle[mIepBuffIndex].srcHandle->data[0], enableLuma?(PQ_CACL_LUMA|PQ_IEP):PQ_IEP);
-                             mIepBufferHandle[mIepBuffIndex].isFilled = true;
-                             mIepBuffIndex++;
-                             if (mIepBuffIndex == SIDEBAND_IEP_BUFF_CNT) {
-                                 mIepBuffIndex = 0;
-                             }
+                            iepIndex = mIepBuffIndex;
+                            dstFd = mIepBufferHandle[iepIndex].srcHandle->data[0];
+                            runMode = enableLuma?(PQ_CACL_LUMA|PQ_IEP):PQ_IEP;
                          }
                     }
                 } else {
-                    mRkpq->dopq(mPqBufferHandle[mPqBuffOutIndex].srcHandle->data[0],
-                        mPqBufferHandle[mPqBuffOutIndex].outHandle->data[0], enableLuma?(PQ_CACL_LUMA|PQ_NORMAL):PQ_NORMAL);
+                    runMode = enableLuma?(PQ_CACL_LUMA|PQ_NORMAL):PQ_NORMAL;
                     showPqFrame = true;
                 }
             } else if (((mPqMode & PQ_LF_RANGE) == PQ_LF_RANGE && mPixelFormat == V4L2_PIX_FMT_BGR24)) {
-                mRkpq->dopq(mPqBufferHandle[mPqBuffOutIndex].srcHandle->data[0],
-                    mPqBufferHandle[mPqBuffOutIndex].outHandle->data[0], enableLuma?(PQ_CACL_LUMA|PQ_LF_RANGE):PQ_LF_RANGE);
+                runMode = enableLuma?(PQ_CACL_LUMA|PQ_LF_RANGE):PQ_LF_RANGE;
                 showPqFrame = true;
             } else if (enableLuma) {
-                mRkpq->dopq(mPqBufferHandle[mPqBuffOutIndex].srcHandle->data[0],
-                    mPqBufferHandle[mPqBuffOutIndex].outHandle->data[0], PQ_CACL_LUMA);
-            }
-            if (mState != START) {
-                return NO_ERROR;
-            }
-            if (showPqFrame && !mPqIniting) {
-                mSidebandWindow->show(mPqBufferHandle[mPqBuffOutIndex].outHandle, mDisplayRatio, mHdmiInType);
-            } else if(mDebugLevel == 3) {
-                ALOGE("pq mSidebandWindow no show, because showPqFrame false");
-            }
-            mPqBufferHandle[mPqBuffOutIndex].isFilled = false;
-            mPqBuffOutIndex++;
-            if (mPqBuffOutIndex == SIDEBAND_PQ_BUFF_CNT) {
-                mPqBuffOutIndex = 0;
+                runMode = PQ_CACL_LUMA;
             }
         }
+        if (claimed >= 0) {
+            mStagesInFlight++;
+        }
     }
     }
-    usleep(500);
+    if (claimed < 0) {
+        // more filled buffers may be queued behind the one just done
+        mPqSignal.wait(ms2ns(PQ_IDLE_TIMEOUT_MS));
+        return NO_ERROR;
+    }
+
+    if (runMode != PQ_OFF) {
+        doPq(srcFd, dstFd, runMode);
+    }
+
+    vt_buffer_t *showBuffer = nullptr;
+    {
+    Mutex::Autolock autoLock(mBufferLock);
+    // stop()/reconfigure() reset the rings, the frame is just dropped
+    if (mState != START) {
+        mStagesInFlight--;
+        mStagesIdleCond.broadcast();
+        return NO_ERROR;
+    }
+    if (vtunnel && lumaOnly) {
+        mPqBufferHandle[claimed].isFilled = false;
+        mPqBuffOutIndex++;
+        if (mPqBuffOutIndex == mPqBufferCount) {
+            mPqBuffOutIndex = 0;
+        }
+    } else if (vtunnel) {
+        qBuf(mPqBufferHandle[claimed].src_vt_fd, true);
+        mPqPrepareList.pop_front();
+        mPqDoneList.push_back(claimed);
+        if (!mUseIep) {
+            showBuffer = mPqBufferHandle[claimed].out_vt_buffer;
+        } else {
+            mIepSignal.signal();
+        }
+    } else {
+        if (iepIndex >= 0) {
+             mIepBufferHandle[iepIndex].isFilled = true;
+             mIepSignal.signal();
+             mIepBuffIndex++;
+             if (mIepBuffIndex == mIepBufferCount) {
+                 mIepBuffIndex = 0;
+             }
+        }
+        if (showPqFrame && !mPqIniting) {
+            showStageFrame(mPqBufferHandle[claimed].outHandle, mDisplayRatio);
+        } else if(mDebugLevel == 3) {
+            ALOGE("pq mSidebandWindow no show, because showPqFrame false");
+        }
+        mPqBufferHandle[claimed].isFilled = false;
+        mPqBuffOutIndex++;
+        if (mPqBuffOutIndex == mPqBufferCount) {
+            mPqBuffOutIndex = 0;
+        }
+    }
+    }
+    // showVTunnel() waits on the vtunnel dequeue and takes mBufferLock itself
+    if (showBuffer != nullptr) {
+        showVTunnel(showBuffer);
+    }
+    endStageFrame();
 
     return NO_ERROR;
 }
 
 bool HinDevImpl::check_zme(int src_width, int src_height, int* dst_width, int* dst_height) {
-    int pq_enable = property_get_int32(TV_INPUT_PQ_ENABLE, 0);
+    std::shared_ptr<const tvinput::TvInputConfigSnapshot> config = mConfig.get();
+    int pq_enable = config->pqEnable;
     if(!pq_enable) {
         return false;
     }
     *dst_width = src_width;
     *dst_height = src_height;
     uint32_t width = 0, height = 0;
-    char res_prop[PROPERTY_VALUE_MAX];
-    int prop_len = property_get(TV_INPUT_RESOLUTION_MAIN, res_prop, NULL);
-    if(prop_len > 0) {
-        sscanf(res_prop, "%dx%d", &width, &height);
+    if(strlen(config->resolutionMain) > 0) {
+        sscanf(config->resolutionMain, "%dx%d", &width, &height);
     } else {
         mRkpq->getResolutionInfo(&width, &height);
     }
@@ -2561,9 +3374,19 @@ bool HinDevImpl::check_zme(int src_width, int src_height, int* dst_width, int* d
 
 int HinDevImpl::iepBufferThread() {
     //Mutex::Autolock autoLock(mBufferLock); will happend rob wait if mBufferLock
+    bool processed = false;
+    if (mState != START) {
+        // the sideband path runs without mBufferLock, reconfigure() waits
+        // for this before it frees the iep buffers or rkiep
+        markParked(&mIepParked);
+        mIepSignal.wait(ms2ns(PQ_IDLE_TIMEOUT_MS));
+        return NO_ERROR;
+    }
     if (mState == START && mPqMode != PQ_OFF && mUseIep) {
         int iepDilOrder = 0;
         if (mFrameType & TYPE_SIDEBAND_VTUNNEL) {
+            vt_buffer_t *showBuffer = nullptr;
+            {
             Mutex::Autolock autoLock(mBufferLock);
             if (mState == START && !mIepBufferHandle.empty() && !mIepPrepareList.empty()
                     && !mPqDoneList.empty() && mPqDoneList.size() > 2) {
@@ -2577,7 +3400,7 @@ int HinDevImpl::iepBufferThread() {
                         && mPqBufferHandle[pqBufIndex2].isFilled) {
                     DEBUG_PRINT(mDebugLevel, "do iep iep iep");
                     int iepBufIndex = mIepPrepareList[0];
-                    mRkiep->iep2_deinterlace(mPqBufferHandle[pqBufIndex0].out_vt_buffer->handle->data[0],
+                    doIep(mPqBufferHandle[pqBufIndex0].out_vt_buffer->handle->data[0],
                         mPqBufferHandle[pqBufIndex1].out_vt_buffer->handle->data[0],
                         mPqBufferHandle[pqBufIndex2].out_vt_buffer->handle->data[0],
                         mIepBufferHandle[iepBufIndex].out_vt_buffer->handle->data[0],
@@ -2589,23 +3412,32 @@ int HinDevImpl::iepBufferThread() {
                     //deal mPqDoneList and mPqPrepareList
                     mPqBufferHandle[pqBufIndex0].src_vt_fd = -1;
                     mPqBufferHandle[pqBufIndex0].isFilled = false;
-                    mPqDoneList.erase(mPqDoneList.begin());
+                    mPqDoneList.pop_front();
                     mPqPrepareList.push_back(pqBufIndex0);
+                    mPqSlotSignal.signal();
                     //iep show
-                    mIepPrepareList.erase(mIepPrepareList.begin());
+                    mIepPrepareList.pop_front();
                     mIepDoneList.push_back(iepBufIndex);
-                    showVTunnel(mIepBufferHandle[iepBufIndex].out_vt_buffer);
+                    processed = true;
+                    showBuffer = mIepBufferHandle[iepBufIndex].out_vt_buffer;
+                    mStagesInFlight++;
                 }
             }
+            }
+            // showVTunnel() takes mBufferLock for the rings itself
+            if (showBuffer != nullptr) {
+                showVTunnel(showBuffer);
+                endStageFrame();
+            }
         } else if (mFrameType & TYPE_SIDEBAND_WINDOW && !mIepBufferHandle.empty()) {
             int cur = mIepBuffOutIndex;
-            int last1 = (cur + SIDEBAND_IEP_BUFF_CNT -1)%SIDEBAND_IEP_BUFF_CNT;
-            int last2 = (cur + SIDEBAND_IEP_BUFF_CNT -2)%SIDEBAND_IEP_BUFF_CNT;
+            int last1 = (cur + mIepBufferCount -1)%mIepBufferCount;
+            int last2 = (cur + mIepBufferCount -2)%mIepBufferCount;
             //ALOGD("check iep %s  %d %d %d----%d %d %d", __FUNCTION__, last2, last1, cur, mIepBufferHandle[last2].isFilled, mIepBufferHandle[last1].isFilled, mIepBufferHandle[cur].isFilled);
             if (mIepBufferHandle[cur].isFilled && mIepBufferHandle[last1].isFilled && mIepBufferHandle[last2].isFilled) {
                 int curIepOutIndex = mIepBuffOutIndex;
-                int nextIepOutIndex = (mIepBuffOutIndex + SIDEBAND_IEP_BUFF_CNT + 1)%SIDEBAND_IEP_BUFF_CNT;
-                mRkiep->iep2_deinterlace(mIepBufferHandle[cur].srcHandle->data[0], mIepBufferHandle[last1].srcHandle->data[0], mIepBufferHandle[last2].srcHandle->data[0],
+                int nextIepOutIndex = (mIepBuffOutIndex + mIepBufferCount + 1)%mIepBufferCount;
+                doIep(mIepBufferHandle[cur].srcHandle->data[0], mIepBufferHandle[last1].srcHandle->data[0], mIepBufferHandle[last2].srcHandle->data[0],
                     mIepBufferHandle[curIepOutIndex].outHandle->data[0], mIepBufferHandle[nextIepOutIndex].outHandle->data[0], &iepDilOrder);
                 if (mState != START) {
                     if(mDebugLevel == 3) {
@@ -2613,16 +3445,19 @@ int HinDevImpl::iepBufferThread() {
                     }
                     return NO_ERROR;
                 }
-                mSidebandWindow->show(mIepBufferHandle[curIepOutIndex].outHandle, mDisplayRatio, mHdmiInType);
+                showStageFrame(mIepBufferHandle[curIepOutIndex].outHandle, mDisplayRatio);
                 mIepBufferHandle[curIepOutIndex].isFilled = false;
                 mIepBuffOutIndex ++;
-                if (mIepBuffOutIndex == SIDEBAND_IEP_BUFF_CNT) {
+                if (mIepBuffOutIndex == mIepBufferCount) {
                     mIepBuffOutIndex = 0;
                 }
+                processed = true;
             }
         }
     }
-    usleep(1000);
+    if (!processed) {
+        mIepSignal.wait(ms2ns(PQ_IDLE_TIMEOUT_MS));
+    }
 
     return NO_ERROR;
 }
@@ -2631,7 +3466,7 @@ int HinDevImpl::check_interlaced() {
     struct v4l2_dv_timings dv_timings;
     memset(&dv_timings, 0 ,sizeof(struct v4l2_dv_timings));
     ALOGE("check_interlaced mHinDevHandle %d", mHinDevHandle);
-    int err = ioctl(mHinDevHandle, VIDIOC_QUERY_DV_TIMINGS, &dv_timings);
+    int err = captureIoctl(VIDIOC_QUERY_DV_TIMINGS, &dv_timings);
     ALOGE("check_interlaced ioctl error %d", err);
     if (err < 0) {
         return 0;
@@ -2641,8 +3476,21 @@ int HinDevImpl::check_interlaced() {
     }
 }
 
+void HinDevImpl::set_buffer_pool(tvinput::GraphicBufferPool *pool) {
+    mSidebandWindow->setBufferPool(pool);
+}
+
+void HinDevImpl::set_stage_backends(const tvinput::StageBackends &backends) {
+    mStageBackends = backends;
+    mDisplay = backends.display ? backends.display : mSidebandWindow.get();
+}
+
+void HinDevImpl::set_buffer_depths(const tv_buffer_depths_t &depths) {
+    mBufferDepths = depths;
+}
+
 void HinDevImpl::set_interlaced(int interlaced) {
-    int pqEnable = property_get_int32(TV_INPUT_PQ_ENABLE, 0);
+    int pqEnable = mConfig.get()->pqEnable;
     if (pqEnable == 1)  {
         if (interlaced == 1)
             mUseIep = true;
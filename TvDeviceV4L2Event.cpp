@@ -31,7 +31,7 @@ int V4L2DeviceEvent::initialize(int fd){
     subscribeEvent(V4L2_EVENT_SOURCE_CHANGE);
     subscribeEvent(V4L2_EVENT_CTRL);
     subscribeEvent(RK_HDMIRX_V4L2_EVENT_SIGNAL_LOST);
-    mV4L2EventThread = new V4L2EventThread(mFd,callback_);
+    mV4L2EventThread = new V4L2EventThread(mFd,callback_,callbackUser_);
     mV4L2EventThread->v4l2pipe();
     mV4L2EventThread->run("Tif_Ev", android::PRIORITY_DISPLAY);
     return 0;
@@ -40,6 +40,8 @@ void V4L2DeviceEvent::closeEventThread() {
     ALOGW("@%s start", __FUNCTION__);
     if (mV4L2EventThread) {
         mV4L2EventThread->requestExit();
+        // the event loop has no timeout, make sure it is awake to see the exit
+        mV4L2EventThread->closeDevice();
         mV4L2EventThread->join();
         mV4L2EventThread.clear();
     }
@@ -228,9 +230,10 @@ status_t V4L2DeviceEvent::queryControl(v4l2_queryctrl &control)
             control.id,  strerror(errno));
     return UNKNOWN_ERROR;
 }
-V4L2DeviceEvent::V4L2EventThread::V4L2EventThread(int fd,V4L2EventCallBack callback){
+V4L2DeviceEvent::V4L2EventThread::V4L2EventThread(int fd,V4L2EventCallBack callback, void *user){
      mVideoFd = fd;
      mCallback_ = callback;
+     mCallbackUser_ = user;
      mCurformat = new V4L2DeviceEvent::FormartSize(0,0,0);
      mStopThread = false;
 }
@@ -238,14 +241,15 @@ V4L2DeviceEvent::V4L2EventThread::V4L2EventThread(int fd,V4L2EventCallBack callb
 V4L2DeviceEvent::V4L2EventThread::~V4L2EventThread() {
     ALOGW("@%s", __FUNCTION__);
     //closeDevice();
+    mReactor.deinit();
 }
 bool V4L2DeviceEvent::V4L2EventThread::v4l2pipe() {
     ALOGI("@%s", __FUNCTION__);
-    if (pipe(pipefd) < 0) {
-	ALOGE("pipe failed: %s\n", strerror(errno));
+    if (!mReactor.init()) {
+	ALOGE("reactor init failed\n");
 	return false;
     }
-    return true;
+    return mReactor.addFd(mVideoFd, EPOLLPRI);
 }
 void V4L2DeviceEvent::V4L2EventThread::openDevice()
 {
@@ -293,33 +297,27 @@ int V4L2DeviceEvent::V4L2EventThread::getFormat(){
 void V4L2DeviceEvent::V4L2EventThread::closeDevice()
 {
     ALOGI("close device");
-    if (write(pipefd[1], "q", 1) != 1) {}
-    close(pipefd[0]);
-    close(pipefd[1]);
     mStopThread = true;
+    mReactor.wake();
 }
 bool V4L2DeviceEvent::V4L2EventThread::threadLoop() {
     ALOGV("@%s", __FUNCTION__);
-    struct pollfd fds[2];
-    //int retry = 3;
-    //fds.events = POLLIN | POLLRDNORM | POLLOUT | POLLWRNORM | POLLRDBAND | POLLPRI;
-    fds[0].fd = pipefd[0];
-    fds[0].events = POLLIN;
-
-    fds[1].fd = mVideoFd;
-    fds[1].events = POLLPRI;
+    struct epoll_event events[1];
+    bool woken = false;
     struct v4l2_event ev;
     CLEAR(ev);
-    if (poll(fds, 2, 5000) < 0) {
-	ALOGD("%d: poll failed: %s\n", mVideoFd, strerror(errno));
+    // blocks until an event is queued or closeDevice() wakes us
+    int n = mReactor.wait(events, 1, -1, &woken);
+    if (n < 0) {
+	ALOGD("%d: epoll wait failed: %s\n", mVideoFd, strerror(-n));
 	return false;
     }
-    if (fds[0].revents & POLLIN) {
+    if (woken || mStopThread) {
 	ALOGD("%d: quit message received\n", mVideoFd);
 	return false;
     }
-    if (fds[1].revents & POLLPRI) {
-	if (ioctl(fds[1].fd, VIDIOC_DQEVENT, &ev) == 0) {
+    if (n > 0 && (events[0].events & EPOLLPRI)) {
+	if (ioctl(mVideoFd, VIDIOC_DQEVENT, &ev) == 0) {
 		switch (ev.type) {
 		case V4L2_EVENT_SOURCE_CHANGE:
 			ALOGD("%d: V4L2_EVENT_SOURCE_CHANGE event\n", mVideoFd);
@@ -338,7 +336,7 @@ bool V4L2DeviceEvent::V4L2EventThread::threadLoop() {
 			break;
 		}
 		if(mCallback_ != NULL)
-                  mCallback_(ev.type);
+                  mCallback_(mCallbackUser_, ev.type);
 	} else {
 		ALOGD("%d: VIDIOC_DQEVENT failed: %s\n",mVideoFd, strerror(errno));
 	}
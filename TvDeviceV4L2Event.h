@@ -17,6 +17,7 @@
 #include <sstream>
 #include <vector>
 #include "common/rk_hdmirx_config.h"
+#include "common/EpollReactor.h"
 
 using namespace std;
 using android::status_t;
@@ -25,8 +26,9 @@ using ::android::sp;
 #define CLEAR_N(x, n) memset (&(x), 0, sizeof(x) * n)
 
 
+// user is the pointer given to RegisterEventvCallBack()
 using V4L2EventCallBack =
-    add_pointer<void(int event_type)>::type;
+    add_pointer<void(void *user, int event_type)>::type;
 //typedef void (*V4L2EventCallBack)(int width, int height,int isHdmiIn);
 class V4L2DeviceEvent : public virtual android::RefBase{
 public:
@@ -44,8 +46,8 @@ public:
     virtual int unsubscribeEvent(int event);
     virtual int dequeueEvent(struct v4l2_event *event);
     virtual void closePipe();
-    void RegisterEventvCallBack(V4L2EventCallBack cb) { callback_ = cb; }
-    void UnRegisterEventCallBack() { callback_ = nullptr; }
+    void RegisterEventvCallBack(V4L2EventCallBack cb, void *user) { callback_ = cb; callbackUser_ = user; }
+    void UnRegisterEventCallBack() { callback_ = nullptr; callbackUser_ = nullptr; }
 
     bool isOpen() { return mFd != -1; }
     int getFd() { return mFd; }
@@ -69,7 +71,7 @@ public:
     };
     class V4L2EventThread : public android::Thread {
         public:
-            V4L2EventThread(int fd,V4L2EventCallBack callback);
+            V4L2EventThread(int fd,V4L2EventCallBack callback, void *user);
             ~V4L2EventThread();
             virtual bool v4l2pipe();
             virtual void openDevice();
@@ -78,13 +80,15 @@ public:
         private :
             int mVideoFd;
             bool mStopThread = false;
-            int pipefd[2] = {-1, -1};
+            android::tvinput::EpollReactor mReactor;
             V4L2EventCallBack mCallback_;
+            void *mCallbackUser_;
             sp<V4L2DeviceEvent::FormartSize> mCurformat;
     };
 protected:
     int mFd;       /*!< file descriptor obtained when device is open */
     sp<V4L2EventThread> mV4L2EventThread;
     V4L2EventCallBack callback_;
+    void *callbackUser_ = nullptr;
 };
 #endif // _CAMERA3_HAL_V4L2DEVICE_H_
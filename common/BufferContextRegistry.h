@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#ifndef _TVINPUT_HAL_BUFFER_CONTEXT_REGISTRY_H_
+#define _TVINPUT_HAL_BUFFER_CONTEXT_REGISTRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+#include <cutils/native_handle.h>
+#include <utils/RWLock.h>
+
+#include "TvInput_Buffer_Manager.h"
+
+namespace common {
+
+// gralloc4 metadata decoded once per buffer, the Get*() queries are
+// answered from here instead of IMapper::get() on every call.
+struct BufferMetadata {
+    static constexpr size_t kMaxPlanes = 4;
+
+    uint64_t width;
+    uint64_t height;
+    // as allocated, width/height may be set smaller by SetContentSize()
+    uint64_t alloc_width;
+    uint64_t alloc_height;
+    int hal_format;
+    uint64_t allocation_size;
+    uint64_t buffer_id;
+    int fd;
+    // entries of PlaneLayouts, may differ from GetNumPlanes()
+    size_t layout_count;
+    int64_t plane_stride[kMaxPlanes];
+    int64_t plane_size[kMaxPlanes];
+};
+
+struct BufferContext {
+    uint64_t buffer_id;
+    BufferType type;
+    // Register() references, 0 for buffers only known through CacheMetadata()
+    uint64_t usage;
+    bool has_metadata;
+    BufferMetadata metadata;
+};
+
+typedef std::unordered_map<buffer_handle_t,
+        std::unique_ptr<struct BufferContext>>
+        BufferContextCache;
+
+// The contexts are queried on every frame from the capture, PQ/IEP and
+// encoder threads and the binder threads, while buffers come and go only
+// when streams are set up. Handles are spread over shards with a
+// reader/writer lock each: lookups share the lock and only wait for a
+// writer on the same shard, which never calls into the mapper while
+// holding it.
+class BufferContextRegistry {
+public:
+    BufferContextRegistry() {}
+
+    // Copies the context of |buffer| to |out|, false if it is unknown.
+    bool Find(buffer_handle_t buffer, BufferContext* out) const {
+        const Shard& shard = ShardOf(buffer);
+        android::RWLock::AutoRLock lock(shard.lock);
+        auto context_it = shard.contexts.find(buffer);
+        if (context_it == shard.contexts.end()) {
+            return false;
+        }
+        *out = *context_it->second;
+        return true;
+    }
+
+    // Runs |fn| on the map holding |buffer| under its write lock, for the
+    // read-modify-write updates.
+    template <typename Fn>
+    auto Edit(buffer_handle_t buffer, Fn fn) -> decltype(fn(std::declval<BufferContextCache&>())) {
+        Shard& shard = ShardOf(buffer);
+        android::RWLock::AutoWLock lock(shard.lock);
+        return fn(shard.contexts);
+    }
+
+    void Insert(buffer_handle_t buffer, std::unique_ptr<BufferContext> context) {
+        Edit(buffer, [&](BufferContextCache& contexts) {
+            contexts[buffer] = std::move(context);
+        });
+    }
+
+private:
+    BufferContextRegistry(const BufferContextRegistry&);
+    BufferContextRegistry& operator=(const BufferContextRegistry&);
+
+    static constexpr size_t kShards = 16;
+
+    struct Shard {
+        mutable android::RWLock lock;
+        BufferContextCache contexts;
+    };
+
+    Shard& ShardOf(buffer_handle_t buffer) {
+        return shards_[Index(buffer)];
+    }
+    const Shard& ShardOf(buffer_handle_t buffer) const {
+        return shards_[Index(buffer)];
+    }
+    static size_t Index(buffer_handle_t buffer) {
+        // native handles come from malloc, the low bits carry no entropy
+        uintptr_t key = reinterpret_cast<uintptr_t>(buffer) >> 4;
+        return (key ^ (key >> 7)) % kShards;
+    }
+
+    Shard shards_[kShards];
+};
+
+}  // namespace common
+
+#endif  // _TVINPUT_HAL_BUFFER_CONTEXT_REGISTRY_H_
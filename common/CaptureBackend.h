@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#ifndef _TVINPUT_HAL_CAPTURE_BACKEND_H_
+#define _TVINPUT_HAL_CAPTURE_BACKEND_H_
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+namespace android {
+namespace tvinput {
+
+/*
+ * Source of captured frames behind the v4l2 capture node. HinDevImpl
+ * only talks to it through v4l2 ioctls and polls fd() for EPOLLIN, so
+ * the real driver and a replay source are interchangeable.
+ */
+class CaptureBackend {
+ public:
+    virtual ~CaptureBackend() {}
+
+    // pollable fd, readable when a buffer can be dequeued
+    virtual int fd() const = 0;
+    // same contract as ioctl(2): <0 with errno set on failure
+    virtual int ioctl(unsigned long request, void *arg) = 0;
+    virtual bool isReplay() const { return false; }
+};
+
+// the rk_hdmirx / rkcif video node, takes ownership of fd
+class V4L2CaptureBackend : public CaptureBackend {
+ public:
+    explicit V4L2CaptureBackend(int fd) : mFd(fd) {}
+    ~V4L2CaptureBackend() override {
+        if (mFd >= 0) {
+            close(mFd);
+        }
+    }
+
+    int fd() const override { return mFd; }
+    int ioctl(unsigned long request, void *arg) override {
+        return ::ioctl(mFd, request, arg);
+    }
+
+ private:
+    V4L2CaptureBackend(const V4L2CaptureBackend& other);
+    V4L2CaptureBackend& operator=(const V4L2CaptureBackend& other);
+
+    int mFd;
+};
+
+}  // namespace tvinput
+}  // namespace android
+
+#endif  // _TVINPUT_HAL_CAPTURE_BACKEND_H_
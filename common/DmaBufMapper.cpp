@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "tv_input_DmaBufMapper"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <utils/Log.h>
+
+#include "DmaBufMapper.h"
+
+// rockchip kernels, syncs [offset, offset + len) only
+#ifndef DMA_BUF_IOCTL_SYNC_PARTIAL
+struct dma_buf_sync_partial {
+    __u64 flags;
+    __u32 offset;
+    __u32 len;
+};
+#define DMA_BUF_IOCTL_SYNC_PARTIAL _IOW(DMA_BUF_BASE, 2, struct dma_buf_sync_partial)
+#endif
+
+namespace android {
+namespace tvinput {
+
+DmaBufMapper::DmaBufMapper()
+    : mPartialSync(true) {
+}
+
+DmaBufMapper::~DmaBufMapper() {
+    clear();
+}
+
+DmaBufMapper::Mapping::~Mapping() {
+    munmap(base, size);
+    close(fd);
+}
+
+DmaBufMapper::Access::Access(DmaBufMapper &mapper, buffer_handle_t handle, uint64_t access,
+        size_t offset, size_t length)
+    : mMapper(mapper), mMapping(mapper.acquire(handle)), mAccess(access),
+      mOffset(offset), mLength(length) {
+    if (mMapping) {
+        mMapper.sync(*mMapping, DMA_BUF_SYNC_START | mAccess, mOffset, mLength);
+    }
+}
+
+DmaBufMapper::Access::~Access() {
+    if (mMapping) {
+        mMapper.sync(*mMapping, DMA_BUF_SYNC_END | mAccess, mOffset, mLength);
+    }
+}
+
+uint8_t *DmaBufMapper::Access::data() const {
+    return mMapping ? mMapping->base : NULL;
+}
+
+size_t DmaBufMapper::Access::size() const {
+    return mMapping ? mMapping->size : 0;
+}
+
+void DmaBufMapper::forget(buffer_handle_t handle) {
+    std::shared_ptr<Mapping> mapping;
+    {
+        Mutex::Autolock autoLock(mLock);
+        auto it = mMappings.find(handle);
+        if (it == mMappings.end()) {
+            return;
+        }
+        mapping.swap(it->second);
+        mMappings.erase(it);
+    }
+    // munmap outside the lock, or later by the last Access
+}
+
+void DmaBufMapper::clear() {
+    std::unordered_map<buffer_handle_t, std::shared_ptr<Mapping>> mappings;
+    {
+        Mutex::Autolock autoLock(mLock);
+        mappings.swap(mMappings);
+    }
+}
+
+size_t DmaBufMapper::count() {
+    Mutex::Autolock autoLock(mLock);
+    return mMappings.size();
+}
+
+std::shared_ptr<DmaBufMapper::Mapping> DmaBufMapper::acquire(buffer_handle_t handle) {
+    if (!handle || handle->numFds < 1) {
+        return nullptr;
+    }
+    int handleFd = handle->data[0];
+    struct stat st;
+    if (fstat(handleFd, &st) != 0) {
+        ALOGE("%s fstat fd=%d failed: %s", __FUNCTION__, handleFd, strerror(errno));
+        return nullptr;
+    }
+
+    std::shared_ptr<Mapping> stale;
+    Mutex::Autolock autoLock(mLock);
+    auto it = mMappings.find(handle);
+    if (it != mMappings.end()) {
+        // the inode tells a recycled handle address from the buffer we mapped
+        if (it->second->inode == st.st_ino) {
+            return it->second;
+        }
+        stale.swap(it->second);
+        mMappings.erase(it);
+    }
+
+    int fd = fcntl(handleFd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        ALOGE("%s dup fd=%d failed: %s", __FUNCTION__, handleFd, strerror(errno));
+        return nullptr;
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    lseek(fd, 0, SEEK_SET);
+    if (size <= 0) {
+        ALOGE("%s fd=%d has no size", __FUNCTION__, handleFd);
+        close(fd);
+        return nullptr;
+    }
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        ALOGE("%s mmap fd=%d size=%lld failed: %s", __FUNCTION__, handleFd, (long long)size,
+            strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+    std::shared_ptr<Mapping> mapping =
+        std::make_shared<Mapping>(fd, st.st_ino, (uint8_t *)base, (size_t)size);
+    ALOGV("%s handle=%p fd=%d size=%zu", __FUNCTION__, handle, handleFd, mapping->size);
+    mMappings[handle] = mapping;
+    return mapping;
+}
+
+void DmaBufMapper::sync(const Mapping &mapping, uint64_t flags, size_t offset, size_t length) {
+    if (length == 0 || offset + length > mapping.size) {
+        offset = 0;
+        length = mapping.size;
+    }
+    if (length < mapping.size && mPartialSync.load(std::memory_order_relaxed)) {
+        struct dma_buf_sync_partial partial;
+        partial.flags = flags;
+        partial.offset = offset;
+        partial.len = length;
+        if (ioctl(mapping.fd, DMA_BUF_IOCTL_SYNC_PARTIAL, &partial) == 0) {
+            return;
+        }
+        if (errno == ENOTTY || errno == EINVAL) {
+            ALOGI("%s no ranged sync (%s), syncing whole buffers", __FUNCTION__, strerror(errno));
+            mPartialSync = false;
+        }
+    }
+    struct dma_buf_sync full;
+    full.flags = flags;
+    if (ioctl(mapping.fd, DMA_BUF_IOCTL_SYNC, &full) != 0) {
+        ALOGV("%s fd=%d flags=0x%llx failed: %s", __FUNCTION__, mapping.fd,
+            (unsigned long long)flags, strerror(errno));
+    }
+}
+
+}  // namespace tvinput
+}  // namespace android
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#ifndef _TVINPUT_HAL_DMABUF_MAPPER_H_
+#define _TVINPUT_HAL_DMABUF_MAPPER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <linux/dma-buf.h>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <cutils/native_handle.h>
+#include <utils/Mutex.h>
+
+namespace android {
+namespace tvinput {
+
+/*
+ * CPU mappings of pipeline buffers kept for the stream lifetime instead
+ * of a gralloc lock/unlock per frame. The dmabuf of data[0] is mapped on
+ * first use, each access is bracketed by DMA_BUF_IOCTL_SYNC limited to
+ * the bytes touched where the kernel allows it.
+ *
+ * A mapping holds its own dup of the dmabuf fd. forget()/clear() only drop
+ * the mapper's reference, an Access still in flight keeps the mapping (and
+ * the fd) until it ends, so a buffer can be freed from another thread.
+ */
+class DmaBufMapper {
+ private:
+    struct Mapping;
+
+ public:
+    DmaBufMapper();
+    ~DmaBufMapper();
+
+    void forget(buffer_handle_t handle);
+    void clear();
+    // live mappings, for tests and dumps
+    size_t count();
+
+    // Maps |handle| if needed and syncs for cpu access in the constructor,
+    // ends the access in the destructor. access is DMA_BUF_SYNC_READ/WRITE/RW,
+    // length 0 means to the end of the buffer. data() is the start of the
+    // buffer, not of the range, NULL if the buffer cannot be mapped.
+    class Access {
+     public:
+        Access(DmaBufMapper &mapper, buffer_handle_t handle, uint64_t access,
+               size_t offset = 0, size_t length = 0);
+        ~Access();
+        uint8_t *data() const;
+        size_t size() const;
+
+     private:
+        Access(const Access& other);
+        Access& operator=(const Access& other);
+
+        DmaBufMapper &mMapper;
+        std::shared_ptr<Mapping> mMapping;
+        uint64_t mAccess;
+        size_t mOffset;
+        size_t mLength;
+    };
+
+ private:
+    DmaBufMapper(const DmaBufMapper& other);
+    DmaBufMapper& operator=(const DmaBufMapper& other);
+
+    // unmapped and closed when the last reference goes
+    struct Mapping {
+        Mapping(int fd, ino_t inode, uint8_t *base, size_t size)
+            : fd(fd), inode(inode), base(base), size(size) {}
+        ~Mapping();
+
+        int fd;
+        ino_t inode;
+        uint8_t *base;
+        size_t size;
+    };
+
+    std::shared_ptr<Mapping> acquire(buffer_handle_t handle);
+    // called without mLock, SYNC_START may wait for the device fences
+    void sync(const Mapping &mapping, uint64_t flags, size_t offset, size_t length);
+
+    Mutex mLock;
+    std::unordered_map<buffer_handle_t, std::shared_ptr<Mapping>> mMappings;
+    // cleared once the kernel rejects the ranged sync
+    std::atomic<bool> mPartialSync;
+};
+
+}  // namespace tvinput
+}  // namespace android
+
+#endif  // _TVINPUT_HAL_DMABUF_MAPPER_H_
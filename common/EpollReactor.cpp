@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#define LOG_TAG "tv_input_Reactor"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <utils/Log.h>
+
+#include "EpollReactor.h"
+
+namespace android {
+namespace tvinput {
+
+EpollReactor::EpollReactor()
+    : mEpollFd(-1),
+      mWakeFd(-1) {
+}
+
+EpollReactor::~EpollReactor() {
+    deinit();
+}
+
+bool EpollReactor::init() {
+    if (mEpollFd >= 0) {
+        return true;
+    }
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (mEpollFd < 0) {
+        ALOGE("%s epoll_create1 failed: %s", __FUNCTION__, strerror(errno));
+        return false;
+    }
+    mWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (mWakeFd < 0) {
+        ALOGE("%s eventfd failed: %s", __FUNCTION__, strerror(errno));
+        deinit();
+        return false;
+    }
+    if (!addFd(mWakeFd, EPOLLIN)) {
+        deinit();
+        return false;
+    }
+    return true;
+}
+
+void EpollReactor::deinit() {
+    if (mWakeFd >= 0) {
+        close(mWakeFd);
+        mWakeFd = -1;
+    }
+    if (mEpollFd >= 0) {
+        close(mEpollFd);
+        mEpollFd = -1;
+    }
+}
+
+bool EpollReactor::addFd(int fd, uint32_t events) {
+    if (mEpollFd < 0 || fd < 0) {
+        return false;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        if (errno == EEXIST) {
+            return epoll_ctl(mEpollFd, EPOLL_CTL_MOD, fd, &ev) == 0;
+        }
+        ALOGE("%s fd=%d failed: %s", __FUNCTION__, fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool EpollReactor::removeFd(int fd) {
+    if (mEpollFd < 0 || fd < 0) {
+        return false;
+    }
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+        ALOGV("%s fd=%d failed: %s", __FUNCTION__, fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+int EpollReactor::wait(struct epoll_event *events, int maxEvents, int timeoutMs, bool *woken) {
+    if (woken) {
+        *woken = false;
+    }
+    if (mEpollFd < 0) {
+        return -EINVAL;
+    }
+    int n = epoll_wait(mEpollFd, events, maxEvents, timeoutMs);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -errno;
+    }
+    int ready = 0;
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.fd == mWakeFd) {
+            drainWake();
+            if (woken) {
+                *woken = true;
+            }
+            continue;
+        }
+        events[ready++] = events[i];
+    }
+    return ready;
+}
+
+bool EpollReactor::waitForWake(int timeoutMs) {
+    if (mWakeFd < 0) {
+        return false;
+    }
+    struct pollfd pfd;
+    pfd.fd = mWakeFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, timeoutMs) > 0 && (pfd.revents & POLLIN)) {
+        drainWake();
+        return true;
+    }
+    return false;
+}
+
+void EpollReactor::wake() {
+    if (mWakeFd < 0) {
+        return;
+    }
+    uint64_t value = 1;
+    if (write(mWakeFd, &value, sizeof(value)) != sizeof(value)) {
+        ALOGW("%s failed: %s", __FUNCTION__, strerror(errno));
+    }
+}
+
+void EpollReactor::drainWake() {
+    uint64_t value = 0;
+    while (read(mWakeFd, &value, sizeof(value)) == sizeof(value)) {
+    }
+}
+
+}  // namespace tvinput
+}  // namespace android
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#ifndef _TVINPUT_HAL_EPOLL_REACTOR_H_
+#define _TVINPUT_HAL_EPOLL_REACTOR_H_
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+namespace android {
+namespace tvinput {
+
+/*
+ * epoll set plus an eventfd used to wake the waiting thread, e.g. on
+ * stop or reconfigure. Owned and waited on by a single thread, wake()
+ * may be called from any thread.
+ */
+class EpollReactor {
+ public:
+    EpollReactor();
+    ~EpollReactor();
+
+    bool init();
+    void deinit();
+    bool isValid() { return mEpollFd >= 0; }
+
+    bool addFd(int fd, uint32_t events);
+    bool removeFd(int fd);
+
+    // returns the number of ready fds in events, the wake eventfd is not
+    // reported there but through woken. 0 on timeout or wake, <0 on error
+    int wait(struct epoll_event *events, int maxEvents, int timeoutMs, bool *woken);
+    // waits on the wake eventfd only, true if woken before timeout
+    bool waitForWake(int timeoutMs);
+    void wake();
+
+ private:
+    EpollReactor(const EpollReactor& other);
+    EpollReactor& operator=(const EpollReactor& other);
+    void drainWake();
+
+    int mEpollFd;
+    int mWakeFd;
+};
+
+}  // namespace tvinput
+}  // namespace android
+
+#endif  // _TVINPUT_HAL_EPOLL_REACTOR_H_
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "tv_input_FrameDumper"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include <linux/dma-buf.h>
+#include <utils/Log.h>
+
+#include "FrameDumper.h"
+
+namespace android {
+namespace tvinput {
+
+namespace {
+
+constexpr char kDumpPrefix[] = "tv_input_dump_";
+constexpr int kDumpPrefixLen = sizeof(kDumpPrefix) - 1;
+
+}  // namespace
+
+FrameDumper::FrameDumper()
+    : mActive(false),
+      mEnding(false),
+      mFile(-1),
+      mFrameSize(0),
+      mSubmitted(0),
+      mSessionDropped(0),
+      mCopying(0),
+      mDataOffset(0),
+      mDropped(0),
+      mWritten(0) {
+    mPath[0] = '\0';
+    memset(&mHeader, 0, sizeof(mHeader));
+    memset(mSlots, 0, sizeof(mSlots));
+}
+
+FrameDumper::~FrameDumper() {
+    stop();
+}
+
+bool FrameDumper::begin(const char *dir, int width, int height, uint32_t format,
+                        size_t frameSize, int maxFrames) {
+    Mutex::Autolock autoLock(mLock);
+    // the previous session may still be flushing, caller retries next frame
+    if (mActive || frameSize == 0 || maxFrames <= 0) {
+        return false;
+    }
+    mThread.clear();
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        mSlots[i].data = (uint8_t *)malloc(frameSize);
+        if (!mSlots[i].data) {
+            ALOGE("%s alloc %zu bytes failed", __FUNCTION__, frameSize);
+            releaseSlots();
+            return false;
+        }
+        mFree.push_back(i);
+    }
+    snprintf(mPath, sizeof(mPath), "%s/%s%dx%d_%lld.bin",
+        dir, kDumpPrefix, width, height, (long long)ns2ms(systemTime()));
+    memset(&mHeader, 0, sizeof(mHeader));
+    mHeader.magic = FRAME_DUMP_MAGIC;
+    mHeader.version = FRAME_DUMP_VERSION;
+    mHeader.width = width;
+    mHeader.height = height;
+    mHeader.format = format;
+    mHeader.maxFrames = maxFrames;
+    mFrameSize = frameSize;
+    mDataOffset = sizeof(FrameDumpHeader) + (uint64_t)maxFrames * sizeof(FrameDumpIndex);
+    mSubmitted = 0;
+    mSessionDropped = 0;
+    mEnding = false;
+    mThread = new WriterThread(this);
+    if (mThread->run("FrameDumper", PRIORITY_BACKGROUND) != NO_ERROR) {
+        ALOGE("%s start writer failed", __FUNCTION__);
+        mThread.clear();
+        releaseSlots();
+        return false;
+    }
+    mActive = true;
+    ALOGD("%s %s %d frames of %zu bytes", __FUNCTION__, mPath, maxFrames, frameSize);
+    return true;
+}
+
+bool FrameDumper::submit(int fd, size_t size, uint32_t sequence, nsecs_t timestamp) {
+    int slot;
+    {
+        Mutex::Autolock autoLock(mLock);
+        if (!mActive || mEnding) {
+            return false;
+        }
+        if (++mSubmitted >= mHeader.maxFrames) {
+            mEnding = true;
+            mCond.signal();
+        }
+        if (mFree.empty()) {
+            mSessionDropped++;
+            mDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slot = mFree.front();
+        mFree.pop_front();
+        mCopying++;
+    }
+
+    // the slot belongs to us until queued, copy without the lock
+    Slot &s = mSlots[slot];
+    s.size = size < mFrameSize ? size : mFrameSize;
+    s.sequence = sequence;
+    s.timestamp = timestamp;
+    bool copied = copyFrame(fd, s.size, s.data);
+
+    Mutex::Autolock autoLock(mLock);
+    mCopying--;
+    if (!copied) {
+        mCond.signal();
+        mSessionDropped++;
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        mFree.push_back(slot);
+        return false;
+    }
+    mQueued.push_back(slot);
+    mCond.signal();
+    return true;
+}
+
+void FrameDumper::end() {
+    Mutex::Autolock autoLock(mLock);
+    if (mActive) {
+        mEnding = true;
+        mCond.signal();
+    }
+}
+
+void FrameDumper::stop() {
+    end();
+    sp<WriterThread> thread;
+    {
+        Mutex::Autolock autoLock(mLock);
+        thread = mThread;
+    }
+    if (thread != NULL) {
+        thread->join();
+    }
+}
+
+bool FrameDumper::isActive() const {
+    Mutex::Autolock autoLock(mLock);
+    return mActive;
+}
+
+bool FrameDumper::copyFrame(int fd, size_t size, uint8_t *dst) {
+    void *src = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (src == MAP_FAILED) {
+        ALOGE("%s mmap fd=%d failed: %s", __FUNCTION__, fd, strerror(errno));
+        return false;
+    }
+    struct dma_buf_sync sync;
+    sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+    ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+    memcpy(dst, src, size);
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+    ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+    munmap(src, size);
+    return true;
+}
+
+bool FrameDumper::writeFrame() {
+    if (mFile < 0) {
+        // open here so the capture thread never waits on the filesystem
+        char dir[PATH_MAX];
+        strncpy(dir, mPath, sizeof(dir) - 1);
+        dir[sizeof(dir) - 1] = '\0';
+        char *slash = strrchr(dir, '/');
+        if (slash) {
+            *slash = '\0';
+            mkdir(dir, 0777);
+            pruneFiles(dir);
+        }
+        mFile = open(mPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (mFile < 0) {
+            ALOGE("%s open %s failed: %s", __FUNCTION__, mPath, strerror(errno));
+            finish();
+            return false;
+        }
+    }
+
+    int slot = -1;
+    {
+        Mutex::Autolock autoLock(mLock);
+        while (mQueued.empty() && (!mEnding || mCopying > 0)) {
+            mCond.wait(mLock);
+        }
+        if (!mQueued.empty()) {
+            slot = mQueued.front();
+            mQueued.pop_front();
+        }
+    }
+    if (slot < 0) {
+        finish();
+        return false;
+    }
+
+    Slot &s = mSlots[slot];
+    FrameDumpIndex index;
+    index.offset = mDataOffset;
+    index.size = s.size;
+    index.sequence = s.sequence;
+    index.timestamp = s.timestamp;
+    off_t indexOffset = sizeof(FrameDumpHeader) + (off_t)mHeader.frameCount * sizeof(FrameDumpIndex);
+    if (pwrite(mFile, s.data, s.size, mDataOffset) == (ssize_t)s.size
+            && pwrite(mFile, &index, sizeof(index), indexOffset) == (ssize_t)sizeof(index)) {
+        mDataOffset += s.size;
+        mHeader.frameCount++;
+        mWritten.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        ALOGE("%s write %s failed: %s", __FUNCTION__, mPath, strerror(errno));
+        Mutex::Autolock autoLock(mLock);
+        mSessionDropped++;
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Mutex::Autolock autoLock(mLock);
+    mFree.push_back(slot);
+    return true;
+}
+
+// writer side, closes the session; frames still queued are dropped
+void FrameDumper::finish() {
+    Mutex::Autolock autoLock(mLock);
+    while (mCopying > 0) {
+        mCond.wait(mLock);
+    }
+    mSessionDropped += mQueued.size();
+    mDropped.fetch_add(mQueued.size(), std::memory_order_relaxed);
+    mQueued.clear();
+    if (mFile >= 0) {
+        mHeader.dropped = mSessionDropped;
+        if (pwrite(mFile, &mHeader, sizeof(mHeader), 0) != (ssize_t)sizeof(mHeader)) {
+            ALOGE("%s write header failed: %s", __FUNCTION__, strerror(errno));
+        }
+        close(mFile);
+        mFile = -1;
+        ALOGI("%s %s: %u frames, %u dropped", __FUNCTION__, mPath,
+            mHeader.frameCount, mSessionDropped);
+    }
+    releaseSlots();
+    mEnding = false;
+    mActive = false;
+}
+
+// writer side, leaves room for the session about to be opened
+void FrameDumper::pruneFiles(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        return;
+    }
+    std::vector<std::pair<nsecs_t, std::string>> files;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strncmp(entry->d_name, kDumpPrefix, kDumpPrefixLen)) {
+            continue;
+        }
+        std::string path = std::string(dir) + "/" + entry->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            files.push_back(std::make_pair(
+                (nsecs_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec, path));
+        }
+    }
+    closedir(d);
+    if (files.size() < (size_t)MAX_KEPT_FILES) {
+        return;
+    }
+    std::sort(files.begin(), files.end());
+    size_t excess = files.size() - MAX_KEPT_FILES + 1;
+    for (size_t i = 0; i < excess; i++) {
+        if (unlink(files[i].second.c_str()) == 0) {
+            ALOGD("%s removed %s", __FUNCTION__, files[i].second.c_str());
+        }
+    }
+}
+
+void FrameDumper::releaseSlots() {
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        free(mSlots[i].data);
+        mSlots[i].data = NULL;
+    }
+    mFree.clear();
+}
+
+}  // namespace tvinput
+}  // namespace android
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#ifndef _TVINPUT_HAL_FRAME_DUMPER_H_
+#define _TVINPUT_HAL_FRAME_DUMPER_H_
+
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <deque>
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace tvinput {
+
+#define FRAME_DUMP_MAGIC   0x50444654  // "TFDP"
+#define FRAME_DUMP_VERSION 1
+
+/*
+ * On-disk layout: header, maxFrames index entries, then the frames back
+ * to back. frameCount/dropped in the header are final once the writer
+ * closed the file, unused index entries stay zero.
+ */
+struct FrameDumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;       // v4l2 fourcc
+    uint32_t maxFrames;
+    uint32_t frameCount;
+    uint32_t dropped;
+};
+
+struct FrameDumpIndex {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t sequence;     // v4l2_buffer.sequence
+    int64_t timestamp;     // capture time, ns
+};
+
+/*
+ * Frame dumps off the capture thread. submit() only copies the dmabuf
+ * into a free slot of a ring allocated by begin(), a background thread
+ * writes the slots to a single file. A frame submitted while every slot
+ * is still waiting for the disk is dropped and counted.
+ */
+class FrameDumper {
+ public:
+    FrameDumper();
+    ~FrameDumper();
+
+    // opens <dir>/tv_input_dump_<w>x<h>_<ms>.bin for up to maxFrames frames,
+    // the oldest dumps in dir are removed to keep MAX_KEPT_FILES
+    bool begin(const char *dir, int width, int height, uint32_t format,
+               size_t frameSize, int maxFrames);
+    // snapshots size bytes of the dmabuf, ends the session once maxFrames were taken
+    bool submit(int fd, size_t size, uint32_t sequence, nsecs_t timestamp);
+    // lets the writer flush the queued frames and close the file
+    void end();
+    // end() and wait for the writer
+    void stop();
+
+    bool isActive() const;
+    uint64_t dropped() const { return mDropped.load(std::memory_order_relaxed); }
+    uint64_t written() const { return mWritten.load(std::memory_order_relaxed); }
+
+    static const int SLOT_COUNT = 4;
+    static const int MAX_KEPT_FILES = 8;
+
+ private:
+    FrameDumper(const FrameDumper& other);
+    FrameDumper& operator=(const FrameDumper& other);
+
+    class WriterThread : public Thread {
+     public:
+        explicit WriterThread(FrameDumper *dumper)
+            : Thread(false), mDumper(dumper) {}
+        bool threadLoop() override { return mDumper->writeFrame(); }
+     private:
+        FrameDumper *mDumper;
+    };
+
+    struct Slot {
+        uint8_t *data;
+        size_t size;
+        uint32_t sequence;
+        nsecs_t timestamp;
+    };
+
+    bool writeFrame();
+    void finish();
+    void releaseSlots();
+    bool copyFrame(int fd, size_t size, uint8_t *dst);
+    void pruneFiles(const char *dir);
+
+    mutable Mutex mLock;
+    Condition mCond;
+    bool mActive;
+    bool mEnding;
+    int mFile;
+    char mPath[PATH_MAX];
+    FrameDumpHeader mHeader;
+    size_t mFrameSize;
+    uint32_t mSubmitted;
+    uint32_t mSessionDropped;
+    int mCopying;
+    uint64_t mDataOffset;
+    Slot mSlots[SLOT_COUNT];
+    std::deque<int> mFree;
+    std::deque<int> mQueued;
+    sp<WriterThread> mThread;
+
+    std::atomic<uint64_t> mDropped;
+    std::atomic<uint64_t> mWritten;
+};
+
+}  // namespace tvinput
+}  // namespace android
+
+#endif  // _TVINPUT_HAL_FRAME_DUMPER_H_
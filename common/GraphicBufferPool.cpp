@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "tv_input_BufferPool"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <tuple>
+#include <ui/GraphicBufferAllocator.h>
+#include <utils/Log.h>
+
+#include "GraphicBufferPool.h"
+
+namespace android {
+namespace tvinput {
+
+namespace {
+
+const char kMemoryPressurePath[] = "/proc/pressure/memory";
+// 100ms of partial stall within 1s, the level lmkd starts to act on
+const char kMemoryPressureTrigger[] = "some 100000 1000000";
+// a buffer unused this long is not part of an input/pq switch any more
+constexpr nsecs_t POOL_IDLE_TIME = s2ns(30);
+constexpr int POOL_CHECK_INTERVAL_MS = 5000;
+
+}  // namespace
+
+bool GraphicBufferPool::Key::operator<(const Key &other) const {
+    return std::tie(width, height, format, usage)
+        < std::tie(other.width, other.height, other.format, other.usage);
+}
+
+GraphicBufferPool::GraphicBufferPool(size_t highWaterBytes)
+    : mHighWaterBytes(highWaterBytes),
+      mCachedBytes(0),
+      mHits(0),
+      mMisses(0),
+      mPressureFd(-1) {
+    if (mHighWaterBytes == 0 || !mReactor.init()) {
+        return;
+    }
+    openPressureMonitor();
+    mThread = new TrimThread(this);
+    if (mThread->run("tvinput bufpool", PRIORITY_BACKGROUND) != NO_ERROR) {
+        ALOGE("%s start trim thread failed", __FUNCTION__);
+        mThread.clear();
+    }
+}
+
+GraphicBufferPool::~GraphicBufferPool() {
+    if (mThread != NULL) {
+        mThread->requestExit();
+        mReactor.wake();
+        mThread->join();
+        mThread.clear();
+    }
+    if (mPressureFd >= 0) {
+        close(mPressureFd);
+    }
+    Mutex::Autolock autoLock(mLock);
+    ALOGD("%s hits=%" PRIu64 " misses=%" PRIu64 " cached=%zu outstanding=%zu", __FUNCTION__,
+        mHits, mMisses, mCachedBytes, mOutstanding.size());
+    trimLocked(0, 0);
+}
+
+void GraphicBufferPool::openPressureMonitor() {
+    mPressureFd = open(kMemoryPressurePath, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (mPressureFd < 0) {
+        ALOGW("%s no %s, idle trimming only: %s", __FUNCTION__, kMemoryPressurePath, strerror(errno));
+        return;
+    }
+    if (write(mPressureFd, kMemoryPressureTrigger, strlen(kMemoryPressureTrigger) + 1) < 0
+            || !mReactor.addFd(mPressureFd, EPOLLPRI)) {
+        ALOGW("%s psi trigger failed: %s", __FUNCTION__, strerror(errno));
+        close(mPressureFd);
+        mPressureFd = -1;
+    }
+}
+
+status_t GraphicBufferPool::acquire(uint32_t width, uint32_t height, int32_t format,
+        uint64_t usage, const char *requestor, buffer_handle_t *handle) {
+    Key key = {width, height, format, usage};
+    {
+        Mutex::Autolock autoLock(mLock);
+        auto it = mFree.find(key);
+        if (it != mFree.end() && !it->second.empty()) {
+            Entry entry = it->second.back();
+            it->second.pop_back();
+            if (it->second.empty()) {
+                mFree.erase(it);
+            }
+            mCachedBytes -= entry.size;
+            mOutstanding[entry.handle] = {key, entry.size};
+            mHits++;
+            *handle = entry.handle;
+            return NO_ERROR;
+        }
+        mMisses++;
+    }
+
+    GraphicBufferAllocator &allocator = GraphicBufferAllocator::get();
+    buffer_handle_t buffer = NULL;
+    uint32_t stride = 0;
+    status_t err = allocator.allocate(width, height, format, 1, usage, &buffer, &stride, 0,
+        std::string(requestor));
+    if (err != NO_ERROR || !buffer) {
+        // cached buffers of other sizes may be what keeps CMA from fitting this one
+        trim(0);
+        buffer = NULL;
+        err = allocator.allocate(width, height, format, 1, usage, &buffer, &stride, 0,
+            std::string(requestor));
+        if (err != NO_ERROR || !buffer) {
+            ALOGE("%s %ux%u fmt=0x%x usage=0x%" PRIx64 " failed: %d", __FUNCTION__,
+                width, height, format, usage, err);
+            return err != NO_ERROR ? err : NO_MEMORY;
+        }
+    }
+    if (mHighWaterBytes > 0) {
+        Mutex::Autolock autoLock(mLock);
+        mOutstanding[buffer] = {key, bufferSize(buffer)};
+    }
+    *handle = buffer;
+    return NO_ERROR;
+}
+
+void GraphicBufferPool::release(buffer_handle_t handle) {
+    if (!handle) {
+        return;
+    }
+    Mutex::Autolock autoLock(mLock);
+    auto it = mOutstanding.find(handle);
+    if (it == mOutstanding.end()) {
+        freeHandle(handle);
+        return;
+    }
+    Allocation allocation = it->second;
+    mOutstanding.erase(it);
+    if (allocation.size == 0 || allocation.size > mHighWaterBytes) {
+        freeHandle(handle);
+        return;
+    }
+    mFree[allocation.key].push_back({handle, allocation.size, systemTime()});
+    mCachedBytes += allocation.size;
+    if (mCachedBytes > mHighWaterBytes) {
+        trimLocked(mHighWaterBytes, 0);
+    }
+}
+
+void GraphicBufferPool::trim(size_t targetBytes) {
+    Mutex::Autolock autoLock(mLock);
+    trimLocked(targetBytes, 0);
+}
+
+size_t GraphicBufferPool::cachedBytes() {
+    Mutex::Autolock autoLock(mLock);
+    return mCachedBytes;
+}
+
+// olderThan > 0 only frees buffers released before that time
+void GraphicBufferPool::trimLocked(size_t targetBytes, nsecs_t olderThan) {
+    while (mCachedBytes > targetBytes) {
+        auto oldest = mFree.end();
+        size_t oldestIndex = 0;
+        for (auto it = mFree.begin(); it != mFree.end(); ++it) {
+            for (size_t i = 0; i < it->second.size(); i++) {
+                if (oldest == mFree.end()
+                        || it->second[i].releasedAt < oldest->second[oldestIndex].releasedAt) {
+                    oldest = it;
+                    oldestIndex = i;
+                }
+            }
+        }
+        if (oldest == mFree.end()) {
+            break;
+        }
+        Entry entry = oldest->second[oldestIndex];
+        if (olderThan > 0 && entry.releasedAt >= olderThan) {
+            break;
+        }
+        oldest->second.erase(oldest->second.begin() + oldestIndex);
+        if (oldest->second.empty()) {
+            mFree.erase(oldest);
+        }
+        mCachedBytes -= entry.size;
+        freeHandle(entry.handle);
+    }
+}
+
+bool GraphicBufferPool::trimLoop() {
+    struct epoll_event events[1];
+    bool woken = false;
+    int n = mReactor.wait(events, 1, POOL_CHECK_INTERVAL_MS, &woken);
+    if (woken) {
+        // requestExit() from the destructor, Thread checks it on return
+        return true;
+    }
+    Mutex::Autolock autoLock(mLock);
+    if (n > 0 && (events[0].events & EPOLLERR)) {
+        ALOGW("%s psi monitor lost", __FUNCTION__);
+        mReactor.removeFd(mPressureFd);
+        close(mPressureFd);
+        mPressureFd = -1;
+    } else if (n > 0 && (events[0].events & EPOLLPRI)) {
+        if (mCachedBytes > 0) {
+            ALOGW("%s memory pressure, dropping %zu cached bytes", __FUNCTION__, mCachedBytes);
+        }
+        trimLocked(0, 0);
+    } else {
+        trimLocked(0, systemTime() - POOL_IDLE_TIME);
+    }
+    return true;
+}
+
+size_t GraphicBufferPool::bufferSize(buffer_handle_t handle) {
+    if (handle->numFds < 1) {
+        return 0;
+    }
+    // a dmabuf reports its size through lseek
+    off_t size = lseek(handle->data[0], 0, SEEK_END);
+    lseek(handle->data[0], 0, SEEK_SET);
+    return size > 0 ? (size_t)size : 0;
+}
+
+void GraphicBufferPool::freeHandle(buffer_handle_t handle) {
+    GraphicBufferAllocator::get().free(handle);
+}
+
+}  // namespace tvinput
+}  // namespace android
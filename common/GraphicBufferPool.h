@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#ifndef _TVINPUT_HAL_GRAPHIC_BUFFER_POOL_H_
+#define _TVINPUT_HAL_GRAPHIC_BUFFER_POOL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <cutils/native_handle.h>
+#include <utils/Errors.h>
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+
+#include "EpollReactor.h"
+
+namespace android {
+namespace tvinput {
+
+/*
+ * Gralloc buffers kept across stream open/close and pq/iep toggles.
+ * Freed buffers are cached per width/height/format/usage bucket, up to
+ * a high-water mark in bytes, and handed out again by an exact match.
+ * Cached buffers are trimmed when they sat unused for a while or when
+ * the kernel reports memory pressure (PSI), so an idle HAL gives the
+ * CMA back. Owned by the tv_input device, outlives HinDevImpl.
+ */
+class GraphicBufferPool {
+ public:
+    explicit GraphicBufferPool(size_t highWaterBytes);
+    ~GraphicBufferPool();
+
+    status_t acquire(uint32_t width, uint32_t height, int32_t format, uint64_t usage,
+                     const char *requestor, buffer_handle_t *handle);
+    // buffers that did not come from acquire() are freed right away
+    void release(buffer_handle_t handle);
+    // frees the least recently released buffers until targetBytes remain
+    void trim(size_t targetBytes);
+
+    size_t cachedBytes();
+
+ private:
+    GraphicBufferPool(const GraphicBufferPool& other);
+    GraphicBufferPool& operator=(const GraphicBufferPool& other);
+
+    class TrimThread : public Thread {
+     public:
+        explicit TrimThread(GraphicBufferPool *pool) : Thread(false), mPool(pool) {}
+        bool threadLoop() override { return mPool->trimLoop(); }
+     private:
+        GraphicBufferPool *mPool;
+    };
+
+    struct Key {
+        uint32_t width;
+        uint32_t height;
+        int32_t format;
+        uint64_t usage;
+        bool operator<(const Key &other) const;
+    };
+
+    struct Entry {
+        buffer_handle_t handle;
+        size_t size;
+        nsecs_t releasedAt;
+    };
+
+    struct Allocation {
+        Key key;
+        size_t size;
+    };
+
+    bool trimLoop();
+    void trimLocked(size_t targetBytes, nsecs_t olderThan);
+    void openPressureMonitor();
+    static size_t bufferSize(buffer_handle_t handle);
+    static void freeHandle(buffer_handle_t handle);
+
+    Mutex mLock;
+    size_t mHighWaterBytes;
+    size_t mCachedBytes;
+    std::map<Key, std::vector<Entry>> mFree;
+    std::unordered_map<buffer_handle_t, Allocation> mOutstanding;
+    uint64_t mHits;
+    uint64_t mMisses;
+
+    int mPressureFd;
+    EpollReactor mReactor;
+    sp<TrimThread> mThread;
+};
+
+}  // namespace tvinput
+}  // namespace android
+
+#endif  // _TVINPUT_HAL_GRAPHIC_BUFFER_POOL_H_
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#ifndef _TVINPUT_HAL_INDEX_RING_H_
+#define _TVINPUT_HAL_INDEX_RING_H_
+
+#include <vector>
+
+namespace android {
+namespace tvinput {
+
+/*
+ * Fixed capacity FIFO of buffer indices. Storage is sized once, push and
+ * pop never allocate or shift. Not thread safe, callers hold the lock of
+ * the stage graph the ring belongs to.
+ */
+class IndexRing {
+ public:
+    explicit IndexRing(int capacity) { reset(capacity); }
+
+    // drops the content and resizes the storage
+    void reset(int capacity) {
+        mSlots.assign(capacity > 0 ? capacity : 1, -1);
+        mHead = 0;
+        mCount = 0;
+    }
+    void clear() {
+        mHead = 0;
+        mCount = 0;
+    }
+
+    bool empty() const { return mCount == 0; }
+    bool full() const { return mCount == (int)mSlots.size(); }
+    int size() const { return mCount; }
+    int capacity() const { return (int)mSlots.size(); }
+
+    // i-th entry from the front
+    int operator[](int i) const { return mSlots[wrap(mHead + i)]; }
+    int front() const { return mSlots[mHead]; }
+
+    bool push_back(int value) {
+        if (full()) {
+            return false;
+        }
+        mSlots[wrap(mHead + mCount)] = value;
+        mCount++;
+        return true;
+    }
+
+    bool pop_front() {
+        if (empty()) {
+            return false;
+        }
+        mHead = wrap(mHead + 1);
+        mCount--;
+        return true;
+    }
+
+    // removes the first entry equal to value, keeps the order of the rest
+    bool remove(int value) {
+        for (int i = 0; i < mCount; i++) {
+            if ((*this)[i] != value) {
+                continue;
+            }
+            for (int j = i; j > 0; j--) {
+                mSlots[wrap(mHead + j)] = mSlots[wrap(mHead + j - 1)];
+            }
+            return pop_front();
+        }
+        return false;
+    }
+
+ private:
+    int wrap(int pos) const { return pos % (int)mSlots.size(); }
+
+    std::vector<int> mSlots;
+    int mHead;
+    int mCount;
+};
+
+}  // namespace tvinput
+}  // namespace android
+
+#endif  // _TVINPUT_HAL_INDEX_RING_H_
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#define LOG_TAG "tv_input_Stats"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+#include "PipelineStats.h"
+
+namespace android {
+namespace tvinput {
+
+static const char *kStageNames[STAGE_COUNT] = {
+    "capture", "flush_cache", "pq", "iep", "present", "encode",
+};
+
+static const char *kDropNames[DROP_COUNT] = {
+    "driver", "skip_frame", "pq_busy", "record_busy", "display_busy", "dqbuf_error",
+};
+
+// a larger jump is a stream restart, not lost frames
+static const uint32_t MAX_SEQUENCE_GAP = 1 << 16;
+
+int LatencyHistogram::bucketOf(int64_t us) {
+    if (us < LINEAR_BUCKETS) {
+        return us < 0 ? 0 : (int)us;
+    }
+    int octave = 63 - __builtin_clzll((uint64_t)us);
+    int sub = (int)((us >> (octave - 2)) & 3);
+    int bucket = LINEAR_BUCKETS + (octave - 4) * 4 + sub;
+    return bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT - 1;
+}
+
+int64_t LatencyHistogram::bucketUpperUs(int bucket) {
+    if (bucket < LINEAR_BUCKETS) {
+        return bucket;
+    }
+    int octave = (bucket - LINEAR_BUCKETS) / 4 + 4;
+    int sub = (bucket - LINEAR_BUCKETS) % 4;
+    return ((int64_t)(5 + sub) << (octave - 2)) - 1;
+}
+
+void LatencyHistogram::record(nsecs_t duration) {
+    int64_t us = (int64_t)(duration / 1000);
+    if (us < 0) {
+        us = 0;
+    }
+    mBuckets[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    mSumUs.fetch_add((uint64_t)us, std::memory_order_relaxed);
+    int64_t max = mMaxUs.load(std::memory_order_relaxed);
+    while (us > max && !mMaxUs.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset() {
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        mBuckets[i].store(0, std::memory_order_relaxed);
+    }
+    mCount.store(0, std::memory_order_relaxed);
+    mSumUs.store(0, std::memory_order_relaxed);
+    mMaxUs.store(0, std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::avgUs() const {
+    uint64_t count = mCount.load(std::memory_order_relaxed);
+    return count > 0 ? (int64_t)(mSumUs.load(std::memory_order_relaxed) / count) : 0;
+}
+
+int64_t LatencyHistogram::percentileUs(double fraction) const {
+    uint64_t total = 0;
+    uint32_t buckets[BUCKET_COUNT];
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        buckets[i] = mBuckets[i].load(std::memory_order_relaxed);
+        total += buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(fraction * total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            int64_t upper = bucketUpperUs(i);
+            int64_t max = maxUs();
+            return upper < max ? upper : max;
+        }
+    }
+    return maxUs();
+}
+
+void PipelineStats::reset() {
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        mStages[i].reset();
+    }
+    for (int i = 0; i < DROP_COUNT; i++) {
+        mDrops[i].store(0, std::memory_order_relaxed);
+    }
+    mFrames.store(0, std::memory_order_relaxed);
+    mSince.store(systemTime(), std::memory_order_relaxed);
+    mCpuSince.store(systemTime(SYSTEM_TIME_PROCESS), std::memory_order_relaxed);
+    mSequenceReset.store(true, std::memory_order_release);
+}
+
+void PipelineStats::recordStage(int stage, nsecs_t start, nsecs_t end) {
+    if (stage < 0 || stage >= STAGE_COUNT || start <= 0 || end < start) {
+        return;
+    }
+    mStages[stage].record(end - start);
+}
+
+void PipelineStats::recordFrame(nsecs_t now) {
+    mFrames.fetch_add(1, std::memory_order_relaxed);
+    if (mWindowStart == 0) {
+        mWindowStart = now;
+    }
+    mWindowFrames++;
+    nsecs_t elapsed = now - mWindowStart;
+    if (elapsed >= s2ns(1)) {
+        mWindowFpsX100.store((uint32_t)(mWindowFrames * 100 * s2ns(1) / elapsed),
+            std::memory_order_relaxed);
+        mWindowStart = now;
+        mWindowFrames = 0;
+    }
+}
+
+void PipelineStats::recordSequence(uint32_t sequence, nsecs_t timestamp) {
+    if (mSequenceReset.exchange(false, std::memory_order_acquire)) {
+        mHasSequence = false;
+    }
+    if (mHasSequence) {
+        uint32_t gap = sequence - mLastSequence - 1;
+        if (sequence == mLastSequence || gap >= MAX_SEQUENCE_GAP) {
+            // driver restarted its count
+            mHasSequence = false;
+        } else if (gap > 0) {
+            mDrops[DROP_DRIVER].fetch_add(gap, std::memory_order_relaxed);
+        }
+    }
+    if (!mHasSequence) {
+        mHasSequence = true;
+        mFirstSequence = sequence;
+        mFirstTimestamp = timestamp;
+    } else if (timestamp > mFirstTimestamp) {
+        uint64_t frames = (uint64_t)(sequence - mFirstSequence);
+        mInputFpsX100.store((uint32_t)(frames * 100 * s2ns(1) / (timestamp - mFirstTimestamp)),
+            std::memory_order_relaxed);
+    }
+    mLastSequence = sequence;
+}
+
+void PipelineStats::recordDrop(int reason) {
+    if (reason < 0 || reason >= DROP_COUNT) {
+        return;
+    }
+    mDrops[reason].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t PipelineStats::drops(int reason) const {
+    if (reason < 0 || reason >= DROP_COUNT) {
+        return 0;
+    }
+    return mDrops[reason].load(std::memory_order_relaxed);
+}
+
+std::string PipelineStats::toJson() const {
+    char buf[256];
+    nsecs_t elapsed = systemTime() - mSince.load(std::memory_order_relaxed);
+    uint64_t frames = mFrames.load(std::memory_order_relaxed);
+    uint32_t fpsX100 = elapsed > 0 ? (uint32_t)(frames * 100 * s2ns(1) / elapsed) : 0;
+    uint32_t windowFpsX100 = mWindowFpsX100.load(std::memory_order_relaxed);
+    uint32_t inputFpsX100 = mInputFpsX100.load(std::memory_order_relaxed);
+    nsecs_t cpu = systemTime(SYSTEM_TIME_PROCESS) - mCpuSince.load(std::memory_order_relaxed);
+    int64_t cpuUsPerFrame = frames > 0 ? (int64_t)(ns2us(cpu) / (int64_t)frames) : 0;
+    uint32_t cpuLoad = elapsed > 0 ? (uint32_t)(cpu * 100 / elapsed) : 0;
+
+    std::string json;
+    snprintf(buf, sizeof(buf),
+        "{\"elapsed_ms\":%" PRId64 ",\"frames\":%" PRIu64 ",\"fps\":%u.%02u,\"fps_1s\":%u.%02u,"
+        "\"input_fps\":%u.%02u,\"cpu_us_per_frame\":%" PRId64 ",\"cpu_load\":%u,\"drops\":{",
+        (int64_t)ns2ms(elapsed), frames, fpsX100 / 100, fpsX100 % 100,
+        windowFpsX100 / 100, windowFpsX100 % 100, inputFpsX100 / 100, inputFpsX100 % 100,
+        cpuUsPerFrame, cpuLoad);
+    json += buf;
+    for (int i = 0; i < DROP_COUNT; i++) {
+        snprintf(buf, sizeof(buf), "%s\"%s\":%" PRIu64, i > 0 ? "," : "",
+            kDropNames[i], mDrops[i].load(std::memory_order_relaxed));
+        json += buf;
+    }
+    json += "},\"stages\":{";
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const LatencyHistogram &h = mStages[i];
+        snprintf(buf, sizeof(buf),
+            "%s\"%s\":{\"count\":%" PRIu64 ",\"avg_us\":%" PRId64 ",\"p50_us\":%" PRId64
+            ",\"p95_us\":%" PRId64 ",\"p99_us\":%" PRId64 ",\"max_us\":%" PRId64 "}",
+            i > 0 ? "," : "", kStageNames[i], h.count(), h.avgUs(),
+            h.percentileUs(0.50), h.percentileUs(0.95), h.percentileUs(0.99), h.maxUs());
+        json += buf;
+    }
+    json += "}}";
+    return json;
+}
+
+int PipelineStats::dumpJson(const char *path) const {
+    std::string json = toJson();
+    json += "\n";
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        int err = errno;
+        ALOGE("%s open %s failed: %s", __FUNCTION__, path, strerror(err));
+        return -err;
+    }
+    ssize_t written = write(fd, json.c_str(), json.size());
+    close(fd);
+    if (written != (ssize_t)json.size()) {
+        ALOGE("%s write %s failed", __FUNCTION__, path);
+        return -EIO;
+    }
+    return 0;
+}
+
+}  // namespace tvinput
+}  // namespace android
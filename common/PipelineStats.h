@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#ifndef _TVINPUT_HAL_PIPELINE_STATS_H_
+#define _TVINPUT_HAL_PIPELINE_STATS_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <utils/Timers.h>
+
+namespace android {
+namespace tvinput {
+
+enum PipelineStage {
+    STAGE_CAPTURE = 0,    // v4l2 timestamp to VIDIOC_DQBUF returning
+    STAGE_FLUSH_CACHE,
+    STAGE_PQ,             // dopq()
+    STAGE_IEP,            // iep2_deinterlace()
+    STAGE_PRESENT,        // SetDrmPlane/queueBuffer through show()
+    STAGE_ENCODE,         // sendFrame()
+    STAGE_COUNT,
+};
+
+enum PipelineDrop {
+    DROP_DRIVER = 0,      // v4l2_buffer.sequence gap, lost before DQBUF
+    DROP_SKIP_FRAME,      // persist.vendor.tvinput.skipframe
+    DROP_PQ_BUSY,         // pq ring full, frame not processed
+    DROP_RECORD_BUSY,     // record buffer still encoding
+    DROP_DISPLAY_BUSY,    // replaced while waiting for vsync, or pq/iep output on a busy plane
+    DROP_DQBUF_ERROR,
+    DROP_COUNT,
+};
+
+/*
+ * Log-linear latency histogram, 4 buckets per power of two above 16us.
+ * record() is lock free, readers get bucket resolution percentiles.
+ */
+class LatencyHistogram {
+ public:
+    LatencyHistogram() { reset(); }
+
+    void record(nsecs_t duration);
+    void reset();
+
+    uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+    int64_t avgUs() const;
+    int64_t maxUs() const { return mMaxUs.load(std::memory_order_relaxed); }
+    // upper bound in us of the bucket holding the given fraction of samples
+    int64_t percentileUs(double fraction) const;
+
+ private:
+    static const int LINEAR_BUCKETS = 16;
+    static const int BUCKET_COUNT = LINEAR_BUCKETS + 21 * 4;
+    static int bucketOf(int64_t us);
+    static int64_t bucketUpperUs(int bucket);
+
+    std::atomic<uint32_t> mBuckets[BUCKET_COUNT];
+    std::atomic<uint64_t> mCount;
+    std::atomic<uint64_t> mSumUs;
+    std::atomic<int64_t> mMaxUs;
+};
+
+/*
+ * Per stream stage latencies, frame rate and drop counters. Every counter
+ * covers the time since the last reset().
+ */
+class PipelineStats {
+ public:
+    PipelineStats()
+        : mWindowStart(0),
+          mWindowFrames(0),
+          mHasSequence(false),
+          mFirstSequence(0),
+          mLastSequence(0),
+          mFirstTimestamp(0) {
+        mWindowFpsX100.store(0);
+        mSequenceReset.store(false);
+        mInputFpsX100.store(0);
+        reset();
+    }
+
+    void reset();
+    void recordStage(int stage, nsecs_t start, nsecs_t end);
+    // called once per dequeued frame, from the capture thread only
+    void recordFrame(nsecs_t now);
+    void recordDrop(int reason);
+    // v4l2 sequence and timestamp of each dequeued frame, capture thread
+    // only. Gaps are counted as DROP_DRIVER
+    void recordSequence(uint32_t sequence, nsecs_t timestamp);
+    uint64_t drops(int reason) const;
+
+    std::string toJson() const;
+    // writes toJson() to path, 0 on success
+    int dumpJson(const char *path) const;
+
+ private:
+    LatencyHistogram mStages[STAGE_COUNT];
+    std::atomic<uint64_t> mDrops[DROP_COUNT];
+    std::atomic<uint64_t> mFrames;
+    std::atomic<nsecs_t> mSince;
+    // process cpu time at reset, for cpu cost per frame
+    std::atomic<nsecs_t> mCpuSince;
+    // last full second, owned by recordFrame() and not cleared by reset()
+    nsecs_t mWindowStart;
+    uint64_t mWindowFrames;
+    std::atomic<uint32_t> mWindowFpsX100;
+    // owned by recordSequence(), reset() only raises mSequenceReset
+    std::atomic<bool> mSequenceReset;
+    bool mHasSequence;
+    uint32_t mFirstSequence;
+    uint32_t mLastSequence;
+    nsecs_t mFirstTimestamp;
+    // input rate seen by the driver, from sequence and timestamps
+    std::atomic<uint32_t> mInputFpsX100;
+};
+
+}  // namespace tvinput
+}  // namespace android
+
+#endif  // _TVINPUT_HAL_PIPELINE_STATS_H_
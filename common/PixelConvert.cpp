@@ -0,0 +1,580 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "tv_input_PixelConvert"
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define PIXEL_CONVERT_NEON 1
+#define PIXEL_CONVERT_SIMD "neon"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PIXEL_CONVERT_SSE2 1
+#define PIXEL_CONVERT_SIMD "sse2"
+#else
+#define PIXEL_CONVERT_SIMD "none"
+#endif
+
+#include "Utils.h"
+#include "PixelConvert.h"
+
+namespace android {
+namespace tvinput {
+
+namespace {
+
+typedef PixelConvert::Image Image;
+
+/*
+ * Row helpers, the vector loop of each returns how many pixels (or
+ * chroma pairs) it did and the caller's scalar loop does the rest.
+ */
+#if defined(PIXEL_CONVERT_NEON)
+
+// 2x2 average of two NV24 chroma rows
+int decimateUVSimd(const uint8_t *s0, const uint8_t *s1, uint8_t *d, int pairs) {
+    int j = 0;
+    for (; j + 8 <= pairs; j += 8) {
+        // val[0..3] = U, V of the even pixel then U, V of the odd one
+        uint8x8x4_t a = vld4_u8(s0 + j * 4);
+        uint8x8x4_t b = vld4_u8(s1 + j * 4);
+        uint16x8_t u = vaddq_u16(vaddl_u8(a.val[0], a.val[2]), vaddl_u8(b.val[0], b.val[2]));
+        uint16x8_t v = vaddq_u16(vaddl_u8(a.val[1], a.val[3]), vaddl_u8(b.val[1], b.val[3]));
+        uint8x8x2_t out;
+        out.val[0] = vrshrn_n_u16(u, 2);
+        out.val[1] = vrshrn_n_u16(v, 2);
+        vst2_u8(d + j * 2, out);
+    }
+    return j;
+}
+
+// horizontal average of one NV24 chroma row
+int halveUVSimd(const uint8_t *s, uint8_t *d, int pairs) {
+    int j = 0;
+    for (; j + 8 <= pairs; j += 8) {
+        uint8x8x4_t a = vld4_u8(s + j * 4);
+        uint8x8x2_t out;
+        out.val[0] = vrhadd_u8(a.val[0], a.val[2]);
+        out.val[1] = vrhadd_u8(a.val[1], a.val[3]);
+        vst2_u8(d + j * 2, out);
+    }
+    return j;
+}
+
+int averageRowsSimd(const uint8_t *s0, const uint8_t *s1, uint8_t *d, int bytes) {
+    int j = 0;
+    for (; j + 16 <= bytes; j += 16) {
+        vst1q_u8(d + j, vrhaddq_u8(vld1q_u8(s0 + j), vld1q_u8(s1 + j)));
+    }
+    return j;
+}
+
+int yuyvLumaSimd(const uint8_t *s, uint8_t *d, int pixels) {
+    int j = 0;
+    for (; j + 16 <= pixels; j += 16) {
+        uint8x16x2_t a = vld2q_u8(s + j * 2);
+        vst1q_u8(d + j, a.val[0]);
+    }
+    return j;
+}
+
+// vertical average of the U and V of two YUYV rows
+int yuyvChromaSimd(const uint8_t *s0, const uint8_t *s1, uint8_t *d, int pairs) {
+    int j = 0;
+    for (; j + 8 <= pairs; j += 8) {
+        // val[0..3] = Y0, U, Y1, V
+        uint8x8x4_t a = vld4_u8(s0 + j * 4);
+        uint8x8x4_t b = vld4_u8(s1 + j * 4);
+        uint8x8x2_t out;
+        out.val[0] = vrhadd_u8(a.val[1], b.val[1]);
+        out.val[1] = vrhadd_u8(a.val[3], b.val[3]);
+        vst2_u8(d + j * 2, out);
+    }
+    return j;
+}
+
+int bgrLumaSimd(const uint8_t *s, uint8_t *d, int pixels) {
+    int j = 0;
+    for (; j + 8 <= pixels; j += 8) {
+        uint8x8x3_t p = vld3_u8(s + j * 3);
+        uint16x8_t acc = vmull_u8(p.val[2], vdup_n_u8(66));
+        acc = vmlal_u8(acc, p.val[1], vdup_n_u8(129));
+        acc = vmlal_u8(acc, p.val[0], vdup_n_u8(25));
+        vst1_u8(d + j, vadd_u8(vrshrn_n_u16(acc, 8), vdup_n_u8(16)));
+    }
+    return j;
+}
+
+#elif defined(PIXEL_CONVERT_SSE2)
+
+// 2x2 sums of 4 chroma pairs from 16 bytes of each NV24 row, as U V U V ... u16
+inline __m128i sumBlock(const uint8_t *s0, const uint8_t *s1) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = _mm_loadu_si128((const __m128i *)s0);
+    __m128i b = _mm_loadu_si128((const __m128i *)s1);
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+    // 32-bit lane k is the U V of pixel k, fold the odd pixels onto the even ones
+    lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 4));
+    hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 4));
+    lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+    hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+    return _mm_unpacklo_epi64(lo, hi);
+}
+
+// 16-bit lanes 0, 2, 4, 6 into the low half
+inline __m128i evenLanes(__m128i x) {
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 0, 2, 0));
+    x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 0, 2, 0));
+    return _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+int decimateUVSimd(const uint8_t *s0, const uint8_t *s1, uint8_t *d, int pairs) {
+    const __m128i round = _mm_set1_epi16(2);
+    int j = 0;
+    for (; j + 8 <= pairs; j += 8) {
+        __m128i x = sumBlock(s0 + j * 4, s1 + j * 4);
+        __m128i y = sumBlock(s0 + j * 4 + 16, s1 + j * 4 + 16);
+        x = _mm_srli_epi16(_mm_add_epi16(x, round), 2);
+        y = _mm_srli_epi16(_mm_add_epi16(y, round), 2);
+        _mm_storeu_si128((__m128i *)(d + j * 2), _mm_packus_epi16(x, y));
+    }
+    return j;
+}
+
+int halveUVSimd(const uint8_t *s, uint8_t *d, int pairs) {
+    int j = 0;
+    for (; j + 8 <= pairs; j += 8) {
+        // a 16-bit lane is the U V of one pixel, average it with the next
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + j * 4));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + j * 4 + 16));
+        a = evenLanes(_mm_avg_epu8(a, _mm_srli_si128(a, 2)));
+        b = evenLanes(_mm_avg_epu8(b, _mm_srli_si128(b, 2)));
+        _mm_storeu_si128((__m128i *)(d + j * 2), _mm_unpacklo_epi64(a, b));
+    }
+    return j;
+}
+
+int averageRowsSimd(const uint8_t *s0, const uint8_t *s1, uint8_t *d, int bytes) {
+    int j = 0;
+    for (; j + 16 <= bytes; j += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s0 + j));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s1 + j));
+        _mm_storeu_si128((__m128i *)(d + j), _mm_avg_epu8(a, b));
+    }
+    return j;
+}
+
+int yuyvLumaSimd(const uint8_t *s, uint8_t *d, int pixels) {
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    int j = 0;
+    for (; j + 16 <= pixels; j += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + j * 2));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + j * 2 + 16));
+        _mm_storeu_si128((__m128i *)(d + j),
+            _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+    }
+    return j;
+}
+
+// U V U V ... of 8 YUYV groups
+inline __m128i yuyvChroma(const uint8_t *s) {
+    __m128i a = _mm_loadu_si128((const __m128i *)s);
+    __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+    return _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+}
+
+int yuyvChromaSimd(const uint8_t *s0, const uint8_t *s1, uint8_t *d, int pairs) {
+    int j = 0;
+    for (; j + 8 <= pairs; j += 8) {
+        __m128i uv = _mm_avg_epu8(yuyvChroma(s0 + j * 4), yuyvChroma(s1 + j * 4));
+        _mm_storeu_si128((__m128i *)(d + j * 2), uv);
+    }
+    return j;
+}
+
+// 3-byte pixels do not deinterleave well with SSE2
+int bgrLumaSimd(const uint8_t *, uint8_t *, int) {
+    return 0;
+}
+
+#else
+
+int decimateUVSimd(const uint8_t *, const uint8_t *, uint8_t *, int) { return 0; }
+int halveUVSimd(const uint8_t *, uint8_t *, int) { return 0; }
+int averageRowsSimd(const uint8_t *, const uint8_t *, uint8_t *, int) { return 0; }
+int yuyvLumaSimd(const uint8_t *, uint8_t *, int) { return 0; }
+int yuyvChromaSimd(const uint8_t *, const uint8_t *, uint8_t *, int) { return 0; }
+int bgrLumaSimd(const uint8_t *, uint8_t *, int) { return 0; }
+
+#endif
+
+bool resolveSimd() {
+    bool cpu = false;
+#if defined(PIXEL_CONVERT_NEON) && defined(__aarch64__)
+    cpu = (getauxval(AT_HWCAP) & HWCAP_ASIMD) != 0;
+#elif defined(PIXEL_CONVERT_NEON)
+    cpu = (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#elif defined(PIXEL_CONVERT_SSE2)
+    cpu = __builtin_cpu_supports("sse2");
+#endif
+    bool scalar = property_get_bool(TV_INPUT_CONVERT_SCALAR, false);
+    ALOGD("%s %s kernels%s", __FUNCTION__, cpu && !scalar ? PIXEL_CONVERT_SIMD : "scalar",
+        cpu && scalar ? " (forced)" : "");
+    return cpu && !scalar;
+}
+
+bool useSimd() {
+    static const bool simd = resolveSimd();
+    return simd;
+}
+
+inline const uint8_t *rowOf(const uint8_t *base, int stride, int y) {
+    return base + (size_t)y * stride;
+}
+
+inline uint8_t *rowOf(uint8_t *base, int stride, int y) {
+    return base + (size_t)y * stride;
+}
+
+inline uint8_t clamp255(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// second luma row of row pair r, the first again on an odd last row
+inline int secondRow(int r, int height) {
+    return 2 * r + 1 < height ? 2 * r + 1 : 2 * r;
+}
+
+void copyLuma(const Image &src, const Image &dst, int width, int height, int r) {
+    memcpy(rowOf(dst.y, dst.yStride, 2 * r), rowOf(src.y, src.yStride, 2 * r), width);
+    if (2 * r + 1 < height) {
+        memcpy(rowOf(dst.y, dst.yStride, 2 * r + 1), rowOf(src.y, src.yStride, 2 * r + 1), width);
+    }
+}
+
+void nv24ToNv12(const Image &src, const Image &dst, int width, int height,
+        int rowBegin, int rowEnd, bool simd) {
+    int pairs = width / 2;
+    for (int r = rowBegin; r < rowEnd; r++) {
+        copyLuma(src, dst, width, height, r);
+        const uint8_t *s0 = rowOf(src.uv, src.uvStride, 2 * r);
+        const uint8_t *s1 = rowOf(src.uv, src.uvStride, secondRow(r, height));
+        uint8_t *d = rowOf(dst.uv, dst.uvStride, r);
+        for (int j = simd ? decimateUVSimd(s0, s1, d, pairs) : 0; j < pairs; j++) {
+            d[j * 2] = (s0[j * 4] + s0[j * 4 + 2] + s1[j * 4] + s1[j * 4 + 2] + 2) >> 2;
+            d[j * 2 + 1] = (s0[j * 4 + 1] + s0[j * 4 + 3] + s1[j * 4 + 1] + s1[j * 4 + 3] + 2) >> 2;
+        }
+    }
+}
+
+void nv24ToNv16(const Image &src, const Image &dst, int width, int height,
+        int rowBegin, int rowEnd, bool simd) {
+    int pairs = width / 2;
+    for (int r = rowBegin; r < rowEnd; r++) {
+        copyLuma(src, dst, width, height, r);
+        for (int y = 2 * r; y <= secondRow(r, height); y++) {
+            const uint8_t *s = rowOf(src.uv, src.uvStride, y);
+            uint8_t *d = rowOf(dst.uv, dst.uvStride, y);
+            for (int j = simd ? halveUVSimd(s, d, pairs) : 0; j < pairs; j++) {
+                d[j * 2] = (s[j * 4] + s[j * 4 + 2] + 1) >> 1;
+                d[j * 2 + 1] = (s[j * 4 + 1] + s[j * 4 + 3] + 1) >> 1;
+            }
+        }
+    }
+}
+
+void nv16ToNv12(const Image &src, const Image &dst, int width, int height,
+        int rowBegin, int rowEnd, bool simd) {
+    int bytes = width / 2 * 2;
+    for (int r = rowBegin; r < rowEnd; r++) {
+        copyLuma(src, dst, width, height, r);
+        const uint8_t *s0 = rowOf(src.uv, src.uvStride, 2 * r);
+        const uint8_t *s1 = rowOf(src.uv, src.uvStride, secondRow(r, height));
+        uint8_t *d = rowOf(dst.uv, dst.uvStride, r);
+        for (int j = simd ? averageRowsSimd(s0, s1, d, bytes) : 0; j < bytes; j++) {
+            d[j] = (s0[j] + s1[j] + 1) >> 1;
+        }
+    }
+}
+
+void yuyvToNv12(const Image &src, const Image &dst, int width, int height,
+        int rowBegin, int rowEnd, bool simd) {
+    int pairs = width / 2;
+    for (int r = rowBegin; r < rowEnd; r++) {
+        for (int y = 2 * r; y <= secondRow(r, height); y++) {
+            const uint8_t *s = rowOf(src.y, src.yStride, y);
+            uint8_t *d = rowOf(dst.y, dst.yStride, y);
+            for (int i = simd ? yuyvLumaSimd(s, d, width) : 0; i < width; i++) {
+                d[i] = s[i * 2];
+            }
+        }
+        const uint8_t *s0 = rowOf(src.y, src.yStride, 2 * r);
+        const uint8_t *s1 = rowOf(src.y, src.yStride, secondRow(r, height));
+        uint8_t *d = rowOf(dst.uv, dst.uvStride, r);
+        for (int j = simd ? yuyvChromaSimd(s0, s1, d, pairs) : 0; j < pairs; j++) {
+            d[j * 2] = (s0[j * 4 + 1] + s1[j * 4 + 1] + 1) >> 1;
+            d[j * 2 + 1] = (s0[j * 4 + 3] + s1[j * 4 + 3] + 1) >> 1;
+        }
+    }
+}
+
+// memory order B G R, chroma from the 2x2 average
+void bgr24ToNv12(const Image &src, const Image &dst, int width, int height,
+        int rowBegin, int rowEnd, bool simd) {
+    int pairs = width / 2;
+    for (int r = rowBegin; r < rowEnd; r++) {
+        for (int y = 2 * r; y <= secondRow(r, height); y++) {
+            const uint8_t *s = rowOf(src.y, src.yStride, y);
+            uint8_t *d = rowOf(dst.y, dst.yStride, y);
+            for (int i = simd ? bgrLumaSimd(s, d, width) : 0; i < width; i++) {
+                d[i] = ((66 * s[i * 3 + 2] + 129 * s[i * 3 + 1] + 25 * s[i * 3] + 128) >> 8) + 16;
+            }
+        }
+        const uint8_t *s0 = rowOf(src.y, src.yStride, 2 * r);
+        const uint8_t *s1 = rowOf(src.y, src.yStride, secondRow(r, height));
+        uint8_t *d = rowOf(dst.uv, dst.uvStride, r);
+        for (int j = 0; j < pairs; j++) {
+            int b = (s0[j * 6] + s0[j * 6 + 3] + s1[j * 6] + s1[j * 6 + 3] + 2) >> 2;
+            int g = (s0[j * 6 + 1] + s0[j * 6 + 4] + s1[j * 6 + 1] + s1[j * 6 + 4] + 2) >> 2;
+            int red = (s0[j * 6 + 2] + s0[j * 6 + 5] + s1[j * 6 + 2] + s1[j * 6 + 5] + 2) >> 2;
+            d[j * 2] = ((-38 * red - 74 * g + 112 * b + 128) >> 8) + 128;
+            d[j * 2 + 1] = ((112 * red - 94 * g - 18 * b + 128) >> 8) + 128;
+        }
+    }
+}
+
+// only used for the no-signal picture and the odd record request, scalar
+void nv12ToBgr24(const Image &src, const Image &dst, int width, int height,
+        int rowBegin, int rowEnd, bool) {
+    for (int r = rowBegin; r < rowEnd; r++) {
+        const uint8_t *uv = rowOf(src.uv, src.uvStride, r);
+        for (int y = 2 * r; y <= secondRow(r, height); y++) {
+            const uint8_t *s = rowOf(src.y, src.yStride, y);
+            uint8_t *d = rowOf(dst.y, dst.yStride, y);
+            for (int i = 0; i < width; i++) {
+                int c = 298 * (s[i] - 16);
+                int u = uv[i / 2 * 2] - 128;
+                int v = uv[i / 2 * 2 + 1] - 128;
+                d[i * 3] = clamp255((c + 516 * u + 128) >> 8);
+                d[i * 3 + 1] = clamp255((c - 100 * u - 208 * v + 128) >> 8);
+                d[i * 3 + 2] = clamp255((c + 409 * v + 128) >> 8);
+            }
+        }
+    }
+}
+
+// NV15 packs 4 samples little endian into 5 bytes. P010 keeps them in the
+// top 10 bits of 16, NV12 drops the 2 low bits
+void unpack10Row(const uint8_t *s, uint16_t *d16, uint8_t *d8, int count) {
+    for (int i = 0; i < count; i += 4, s += 5) {
+        int n = count - i < 4 ? count - i : 4;
+        uint64_t bits = 0;
+        for (int k = 0; k < (n * 10 + 7) / 8; k++) {
+            bits |= (uint64_t)s[k] << (k * 8);
+        }
+        for (int k = 0; k < n; k++) {
+            uint16_t v = (bits >> (k * 10)) & 0x3ff;
+            if (d16) {
+                d16[i + k] = v << 6;
+            } else {
+                d8[i + k] = v >> 2;
+            }
+        }
+    }
+}
+
+void nv15Unpack(const Image &src, const Image &dst, int width, int height,
+        int rowBegin, int rowEnd, bool to16) {
+    int chroma = width / 2 * 2;
+    for (int r = rowBegin; r < rowEnd; r++) {
+        for (int y = 2 * r; y <= secondRow(r, height); y++) {
+            uint8_t *d = rowOf(dst.y, dst.yStride, y);
+            unpack10Row(rowOf(src.y, src.yStride, y), to16 ? (uint16_t *)d : NULL, d, width);
+        }
+        uint8_t *d = rowOf(dst.uv, dst.uvStride, r);
+        unpack10Row(rowOf(src.uv, src.uvStride, r), to16 ? (uint16_t *)d : NULL, d, chroma);
+    }
+}
+
+void nv15ToP010(const Image &src, const Image &dst, int width, int height,
+        int rowBegin, int rowEnd, bool) {
+    nv15Unpack(src, dst, width, height, rowBegin, rowEnd, true);
+}
+
+void nv15ToNv12(const Image &src, const Image &dst, int width, int height,
+        int rowBegin, int rowEnd, bool) {
+    nv15Unpack(src, dst, width, height, rowBegin, rowEnd, false);
+}
+
+typedef void (*ConvertRows)(const Image &src, const Image &dst, int width, int height,
+                            int rowBegin, int rowEnd, bool simd);
+
+struct Conversion {
+    uint32_t src;
+    uint32_t dst;
+    ConvertRows rows;
+};
+
+const Conversion kConversions[] = {
+    { V4L2_PIX_FMT_NV24,  V4L2_PIX_FMT_NV12,  nv24ToNv12 },
+    { V4L2_PIX_FMT_NV24,  V4L2_PIX_FMT_NV16,  nv24ToNv16 },
+    { V4L2_PIX_FMT_NV16,  V4L2_PIX_FMT_NV12,  nv16ToNv12 },
+    { V4L2_PIX_FMT_YUYV,  V4L2_PIX_FMT_NV12,  yuyvToNv12 },
+    { V4L2_PIX_FMT_BGR24, V4L2_PIX_FMT_NV12,  bgr24ToNv12 },
+    { V4L2_PIX_FMT_NV12,  V4L2_PIX_FMT_BGR24, nv12ToBgr24 },
+    { V4L2_PIX_FMT_NV15,  V4L2_PIX_FMT_P010,  nv15ToP010 },
+    { V4L2_PIX_FMT_NV15,  V4L2_PIX_FMT_NV12,  nv15ToNv12 },
+};
+
+const Conversion *findConversion(uint32_t srcFormat, uint32_t dstFormat) {
+    for (size_t i = 0; i < sizeof(kConversions) / sizeof(kConversions[0]); i++) {
+        if (kConversions[i].src == srcFormat && kConversions[i].dst == dstFormat) {
+            return &kConversions[i];
+        }
+    }
+    return NULL;
+}
+
+// uvStride 0 for the packed formats
+void planeStrides(uint32_t format, int widthStride, int *yStride, int *uvStride) {
+    *uvStride = 0;
+    switch (format) {
+    case V4L2_PIX_FMT_BGR24:
+        *yStride = widthStride * 3;
+        break;
+    case V4L2_PIX_FMT_YUYV:
+        *yStride = widthStride * 2;
+        break;
+    case V4L2_PIX_FMT_NV15:
+        *yStride = widthStride * 10 / 8;
+        *uvStride = *yStride;
+        break;
+    case V4L2_PIX_FMT_P010:
+        *yStride = widthStride * 2;
+        *uvStride = *yStride;
+        break;
+    case V4L2_PIX_FMT_NV24:
+        *yStride = widthStride;
+        *uvStride = widthStride * 2;
+        break;
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV16:
+        *yStride = widthStride;
+        *uvStride = widthStride;
+        break;
+    default:
+        *yStride = widthStride;
+        break;
+    }
+}
+
+bool hasLayout(uint32_t format) {
+    switch (format) {
+    case V4L2_PIX_FMT_BGR24:
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_NV15:
+    case V4L2_PIX_FMT_P010:
+    case V4L2_PIX_FMT_NV24:
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV16:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// chroma has a row per luma row, not one per row pair
+bool fullHeightChroma(uint32_t format) {
+    return format == V4L2_PIX_FMT_NV16 || format == V4L2_PIX_FMT_NV24;
+}
+
+}  // namespace
+
+bool PixelConvert::isSupported(uint32_t srcFormat, uint32_t dstFormat) {
+    if (srcFormat == dstFormat) {
+        return hasLayout(srcFormat);
+    }
+    return findConversion(srcFormat, dstFormat) != NULL;
+}
+
+PixelConvert::Image PixelConvert::layout(uint32_t format, uint8_t *base,
+        int widthStride, int heightStride) {
+    Image image = {base, NULL, 0, 0};
+    planeStrides(format, widthStride, &image.yStride, &image.uvStride);
+    if (image.uvStride > 0) {
+        image.uv = base + (size_t)image.yStride * heightStride;
+    }
+    return image;
+}
+
+size_t PixelConvert::frameSize(uint32_t format, int widthStride, int heightStride) {
+    int yStride, uvStride;
+    planeStrides(format, widthStride, &yStride, &uvStride);
+    size_t lumaSize = (size_t)yStride * heightStride;
+    switch (format) {
+    case V4L2_PIX_FMT_NV16:
+    case V4L2_PIX_FMT_NV24:
+        return lumaSize + (size_t)uvStride * heightStride;
+    default:
+        return lumaSize + (size_t)uvStride * rowCount(heightStride);
+    }
+}
+
+int PixelConvert::convert(uint32_t srcFormat, const Image &src, uint32_t dstFormat,
+        const Image &dst, int width, int height, int rowBegin, int rowEnd) {
+    if (srcFormat == dstFormat) {
+        return copy(srcFormat, src, dst, width, height, rowBegin, rowEnd);
+    }
+    const Conversion *conversion = findConversion(srcFormat, dstFormat);
+    if (!conversion) {
+        return -1;
+    }
+    if (rowEnd > rowCount(height)) {
+        rowEnd = rowCount(height);
+    }
+    conversion->rows(src, dst, width, height, rowBegin, rowEnd, useSimd());
+    return 0;
+}
+
+int PixelConvert::copy(uint32_t format, const Image &src, const Image &dst,
+        int width, int height, int rowBegin, int rowEnd) {
+    if (!hasLayout(format)) {
+        return -1;
+    }
+    if (rowEnd > rowCount(height)) {
+        rowEnd = rowCount(height);
+    }
+    int lumaBytes, chromaBytes;
+    planeStrides(format, width, &lumaBytes, &chromaBytes);
+    for (int r = rowBegin; r < rowEnd; r++) {
+        for (int y = 2 * r; y < 2 * r + 2 && y < height; y++) {
+            memcpy(rowOf(dst.y, dst.yStride, y), rowOf(src.y, src.yStride, y), lumaBytes);
+        }
+        if (!chromaBytes) {
+            continue;
+        }
+        if (fullHeightChroma(format)) {
+            for (int y = 2 * r; y < 2 * r + 2 && y < height; y++) {
+                memcpy(rowOf(dst.uv, dst.uvStride, y), rowOf(src.uv, src.uvStride, y), chromaBytes);
+            }
+        } else {
+            memcpy(rowOf(dst.uv, dst.uvStride, r), rowOf(src.uv, src.uvStride, r), chromaBytes);
+        }
+    }
+    return 0;
+}
+
+const char *PixelConvert::kernelName() {
+    return useSimd() ? PIXEL_CONVERT_SIMD : "scalar";
+}
+
+}  // namespace tvinput
+}  // namespace android
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#ifndef _TVINPUT_HAL_PIXEL_CONVERT_H_
+#define _TVINPUT_HAL_PIXEL_CONVERT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/videodev2.h>
+
+// rockchip 10-bit 4:2:0, 4 samples in 5 bytes (HAL_PIXEL_FORMAT_YCrCb_NV12_10)
+#ifndef V4L2_PIX_FMT_NV15
+#define V4L2_PIX_FMT_NV15 v4l2_fourcc('N', 'V', '1', '5')
+#endif
+#ifndef V4L2_PIX_FMT_P010
+#define V4L2_PIX_FMT_P010 v4l2_fourcc('P', '0', '1', '0')
+#endif
+
+namespace android {
+namespace tvinput {
+
+/*
+ * CPU pixel format conversion, the fallback for what RGA cannot do or
+ * failed to do. Formats are v4l2 fourccs, sizes must match (no scaling).
+ * A format converted to itself is a copy that honours both strides.
+ * The NEON/SSE2 kernels are picked at first use when the cpu has them,
+ * vendor.tvinput.convert.scalar=1 forces the scalar ones. Both produce
+ * the same bytes. YUV is BT.601 limited range.
+ *
+ * A conversion works on a range of rows so a frame can be split across
+ * a RowWorkerPool: row r is luma rows 2r and 2r + 1, see rowCount().
+ */
+class PixelConvert {
+ public:
+    // strides in bytes, uv unused by the packed formats
+    struct Image {
+        uint8_t *y;
+        uint8_t *uv;
+        int yStride;
+        int uvStride;
+    };
+
+    static bool isSupported(uint32_t srcFormat, uint32_t dstFormat);
+    static int rowCount(int height) { return (height + 1) / 2; }
+    // planes of a contiguous buffer, strides in pixels
+    static Image layout(uint32_t format, uint8_t *base, int widthStride, int heightStride);
+    // bytes from the start of the buffer to the end of the last plane
+    static size_t frameSize(uint32_t format, int widthStride, int heightStride);
+
+    // -1 if the pair is not supported
+    static int convert(uint32_t srcFormat, const Image &src, uint32_t dstFormat, const Image &dst,
+                       int width, int height, int rowBegin, int rowEnd);
+    // same format, row by row so src and dst strides may differ. -1 if
+    // layout() does not know the format
+    static int copy(uint32_t format, const Image &src, const Image &dst,
+                    int width, int height, int rowBegin, int rowEnd);
+
+    static const char *kernelName();
+};
+
+}  // namespace tvinput
+}  // namespace android
+
+#endif  // _TVINPUT_HAL_PIXEL_CONVERT_H_
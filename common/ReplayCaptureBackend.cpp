@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#define LOG_TAG "tv_input_Replay"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <utils/Log.h>
+
+#include "ReplayCaptureBackend.h"
+#include "rk_hdmirx_config.h"
+
+namespace android {
+namespace tvinput {
+
+ReplayCaptureBackend::ReplayCaptureBackend(const char *path, int width, int height,
+        uint32_t pixelFormat, int fps)
+    : mWidth(width),
+      mHeight(height),
+      mPixelFormat(pixelFormat),
+      mFps(fps > 0 ? fps : 60),
+      mFrameSize(frameSize(pixelFormat, width, height)),
+      mInterlaced(false),
+      mEventFd(-1),
+      mFile(NULL),
+      mFrame(NULL),
+      mStreaming(false),
+      mBufferCount(0),
+      mSequence(0),
+      mNextFrameTime(0),
+      mNextIndex(0) {
+    snprintf(mPath, sizeof(mPath), "%s", path);
+    memset(mBuffers, 0, sizeof(mBuffers));
+}
+
+ReplayCaptureBackend::~ReplayCaptureBackend() {
+    streamOff();
+    if (mFile) {
+        fclose(mFile);
+    }
+    free(mFrame);
+    if (mEventFd >= 0) {
+        close(mEventFd);
+    }
+}
+
+size_t ReplayCaptureBackend::frameSize(uint32_t pixelFormat, int width, int height) {
+    size_t pixels = (size_t)width * height;
+    switch (pixelFormat) {
+        case V4L2_PIX_FMT_NV12:
+            return pixels * 3 / 2;
+        case V4L2_PIX_FMT_NV16:
+            return pixels * 2;
+        case V4L2_PIX_FMT_NV24:
+        case V4L2_PIX_FMT_BGR24:
+            return pixels * 3;
+        default:
+            return 0;
+    }
+}
+
+bool ReplayCaptureBackend::open() {
+    if (mFrameSize == 0) {
+        ALOGE("%s unsupported format 0x%x %dx%d", __FUNCTION__, mPixelFormat, mWidth, mHeight);
+        return false;
+    }
+    mFile = fopen(mPath, "rb");
+    if (!mFile) {
+        ALOGE("%s open %s failed: %s", __FUNCTION__, mPath, strerror(errno));
+        return false;
+    }
+    loadIndex();
+    mFrame = (uint8_t *)malloc(mFrameSize);
+    if (!mFrame || !readFrame()) {
+        ALOGE("%s %s holds no full %zu byte frame", __FUNCTION__, mPath, mFrameSize);
+        return false;
+    }
+    rewind(mFile);
+    mNextIndex = 0;
+    // one count per done buffer, so the fd stays readable until all are dequeued
+    mEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+    if (mEventFd < 0) {
+        ALOGE("%s eventfd failed: %s", __FUNCTION__, strerror(errno));
+        return false;
+    }
+    ALOGD("%s %s %dx%d fmt=0x%x fps=%d", __FUNCTION__, mPath, mWidth, mHeight, mPixelFormat, mFps);
+    return true;
+}
+
+void ReplayCaptureBackend::fillFormat(struct v4l2_format *format) {
+    format->type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    memset(&format->fmt.pix_mp, 0, sizeof(format->fmt.pix_mp));
+    format->fmt.pix_mp.width = mWidth;
+    format->fmt.pix_mp.height = mHeight;
+    format->fmt.pix_mp.pixelformat = mPixelFormat;
+    format->fmt.pix_mp.field = V4L2_FIELD_NONE;
+    format->fmt.pix_mp.num_planes = 1;
+    format->fmt.pix_mp.plane_fmt[0].sizeimage = mFrameSize;
+    format->fmt.pix_mp.plane_fmt[0].bytesperline =
+        mPixelFormat == V4L2_PIX_FMT_BGR24 ? mWidth * 3 : mWidth;
+}
+
+int ReplayCaptureBackend::ioctl(unsigned long request, void *arg) {
+    switch (request) {
+        case VIDIOC_QUERYCAP: {
+            struct v4l2_capability *cap = (struct v4l2_capability *)arg;
+            memset(cap, 0, sizeof(*cap));
+            snprintf((char *)cap->driver, sizeof(cap->driver), "replay");
+            snprintf((char *)cap->card, sizeof(cap->card), "%s", mPath);
+            cap->device_caps = V4L2_CAP_VIDEO_CAPTURE_MPLANE | V4L2_CAP_STREAMING;
+            cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+            return 0;
+        }
+        case VIDIOC_ENUM_FMT: {
+            struct v4l2_fmtdesc *desc = (struct v4l2_fmtdesc *)arg;
+            if (desc->index != 0) {
+                errno = EINVAL;
+                return -1;
+            }
+            desc->pixelformat = mPixelFormat;
+            snprintf((char *)desc->description, sizeof(desc->description), "replay");
+            return 0;
+        }
+        case VIDIOC_G_FMT:
+        case VIDIOC_S_FMT:
+        case VIDIOC_TRY_FMT:
+            // the dump decides the format
+            fillFormat((struct v4l2_format *)arg);
+            return 0;
+        case VIDIOC_S_PARM:
+            return 0;
+        case VIDIOC_QUERY_DV_TIMINGS: {
+            struct v4l2_dv_timings *timings = (struct v4l2_dv_timings *)arg;
+            memset(timings, 0, sizeof(*timings));
+            timings->type = V4L2_DV_BT_656_1120;
+            timings->bt.width = mWidth;
+            timings->bt.height = mHeight;
+            timings->bt.interlaced = mInterlaced ? V4L2_DV_INTERLACED : V4L2_DV_PROGRESSIVE;
+            return 0;
+        }
+        case VIDIOC_G_CTRL: {
+            struct v4l2_control *control = (struct v4l2_control *)arg;
+            if (control->id != V4L2_CID_DV_RX_POWER_PRESENT) {
+                errno = EINVAL;
+                return -1;
+            }
+            control->value = 1;
+            return 0;
+        }
+        case RK_HDMIRX_CMD_GET_FPS:
+            *(int *)arg = mFps;
+            return 0;
+        case RK_HDMIRX_CMD_GET_COLOR_RANGE:
+            *(int *)arg = HDMIRX_DEFAULT_RANGE;
+            return 0;
+        case RK_HDMIRX_CMD_GET_COLOR_SPACE:
+            *(int *)arg = HDMIRX_XVYCC709;
+            return 0;
+        case VIDIOC_REQBUFS: {
+            struct v4l2_requestbuffers *req = (struct v4l2_requestbuffers *)arg;
+            Mutex::Autolock autoLock(mLock);
+            if (mStreaming) {
+                errno = EBUSY;
+                return -1;
+            }
+            if (req->count > TV_INPUT_MAX_BUFF_CNT) {
+                req->count = TV_INPUT_MAX_BUFF_CNT;
+            }
+            mBufferCount = req->count;
+            memset(mBuffers, 0, sizeof(mBuffers));
+            mQueued.clear();
+            mDone.clear();
+            return 0;
+        }
+        case VIDIOC_QUERYBUF: {
+            struct v4l2_buffer *buf = (struct v4l2_buffer *)arg;
+            Mutex::Autolock autoLock(mLock);
+            if (buf->index >= mBufferCount) {
+                errno = EINVAL;
+                return -1;
+            }
+            buf->flags = 0;
+            if (buf->m.planes && buf->length > 0) {
+                buf->m.planes[0].length = mFrameSize;
+            }
+            return 0;
+        }
+        case VIDIOC_QBUF:
+            return queueBuffer((struct v4l2_buffer *)arg);
+        case VIDIOC_DQBUF:
+            return dequeueBuffer((struct v4l2_buffer *)arg);
+        case VIDIOC_STREAMON:
+            return streamOn();
+        case VIDIOC_STREAMOFF:
+            return streamOff();
+        default:
+            errno = ENOTTY;
+            return -1;
+    }
+}
+
+int ReplayCaptureBackend::queueBuffer(struct v4l2_buffer *buf) {
+    Mutex::Autolock autoLock(mLock);
+    if (buf->index >= mBufferCount || !buf->m.planes || buf->length == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    ReplayBuffer &buffer = mBuffers[buf->index];
+    buffer.fd = buf->m.planes[0].m.fd;
+    buffer.length = buf->m.planes[0].length;
+    if (buffer.length == 0) {
+        off_t size = lseek(buffer.fd, 0, SEEK_END);
+        buffer.length = size > 0 ? (uint32_t)size : 0;
+    }
+    mQueued.push_back(buf->index);
+    return 0;
+}
+
+int ReplayCaptureBackend::dequeueBuffer(struct v4l2_buffer *buf) {
+    Mutex::Autolock autoLock(mLock);
+    if (mDone.empty() || !buf->m.planes || buf->length == 0) {
+        errno = mDone.empty() ? EAGAIN : EINVAL;
+        return -1;
+    }
+    eventfd_t count;
+    eventfd_read(mEventFd, &count);
+    uint32_t index = mDone.front();
+    mDone.pop_front();
+    const ReplayBuffer &buffer = mBuffers[index];
+    buf->index = index;
+    buf->flags = V4L2_BUF_FLAG_DONE | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    buf->field = V4L2_FIELD_NONE;
+    buf->sequence = buffer.sequence;
+    buf->timestamp = buffer.timestamp;
+    buf->m.planes[0].m.fd = buffer.fd;
+    buf->m.planes[0].length = buffer.length;
+    buf->m.planes[0].bytesused = buffer.bytesused;
+    return 0;
+}
+
+int ReplayCaptureBackend::streamOn() {
+    Mutex::Autolock autoLock(mLock);
+    if (mStreaming) {
+        return 0;
+    }
+    mStreaming = true;
+    mSequence = 0;
+    mNextFrameTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    mThread = new ProducerThread(this);
+    mThread->run("Tif_Replay", PRIORITY_DISPLAY);
+    return 0;
+}
+
+int ReplayCaptureBackend::streamOff() {
+    sp<ProducerThread> thread;
+    {
+        Mutex::Autolock autoLock(mLock);
+        mStreaming = false;
+        mStreamCond.broadcast();
+        thread = mThread;
+        mThread.clear();
+    }
+    if (thread != NULL) {
+        thread->requestExitAndWait();
+    }
+    Mutex::Autolock autoLock(mLock);
+    mQueued.clear();
+    mDone.clear();
+    if (mEventFd >= 0) {
+        eventfd_t count;
+        while (eventfd_read(mEventFd, &count) == 0) {
+        }
+    }
+    return 0;
+}
+
+// FrameDumper files are replayed through their index, anything else is raw frames
+void ReplayCaptureBackend::loadIndex() {
+    FrameDumpHeader header;
+    if (fread(&header, sizeof(header), 1, mFile) == 1 && header.magic == FRAME_DUMP_MAGIC
+            && header.version == FRAME_DUMP_VERSION && header.frameCount <= header.maxFrames) {
+        for (uint32_t i = 0; i < header.frameCount; i++) {
+            FrameDumpIndex index;
+            if (fread(&index, sizeof(index), 1, mFile) != 1) {
+                break;
+            }
+            // dumps hold the whole gralloc buffer, padding after the frame is skipped
+            if (index.size >= mFrameSize) {
+                mIndex.push_back(index);
+            }
+        }
+        ALOGD("%s %s: %zu of %u dumped frames usable", __FUNCTION__, mPath,
+            mIndex.size(), header.frameCount);
+    }
+    rewind(mFile);
+}
+
+bool ReplayCaptureBackend::readFrame() {
+    if (!mIndex.empty()) {
+        const FrameDumpIndex &index = mIndex[mNextIndex];
+        mNextIndex = (mNextIndex + 1) % mIndex.size();
+        return fseeko(mFile, index.offset, SEEK_SET) == 0
+            && fread(mFrame, mFrameSize, 1, mFile) == 1;
+    }
+    if (fread(mFrame, mFrameSize, 1, mFile) == 1) {
+        return true;
+    }
+    rewind(mFile);
+    return fread(mFrame, mFrameSize, 1, mFile) == 1;
+}
+
+void ReplayCaptureBackend::copyFrame(ReplayBuffer *buffer) {
+    size_t size = buffer->length < mFrameSize ? buffer->length : mFrameSize;
+    buffer->bytesused = 0;
+    void *dst = mmap(NULL, buffer->length, PROT_WRITE, MAP_SHARED, buffer->fd, 0);
+    if (dst == MAP_FAILED) {
+        ALOGE("%s mmap fd=%d failed: %s", __FUNCTION__, buffer->fd, strerror(errno));
+        return;
+    }
+    memcpy(dst, mFrame, size);
+    munmap(dst, buffer->length);
+    buffer->bytesused = size;
+}
+
+bool ReplayCaptureBackend::produceFrame() {
+    nsecs_t period = s2ns(1) / mFps;
+    nsecs_t frameTime;
+    uint32_t sequence;
+    uint32_t index;
+    {
+        Mutex::Autolock autoLock(mLock);
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        while (mStreaming && now < mNextFrameTime) {
+            mStreamCond.waitRelative(mLock, mNextFrameTime - now);
+            now = systemTime(SYSTEM_TIME_MONOTONIC);
+        }
+        if (!mStreaming) {
+            return false;
+        }
+        frameTime = mNextFrameTime;
+        // skip ahead rather than burst after a stall
+        mNextFrameTime = now - mNextFrameTime > period ? now + period : mNextFrameTime + period;
+        sequence = mSequence++;
+        if (mQueued.empty()) {
+            return true;
+        }
+        index = mQueued.front();
+        mQueued.pop_front();
+    }
+
+    // buffers are not reallocated while streaming, fill outside the lock
+    ReplayBuffer &buffer = mBuffers[index];
+    if (!readFrame()) {
+        ALOGE("%s read %s failed", __FUNCTION__, mPath);
+    }
+    copyFrame(&buffer);
+    buffer.sequence = sequence;
+    buffer.timestamp.tv_sec = frameTime / s2ns(1);
+    buffer.timestamp.tv_usec = (frameTime % s2ns(1)) / 1000;
+
+    Mutex::Autolock autoLock(mLock);
+    mDone.push_back(index);
+    eventfd_write(mEventFd, 1);
+    return true;
+}
+
+}  // namespace tvinput
+}  // namespace android
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#ifndef _TVINPUT_HAL_REPLAY_CAPTURE_BACKEND_H_
+#define _TVINPUT_HAL_REPLAY_CAPTURE_BACKEND_H_
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <deque>
+#include <vector>
+#include <linux/videodev2.h>
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+
+#include "CaptureBackend.h"
+#include "FrameDumper.h"
+#include "Utils.h"
+
+namespace android {
+namespace tvinput {
+
+/*
+ * Fake v4l2 capture node streaming raw frames from a file, e.g. the
+ * dumps written to /data/system/dumpimage. Frames are copied into the
+ * queued dmabufs at the configured fps with monotonic timestamps and
+ * sequence numbers, a frame due while no buffer is queued is dropped
+ * and shows up as a sequence gap like a driver overrun. The file is
+ * replayed in a loop, either raw frames or a FrameDumper file.
+ */
+class ReplayCaptureBackend : public CaptureBackend {
+ public:
+    ReplayCaptureBackend(const char *path, int width, int height, uint32_t pixelFormat, int fps);
+    ~ReplayCaptureBackend() override;
+
+    bool open();
+
+    int fd() const override { return mEventFd; }
+    int ioctl(unsigned long request, void *arg) override;
+    bool isReplay() const override { return true; }
+
+    // reported through VIDIOC_QUERY_DV_TIMINGS, an interlaced source
+    // sends the HAL through rkiep; call before the HAL opens the node
+    void setInterlaced(bool interlaced) { mInterlaced = interlaced; }
+
+    // frame size of the dump for a v4l2 pixel format, 0 if unsupported
+    static size_t frameSize(uint32_t pixelFormat, int width, int height);
+
+ private:
+    ReplayCaptureBackend(const ReplayCaptureBackend& other);
+    ReplayCaptureBackend& operator=(const ReplayCaptureBackend& other);
+
+    class ProducerThread : public Thread {
+     public:
+        explicit ProducerThread(ReplayCaptureBackend *backend)
+            : Thread(false), mBackend(backend) {}
+        bool threadLoop() override { return mBackend->produceFrame(); }
+     private:
+        ReplayCaptureBackend *mBackend;
+    };
+
+    struct ReplayBuffer {
+        int fd;
+        uint32_t length;
+        uint32_t bytesused;
+        uint32_t sequence;
+        struct timeval timestamp;
+    };
+
+    void fillFormat(struct v4l2_format *format);
+    int queueBuffer(struct v4l2_buffer *buf);
+    int dequeueBuffer(struct v4l2_buffer *buf);
+    int streamOn();
+    int streamOff();
+    bool produceFrame();
+    void loadIndex();
+    bool readFrame();
+    void copyFrame(ReplayBuffer *buffer);
+
+    char mPath[PATH_MAX];
+    int mWidth;
+    int mHeight;
+    uint32_t mPixelFormat;
+    int mFps;
+    size_t mFrameSize;
+    bool mInterlaced;
+
+    int mEventFd;
+    FILE *mFile;
+    uint8_t *mFrame;
+
+    Mutex mLock;
+    Condition mStreamCond;
+    bool mStreaming;
+    uint32_t mBufferCount;
+    ReplayBuffer mBuffers[TV_INPUT_MAX_BUFF_CNT];
+    std::deque<uint32_t> mQueued;
+    std::deque<uint32_t> mDone;
+    uint32_t mSequence;
+    nsecs_t mNextFrameTime;
+    std::vector<FrameDumpIndex> mIndex;
+    size_t mNextIndex;
+    sp<ProducerThread> mThread;
+};
+
+}  // namespace tvinput
+}  // namespace android
+
+#endif  // _TVINPUT_HAL_REPLAY_CAPTURE_BACKEND_H_
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "tv_input_RowWorkerPool"
+
+#include <stdio.h>
+#include <utils/Log.h>
+
+#include "RowWorkerPool.h"
+
+namespace android {
+namespace tvinput {
+
+namespace {
+
+// waking a worker costs more than converting a few rows
+constexpr int MIN_ROWS_PER_THREAD = 16;
+constexpr int MAX_THREADS = 4;
+
+}  // namespace
+
+RowWorkerPool::RowWorkerPool()
+    : mInitialized(false),
+      mExiting(false),
+      mGeneration(0),
+      mRows(0),
+      mPending(0),
+      mJob(NULL) {
+}
+
+RowWorkerPool::~RowWorkerPool() {
+    deinit();
+}
+
+bool RowWorkerPool::init(int threads) {
+    Mutex::Autolock runLock(mRunLock);
+    if (mInitialized) {
+        return true;
+    }
+    mInitialized = true;
+    if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+    for (int i = 0; i < threads - 1; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "Tif_Rows%d", i);
+        sp<Worker> worker = new Worker(this, i);
+        if (worker->run(name, PRIORITY_DISPLAY) != NO_ERROR) {
+            ALOGE("%s start %s failed, %zu workers", __FUNCTION__, name, mWorkers.size());
+            break;
+        }
+        mWorkers.push_back(worker);
+    }
+    ALOGD("%s %d threads", __FUNCTION__, this->threads());
+    return true;
+}
+
+void RowWorkerPool::deinit() {
+    Mutex::Autolock runLock(mRunLock);
+    {
+        Mutex::Autolock autoLock(mLock);
+        mExiting = true;
+        mStartCond.broadcast();
+    }
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        mWorkers[i]->requestExit();
+        mWorkers[i]->join();
+    }
+    mWorkers.clear();
+    Mutex::Autolock autoLock(mLock);
+    mExiting = false;
+    mInitialized = false;
+}
+
+void RowWorkerPool::run(int rows, const std::function<void(int rowBegin, int rowEnd)> &job) {
+    Mutex::Autolock runLock(mRunLock);
+    if (mWorkers.empty() || rows < MIN_ROWS_PER_THREAD * threads()) {
+        job(0, rows);
+        return;
+    }
+    {
+        Mutex::Autolock autoLock(mLock);
+        mJob = &job;
+        mRows = rows;
+        mPending = (int)mWorkers.size();
+        mGeneration++;
+        mStartCond.broadcast();
+    }
+    int rowBegin, rowEnd;
+    split(0, &rowBegin, &rowEnd);
+    job(rowBegin, rowEnd);
+
+    Mutex::Autolock autoLock(mLock);
+    while (mPending > 0) {
+        mDoneCond.wait(mLock);
+    }
+    mJob = NULL;
+}
+
+bool RowWorkerPool::workerLoop(int index, uint32_t *generation) {
+    const std::function<void(int, int)> *job;
+    int rowBegin, rowEnd;
+    {
+        Mutex::Autolock autoLock(mLock);
+        while (!mExiting && mGeneration == *generation) {
+            mStartCond.wait(mLock);
+        }
+        if (mExiting) {
+            return false;
+        }
+        *generation = mGeneration;
+        job = mJob;
+        split(index + 1, &rowBegin, &rowEnd);
+    }
+    if (rowBegin < rowEnd) {
+        (*job)(rowBegin, rowEnd);
+    }
+    Mutex::Autolock autoLock(mLock);
+    if (--mPending == 0) {
+        mDoneCond.signal();
+    }
+    return true;
+}
+
+// part 0 is the caller's, the first mRows % threads parts get a row more
+void RowWorkerPool::split(int part, int *rowBegin, int *rowEnd) const {
+    int parts = threads();
+    int chunk = mRows / parts;
+    int extra = mRows % parts;
+    *rowBegin = part * chunk + (part < extra ? part : extra);
+    *rowEnd = *rowBegin + chunk + (part < extra ? 1 : 0);
+}
+
+}  // namespace tvinput
+}  // namespace android
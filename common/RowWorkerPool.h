@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#ifndef _TVINPUT_HAL_ROW_WORKER_POOL_H_
+#define _TVINPUT_HAL_ROW_WORKER_POOL_H_
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+
+namespace android {
+namespace tvinput {
+
+/*
+ * A few threads a cpu frame operation is split across by rows. run()
+ * hands each worker one contiguous range, does the first range on the
+ * calling thread and returns once all ranges are done. Without workers
+ * (threads <= 1) run() is a plain call.
+ */
+class RowWorkerPool {
+ public:
+    RowWorkerPool();
+    ~RowWorkerPool();
+
+    // threads counts the caller, so threads - 1 workers are started
+    bool init(int threads);
+    void deinit();
+    bool isInitialized() const { return mInitialized; }
+    int threads() const { return (int)mWorkers.size() + 1; }
+
+    void run(int rows, const std::function<void(int rowBegin, int rowEnd)> &job);
+
+ private:
+    RowWorkerPool(const RowWorkerPool& other);
+    RowWorkerPool& operator=(const RowWorkerPool& other);
+
+    class Worker : public Thread {
+     public:
+        Worker(RowWorkerPool *pool, int index)
+            : Thread(false), mPool(pool), mIndex(index), mGeneration(0) {}
+        bool threadLoop() override { return mPool->workerLoop(mIndex, &mGeneration); }
+     private:
+        RowWorkerPool *mPool;
+        int mIndex;
+        uint32_t mGeneration;
+    };
+
+    bool workerLoop(int index, uint32_t *generation);
+    void split(int part, int *rowBegin, int *rowEnd) const;
+
+    // one run() at a time
+    Mutex mRunLock;
+    Mutex mLock;
+    Condition mStartCond;
+    Condition mDoneCond;
+    bool mInitialized;
+    bool mExiting;
+    uint32_t mGeneration;
+    int mRows;
+    int mPending;
+    const std::function<void(int, int)> *mJob;
+    std::vector<sp<Worker>> mWorkers;
+};
+
+}  // namespace tvinput
+}  // namespace android
+
+#endif  // _TVINPUT_HAL_ROW_WORKER_POOL_H_
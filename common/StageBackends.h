@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#ifndef _TVINPUT_HAL_STAGE_BACKENDS_H_
+#define _TVINPUT_HAL_STAGE_BACKENDS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cutils/native_handle.h>
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+
+#include "video_tunnel.h"
+
+namespace android {
+namespace tvinput {
+
+/*
+ * The hardware HinDevImpl hands frames to after capture, see
+ * CaptureBackend for the capture side. Only the per frame calls go
+ * through these, setup (buffer allocation, rkpq/rkiep init) stays
+ * with the real components. tv_input_bench puts stand-ins here to
+ * time the shipped work, pq and iep threads on replayed frames.
+ */
+
+// the VOP plane or the vtunnel consumer, RTSidebandWindow on a device
+class DisplaySink {
+ public:
+    virtual ~DisplaySink() {}
+
+    // -EBUSY while the last commit is in flight, nothing is shown then.
+    // releaseFence, if given, gets the fence that frees the previous buffer
+    virtual status_t show(buffer_handle_t buffer, int displayRatio, int hdmiInType,
+                          int *releaseFence = NULL, nsecs_t captureTime = 0) = 0;
+    virtual bool isPresentPending() = 0;
+    // fence of the commit in flight, -1 if none, caller owns the fd
+    virtual int getPresentFence() = 0;
+
+    // vtunnel, a queued buffer comes back from dequeueBuffer() once the
+    // consumer has replaced it on screen
+    virtual status_t queueBuffer(vt_buffer_t *buffer, int fence, int64_t expectedPresentTime) = 0;
+    virtual status_t dequeueBuffer(vt_buffer_t **buffer, int timeoutMs, int *fence) = 0;
+};
+
+// rkpq::dopq() and rkiep::iep2_deinterlace()
+class PqProcessor {
+ public:
+    virtual ~PqProcessor() {}
+
+    virtual void pq(int srcFd, int dstFd, int pqMode) = 0;
+    virtual void iep(int src0Fd, int src1Fd, int src2Fd, int dstFd, int dst2Fd,
+                     int *dilOrder) = 0;
+};
+
+// the record encoder, an MppEncodeServer on a device
+class RecordEncoder {
+ public:
+    // index of the record buffer the encoder is done with
+    typedef void (*InputAvailable)(void *user, int32_t index);
+
+    virtual ~RecordEncoder() {}
+
+    virtual bool start(int width, int height, int fps, InputAvailable callback, void *user) = 0;
+    virtual void stop() = 0;
+    virtual bool isRunning() = 0;
+    // an NV12 frame in record buffer index, false if it was not taken
+    virtual bool sendFrame(int fd, int index, size_t size, nsecs_t pts) = 0;
+};
+
+// HinDevImpl::set_stage_backends(), NULL keeps the hardware
+struct StageBackends {
+    DisplaySink *display = NULL;
+    PqProcessor *pq = NULL;
+    RecordEncoder *encoder = NULL;
+};
+
+}  // namespace tvinput
+}  // namespace android
+
+#endif  // _TVINPUT_HAL_STAGE_BACKENDS_H_
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#define LOG_TAG "tv_input_Config"
+
+#include <stdlib.h>
+#include <sys/system_properties.h>
+#include <utils/Log.h>
+
+#include "Utils.h"
+#include "TvInputConfig.h"
+
+namespace android {
+namespace tvinput {
+
+namespace {
+
+uint32_t propertySerial(const char *name) {
+    const prop_info *pi = __system_property_find(name);
+    return pi ? __system_property_serial(pi) : 0;
+}
+
+}  // namespace
+
+TvInputConfig::TvInputConfig()
+    : mSerial(0) {
+}
+
+std::shared_ptr<const TvInputConfigSnapshot> TvInputConfig::get() {
+    uint32_t serial = __system_property_area_serial();
+    if (serial != mSerial.load(std::memory_order_acquire)
+            || !std::atomic_load(&mSnapshot)) {
+        Mutex::Autolock autoLock(mLock);
+        if (serial != mSerial.load(std::memory_order_relaxed) || !mSnapshot) {
+            reloadLocked(serial);
+        }
+    }
+    return std::atomic_load(&mSnapshot);
+}
+
+void TvInputConfig::reloadLocked(uint32_t serial) {
+    std::shared_ptr<TvInputConfigSnapshot> config = std::make_shared<TvInputConfigSnapshot>();
+    config->serial = serial;
+    config->debugLevel = property_get_int32(TV_INPUT_DEBUG_LEVEL, 0);
+    config->enableDump = property_get_int32(TV_INPUT_DEBUG_DUMP, 0);
+    config->dumpFrameCount = property_get_int32(TV_INPUT_DEBUG_DUMPNUM, 0);
+    config->dumpSerial = propertySerial(TV_INPUT_DEBUG_DUMP) + propertySerial(TV_INPUT_DEBUG_DUMPNUM);
+    config->pqEnable = property_get_int32(TV_INPUT_PQ_ENABLE, 0);
+    config->pqLuma = property_get_int32(TV_INPUT_PQ_LUMA, 0);
+    config->pqAutoDetection = property_get_int32(TV_INPUT_PQ_AUTO_DETECTION, 0);
+    property_get(TV_INPUT_PQ_RANGE, config->pqRange, "auto");
+    property_get(TV_INPUT_RESOLUTION_MAIN, config->resolutionMain, "");
+    std::atomic_store(&mSnapshot, std::shared_ptr<const TvInputConfigSnapshot>(config));
+    mSerial.store(serial, std::memory_order_release);
+    ALOGV("%s serial=%u debug=%d pq=%d luma=%d range=%s", __FUNCTION__, serial,
+        config->debugLevel, config->pqEnable, config->pqLuma, config->pqRange);
+}
+
+}  // namespace tvinput
+}  // namespace android
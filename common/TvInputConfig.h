@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#ifndef _TVINPUT_HAL_CONFIG_H_
+#define _TVINPUT_HAL_CONFIG_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <cutils/properties.h>
+#include <utils/Mutex.h>
+
+namespace android {
+namespace tvinput {
+
+// TV_INPUT_* properties read by the streaming threads, never modified once published
+struct TvInputConfigSnapshot {
+    uint32_t serial = 0;
+    int debugLevel = 0;
+    int enableDump = 0;
+    int dumpFrameCount = 0;
+    // moves whenever TV_INPUT_DEBUG_DUMP or _DUMPNUM is set, even to the same value
+    uint32_t dumpSerial = 0;
+    int pqEnable = 0;
+    int pqLuma = 0;
+    int pqAutoDetection = 0;
+    // TV_INPUT_PQ_RANGE, also read as TV_INPUT_HDMI_RANGE
+    char pqRange[PROPERTY_VALUE_MAX] = {0};
+    char resolutionMain[PROPERTY_VALUE_MAX] = {0};
+};
+
+/*
+ * Holds the current snapshot and reloads it only when the system property
+ * area serial moved, so a poll from a hot thread costs one atomic load
+ * while nothing changes.
+ */
+class TvInputConfig {
+ public:
+    TvInputConfig();
+
+    std::shared_ptr<const TvInputConfigSnapshot> get();
+
+ private:
+    TvInputConfig(const TvInputConfig& other);
+    TvInputConfig& operator=(const TvInputConfig& other);
+    void reloadLocked(uint32_t serial);
+
+    Mutex mLock;
+    std::atomic<uint32_t> mSerial;
+    std::shared_ptr<const TvInputConfigSnapshot> mSnapshot;
+};
+
+}  // namespace tvinput
+}  // namespace android
+
+#endif  // _TVINPUT_HAL_CONFIG_H_
@@ -250,6 +250,33 @@ class EXPORTED TvInputBufferManager {
   //    buffer size
   virtual int GetHandleBufferSize(buffer_handle_t handle) = 0;
 
+  // Decodes the metadata of |buffer| once so the Get*() queries above and
+  // below stop going through the mapper. Buffers from Allocate(), Register()
+  // and ImportBufferLocked() are cached already; buffers allocated elsewhere
+  // call this after allocation and ForgetMetadata() before they are freed,
+  // a recycled handle address would otherwise see stale values.
+  //
+  // Args:
+  //    |buffer|: The buffer handle to cache.
+  //
+  // Returns:
+  //    0 on success; corresponding error code on failure.
+  virtual int CacheMetadata(buffer_handle_t buffer) = 0;
+  virtual void ForgetMetadata(buffer_handle_t buffer) = 0;
+
+  // Records that |buffer| holds a |width| x |height| frame in the top left
+  // corner of its allocation. GetWidth()/GetHeight() answer the content size
+  // from then on, strides and sizes stay those of the allocation. Only for
+  // cached buffers, CacheMetadata() restores the allocated size.
+  //
+  // Args:
+  //    |buffer|: The buffer handle to update.
+  //    |width|, |height|: The content size, at most the allocated size.
+  //
+  // Returns:
+  //    0 on success; -EINVAL if |buffer| is not cached or too small.
+  virtual int SetContentSize(buffer_handle_t buffer, int width, int height) = 0;
+
   // Get the number of physical planes associated with |buffer|.
   //
   // Args:
@@ -18,6 +18,7 @@
 //#include "LogHelper.h"
 
 #include <linux/videodev2.h>
+#include <algorithm>
 
 using android::hardware::graphics::mapper::V4_0::Error;
 using android::hardware::graphics::mapper::V4_0::IMapper;
@@ -165,6 +166,10 @@ TvInputBufferManager* TvInputBufferManager::GetInstance() {
 // static
 int TvInputBufferManagerImpl::GetHalPixelFormat(buffer_handle_t buffer) {
     ALOGV("GetHalPixelFormat %p", buffer);
+    BufferMetadata metadata;
+    if (FindMetadata(buffer, &metadata)) {
+        return metadata.hal_format;
+    }
     auto &mapper = get_mapperservice();
     // android::PixelFormat format;    // *format_requested
     PixelFormat format;    // *format_requested
@@ -248,6 +253,10 @@ uint32_t TvInputBufferManager::GetV4L2PixelFormat(buffer_handle_t buffer) {
 
 int TvInputBufferManagerImpl::GetWidth(buffer_handle_t handle)
 {
+    BufferMetadata metadata;
+    if (FindMetadata(handle, &metadata)) {
+        return (int)metadata.width;
+    }
     auto &mapper = get_mapperservice();
     uint64_t width;
 
@@ -262,6 +271,10 @@ int TvInputBufferManagerImpl::GetWidth(buffer_handle_t handle)
 
 int TvInputBufferManagerImpl::GetHeight(buffer_handle_t handle)
 {
+    BufferMetadata metadata;
+    if (FindMetadata(handle, &metadata)) {
+        return (int)metadata.height;
+    }
     auto &mapper = get_mapperservice();
     uint64_t height;
 
@@ -276,6 +289,10 @@ int TvInputBufferManagerImpl::GetHeight(buffer_handle_t handle)
 
 int TvInputBufferManagerImpl::GetHandleBufferSize(buffer_handle_t handle) {
     ALOGV("GetHandleBufferSize handle:%p", handle);
+    BufferMetadata metadata;
+    if (FindMetadata(handle, &metadata)) {
+        return (int)metadata.allocation_size;
+    }
 
     auto &mapper = get_mapperservice();
     uint64_t bufferSize;
@@ -299,6 +316,17 @@ size_t TvInputBufferManager::GetPlaneStride(buffer_handle_t buffer,
         return 0;
     }
 
+    BufferMetadata metadata;
+    if (static_cast<TvInputBufferManagerImpl*>(GetInstance())->FindMetadata(buffer, &metadata)) {
+        if (metadata.hal_format == HAL_PIXEL_FORMAT_YCrCb_NV12_10) {
+            // same trick as below, the byte stride was passed in as width
+            return (int)metadata.width;
+        }
+        if (plane < metadata.layout_count) {
+            return metadata.plane_stride[plane];
+        }
+    }
+
     auto &mapper = get_mapperservice();
     std::vector<PlaneLayout> layouts;
     int format_requested;
@@ -349,6 +377,17 @@ size_t TvInputBufferManager::GetPlaneSize(buffer_handle_t buffer, size_t plane)
         return 0;
     }
 
+    BufferMetadata metadata;
+    if (static_cast<TvInputBufferManagerImpl*>(GetInstance())->FindMetadata(buffer, &metadata)) {
+        if (metadata.hal_format == HAL_PIXEL_FORMAT_YCrCb_NV12_10) {
+            // same trick as below, the byte stride was passed in as width
+            return (int)metadata.width;
+        }
+        if (plane < metadata.layout_count) {
+            return metadata.plane_size[plane];
+        }
+    }
+
     auto &mapper = get_mapperservice();
     std::vector<PlaneLayout> layouts;
     int format_requested;
@@ -481,15 +520,22 @@ int TvInputBufferManagerImpl::Allocate(size_t width,
 int TvInputBufferManagerImpl::Free(buffer_handle_t buffer) {
     ALOGD("Free %p", buffer);
 
-    auto context_it = buffer_context_.find(buffer);
-    if (context_it == buffer_context_.end()) {
+    BufferType type = GRALLOC;
+    bool found = buffer_context_.Edit(buffer, [&](BufferContextCache& contexts) {
+        auto context_it = contexts.find(buffer);
+        if (context_it == contexts.end()) {
+            return false;
+        }
+        type = context_it->second->type;
+        contexts.erase(context_it);
+        return true;
+    });
+    if (!found) {
         ALOGE("Failed Unknown buffer %p", buffer);
         return -EINVAL;
     }
 
-    auto buffer_context = context_it->second.get();
-
-    if (buffer_context->type == GRALLOC) {
+    if (type == GRALLOC) {
         #if IMPORTBUFFER_CB == 1
         if (buffer) {
             freeBuffer(buffer);           
@@ -534,15 +580,22 @@ int TvInputBufferManagerImpl::FreeLocked(buffer_handle_t buffer) {
 
 int TvInputBufferManagerImpl::Register(buffer_handle_t buffer, buffer_handle_t* outbuffer) {
     ALOGV("Register buffer:%p", buffer);
-    auto context_it = buffer_context_.find(buffer);
-    if (context_it != buffer_context_.end()) {
+    bool registered = buffer_context_.Edit(buffer, [&](BufferContextCache& contexts) {
+        auto context_it = contexts.find(buffer);
+        if (context_it == contexts.end()) {
+            return false;
+        }
         context_it->second->usage++;
+        return true;
+    });
+    if (registered) {
         return 1;
     }
 
     std::unique_ptr<BufferContext> buffer_context(new struct BufferContext);
 
     buffer_context->type = GRALLOC;
+    buffer_context->has_metadata = false;
 
     int ret = importBuffer(buffer, outbuffer);
 
@@ -554,7 +607,8 @@ int TvInputBufferManagerImpl::Register(buffer_handle_t buffer, buffer_handle_t*
     }
     
     buffer_context->usage = 1;
-    buffer_context_[*outbuffer] = std::move(buffer_context);
+    buffer_context->has_metadata = LoadMetadata(*outbuffer, &buffer_context->metadata) == 0;
+    buffer_context_.Insert(*outbuffer, std::move(buffer_context));
     ALOGV("Register buffer ok");
 
     return 0;
@@ -563,17 +617,34 @@ int TvInputBufferManagerImpl::Register(buffer_handle_t buffer, buffer_handle_t*
 int TvInputBufferManagerImpl::Deregister(buffer_handle_t buffer) {
     ALOGV("Deregister %p", buffer);
 
-    auto context_it = buffer_context_.find(buffer);
-    if (context_it == buffer_context_.end()) {
-        ALOGE("Failed Unknown buffer %p", buffer);
-        return -EINVAL;
+    BufferType type = GRALLOC;
+    uint64_t usage = 0;
+    int err = buffer_context_.Edit(buffer, [&](BufferContextCache& contexts) {
+        auto context_it = contexts.find(buffer);
+        if (context_it == contexts.end()) {
+            ALOGE("Failed Unknown buffer %p", buffer);
+            return -EINVAL;
+        }
+        auto buffer_context = context_it->second.get();
+        if (!buffer_context->usage) {
+            ALOGE("Deregister buffer %p that was not registered", buffer);
+            return -EINVAL;
+        }
+        type = buffer_context->type;
+        if (type == GRALLOC) {
+            usage = --buffer_context->usage;
+            if (!usage) {
+                contexts.erase(context_it);
+            }
+        }
+        return 0;
+    });
+    if (err) {
+        return err;
     }
-    auto buffer_context = context_it->second.get();
-    if (buffer_context->type == GRALLOC) {
-        if (!--buffer_context->usage) {
+    if (type == GRALLOC) {
+        if (!usage) {
             // Unmap all the existing mapping of bo.
-            buffer_context_.erase(context_it);
-
             int ret = freeBuffer(buffer);
 
             if (ret) {
@@ -583,7 +654,7 @@ int TvInputBufferManagerImpl::Deregister(buffer_handle_t buffer) {
         }
         return 0;
     } else {
-        ALOGE("Invalid buffer type: %d", buffer_context->type);
+        ALOGE("Invalid buffer type: %d", type);
         return -EINVAL;
     }
 }
@@ -604,6 +675,7 @@ int TvInputBufferManagerImpl::ImportBufferLocked(buffer_handle_t& rawHandle) {
 
     rawHandle = importedHandle;
     ALOGD("%s rawBuffer :%p, outHandle = %p", __FUNCTION__, rawHandle, importedHandle);
+    CacheMetadata(importedHandle);
     return 0;
 }
 
@@ -616,19 +688,18 @@ int TvInputBufferManagerImpl::Lockinternal(buffer_handle_t bufferHandle,
                                   void** out_addr) {
     ALOGV("lock buffer:%p   %d, %d, %d, %d, %d", bufferHandle, x, y,width, height, flags);
 
-    auto context_it = buffer_context_.find(bufferHandle);
-    if (context_it == buffer_context_.end()) {
+    BufferContext context;
+    if (!buffer_context_.Find(bufferHandle, &context)) {
         ALOGE("Failed Unknown buffer %p", bufferHandle);
         return -EINVAL;
     }
-    auto buffer_context = context_it->second.get();
 
     uint32_t num_planes = GetNumPlanes(bufferHandle);
     if (!num_planes) {
         return -EINVAL;
     }
 
-    if (buffer_context->type == GRALLOC) {
+    if (context.type == GRALLOC) {
         auto &mapper = get_mapperservice();
         auto buffer = const_cast<native_handle_t*>(bufferHandle);
         ALOGD("lock buffer:%p", &buffer);
@@ -656,7 +727,7 @@ int TvInputBufferManagerImpl::Lockinternal(buffer_handle_t bufferHandle,
 
         return (int)error;
     } else {
-        ALOGE("Invalid buffer type: %d", buffer_context->type);
+        ALOGE("Invalid buffer type: %d", context.type);
         return -EINVAL;
     }
 
@@ -666,13 +737,12 @@ int TvInputBufferManagerImpl::Lockinternal(buffer_handle_t bufferHandle,
 int TvInputBufferManagerImpl::Unlockinternal(buffer_handle_t bufferHandle) {
     ALOGV("Unlock buffer:%p", bufferHandle);
 
-    auto context_it = buffer_context_.find(bufferHandle);
-    if (context_it == buffer_context_.end()) {
+    BufferContext context;
+    if (!buffer_context_.Find(bufferHandle, &context)) {
         ALOGE("Failed Unknown buffer %p", bufferHandle);
         return -EINVAL;
     }
-    auto buffer_context = context_it->second.get();
-    if (buffer_context->type == GRALLOC) {
+    if (context.type == GRALLOC) {
         auto &mapper = get_mapperservice();
         auto buffer = const_cast<native_handle_t*>(bufferHandle);
         ALOGV("Unlock buffer:%p", buffer);
@@ -724,12 +794,11 @@ int TvInputBufferManagerImpl::Lock(buffer_handle_t bufferHandle,
                                   void** out_addr) {
     ALOGV("lock buffer:%p   %d, %d, %d, %d, %d", bufferHandle, x, y,width, height, flags);
 
-    auto context_it = buffer_context_.find(bufferHandle);
-    if (context_it == buffer_context_.end()) {
+    BufferContext context;
+    if (!buffer_context_.Find(bufferHandle, &context)) {
         ALOGE("Failed Unknown buffer %p", bufferHandle);
         return -EINVAL;
     }
-    auto buffer_context = context_it->second.get();
 
     uint32_t num_planes = GetNumPlanes(bufferHandle);
     if (!num_planes) {
@@ -740,7 +809,7 @@ int TvInputBufferManagerImpl::Lock(buffer_handle_t bufferHandle,
         return -EINVAL;
     }
 
-    if (buffer_context->type == GRALLOC) {
+    if (context.type == GRALLOC) {
         auto &mapper = get_mapperservice();
         auto buffer = const_cast<native_handle_t*>(bufferHandle);
         ALOGV("lock buffer:%p", &buffer);
@@ -768,7 +837,7 @@ int TvInputBufferManagerImpl::Lock(buffer_handle_t bufferHandle,
 
         return (int)error;
     } else {
-        ALOGE("Invalid buffer type: %d", buffer_context->type);
+        ALOGE("Invalid buffer type: %d", context.type);
         return -EINVAL;
     }
 
@@ -838,25 +907,24 @@ int TvInputBufferManagerImpl::LockYCbCr(buffer_handle_t buffer,
                                        struct android_ycbcr* out_ycbcr) {
     ALOGV("LockYCbCr");
 
-    auto context_it = buffer_context_.find(buffer);
-    if (context_it == buffer_context_.end()) {
+    BufferContext context;
+    if (!buffer_context_.Find(buffer, &context)) {
         ALOGE("Failed Unknown buffer %p", buffer);
         return -EINVAL;
     }
-    auto buffer_context = context_it->second.get();
     uint32_t num_planes = GetNumPlanes(buffer);
     if (!num_planes) {
         return -EINVAL;
     }
     if (num_planes < 2) {
-        //ALOGE("LockYCbCr called on single-planar buffer %lx", buffer_context->buffer_id);
+        //ALOGE("LockYCbCr called on single-planar buffer %lx", context.buffer_id);
         return -EINVAL;
     }
 
     //Todo wgh
     //DCHECK_LE(num_planes, 3u);
 
-    if (buffer_context->type == GRALLOC) {
+    if (context.type == GRALLOC) {
         auto &mapper = get_mapperservice();
         std::vector<PlaneLayout> planeLayouts;
         
@@ -961,13 +1029,12 @@ int TvInputBufferManagerImpl::LockYCbCr(buffer_handle_t buffer,
 int TvInputBufferManagerImpl::Unlock(buffer_handle_t bufferHandle) {
     ALOGV("Unlock buffer:%p", bufferHandle);
 
-    auto context_it = buffer_context_.find(bufferHandle);
-    if (context_it == buffer_context_.end()) {
+    BufferContext context;
+    if (!buffer_context_.Find(bufferHandle, &context)) {
         ALOGE("Failed Unknown buffer %p", bufferHandle);
         return -EINVAL;
     }
-    auto buffer_context = context_it->second.get();
-    if (buffer_context->type == GRALLOC) {
+    if (context.type == GRALLOC) {
         auto &mapper = get_mapperservice();
         auto buffer = const_cast<native_handle_t*>(bufferHandle);
         ALOGV("Unlock buffer:%p", buffer);
@@ -1083,6 +1150,10 @@ int TvInputBufferManagerImpl::FlushCache(buffer_handle_t buffer) {
 }
 
 int TvInputBufferManagerImpl::GetBufferId(buffer_handle_t buffer) {
+    BufferMetadata metadata;
+    if (FindMetadata(buffer, &metadata)) {
+        return (int32_t)metadata.buffer_id;
+    }
     uint64_t buffer_id = -1;
 
     auto &mapper = get_mapperservice();
@@ -1098,6 +1169,10 @@ int TvInputBufferManagerImpl::GetBufferId(buffer_handle_t buffer) {
 }
 
 int TvInputBufferManagerImpl::GetHandleFd(buffer_handle_t buffer) {
+    BufferMetadata metadata;
+    if (FindMetadata(buffer, &metadata) && metadata.fd >= 0) {
+        return metadata.fd;
+    }
     int fd = -1;
     auto &mapper = get_mapperservice();
     std::vector<int64_t> fds;
@@ -1116,6 +1191,124 @@ int TvInputBufferManagerImpl::GetHandleFd(buffer_handle_t buffer) {
     return fd;
 }
 
+int TvInputBufferManagerImpl::CacheMetadata(buffer_handle_t buffer) {
+    if (!buffer) {
+        return -EINVAL;
+    }
+    BufferMetadata metadata;
+    int err = LoadMetadata(buffer, &metadata);
+    if (err != android::OK) {
+        return err;
+    }
+
+    buffer_context_.Edit(buffer, [&](BufferContextCache& contexts) {
+        auto context_it = contexts.find(buffer);
+        if (context_it == contexts.end()) {
+            std::unique_ptr<BufferContext> buffer_context(new struct BufferContext);
+            buffer_context->buffer_id = reinterpret_cast<uint64_t>(buffer_context.get());
+            buffer_context->type = GRALLOC;
+            buffer_context->usage = 0;
+            context_it = contexts.emplace(buffer, std::move(buffer_context)).first;
+        }
+        context_it->second->metadata = metadata;
+        context_it->second->has_metadata = true;
+    });
+    ALOGV("CacheMetadata %p %" PRIu64 "x%" PRIu64 " format:%d size:%" PRIu64, buffer,
+          metadata.width, metadata.height, metadata.hal_format, metadata.allocation_size);
+    return 0;
+}
+
+void TvInputBufferManagerImpl::ForgetMetadata(buffer_handle_t buffer) {
+    buffer_context_.Edit(buffer, [&](BufferContextCache& contexts) {
+        auto context_it = contexts.find(buffer);
+        if (context_it == contexts.end()) {
+            return;
+        }
+        if (!context_it->second->usage) {
+            contexts.erase(context_it);
+        } else {
+            context_it->second->has_metadata = false;
+        }
+    });
+}
+
+int TvInputBufferManagerImpl::SetContentSize(buffer_handle_t buffer, int width, int height) {
+    if (!buffer || width <= 0 || height <= 0) {
+        return -EINVAL;
+    }
+    return buffer_context_.Edit(buffer, [&](BufferContextCache& contexts) {
+        auto context_it = contexts.find(buffer);
+        if (context_it == contexts.end() || !context_it->second->has_metadata) {
+            return -EINVAL;
+        }
+        BufferMetadata& metadata = context_it->second->metadata;
+        // NV12_10 carries its byte stride in width, see GetPlaneStride()
+        if ((uint64_t)width > metadata.alloc_width || (uint64_t)height > metadata.alloc_height
+                || metadata.hal_format == HAL_PIXEL_FORMAT_YCrCb_NV12_10) {
+            return -EINVAL;
+        }
+        metadata.width = width;
+        metadata.height = height;
+        return 0;
+    });
+}
+
+// static
+int TvInputBufferManagerImpl::LoadMetadata(buffer_handle_t buffer, BufferMetadata* metadata) {
+    auto &mapper = get_mapperservice();
+    PixelFormat format;
+    std::vector<PlaneLayout> layouts;
+    std::vector<int64_t> fds;
+
+    int err = get_metadata(mapper, buffer, MetadataType_Width, decodeWidth, &metadata->width);
+    if (err == android::OK) {
+        err = get_metadata(mapper, buffer, MetadataType_Height, decodeHeight, &metadata->height);
+    }
+    if (err == android::OK) {
+        err = get_metadata(mapper, buffer, MetadataType_PixelFormatRequested,
+                           decodePixelFormatRequested, &format);
+    }
+    if (err == android::OK) {
+        err = get_metadata(mapper, buffer, MetadataType_AllocationSize, decodeAllocationSize,
+                           &metadata->allocation_size);
+    }
+    if (err == android::OK) {
+        err = get_metadata(mapper, buffer, MetadataType_BufferId, decodeBufferId, &metadata->buffer_id);
+    }
+    if (err != android::OK) {
+        ALOGE("%s %p failed: %d", __FUNCTION__, buffer, err);
+        return err;
+    }
+    metadata->hal_format = (int)format;
+    metadata->alloc_width = metadata->width;
+    metadata->alloc_height = metadata->height;
+
+    // optional, the getters fall back to the mapper without them
+    metadata->layout_count = 0;
+    if (get_metadata(mapper, buffer, MetadataType_PlaneLayouts, decodePlaneLayouts, &layouts) == android::OK) {
+        metadata->layout_count = std::min(layouts.size(), BufferMetadata::kMaxPlanes);
+        for (size_t i = 0; i < metadata->layout_count; i++) {
+            metadata->plane_stride[i] = layouts[i].strideInBytes;
+            metadata->plane_size[i] = layouts[i].totalSizeInBytes;
+        }
+    }
+    metadata->fd = -1;
+    if (get_metadata(mapper, buffer, ArmMetadataType_PLANE_FDS, decodeArmPlaneFds, &fds) == android::OK
+            && !fds.empty()) {
+        metadata->fd = (int)fds[0];
+    }
+    return 0;
+}
+
+bool TvInputBufferManagerImpl::FindMetadata(buffer_handle_t buffer, BufferMetadata* metadata) {
+    BufferContext context;
+    if (!buffer_context_.Find(buffer, &context) || !context.has_metadata) {
+        return false;
+    }
+    *metadata = context.metadata;
+    return true;
+}
+
 int TvInputBufferManagerImpl::AllocateGrallocBuffer(size_t width,
                                                    size_t height,
                                                    uint32_t format,
@@ -1138,6 +1331,7 @@ int TvInputBufferManagerImpl::AllocateGrallocBuffer(size_t width,
 
     buffer_context->buffer_id = reinterpret_cast<uint64_t>(buffer_context.get());
     buffer_context->type = GRALLOC;
+    buffer_context->has_metadata = false;
 
     int bufferCount = 1;
     auto &allocator = get_allocservice();
@@ -1184,7 +1378,10 @@ int TvInputBufferManagerImpl::AllocateGrallocBuffer(size_t width,
 
     ALOGD("AllocateGrallocBuffer %p", *out_buffer);
     buffer_context->usage = 1;
-    buffer_context_[*out_buffer] = std::move(buffer_context);
+    if (error == android::NO_ERROR) {
+        buffer_context->has_metadata = LoadMetadata(*out_buffer, &buffer_context->metadata) == 0;
+    }
+    buffer_context_.Insert(*out_buffer, std::move(buffer_context));
 
     // make sure the kernel driver sees BC_FREE_BUFFER and closes the fds now
     android::hardware::IPCThreadState::self()->flushCommands();
@@ -8,6 +8,7 @@
 #define COMMON_TVINPUT_BUFFER_MANAGER_IMPL_H_
 
 #include "TvInput_Buffer_Manager.h"
+#include "BufferContextRegistry.h"
 
 #include <memory>
 #include <unordered_map>
@@ -26,6 +27,7 @@
 
 #include <cutils/native_handle.h>
 #include <utils/Errors.h>
+#include <utils/RWLock.h>
 
 #include <ui/PixelFormat.h>
 
@@ -41,16 +43,6 @@ namespace common {
 using android::status_t;
 using android::hardware::graphics::mapper::V4_0::IMapper;
 
-struct BufferContext {
-    uint64_t buffer_id;
-    BufferType type;
-    uint64_t usage;
-};
-
-typedef std::unordered_map<buffer_handle_t,
-        std::unique_ptr<struct BufferContext>>
-        BufferContextCache;
-
 class TvInputBufferManagerImpl final : public TvInputBufferManager {
 public:
     TvInputBufferManagerImpl();
@@ -99,10 +91,17 @@ public:
     int GetWidth(buffer_handle_t handle) final;
     int GetHeight(buffer_handle_t handle) final;
     int GetHalPixelFormat(buffer_handle_t buffer) final;
+    int CacheMetadata(buffer_handle_t buffer) final;
+    void ForgetMetadata(buffer_handle_t buffer) final;
+    int SetContentSize(buffer_handle_t buffer, int width, int height) final;
 
 private:
     friend class TvInputBufferManager;
 
+    static int LoadMetadata(buffer_handle_t buffer, BufferMetadata* metadata);
+    // false if |buffer| has no decoded metadata, the caller asks IMapper
+    bool FindMetadata(buffer_handle_t buffer, BufferMetadata* metadata);
+
     int AllocateGrallocBuffer(size_t width,
                               size_t height,
                               uint32_t format,
@@ -127,15 +126,9 @@ private:
                                       buffer_handle_t* outBufferHandle) const;
 	status_t freeBuffer(buffer_handle_t bufferHandle) const;
 
-    // Lock to guard access member variables.
-    //base::Lock lock_;
-
-    // ** Start of lock_ scope **
-
-    // A cache which stores all the context of the registered buffers.
-    BufferContextCache buffer_context_;
-
-    // ** End of lock_ scope **
+    // A cache which stores all the context of the registered buffers,
+    // locks itself.
+    BufferContextRegistry buffer_context_;
 
     //DISALLOW_COPY_AND_ASSIGN(TvInputBufferManagerImpl);
 };
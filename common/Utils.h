@@ -42,6 +42,8 @@
 #define SIDEBAND_PQ_BUFF_CNT SIDEBAND_WINDOW_BUFF_CNT
 #define SIDEBAND_IEP_BUFF_CNT SIDEBAND_WINDOW_BUFF_CNT
 #define PLANES_NUM 1
+// upper bound of the per stream queue depths, see tv_buffer_depths_t
+#define TV_INPUT_MAX_BUFF_CNT 8
 
 #define DEFAULT_V4L2_STREAM_WIDTH 1920
 #define DEFAULT_V4L2_STREAM_HEIGHT 1080
@@ -94,9 +96,30 @@ static const int64_t STREAM_BUFFER_GRALLOC_USAGE = (
 #define TV_INPUT_HDMI_RANGE "persist.vendor.tvinput.rkpq.range"
 #define TV_INPUT_HDMIIN_TYPE "vendor.tvinput.hdmiin.type"
 #define TV_INPUT_DISPLAY_RATIO "vendor.tvinput.displayratio"
+#define TV_INPUT_VSYNC_PACING "persist.vendor.tvinput.vsync.pacing"
+#define TV_INPUT_FB_CACHE_SIZE "persist.vendor.tvinput.fbcache.size"
+#define TV_INPUT_CAPTURE_BUFF_CNT "persist.vendor.tvinput.buffcnt.capture"
+#define TV_INPUT_CAPTURE_PQ_BUFF_CNT "persist.vendor.tvinput.buffcnt.capture.pq"
+#define TV_INPUT_PQ_BUFF_CNT "persist.vendor.tvinput.buffcnt.pq"
+#define TV_INPUT_IEP_BUFF_CNT "persist.vendor.tvinput.buffcnt.iep"
+#define TV_INPUT_RECORD_BUFF_CNT "persist.vendor.tvinput.buffcnt.record"
+// game mode, a capture ring of 2 unless pq is on or the depth is set
+#define TV_INPUT_LOW_LATENCY "persist.vendor.tvinput.lowlatency"
+// gralloc buffers kept across stream open/close, 0 disables the pool
+#define TV_INPUT_BUFFER_POOL_MB "persist.vendor.tvinput.bufpool.mb"
+// threads a cpu format conversion is split across, 1 keeps it on the caller
+#define TV_INPUT_CONVERT_THREADS "persist.vendor.tvinput.convert.threads"
+// skip the neon/sse2 conversion kernels, read once
+#define TV_INPUT_CONVERT_SCALAR "vendor.tvinput.convert.scalar"
+// replay a raw dump instead of opening the capture node, see ReplayCaptureBackend
+#define TV_INPUT_REPLAY_PATH "vendor.tvinput.replay.path"
+#define TV_INPUT_REPLAY_SIZE "vendor.tvinput.replay.size"
+#define TV_INPUT_REPLAY_FORMAT "vendor.tvinput.replay.format"
+#define TV_INPUT_REPLAY_FPS "vendor.tvinput.replay.fps"
 #define TV_INPUT_DEBUG_LEVEL "vendor.tvinput.debug.level"
 #define TV_INPUT_DEBUG_DUMP "vendor.tvinput.debug.dump"
 #define TV_INPUT_DEBUG_DUMPNUM "vendor.tvinput.debug.dumpnum"
+#define TV_INPUT_DUMP_DIR "/data/system/dumpimage"
 
 #define SIDEBAND_MODE_TYPE "vendor.hwc.enable_sideband_stream_2_mode"
 
@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "tv_input_DeviceRegistry"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#include <utils/Log.h>
+
+#include "V4L2DeviceRegistry.h"
+#include "rk-camera-module.h"
+
+namespace android {
+namespace tvinput {
+
+namespace {
+
+const char kDevicePath[] = "/dev/";
+constexpr char kPrefix[] = "video";
+constexpr int kPrefixLen = sizeof(kPrefix) - 1;
+constexpr char kCsiPrefix[] = "v4l-subdev";
+constexpr int kCsiPrefixLen = sizeof(kCsiPrefix) - 1;
+constexpr char kHdmiNodeName[] = "rk_hdmirx";
+constexpr char kCsiPreSubDevModule[] = "HDMI-MIPI";
+constexpr int kCsiPreSubDevModuleLen = sizeof(kCsiPreSubDevModule) - 1;
+constexpr char kCsiPreBusInfo[] = "platform:rkcif-mipi-lvds";
+
+bool isVideoName(const char *name) {
+    return !strncmp(kPrefix, name, kPrefixLen);
+}
+
+bool isSubdevName(const char *name) {
+    return !strncmp(kCsiPrefix, name, kCsiPrefixLen);
+}
+
+}  // namespace
+
+V4L2DeviceRegistry::V4L2DeviceRegistry()
+    : mInotifyFd(-1),
+      mScanned(false) {
+}
+
+V4L2DeviceRegistry::~V4L2DeviceRegistry() {
+    if (mInotifyFd >= 0) {
+        close(mInotifyFd);
+    }
+}
+
+bool V4L2DeviceRegistry::findHdmiRx(int input, std::string *videoPath, uint32_t *capabilities) {
+    Mutex::Autolock autoLock(mLock);
+    refresh();
+    std::vector<const std::string *> names;
+    hdmiRxNodesLocked(&names);
+    if (input < 0 || (size_t)input >= names.size()) {
+        return false;
+    }
+    *videoPath = kDevicePath + *names[input];
+    *capabilities = mNodes[*names[input]].capabilities;
+    return true;
+}
+
+bool V4L2DeviceRegistry::findHdmiCsi(int input, std::string *subdevPath, std::string *videoPath) {
+    Mutex::Autolock autoLock(mLock);
+    refresh();
+    std::vector<const std::string *> bridges;
+    hdmiCsiBridgesLocked(&bridges);
+    if (input < 0 || (size_t)input >= bridges.size()) {
+        return false;
+    }
+    const std::string *bridge = bridges[input];
+    const std::string &module = mNodes[*bridge].module;
+    // HDMI-MIPI0 sits on rkcif-mipi-lvds, HDMI-MIPIn on rkcif-mipi-lvdsn
+    std::string busInfo = kCsiPreBusInfo;
+    const char *suffix = strstr(module.c_str(), kCsiPreSubDevModule) + kCsiPreSubDevModuleLen;
+    if (*suffix && *suffix != '0') {
+        busInfo += *suffix;
+    }
+    ALOGD("%s %s module %s on %s", __FUNCTION__, bridge->c_str(), module.c_str(), busInfo.c_str());
+
+    const std::string *video = NULL;
+    int minIndex = INT32_MAX;
+    for (auto &it : mNodes) {
+        Node &node = it.second;
+        if (node.isSubdev) {
+            continue;
+        }
+        if (!node.probed) {
+            probe(it.first, node);
+        }
+        if (node.valid && node.busInfo == busInfo && node.index < minIndex) {
+            minIndex = node.index;
+            video = &it.first;
+        }
+    }
+    if (!video) {
+        return false;
+    }
+    *subdevPath = kDevicePath + *bridge;
+    *videoPath = kDevicePath + *video;
+    return true;
+}
+
+int V4L2DeviceRegistry::countInputs(bool csi) {
+    Mutex::Autolock autoLock(mLock);
+    refresh();
+    std::vector<const std::string *> names;
+    if (csi) {
+        hdmiCsiBridgesLocked(&names);
+    } else {
+        hdmiRxNodesLocked(&names);
+    }
+    return (int)names.size();
+}
+
+void V4L2DeviceRegistry::hdmiRxNodesLocked(std::vector<const std::string *> *names) {
+    std::vector<std::pair<int, const std::string *>> found;
+    for (auto &it : mNodes) {
+        Node &node = it.second;
+        if (node.isSubdev) {
+            continue;
+        }
+        if (!node.probed) {
+            probe(it.first, node);
+        }
+        if (node.valid && !strncmp(kHdmiNodeName, node.driver.c_str(), sizeof(kHdmiNodeName) - 1)) {
+            found.push_back(std::make_pair(node.index, &it.first));
+        }
+    }
+    // video2 before video10, the map is ordered by name
+    std::sort(found.begin(), found.end());
+    for (auto &it : found) {
+        names->push_back(it.second);
+    }
+}
+
+void V4L2DeviceRegistry::hdmiCsiBridgesLocked(std::vector<const std::string *> *names) {
+    std::vector<std::pair<std::string, const std::string *>> found;
+    for (auto &it : mNodes) {
+        Node &node = it.second;
+        if (!node.isSubdev) {
+            continue;
+        }
+        if (!node.probed) {
+            probe(it.first, node);
+        }
+        if (node.valid && strstr(node.module.c_str(), kCsiPreSubDevModule)) {
+            found.push_back(std::make_pair(node.module, &it.first));
+        }
+    }
+    // input n is the n-th bridge by module name, HDMI-MIPI0 first
+    std::sort(found.begin(), found.end());
+    for (auto &it : found) {
+        names->push_back(it.second);
+    }
+}
+
+void V4L2DeviceRegistry::invalidate(const std::string &path) {
+    Mutex::Autolock autoLock(mLock);
+    if (path.compare(0, sizeof(kDevicePath) - 1, kDevicePath) != 0) {
+        return;
+    }
+    auto it = mNodes.find(path.substr(sizeof(kDevicePath) - 1));
+    if (it != mNodes.end()) {
+        it->second.probed = false;
+    }
+}
+
+void V4L2DeviceRegistry::refresh() {
+    if (!mScanned) {
+        // watch before listing so nothing created in between is missed
+        mInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (mInotifyFd >= 0 && inotify_add_watch(mInotifyFd, kDevicePath,
+                IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+            ALOGW("%s watch %s failed: %s", __FUNCTION__, kDevicePath, strerror(errno));
+            close(mInotifyFd);
+            mInotifyFd = -1;
+        }
+        scan();
+        mScanned = true;
+    } else if (mInotifyFd < 0) {
+        scan();
+    } else {
+        drainEvents();
+    }
+}
+
+void V4L2DeviceRegistry::scan() {
+    mNodes.clear();
+    DIR *devdir = opendir(kDevicePath);
+    if (!devdir) {
+        ALOGE("%s: cannot open %s: %s", __FUNCTION__, kDevicePath, strerror(errno));
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(devdir)) != NULL) {
+        addNode(de->d_name);
+    }
+    closedir(devdir);
+}
+
+void V4L2DeviceRegistry::drainEvents() {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool overflow = false;
+    ssize_t len;
+    while ((len = read(mInotifyFd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+            } else if (event->len == 0) {
+                continue;
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                if (mNodes.erase(event->name)) {
+                    ALOGD("%s %s removed", __FUNCTION__, event->name);
+                }
+            } else {
+                // ueventd chmods after creating, IN_ATTRIB makes it probe again
+                addNode(event->name);
+            }
+        }
+    }
+    if (overflow) {
+        ALOGW("%s inotify overflow, rescanning %s", __FUNCTION__, kDevicePath);
+        scan();
+    }
+}
+
+void V4L2DeviceRegistry::addNode(const char *name) {
+    Node node;
+    node.isSubdev = isSubdevName(name);
+    if (!node.isSubdev && !isVideoName(name)) {
+        return;
+    }
+    node.probed = false;
+    node.valid = false;
+    node.index = atoi(name + (node.isSubdev ? kCsiPrefixLen : kPrefixLen));
+    node.capabilities = 0;
+    mNodes[name] = node;
+}
+
+void V4L2DeviceRegistry::probe(const std::string &name, Node &node) {
+    std::string path = kDevicePath + name;
+    node.probed = true;
+    node.valid = false;
+    if (!node.isSubdev) {
+        std::string gadget = "/sys/class/video4linux/" + name + "/function_name";
+        if (access(gadget.c_str(), F_OK) == 0) {
+            ALOGW("%s is uvc gadget device, don't open it!", path.c_str());
+            return;
+        }
+    }
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("%s open %s failed: %s", __FUNCTION__, path.c_str(), strerror(errno));
+        return;
+    }
+    if (!node.isSubdev) {
+        struct v4l2_capability cap;
+        memset(&cap, 0, sizeof(cap));
+        if (ioctl(fd, VIDIOC_QUERYCAP, &cap) == 0) {
+            node.driver.assign((const char *)cap.driver, strnlen((const char *)cap.driver, sizeof(cap.driver)));
+            node.busInfo.assign((const char *)cap.bus_info, strnlen((const char *)cap.bus_info, sizeof(cap.bus_info)));
+            node.capabilities = cap.capabilities;
+            node.valid = true;
+            ALOGD("%s %s driver=%s bus_info=%s caps=0x%08x", __FUNCTION__, path.c_str(),
+                node.driver.c_str(), node.busInfo.c_str(), node.capabilities);
+        } else {
+            ALOGE("VIDIOC_QUERYCAP %s Failed, error: %s", path.c_str(), strerror(errno));
+        }
+    } else {
+        uint32_t ishdmi = 0;
+        struct rkmodule_inf minfo;
+        memset(&minfo, 0, sizeof(minfo));
+        // only hdmi bridges are of interest, other subdevs stay valid with no module
+        if (ioctl(fd, RKMODULE_GET_HDMI_MODE, (void *)&ishdmi) == 0 && ishdmi
+                && ioctl(fd, RKMODULE_GET_MODULE_INFO, &minfo) == 0) {
+            node.module.assign(minfo.base.module, strnlen(minfo.base.module, sizeof(minfo.base.module)));
+            ALOGD("%s %s sensor name: %s, module name: %s", __FUNCTION__, path.c_str(),
+                minfo.base.sensor, node.module.c_str());
+        } else {
+            node.module.clear();
+        }
+        node.valid = true;
+    }
+    close(fd);
+}
+
+}  // namespace tvinput
+}  // namespace android
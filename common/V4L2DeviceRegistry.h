@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#ifndef _TVINPUT_HAL_V4L2_DEVICE_REGISTRY_H_
+#define _TVINPUT_HAL_V4L2_DEVICE_REGISTRY_H_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <utils/Mutex.h>
+
+namespace android {
+namespace tvinput {
+
+/*
+ * Cache of the /dev/video* and /dev/v4l-subdev* probe results. Nodes are
+ * probed once on the first lookup that needs them and kept up to date
+ * through an inotify watch on /dev, drained at each lookup, so finding
+ * the capture node again is a map walk without opening anything.
+ * Without inotify every lookup rescans.
+ */
+class V4L2DeviceRegistry {
+ public:
+    V4L2DeviceRegistry();
+    ~V4L2DeviceRegistry();
+
+    // capture node of the input-th rk_hdmirx, in /dev/videoN order
+    bool findHdmiRx(int input, std::string *videoPath, uint32_t *capabilities);
+    // input-th HDMI-MIPI bridge subdev and the lowest rkcif video node on its bus
+    bool findHdmiCsi(int input, std::string *subdevPath, std::string *videoPath);
+    // hdmi inputs of one kind on the board
+    int countInputs(bool csi);
+    // node failed to open, probe it again on the next lookup
+    void invalidate(const std::string &path);
+
+ private:
+    V4L2DeviceRegistry(const V4L2DeviceRegistry& other);
+    V4L2DeviceRegistry& operator=(const V4L2DeviceRegistry& other);
+
+    struct Node {
+        bool isSubdev;
+        bool probed;
+        bool valid;             // opened and answered the probe ioctls
+        int index;              // N of videoN / v4l-subdevN
+        std::string driver;     // v4l2_capability, video nodes
+        std::string busInfo;
+        uint32_t capabilities;
+        std::string module;     // rkmodule_inf, hdmi subdevs only
+    };
+
+    void refresh();
+    void scan();
+    void drainEvents();
+    void addNode(const char *name);
+    void probe(const std::string &name, Node &node);
+    void hdmiRxNodesLocked(std::vector<const std::string *> *names);
+    void hdmiCsiBridgesLocked(std::vector<const std::string *> *names);
+
+    Mutex mLock;
+    int mInotifyFd;
+    bool mScanned;
+    // keyed by the /dev entry name
+    std::map<std::string, Node> mNodes;
+};
+
+}  // namespace tvinput
+}  // namespace android
+
+#endif  // _TVINPUT_HAL_V4L2_DEVICE_REGISTRY_H_
@@ -25,6 +25,7 @@
 #include <cutils/properties.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -38,8 +39,6 @@ using namespace android;
 #define _ALIGN(x, a) (((x) + (a)-1) & ~((a)-1))
 
 uint32_t enc_debug = 0;
-RKMppEncApi::EncCfgInfo_t encInfo;
-uint32_t mFrameCount = 0;
 
 char videoPath[30] = "/data/video/";
 
@@ -114,12 +113,14 @@ bool MppEncodeServer::init(MetaInfo *meta) {
 bool MppEncodeServer::setNotifyCallback(NotifyCallback callback,
                                         void *userdata) {
     mNotifyCallback = callback;
-    (void)userdata;
+    mNotifyUserdata = userdata;
     return true;
 }
 
 // TODO: Expand the parameters
 bool MppEncodeServer::initOther(MetaInfo *meta) {
+    RKMppEncApi::EncCfgInfo_t encInfo;
+    memset(&encInfo, 0, sizeof(encInfo));
     encInfo.width = meta->width;
     encInfo.height = meta->height;
     encInfo.scaleWidth = _ALIGN((meta->width) / 2, 2);
@@ -346,9 +347,6 @@ void MppEncodeServer::WorkHandler::onMessageReceived(const sp<AMessage> &msg) {
     }
 }
 
-extern nsecs_t now;
-extern nsecs_t mLastTime;
-extern nsecs_t diff;
 bool MppEncodeServer::processQueue() {
     Trace();
     bool ret = false;
@@ -356,13 +354,9 @@ bool MppEncodeServer::processQueue() {
 
     memset(&entry, 0, sizeof(RKMppEncApi::OutWorkEntry));
 
-    // mLastTime = systemTime();
     ALOGD("zj add file: %s func %s line %d \n",__FILE__,__FUNCTION__,__LINE__);
     ret = mEncoder->getoutpacket(&entry);
     ALOGD("zj add file: %s func %s line %d \n",__FILE__,__FUNCTION__,__LINE__);
-    now = systemTime();
-    diff = now - mLastTime;
-    // ALOGD("getoutpacket diff %" PRIu64, diff);
     if (ret == true && NULL != entry.outPacket) {
         void *data = mpp_packet_get_data(entry.outPacket);
         size_t len = mpp_packet_get_length(entry.outPacket);
@@ -376,7 +370,7 @@ bool MppEncodeServer::processQueue() {
         return false;
     }
 
-    mNotifyCallback.onInputAvailable(entry.index);
+    mNotifyCallback.onInputAvailable(mNotifyUserdata, entry.index);
 
     if (NULL != entry.outPacket) {
         mpp_packet_deinit(&entry.outPacket);
@@ -35,11 +35,10 @@ using namespace android;
 
 /**
  * Called when an input buffer becomes available.
- * The specified index is the index of the available input buffer.
+ * The specified index is the index of the available input buffer,
+ * user is the userdata given to setNotifyCallback().
  */
-typedef void (*OnInputAvailable)(int32_t fd);
-
-void OnInputAvailableCB(int32_t fd);
+typedef void (*OnInputAvailable)(void* user, int32_t index);
 
 typedef struct NotifyCallback {
     OnInputAvailable onInputAvailable;
@@ -74,6 +73,7 @@ class MppEncodeServer : public std::enable_shared_from_this<MppEncodeServer>,
 
     RKMppEncApi* mEncoder;
     NotifyCallback mNotifyCallback;
+    void* mNotifyUserdata = nullptr;
     FILE* mInputFile = nullptr;
     FILE* mOutputFile = nullptr;
     // This is used by one thread to tell another thread to exit. So it must be
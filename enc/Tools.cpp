@@ -29,10 +29,13 @@
 #include <sys/mman.h>
 #include <sys/system_properties.h>
 #include <unistd.h>
+#include <mutex>
 #include "Tools.h"
 #include "mpp_mem.h"
+#include "common/PixelConvert.h"
 
-static int rga_init = 0;
+// process-wide, the encoders of both inputs convert through it
+static std::once_flag rga_init;
 
 void dump_mpp_frame_to_file(MppFrame frame, FILE* fp) {
     int width = 0;
@@ -231,11 +234,10 @@ MPP_RET crop_yuv_image(uint8_t* src,
     int srcFormat, dstFormat;
     rga_info_t rgasrc, rgadst;
 
-    if (!rga_init) {
+    std::call_once(rga_init, [&rga_ctx]() {
         RgaInit(&rga_ctx);
-        rga_init = 1;
         ALOGD("init rga ctx done");
-    }
+    });
 
     srcFormat = dstFormat = HAL_PIXEL_FORMAT_YCrCb_NV12;
 
@@ -494,45 +496,17 @@ void yuyv_to_nv12(char* image_in,
                   int width,
                   int height,
                   unsigned long int filesize) {
-    /* 计算循环次数，YUYV 一个像素点占2个字节*/
+    using android::tvinput::PixelConvert;
+    /* YUYV 一个像素点占2个字节, filesize 可能包含多帧 */
     int pixNUM = width * height;
     unsigned int cycleNum = filesize / pixNUM / 2;
 
-    /*单帧图像中 NV12格式的输出图像 Y分量 和 UV 分量的起始地址，并初始化*/
-    char* y = image_out;
-    char* uv = image_out + pixNUM;
-
-    char* start = image_in;
-    unsigned int i = 0;
-    int j = 0, k = 0;
-
-    /*处理Y分量*/
-    for (i = 0; i < cycleNum; i++) {
-        int index = 0;
-        for (j = 0; j < pixNUM * 2; j = j + 2)  // YUYV单行中每两个字节一个Y分量
-        {
-            *(y + index) = *(start + j);
-            index++;
-        }
-        start = image_in + pixNUM * 2 * i;
-        y = y + pixNUM * 3 / 2;
+    for (unsigned int i = 0; i < cycleNum; i++) {
+        uint8_t* in = (uint8_t*)image_in + (size_t)pixNUM * 2 * i;
+        uint8_t* out = (uint8_t*)image_out + (size_t)pixNUM * 3 / 2 * i;
+        PixelConvert::Image src = PixelConvert::layout(V4L2_PIX_FMT_YUYV, in, width, height);
+        PixelConvert::Image dst = PixelConvert::layout(V4L2_PIX_FMT_NV12, out, width, height);
+        PixelConvert::convert(V4L2_PIX_FMT_YUYV, src, V4L2_PIX_FMT_NV12, dst,
+                              width, height, 0, PixelConvert::rowCount(height));
     }
-
-    /**处理UV分量**/
-    start = image_in;
-    for (i = 0; i < cycleNum; i++) {
-        int uv_index = 0;
-        for (j = 0; j < height; j = j + 2)  // 隔行, 我选择保留偶数行
-        {
-            for (k = j * width * 2 + 1; k < width * 2 * (j + 1);
-                 k = k + 4)  // YUYV单行中每四个字节含有一对UV分量
-            {
-                *(uv + uv_index) = *(start + k);
-                *(uv + uv_index + 1) = *(start + k + 2);
-                uv_index += 2;
-            }
-        }
-        start = image_in + pixNUM * 2 * i;
-        uv = uv + pixNUM * 3 / 2;
-    }
-}
\ No newline at end of file
+}
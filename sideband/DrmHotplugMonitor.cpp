@@ -0,0 +1,188 @@
+/*
+ * Copyright 2019 Rockchip Electronics Co. LTD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "tv_input_Hotplug"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <cutils/uevent.h>
+#include "log/log.h"
+
+#include "DrmHotplugMonitor.h"
+
+namespace android {
+
+#define UEVENT_MSG_LEN 2048
+
+DrmHotplugMonitor::DrmHotplugMonitor()
+    : mUeventFd(-1),
+    mOwnSocket(false),
+    mRunning(false),
+    mListening(false),
+    mDirty(false),
+    mLastEventTime(0)
+{
+    mWakePipe[0] = -1;
+    mWakePipe[1] = -1;
+}
+
+DrmHotplugMonitor::~DrmHotplugMonitor()
+{
+    stop();
+}
+
+bool DrmHotplugMonitor::start()
+{
+    int fd = uevent_open_socket(64 * 1024, true);
+    if (fd < 0) {
+        ALOGE("%s failed to open uevent socket, %s", __FUNCTION__, strerror(errno));
+        return false;
+    }
+    if (!startThread(fd, true)) {
+        close(fd);
+        return false;
+    }
+    return true;
+}
+
+bool DrmHotplugMonitor::start(int ueventFd)
+{
+    return startThread(ueventFd, false);
+}
+
+bool DrmHotplugMonitor::startThread(int ueventFd, bool ownSocket)
+{
+    if (mRunning) {
+        return true;
+    }
+    if (pipe2(mWakePipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        ALOGE("%s failed to create pipe, %s", __FUNCTION__, strerror(errno));
+        return false;
+    }
+    mUeventFd = ueventFd;
+    mOwnSocket = ownSocket;
+    mListening.store(true, std::memory_order_release);
+    if (run("Tif_Hotplug", PRIORITY_DISPLAY) != NO_ERROR) {
+        ALOGE("%s failed to run hotplug thread", __FUNCTION__);
+        close(mWakePipe[0]);
+        close(mWakePipe[1]);
+        mWakePipe[0] = mWakePipe[1] = -1;
+        mUeventFd = -1;
+        mOwnSocket = false;
+        mListening.store(false, std::memory_order_release);
+        return false;
+    }
+    mRunning = true;
+    return true;
+}
+
+void DrmHotplugMonitor::stop()
+{
+    if (!mRunning) {
+        return;
+    }
+    requestExit();
+    if (write(mWakePipe[1], "q", 1) < 0) {
+        ALOGW("%s failed to wake hotplug thread, %s", __FUNCTION__, strerror(errno));
+    }
+    join();
+    close(mWakePipe[0]);
+    close(mWakePipe[1]);
+    mWakePipe[0] = mWakePipe[1] = -1;
+    if (mOwnSocket) {
+        close(mUeventFd);
+    }
+    mUeventFd = -1;
+    mOwnSocket = false;
+    mRunning = false;
+    mListening.store(false, std::memory_order_release);
+}
+
+void DrmHotplugMonitor::markDirty()
+{
+    mLastEventTime.store(systemTime(), std::memory_order_release);
+    mDirty.store(true, std::memory_order_release);
+}
+
+bool DrmHotplugMonitor::handleUevent(const char *msg, int len)
+{
+    bool isDrm = false;
+    bool isHotplug = false;
+    const char *end = msg + len;
+    while (msg < end && *msg) {
+        if (!strcmp(msg, "SUBSYSTEM=drm")) {
+            isDrm = true;
+        } else if (!strcmp(msg, "HOTPLUG=1")) {
+            isHotplug = true;
+        }
+        msg += strnlen(msg, end - msg) + 1;
+    }
+    if (isDrm && isHotplug) {
+        ALOGD("%s drm hotplug event", __FUNCTION__);
+        markDirty();
+        return true;
+    }
+    return false;
+}
+
+bool DrmHotplugMonitor::threadLoop()
+{
+    struct pollfd fds[2];
+    fds[0].fd = mWakePipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = mUeventFd;
+    fds[1].events = POLLIN;
+
+    int ret = poll(fds, 2, -1);
+    if (ret < 0) {
+        if (errno == EINTR) {
+            return true;
+        }
+        ALOGE("%s poll failed, %s", __FUNCTION__, strerror(errno));
+        mListening.store(false, std::memory_order_release);
+        return false;
+    }
+    if (fds[0].revents) {
+        return false;
+    }
+    if (fds[1].revents & POLLIN) {
+        char msg[UEVENT_MSG_LEN + 2];
+        ssize_t n = mOwnSocket ? uevent_kernel_multicast_recv(mUeventFd, msg, UEVENT_MSG_LEN)
+                               : read(mUeventFd, msg, UEVENT_MSG_LEN);
+        if (n > 0 && n <= UEVENT_MSG_LEN) {
+            msg[n] = '\0';
+            msg[n + 1] = '\0';
+            handleUevent(msg, n);
+        } else if (n == 0 && !mOwnSocket) {
+            // end of an injected source, POLLIN stays set and would spin here
+            ALOGE("%s uevent source closed", __FUNCTION__);
+            mListening.store(false, std::memory_order_release);
+            return false;
+        }
+    } else if (fds[1].revents & (POLLHUP | POLLERR)) {
+        ALOGE("%s uevent source closed", __FUNCTION__);
+        mListening.store(false, std::memory_order_release);
+        return false;
+    }
+    return true;
+}
+
+} // namespace android
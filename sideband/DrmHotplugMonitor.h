@@ -0,0 +1,69 @@
+/*
+ * Copyright 2019 Rockchip Electronics Co. LTD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __DRM_HOTPLUG_MONITOR_H__
+#define __DRM_HOTPLUG_MONITOR_H__
+
+#include <atomic>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+/*
+ * Listens for drm hotplug uevents and raises a "topology dirty" flag,
+ * so the frame path only has to read an atomic.
+ *
+ * start() opens the kernel uevent netlink socket. start(fd) reads raw
+ * uevent messages from any fd instead (e.g. one end of a socketpair),
+ * which allows feeding fake events on a host.
+ */
+class DrmHotplugMonitor : public Thread {
+public:
+    DrmHotplugMonitor();
+    virtual ~DrmHotplugMonitor();
+
+    bool start();
+    bool start(int ueventFd);
+    void stop();
+    // false if the uevent source failed, callers should fall back to polling
+    bool isListening() { return mListening.load(std::memory_order_acquire); }
+
+    bool isDirty() { return mDirty.load(std::memory_order_acquire); }
+    void markDirty();
+    void clearDirty() { mDirty.store(false, std::memory_order_release); }
+    nsecs_t lastEventTime() { return mLastEventTime.load(std::memory_order_acquire); }
+
+    // returns true if msg is a drm hotplug event, msg is NUL separated KEY=VALUE
+    bool handleUevent(const char *msg, int len);
+
+private:
+    bool startThread(int ueventFd, bool ownSocket);
+    virtual bool threadLoop();
+
+    int mUeventFd;
+    bool mOwnSocket;
+    bool mRunning;
+    int mWakePipe[2];
+    std::atomic<bool> mListening;
+    std::atomic<bool> mDirty;
+    std::atomic<nsecs_t> mLastEventTime;
+};
+
+} // namespace android
+
+#endif /* __DRM_HOTPLUG_MONITOR_H__ */
@@ -1,17 +1,20 @@
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
+#include <inttypes.h>
+#include <algorithm>
 #include "DrmVopRender.h"
 #include "log/log.h"
 #include <unistd.h>
 
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <cutils/properties.h>
+#include <sync/sync.h>
 
 #include "common/TvInput_Buffer_Manager.h"
 #include "common/Utils.h"
 
-#define HAS_ATOMIC 1
-
 #define PROPERTY_TYPE "vendor"
 
 #ifdef LOG_TAG
@@ -23,26 +26,56 @@ namespace android {
 
 #define ALIGN_DOWN( value, base)     (value & (~(base-1)) )
 #define ALIGN(x, a) (((x) + (a)-1) & ~((a)-1))
+#define COMMIT_FENCE_TIMEOUT_MS 50
+
+// every input has its own render, a sideband plane is driven by one of them
+static Mutex sPlaneOwnerLock;
+static std::map<int, const DrmVopRender *> sPlaneOwners;
+
+static bool claimPlane(int planeId, const DrmVopRender *render) {
+    Mutex::Autolock autoLock(sPlaneOwnerLock);
+    auto it = sPlaneOwners.find(planeId);
+    if (it != sPlaneOwners.end()) {
+        return it->second == render;
+    }
+    sPlaneOwners[planeId] = render;
+    return true;
+}
+
+static bool isPlaneOfOther(int planeId, const DrmVopRender *render) {
+    Mutex::Autolock autoLock(sPlaneOwnerLock);
+    auto it = sPlaneOwners.find(planeId);
+    return it != sPlaneOwners.end() && it->second != render;
+}
+
+static void releasePlanes(const DrmVopRender *render) {
+    Mutex::Autolock autoLock(sPlaneOwnerLock);
+    for (auto it = sPlaneOwners.begin(); it != sPlaneOwners.end();) {
+        if (it->second == render) {
+            it = sPlaneOwners.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
 
 DrmVopRender::DrmVopRender()
     : mDrmFd(0),
     mSidebandPlaneId(0)
 {
     memset(&mOutputs, 0, sizeof(mOutputs));
+    memset(&mPresentStats, 0, sizeof(mPresentStats));
     ALOGE("DrmVopRender");
 }
 
 DrmVopRender::~DrmVopRender()
 {
    // WARN_IF_NOT_DEINIT();
+    deinitialize();
+    releasePlanes(this);
     ALOGE("DrmVopRender delete ");
 }
 
-DrmVopRender* DrmVopRender::GetInstance() {
-    static DrmVopRender instance;
-    return &instance;
-}
-
 bool DrmVopRender::initialize()
 {
     Mutex::Autolock autoLock(mVopPlaneLock);
@@ -61,16 +94,20 @@ bool DrmVopRender::initialize()
     }
     ALOGE("mDrmFd = %d", mDrmFd);
 
-    for (const auto &fbidMap : mFbidMap) {
-        int fbid = fbidMap.second;
-        ALOGE("%s find last fbid=%d", __FUNCTION__, fbid);
-        if (drmModeRmFB(mDrmFd, fbid))
-            ALOGE("Failed to rm fb %d", fbid);
-    }
-    mFbidMap.clear();
+    // fbs of a previous fd are gone with it
+    mFbCache.clear();
+    int32_t configured = property_get_int32(TV_INPUT_FB_CACHE_SIZE, DEFAULT_FB_CACHE_SIZE);
+    mFbCacheConfigured = configured > 0 ? configured : 0;
+    mFbCacheCapacity = std::max(mFbCacheConfigured, mFbCacheReserved);
 
     memset(&mOutputs, 0, sizeof(mOutputs));
     mInitialized = true;
+    if (mHotplugMonitor == NULL) {
+        mHotplugMonitor = new DrmHotplugMonitor();
+    }
+    if (!mHotplugMonitor->start()) {
+        ALOGE("hotplug monitor unavailable, poll display properties per frame");
+    }
     int ret = hw_get_module(GRALLOC_HARDWARE_MODULE_ID,
                       (const hw_module_t **)&gralloc_);
 
@@ -87,34 +124,70 @@ void DrmVopRender::deinitialize()
 {
     ALOGE("deinitialize in");
     if(!mInitialized) return;
+    if (mHotplugMonitor != NULL) {
+        mHotplugMonitor->stop();
+        mHotplugMonitor->clearDirty();
+    }
     Mutex::Autolock autoLock(mVopPlaneLock);
+    if (mLastCommitFence >= 0) {
+        close(mLastCommitFence);
+        mLastCommitFence = -1;
+    }
+    mInflightFlip = false;
     for (int i = 0; i < OUTPUT_MAX; i++) {
         resetOutput(i);
     }
 
+    clearFbCacheLocked();
+    dumpFbCacheStats();
     if (mDrmFd) {
         close(mDrmFd);
         mDrmFd = 0;
     }
 
-    for (const auto &fbidMap : mFbidMap) {
-        int fbid = fbidMap.second;
-        if (drmModeRmFB(mDrmFd, fbid))
-            ALOGE("Failed to rm fb");
-    }
-
     mInitialized = false;
 }
 
 void DrmVopRender::DestoryFB() {
     Mutex::Autolock autoLock(mVopPlaneLock);
-    for (const auto &fbidMap : mFbidMap) {
-        int fbid = fbidMap.second;
-        ALOGV("%s fbid=%d", __FUNCTION__, fbid);
-        if (drmModeRmFB(mDrmFd, fbid))
-            ALOGE("Failed to rm fb");
+    clearFbCacheLocked();
+}
+
+void DrmVopRender::releaseFbLocked(const FbCacheEntry_t &entry) {
+    ALOGV("%s fbid=%d", __FUNCTION__, entry.fb_id);
+    if (drmModeRmFB(mDrmFd, entry.fb_id))
+        ALOGE("Failed to rm fb %d", entry.fb_id);
+    // the gem handle is shared by every fb of the same dmabuf
+    for (const auto &other : mFbCache) {
+        if (&other != &entry && other.gem_handle == entry.gem_handle) {
+            return;
+        }
+    }
+    struct drm_gem_close gemClose;
+    memset(&gemClose, 0, sizeof(gemClose));
+    gemClose.handle = entry.gem_handle;
+    if (drmIoctl(mDrmFd, DRM_IOCTL_GEM_CLOSE, &gemClose))
+        ALOGE("Failed to close gem handle %d", entry.gem_handle);
+}
+
+void DrmVopRender::clearFbCacheLocked() {
+    while (!mFbCache.empty()) {
+        releaseFbLocked(mFbCache.back());
+        mFbCache.pop_back();
+    }
+}
+
+void DrmVopRender::evictFbLocked() {
+    while (mFbCache.size() >= mFbCacheCapacity) {
+        releaseFbLocked(mFbCache.back());
+        mFbCache.pop_back();
+        mFbCacheEvictions++;
     }
-    mFbidMap.clear();
+}
+
+void DrmVopRender::dumpFbCacheStats() {
+    ALOGD("fb cache size=%zu/%zu hits=%" PRIu64 " misses=%" PRIu64 " evictions=%" PRIu64,
+        mFbCache.size(), mFbCacheCapacity, mFbCacheHits, mFbCacheMisses, mFbCacheEvictions);
 }
 
 bool DrmVopRender::detect() {
@@ -134,6 +207,7 @@ bool DrmVopRender::detect(int device)
     if (outputIndex < 0 ) {
         return false;
     }
+    mSidebandPlaneCached = false;
 
     char prop_name[PROPERTY_VALUE_MAX] = {0};
     char prop_value[PROPERTY_VALUE_MAX] = {0};
@@ -204,10 +278,10 @@ bool DrmVopRender::detect(int device)
         ALOGE("Failed to set atomic cap %s", strerror(errno));
         return ret;
     }
-    ret = drmSetClientCap(mDrmFd, DRM_CLIENT_CAP_ATOMIC, 1);
-    if (ret) {
-        ALOGE("Failed to set atomic cap %s", strerror(errno));
-        return ret;
+    // kernels without atomic modesetting still take legacy setplane
+    mHasAtomic = drmSetClientCap(mDrmFd, DRM_CLIENT_CAP_ATOMIC, 1) == 0;
+    if (!mHasAtomic) {
+        ALOGW("no atomic cap %s, using legacy setplane", strerror(errno));
     }
 
     output->res = resources;
@@ -415,6 +489,16 @@ bool DrmVopRender::detect(int device)
 
     drmModeFreeResources(resources);
 
+    if (output->connected) {
+        // plane topology only changes on hotplug, resolve it once here
+        int planeId = FindSidebandPlaneLocked(device);
+        if (planeId > 0) {
+            mSidebandPlaneId = planeId;
+            mSidebandPlaneCached = true;
+        }
+        ALOGD("%s sideband plane id=%d", __FUNCTION__, planeId);
+    }
+
     return ret;
 }
 
@@ -461,6 +545,18 @@ uint32_t DrmVopRender::ConvertHalFormatToDrm(uint32_t hal_format) {
 
 int DrmVopRender::FindSidebandPlane(int device) {
     Mutex::Autolock autoLock(mVopPlaneLock);
+    if (mSidebandPlaneCached) {
+        return mSidebandPlaneId;
+    }
+    // hwc may not have marked the plane yet when detect() ran
+    int planeId = FindSidebandPlaneLocked(device);
+    if (planeId > 0) {
+        mSidebandPlaneCached = true;
+    }
+    return planeId;
+}
+
+int DrmVopRender::FindSidebandPlaneLocked(int device) {
     drmModePlanePtr plane;
     drmModeObjectPropertiesPtr props;
     drmModePropertyPtr prop;
@@ -481,6 +577,7 @@ int DrmVopRender::FindSidebandPlane(int device) {
         return false;
     }
     int plandIdCount = 0;
+    releasePlanes(this);
     if (!output->mDrmModeInfos.empty()) {
         for (int i=0; i<output->mDrmModeInfos.size(); i++) {
             output->mDrmModeInfos[i].plane_id = -1;
@@ -501,14 +598,15 @@ int DrmVopRender::FindSidebandPlane(int device) {
             ALOGE("Failed to found props plane[%d] %s\n",plane->plane_id, strerror(errno));
            return -ENODEV;
         }
-        int plane_id;
+        int plane_id = 0;
         for (uint32_t j = 0; j < props->count_props; j++) {
             prop = drmModeGetProperty(mDrmFd, props->props[j]);
             if (!strcmp(prop->name, "ASYNC_COMMIT")) {
                 if (mDebugLevel == 3) {
                     ALOGE("find ASYNC_COMMIT plane id=%d value=%lld====%d-%d", plane->plane_id, (long long)props->prop_values[j], i, j);
                 }
-                if (props->prop_values[j] != 0) {
+                // hwc marks one plane per sideband layer, skip the other inputs' planes
+                if (props->prop_values[j] != 0 && !isPlaneOfOther(plane->plane_id, this)) {
                     plane_id = plane->plane_id;
                 }
             } else if (plane_id > 0 && !strcmp(prop->name, "NAME")) {
@@ -519,8 +617,13 @@ int DrmVopRender::FindSidebandPlane(int device) {
                         strncpy(plane_name, prop->enums[0].name, strlen(prop->enums[0].name)-strlen(win_name));
                         for (int k=0; k<output->mDrmModeInfos.size(); k++) {
                             ALOGV("crtc_plane_mask=%s  plane_name=%s", output->mDrmModeInfos[k].crtc_plane_mask, plane_name);
-                            if (strstr(output->mDrmModeInfos[k].crtc_plane_mask, plane_name)) {
+                            if (strstr(output->mDrmModeInfos[k].crtc_plane_mask, plane_name)
+                                    && output->mDrmModeInfos[k].plane_id < 0
+                                    && claimPlane(plane_id, this)) {
                                 output->mDrmModeInfos[k].plane_id = plane_id;
+                                initPlaneProps(plane_id, &output->mDrmModeInfos[k].plane_props,
+                                    &output->mDrmModeInfos[k].out_fence_ptr_prop,
+                                    output->mDrmModeInfos[k].crtc->crtc_id);
                                 ALOGV("set plan_id=%d crtc_id=%d to pos=%d", plane_id, output->mDrmModeInfos[k].crtc->crtc_id, k);
                                 find_plan_id = plane_id;
                                 plandIdCount--;
@@ -545,6 +648,62 @@ int DrmVopRender::FindSidebandPlane(int device) {
     return find_plan_id;
 }
 
+void DrmVopRender::initPlaneProps(int planeId, plane_prop *planeProps, int *outFencePtrProp, uint32_t crtcId) {
+    memset(planeProps, 0, sizeof(plane_prop));
+    *outFencePtrProp = 0;
+    drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(mDrmFd, planeId, DRM_MODE_OBJECT_PLANE);
+    if (props) {
+        for (uint32_t i = 0; i < props->count_props; i++) {
+            drmModePropertyPtr prop = drmModeGetProperty(mDrmFd, props->props[i]);
+            if (!prop) {
+                continue;
+            }
+            int id = (int)prop->prop_id;
+            if (!strcmp(prop->name, "CRTC_ID")) {
+                planeProps->crtc_id = id;
+            } else if (!strcmp(prop->name, "FB_ID")) {
+                planeProps->fb_id = id;
+            } else if (!strcmp(prop->name, "SRC_X")) {
+                planeProps->src_x = id;
+            } else if (!strcmp(prop->name, "SRC_Y")) {
+                planeProps->src_y = id;
+            } else if (!strcmp(prop->name, "SRC_W")) {
+                planeProps->src_w = id;
+            } else if (!strcmp(prop->name, "SRC_H")) {
+                planeProps->src_h = id;
+            } else if (!strcmp(prop->name, "CRTC_X")) {
+                planeProps->crtc_x = id;
+            } else if (!strcmp(prop->name, "CRTC_Y")) {
+                planeProps->crtc_y = id;
+            } else if (!strcmp(prop->name, "CRTC_W")) {
+                planeProps->crtc_w = id;
+            } else if (!strcmp(prop->name, "CRTC_H")) {
+                planeProps->crtc_h = id;
+            } else if (!strcmp(prop->name, "zpos")) {
+                planeProps->zpos = id;
+            }
+            drmModeFreeProperty(prop);
+        }
+        drmModeFreeObjectProperties(props);
+    }
+    props = drmModeObjectGetProperties(mDrmFd, crtcId, DRM_MODE_OBJECT_CRTC);
+    if (props) {
+        for (uint32_t i = 0; i < props->count_props; i++) {
+            drmModePropertyPtr prop = drmModeGetProperty(mDrmFd, props->props[i]);
+            if (!prop) {
+                continue;
+            }
+            if (!strcmp(prop->name, "OUT_FENCE_PTR")) {
+                *outFencePtrProp = (int)prop->prop_id;
+            }
+            drmModeFreeProperty(prop);
+        }
+        drmModeFreeObjectProperties(props);
+    }
+    ALOGD("%s plane=%d crtc=%d fb_id prop=%d out_fence_ptr prop=%d",
+        __FUNCTION__, planeId, crtcId, planeProps->fb_id, *outFencePtrProp);
+}
+
 int DrmVopRender::getFbLength(buffer_handle_t handle) {
     if (!handle) {
         ALOGE("%s buffer_handle_t is NULL.", __FUNCTION__);
@@ -559,6 +718,25 @@ int DrmVopRender::getFbLength(buffer_handle_t handle) {
 
 int DrmVopRender::getFbid(buffer_handle_t handle, int hdmiInType) {
     Mutex::Autolock autoLock(mVopPlaneLock);
+    return getFbidLocked(handle, hdmiInType);
+}
+
+void DrmVopRender::reserveFbCache(size_t count) {
+    Mutex::Autolock autoLock(mVopPlaneLock);
+    mFbCacheReserved = count;
+    mFbCacheCapacity = std::max(mFbCacheConfigured, mFbCacheReserved);
+    ALOGD("%s reserved=%zu capacity=%zu", __FUNCTION__, mFbCacheReserved, mFbCacheCapacity);
+}
+
+void DrmVopRender::preRegisterFb(buffer_handle_t handle, int hdmiInType) {
+    Mutex::Autolock autoLock(mVopPlaneLock);
+    if (!mInitialized || mDrmFd <= 0) {
+        return;
+    }
+    getFbidLocked(handle, hdmiInType);
+}
+
+int DrmVopRender::getFbidLocked(buffer_handle_t handle, int hdmiInType) {
     if (!handle) {
         ALOGE("%s buffer_handle_t is NULL.", __FUNCTION__);
         return -1;
@@ -575,81 +753,116 @@ int DrmVopRender::getFbid(buffer_handle_t handle, int hdmiInType) {
     int src_stride = 0;
 
     fd = (int)tvBufferMgr->GetHandleFd(handle);
-    std::map<int, int>::iterator it = mFbidMap.find(fd);
-    int fbid = 0;
-    if (it == mFbidMap.end()) {
-        memset(&bo, 0, sizeof(hwc_drm_bo_t));
-        uint32_t gem_handle;
-        size_t plane_size;
-        fd = (int)tvBufferMgr->GetHandleFd(handle);
-        ret = drmPrimeFDToHandle(mDrmFd, fd, &gem_handle);
-        src_w = tvBufferMgr->GetWidth(handle);
-        src_h = tvBufferMgr->GetHeight(handle);
-        src_format = tvBufferMgr->GetHalPixelFormat(handle);
-        plane_size = tvBufferMgr->GetNumPlanes(handle);
-        ALOGV("format=%d, plane_size = %zu", src_format, plane_size);
-        if (hdmiInType == HDMIIN_TYPE_MIPICSI) {
-            if (src_format == HAL_PIXEL_FORMAT_BGR_888) {
-                src_stride = src_w * 3;
-            } else if (src_format != HAL_PIXEL_FORMAT_YCrCb_NV12_10) {
-                src_stride = src_w;
-            } else {
-                src_stride = (int)tvBufferMgr->GetPlaneStride(handle, 0);
-            }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        ALOGE("%s fstat fd=%d failed %s", __FUNCTION__, fd, strerror(errno));
+        return -1;
+    }
+    src_w = tvBufferMgr->GetWidth(handle);
+    src_h = tvBufferMgr->GetHeight(handle);
+    src_format = tvBufferMgr->GetHalPixelFormat(handle);
+    if (hdmiInType == HDMIIN_TYPE_MIPICSI) {
+        if (src_format == HAL_PIXEL_FORMAT_BGR_888) {
+            src_stride = src_w * 3;
+        } else if (src_format != HAL_PIXEL_FORMAT_YCrCb_NV12_10) {
+            src_stride = src_w;
         } else {
             src_stride = (int)tvBufferMgr->GetPlaneStride(handle, 0);
         }
+    } else {
+        src_stride = (int)tvBufferMgr->GetPlaneStride(handle, 0);
+    }
 
-        //gralloc_->perform(gralloc_, GRALLOC_MODULE_PERFORM_GET_HADNLE_WIDTH, handle, &src_w);
-        //gralloc_->perform(gralloc_, GRALLOC_MODULE_PERFORM_GET_HADNLE_HEIGHT, handle, &src_h);
-        //gralloc_->perform(gralloc_, GRALLOC_MODULE_PERFORM_GET_HADNLE_FORMAT, handle, &src_format);
-        //gralloc_->perform(gralloc_, GRALLOC_MODULE_PERFORM_GET_HADNLE_BYTE_STRIDE, handle, &src_stride);
-        bo.width = src_w;
-        bo.height = src_h;
-        //bo.format = ConvertHalFormatToDrm(HAL_PIXEL_FORMAT_YCrCb_NV12);
-        bo.format = ConvertHalFormatToDrm(src_format);
-        if (src_format == HAL_PIXEL_FORMAT_YCrCb_NV12_10) {
-            bo.pitches[0] = ALIGN(src_stride / 4 * 5, 64);
-        } else {
-            bo.pitches[0] = src_stride;
-        }
-        bo.gem_handles[0] = gem_handle;
-        bo.offsets[0] = 0;
-        if(src_format == HAL_PIXEL_FORMAT_YCrCb_NV12
-            || src_format == HAL_PIXEL_FORMAT_YCrCb_NV12_10
-            || src_format == HAL_PIXEL_FORMAT_YCbCr_422_SP)
-        {
-            bo.pitches[1] = bo.pitches[0];
-            bo.gem_handles[1] = gem_handle;
-            bo.offsets[1] = bo.pitches[1] * bo.height;
-        } else if (src_format == HAL_PIXEL_FORMAT_YCbCr_444_888) {
-            if (src_w == src_stride) {
-                bo.pitches[1] = bo.pitches[0] * 2;
-            } else {
-                bo.pitches[1] = ALIGN(src_w * 2, 64);
-            }
-            bo.gem_handles[1] = gem_handle;
-            bo.offsets[1] = bo.pitches[0] * bo.height;
-        }
-        //if (src_format == HAL_PIXEL_FORMAT_YCrCb_NV12_10) {
-        //    bo.width = src_w / 1.25;
-        //    bo.width = ALIGN_DOWN(bo.width, 2);
-        //}
-        ALOGD("width=%d,height=%d,format=%x,fd=%d,src_stride=%d, pitched=%d-%d",
-            bo.width, bo.height, bo.format, fd, src_stride, bo.pitches[0], bo.pitches[1]);
-        ret = drmModeAddFB2(mDrmFd, bo.width, bo.height, bo.format, bo.gem_handles,\
-                     bo.pitches, bo.offsets, &bo.fb_id, 0);
-        fbid = bo.fb_id;
-        ALOGD("drmModeAddFB2 ret = %s fbid=%d", strerror(ret), fbid);
-        mFbidMap.insert(std::make_pair(fd, fbid));
+    for (auto it = mFbCache.begin(); it != mFbCache.end(); ++it) {
+        if (it->inode == (uint64_t)st.st_ino && it->width == (uint32_t)src_w
+                && it->height == (uint32_t)src_h && it->format == (uint32_t)src_format
+                && it->stride == (uint32_t)src_stride) {
+            mFbCacheHits++;
+            mFbCache.splice(mFbCache.begin(), mFbCache, it);
+            return mFbCache.front().fb_id;
+        }
+    }
+    mFbCacheMisses++;
+
+    memset(&bo, 0, sizeof(hwc_drm_bo_t));
+    uint32_t gem_handle;
+    ret = drmPrimeFDToHandle(mDrmFd, fd, &gem_handle);
+    if (ret) {
+        ALOGE("%s drmPrimeFDToHandle fd=%d failed %s", __FUNCTION__, fd, strerror(errno));
+        return -1;
+    }
+    ALOGV("format=%d, plane_size = %zu", src_format, (size_t)tvBufferMgr->GetNumPlanes(handle));
+
+    //gralloc_->perform(gralloc_, GRALLOC_MODULE_PERFORM_GET_HADNLE_WIDTH, handle, &src_w);
+    //gralloc_->perform(gralloc_, GRALLOC_MODULE_PERFORM_GET_HADNLE_HEIGHT, handle, &src_h);
+    //gralloc_->perform(gralloc_, GRALLOC_MODULE_PERFORM_GET_HADNLE_FORMAT, handle, &src_format);
+    //gralloc_->perform(gralloc_, GRALLOC_MODULE_PERFORM_GET_HADNLE_BYTE_STRIDE, handle, &src_stride);
+    bo.width = src_w;
+    bo.height = src_h;
+    //bo.format = ConvertHalFormatToDrm(HAL_PIXEL_FORMAT_YCrCb_NV12);
+    bo.format = ConvertHalFormatToDrm(src_format);
+    if (src_format == HAL_PIXEL_FORMAT_YCrCb_NV12_10) {
+        bo.pitches[0] = ALIGN(src_stride / 4 * 5, 64);
     } else {
-        fbid = it->second;
+        bo.pitches[0] = src_stride;
+    }
+    bo.gem_handles[0] = gem_handle;
+    bo.offsets[0] = 0;
+    if(src_format == HAL_PIXEL_FORMAT_YCrCb_NV12
+        || src_format == HAL_PIXEL_FORMAT_YCrCb_NV12_10
+        || src_format == HAL_PIXEL_FORMAT_YCbCr_422_SP)
+    {
+        bo.pitches[1] = bo.pitches[0];
+        bo.gem_handles[1] = gem_handle;
+        bo.offsets[1] = bo.pitches[1] * bo.height;
+    } else if (src_format == HAL_PIXEL_FORMAT_YCbCr_444_888) {
+        if (src_w == src_stride) {
+            bo.pitches[1] = bo.pitches[0] * 2;
+        } else {
+            bo.pitches[1] = ALIGN(src_w * 2, 64);
+        }
+        bo.gem_handles[1] = gem_handle;
+        bo.offsets[1] = bo.pitches[0] * bo.height;
     }
-    if (fbid <= 0) {
+    //if (src_format == HAL_PIXEL_FORMAT_YCrCb_NV12_10) {
+    //    bo.width = src_w / 1.25;
+    //    bo.width = ALIGN_DOWN(bo.width, 2);
+    //}
+    ALOGD("width=%d,height=%d,format=%x,fd=%d,src_stride=%d, pitched=%d-%d",
+        bo.width, bo.height, bo.format, fd, src_stride, bo.pitches[0], bo.pitches[1]);
+    ret = drmModeAddFB2(mDrmFd, bo.width, bo.height, bo.format, bo.gem_handles,\
+                 bo.pitches, bo.offsets, &bo.fb_id, 0);
+    int fbid = bo.fb_id;
+    ALOGD("drmModeAddFB2 ret = %s fbid=%d", strerror(ret), fbid);
+    if (ret || fbid <= 0) {
         ALOGD("fbid is error.");
+        bool shared = false;
+        for (const auto &other : mFbCache) {
+            shared |= other.gem_handle == gem_handle;
+        }
+        if (!shared) {
+            struct drm_gem_close gemClose;
+            memset(&gemClose, 0, sizeof(gemClose));
+            gemClose.handle = gem_handle;
+            drmIoctl(mDrmFd, DRM_IOCTL_GEM_CLOSE, &gemClose);
+        }
         return -1;
     }
 
+    evictFbLocked();
+    FbCacheEntry_t entry;
+    entry.inode = (uint64_t)st.st_ino;
+    entry.width = src_w;
+    entry.height = src_h;
+    entry.format = src_format;
+    entry.stride = src_stride;
+    entry.fb_id = fbid;
+    entry.gem_handle = gem_handle;
+    mFbCache.push_front(entry);
+    if (mDebugLevel == 3) {
+        dumpFbCacheStats();
+    }
+
     return fbid;
 }
 
@@ -657,6 +870,8 @@ void DrmVopRender::resetOutput(int index)
 {
     ALOGE("resetOutput index=%d", index);
     DrmOutput *output = &mOutputs[index];
+    mSidebandPlaneCached = false;
+    releasePlanes(this);
 
     output->connected = false;
     memset(&output->mode, 0, sizeof(drmModeModeInfo));
@@ -689,6 +904,24 @@ void DrmVopRender::resetOutput(int index)
 }
 
 bool DrmVopRender::needRedetect() {
+    bool listening = mHotplugMonitor != NULL && mHotplugMonitor->isListening();
+    if (listening) {
+        if (!mHotplugMonitor->isDirty()) {
+            return false;
+        }
+        // hwc updates display-N after handling the same uevent, give it time
+        if (systemTime() - mHotplugMonitor->lastEventTime() > HOTPLUG_SETTLE_TIME) {
+            mHotplugMonitor->clearDirty();
+        }
+    }
+    bool changed = displayStateChanged();
+    if (changed && listening) {
+        mHotplugMonitor->clearDirty();
+    }
+    return changed;
+}
+
+bool DrmVopRender::displayStateChanged() {
     char prop_name[PROPERTY_VALUE_MAX] = {0};
     char prop_value[PROPERTY_VALUE_MAX] = {0};
     for (int i=0; i<mDisplayInfos.size(); i++) {
@@ -713,8 +946,75 @@ void DrmVopRender::setDebugLevel(int debugLevel) {
     }
 }
 
+bool DrmVopRender::isCommitPending() {
+    Mutex::Autolock autoLock(mVopPlaneLock);
+    return mLastCommitFence >= 0 && sync_wait(mLastCommitFence, 0) < 0;
+}
+
+int DrmVopRender::dupCommitFence() {
+    Mutex::Autolock autoLock(mVopPlaneLock);
+    return mLastCommitFence >= 0 ? dup(mLastCommitFence) : -1;
+}
+
+void DrmVopRender::getPresentStats(PresentStats_t *stats) {
+    Mutex::Autolock autoLock(mVopPlaneLock);
+    handleDrmEvents();
+    *stats = mPresentStats;
+}
+
+void DrmVopRender::pageFlipHandler(int fd, unsigned int sequence, unsigned int tv_sec,
+        unsigned int tv_usec, unsigned int crtc_id, void *user_data) {
+    DrmVopRender *render = (DrmVopRender *)user_data;
+    if (!render || !render->mInflightFlip) {
+        // mirrored crtcs report the same commit again
+        return;
+    }
+    render->mInflightFlip = false;
+    PresentStats_t &stats = render->mPresentStats;
+    stats.presented++;
+    stats.lastScanoutTime = (nsecs_t)tv_sec * 1000000000LL + (nsecs_t)tv_usec * 1000LL;
+    stats.lastLatency = 0;
+    if (render->mInflightCaptureTime > 0 && stats.lastScanoutTime > render->mInflightCaptureTime) {
+        stats.lastLatency = stats.lastScanoutTime - render->mInflightCaptureTime;
+        stats.avgLatency = stats.avgLatency ? (stats.avgLatency * 15 + stats.lastLatency) / 16 : stats.lastLatency;
+        if (stats.lastLatency > stats.maxLatency) {
+            stats.maxLatency = stats.lastLatency;
+        }
+    }
+    if (render->mDebugLevel == 3) {
+        ALOGE("flip crtc=%u seq=%u scanout=%" PRId64 " latency=%" PRId64 "us avg=%" PRId64 "us",
+            crtc_id, sequence, (int64_t)stats.lastScanoutTime,
+            (int64_t)(stats.lastLatency / 1000), (int64_t)(stats.avgLatency / 1000));
+    }
+}
+
+void DrmVopRender::handleDrmEvents() {
+    if (mDrmFd <= 0) {
+        return;
+    }
+    drmEventContext evctx;
+    memset(&evctx, 0, sizeof(evctx));
+    evctx.version = 3;
+    evctx.page_flip_handler2 = pageFlipHandler;
+    struct pollfd pfd;
+    pfd.fd = mDrmFd;
+    pfd.events = POLLIN;
+    while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+        if (drmHandleEvent(mDrmFd, &evctx) != 0) {
+            break;
+        }
+    }
+}
+
 bool DrmVopRender::SetDrmPlane(int device, int32_t width, int32_t height,
-        buffer_handle_t handle, int displayRatio, int hdmiInType) {
+        buffer_handle_t handle, int displayRatio, int hdmiInType, int *outFence,
+        nsecs_t captureTime, bool *busy) {
+    if (outFence) {
+        *outFence = -1;
+    }
+    if (busy) {
+        *busy = false;
+    }
     if (mDebugLevel == 3) {
         ALOGE("%s come in, device=%d, handle=%p", __FUNCTION__, device, handle);
     }
@@ -743,7 +1043,6 @@ bool DrmVopRender::SetDrmPlane(int device, int32_t width, int32_t height,
     mSidebandPlaneId = find_plan_id;
     bool findAvailedPlane = find_plan_id > 0;
     int fb_id = findAvailedPlane?getFbid(handle, hdmiInType):-1;
-    int flags = 0;
     int src_left = 0;
     int src_top = 0;
     int src_right = 0;
@@ -783,9 +1082,10 @@ bool DrmVopRender::SetDrmPlane(int device, int32_t width, int32_t height,
     //gralloc_->perform(gralloc_, GRALLOC_MODULE_PERFORM_GET_HADNLE_FORMAT, handle, &src_format);
     //ALOGV("dst_w %d dst_h %d src_w %d src_h %d in", dst_w, dst_h, src_w, src_h);
     //ALOGV("mDrmFd=%d plane_id=%d, output->crtc->crtc_id=%d fb_id=%d flags=%d", mDrmFd, plane_id, output->crtc->crtc_id, fb_id, flags);
+    std::vector<DrmPlaneUpdate_t> updates;
     if (!output->mDrmModeInfos.empty()) {
         for (int i=0; i<output->mDrmModeInfos.size(); i++) {
-            DrmModeInfo_t drmModeInfo = output->mDrmModeInfos[i];
+            const DrmModeInfo_t &drmModeInfo = output->mDrmModeInfos[i];
             int plane_id = drmModeInfo.plane_id;
             if (plane_id > 0) {
                 int overscan[] = {100, 100, 100, 100};
@@ -843,28 +1143,156 @@ bool DrmVopRender::SetDrmPlane(int device, int32_t width, int32_t height,
                 int32_t crtc_y = dst_top + (dst_h - ratio_h) / 2 + offset_t;
                 uint32_t crtc_w = ALIGN_DOWN(ratio_w - offset_l - offset_r, 2);
                 uint32_t crtc_h = ALIGN_DOWN(ratio_h - offset_t - offset_b, 2);
-                ret = drmModeSetPlane(mDrmFd, plane_id,
-                    drmModeInfo.crtc->crtc_id, fb_id, flags,
-                    crtc_x, crtc_y, crtc_w, crtc_h,
-                    0, 0,
-                    src_w << 16, src_h << 16);
-                if (mDebugLevel == 3) {
-                    ALOGE("drmModeSetPlane ret=%s mDrmFd=%d plane_id=%d, crtc_id=%d, fb_id=%d, flags=%d, %d %d, %d %d %d %d",
-                        strerror(ret), mDrmFd, plane_id, drmModeInfo.crtc->crtc_id, fb_id, flags, dst_w, dst_h, crtc_x, crtc_y, crtc_w, crtc_h);
-                }
+                DrmPlaneUpdate_t update;
+                update.info = &drmModeInfo;
+                update.crtc_x = crtc_x;
+                update.crtc_y = crtc_y;
+                update.crtc_w = crtc_w;
+                update.crtc_h = crtc_h;
+                updates.push_back(update);
             }
         }
     }
+    if (updates.empty()) {
+        return false;
+    }
+
+    Mutex::Autolock autoLock(mVopPlaneLock);
+    if (mHasAtomic) {
+        // one commit for every mirrored crtc, fall back to legacy on refusal
+        ret = commitPlanes(updates, fb_id, src_w, src_h, outFence, captureTime);
+        if (ret == 0) {
+            ALOGV("%s end.", __FUNCTION__);
+            return true;
+        }
+        if (ret == -EBUSY) {
+            // a legacy setplane would tear the frame still being flipped in
+            if (busy) {
+                *busy = true;
+            }
+            return false;
+        }
+        ALOGE("%s atomic commit failed %d, use legacy setplane", __FUNCTION__, ret);
+    }
+    setPlanesLegacy(updates, fb_id, src_w, src_h);
     ALOGV("%s end.", __FUNCTION__);
     return true;
 }
 
+int DrmVopRender::commitPlanes(const std::vector<DrmPlaneUpdate_t> &updates, int fb_id,
+        int32_t src_w, int32_t src_h, int *outFence, nsecs_t captureTime) {
+    if (mLastCommitFence >= 0) {
+        // nonblocking commits on a busy crtc are refused with EBUSY by the
+        // kernel too, the caller polls dupCommitFence() and comes back
+        if (sync_wait(mLastCommitFence, 0) < 0) {
+            DEBUG_PRINT(mDebugLevel, "%s last commit still in flight", __FUNCTION__);
+            return -EBUSY;
+        }
+        close(mLastCommitFence);
+        mLastCommitFence = -1;
+    }
+    // the flip event of the previous commit is queued by now
+    handleDrmEvents();
+
+    drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+    if (!req) {
+        return -ENOMEM;
+    }
+    std::vector<int32_t> fences(updates.size(), -1);
+    int ret = 0;
+    for (size_t i = 0; i < updates.size() && ret >= 0; i++) {
+        const DrmPlaneUpdate_t &update = updates[i];
+        const plane_prop &props = update.info->plane_props;
+        uint32_t plane_id = update.info->plane_id;
+        if (props.fb_id <= 0 || props.crtc_id <= 0) {
+            ret = -EINVAL;
+            break;
+        }
+        ret |= drmModeAtomicAddProperty(req, plane_id, props.crtc_id, update.info->crtc->crtc_id);
+        ret |= drmModeAtomicAddProperty(req, plane_id, props.fb_id, fb_id);
+        ret |= drmModeAtomicAddProperty(req, plane_id, props.src_x, 0);
+        ret |= drmModeAtomicAddProperty(req, plane_id, props.src_y, 0);
+        ret |= drmModeAtomicAddProperty(req, plane_id, props.src_w, src_w << 16);
+        ret |= drmModeAtomicAddProperty(req, plane_id, props.src_h, src_h << 16);
+        ret |= drmModeAtomicAddProperty(req, plane_id, props.crtc_x, update.crtc_x);
+        ret |= drmModeAtomicAddProperty(req, plane_id, props.crtc_y, update.crtc_y);
+        ret |= drmModeAtomicAddProperty(req, plane_id, props.crtc_w, update.crtc_w);
+        ret |= drmModeAtomicAddProperty(req, plane_id, props.crtc_h, update.crtc_h);
+        if (update.info->out_fence_ptr_prop > 0) {
+            ret |= drmModeAtomicAddProperty(req, update.info->crtc->crtc_id,
+                update.info->out_fence_ptr_prop, (uint64_t)(uintptr_t)&fences[i]);
+        }
+    }
+    if (ret >= 0) {
+        ret = drmModeAtomicCommit(mDrmFd, req,
+            DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, this);
+    }
+    drmModeAtomicFree(req);
+    if (ret < 0) {
+        return ret;
+    }
+    mInflightFlip = true;
+    mInflightCaptureTime = captureTime;
+
+    int fence = -1;
+    for (size_t i = 0; i < fences.size(); i++) {
+        if (fences[i] < 0) {
+            continue;
+        }
+        if (fence < 0) {
+            fence = fences[i];
+        } else {
+            int merged = sync_merge("tvinput_sideband", fence, fences[i]);
+            close(fence);
+            close(fences[i]);
+            fence = merged;
+        }
+    }
+    if (mDebugLevel == 3) {
+        ALOGE("%s fb_id=%d planes=%zu fence=%d", __FUNCTION__, fb_id, updates.size(), fence);
+    }
+    if (fence >= 0) {
+        mLastCommitFence = dup(fence);
+    }
+    if (outFence) {
+        *outFence = fence;
+    } else if (fence >= 0) {
+        close(fence);
+    }
+    return 0;
+}
+
+void DrmVopRender::setPlanesLegacy(const std::vector<DrmPlaneUpdate_t> &updates, int fb_id,
+        int32_t src_w, int32_t src_h) {
+    int flags = 0;
+    for (size_t i = 0; i < updates.size(); i++) {
+        const DrmPlaneUpdate_t &update = updates[i];
+        int ret = drmModeSetPlane(mDrmFd, update.info->plane_id,
+            update.info->crtc->crtc_id, fb_id, flags,
+            update.crtc_x, update.crtc_y, update.crtc_w, update.crtc_h,
+            0, 0,
+            src_w << 16, src_h << 16);
+        if (mDebugLevel == 3) {
+            ALOGE("drmModeSetPlane ret=%s mDrmFd=%d plane_id=%d, crtc_id=%d, fb_id=%d, flags=%d, %d %d %d %d",
+                strerror(ret), mDrmFd, update.info->plane_id, update.info->crtc->crtc_id, fb_id, flags,
+                update.crtc_x, update.crtc_y, update.crtc_w, update.crtc_h);
+        }
+    }
+}
+
 bool DrmVopRender::ClearDrmPlaneContent(int device, int32_t width, int32_t height)
 {
     Mutex::Autolock autoLock(mVopPlaneLock);
     ALOGD("%s come in, device=%d", __FUNCTION__, device);
     bool ret = true;
     int plane_id = 0;//FindSidebandPlane(device);
+    // ASYNC_COMMIT is reset below, the cached plane is no longer marked
+    mSidebandPlaneCached = false;
+    if (mLastCommitFence >= 0) {
+        sync_wait(mLastCommitFence, COMMIT_FENCE_TIMEOUT_MS);
+        close(mLastCommitFence);
+        mLastCommitFence = -1;
+    }
     // drmModeAtomicReqPtr reqPtr = drmModeAtomicAlloc();
     DrmOutput *output= &mOutputs[device];
     drmModePlanePtr plane;
@@ -888,7 +1316,8 @@ bool DrmVopRender::ClearDrmPlaneContent(int device, int32_t width, int32_t heigh
         for (uint32_t j = 0; j < props->count_props; j++) {
             prop = drmModeGetProperty(mDrmFd, props->props[j]);
             if (!strcmp(prop->name, "ASYNC_COMMIT")) {
-                if (props->prop_values[j] != 0) {
+                // leave the plane of another input on screen
+                if (props->prop_values[j] != 0 && !isPlaneOfOther(plane->plane_id, this)) {
                     plane_id = plane->plane_id;
                     // ret = drmModeAtomicAddProperty(reqPtr, plane_id, prop->prop_id, 0) < 0;
                     ret =  drmModeObjectSetProperty(mDrmFd, plane_id, 0, prop->prop_id, 0) < 0;
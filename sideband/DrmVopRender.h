@@ -20,9 +20,11 @@
 
 #include <cutils/native_handle.h>
 #include <hardware/hwcomposer_defs.h>
+#include <list>
 #include <map>
 #include <vector>
 #include <utils/threads.h>
+#include "DrmHotplugMonitor.h"
 
 extern "C" {
 #include "xf86drm.h"
@@ -46,6 +48,8 @@ enum {
 
 #define MAX_DISPLAY_NUM 4
 #define SKIP_FRAME_TIME 2000000000
+#define HOTPLUG_SETTLE_TIME 3000000000
+#define DEFAULT_FB_CACHE_SIZE 32
 
 struct plane_prop {
   int crtc_id;
@@ -77,12 +81,22 @@ typedef struct hwc_drm_bo {
 } hwc_drm_bo_t;
 
 
+typedef struct PresentStats {
+    uint64_t presented;
+    nsecs_t lastScanoutTime;
+    // capture timestamp to scanout, 0 if the frame had no capture time
+    nsecs_t lastLatency;
+    nsecs_t avgLatency;
+    nsecs_t maxLatency;
+} PresentStats_t;
+
+// One per sideband window, so each input keeps its own drm fd, fb cache,
+// plane and commit fence. Sideband planes are claimed process-wide.
 class DrmVopRender {
 public:
     DrmVopRender();
     virtual ~DrmVopRender();
 public:
-    static DrmVopRender *GetInstance();
     bool mInitialized = false;
     bool initialize();
     void deinitialize();
@@ -90,24 +104,57 @@ public:
     bool detect(int device);
     void DestoryFB();
     int getFbid(buffer_handle_t handle, int hdmiInType);
+    // the cache never evicts below |count|, the buffers the pipeline
+    // pre-registers for one stream (capture + pq + iep)
+    void reserveFbCache(size_t count);
+    // add the fb ahead of time so the first shown frame does not pay for it
+    void preRegisterFb(buffer_handle_t handle, int hdmiInType);
+    void dumpFbCacheStats();
     int getFbLength(buffer_handle_t handle);
 
     uint32_t ConvertHalFormatToDrm(uint32_t hal_format);
 
+    // outFence, if given, receives a fence that signals once the frame
+    // is on screen, i.e. the previously shown buffer is released. Never
+    // waits for the last commit: while it is in flight the frame is
+    // refused and busy, if given, is set.
     bool SetDrmPlane(int device, int32_t width, int32_t height,
-        buffer_handle_t handle, int displayRatio, int hdmiInType);
+        buffer_handle_t handle, int displayRatio, int hdmiInType, int *outFence = NULL,
+        nsecs_t captureTime = 0, bool *busy = NULL);
+    // true while the last nonblocking commit has not reached the screen
+    bool isCommitPending();
+    // dup of the last commit fence for polling, caller closes it
+    int dupCommitFence();
+    void getPresentStats(PresentStats_t *stats);
     bool ClearDrmPlaneContent(int device, int32_t width, int32_t height);
     void setDebugLevel(int debugLevel);
     int getSidebandPlaneId();
 private:
     void resetOutput(int index);
     int FindSidebandPlane(int device);
+    int FindSidebandPlaneLocked(int device);
+    void initPlaneProps(int planeId, plane_prop *planeProps, int *outFencePtrProp, uint32_t crtcId);
     uint32_t getDrmEncoder(int device);
 
     // map device type to output index, return -1 if not mapped
     inline int getOutputIndex(int device);
-    std::map<int, int> mFbidMap;
+
+    // framebuffers are keyed by dmabuf identity, not by fd number
+    typedef struct FbCacheEntry {
+        uint64_t inode;
+        uint32_t width;
+        uint32_t height;
+        uint32_t format;
+        uint32_t stride;
+        uint32_t fb_id;
+        uint32_t gem_handle;
+    } FbCacheEntry_t;
+    int getFbidLocked(buffer_handle_t handle, int hdmiInType);
+    void evictFbLocked();
+    void releaseFbLocked(const FbCacheEntry_t &entry);
+    void clearFbCacheLocked();
     bool needRedetect();
+    bool displayStateChanged();
 private:
     // DRM object index
     enum {
@@ -126,9 +173,42 @@ private:
 
         char crtc_plane_mask[255];
         int plane_id = -1;
+        // atomic property ids of plane_id and its crtc
+        plane_prop plane_props;
+        int out_fence_ptr_prop;
         //int crtc_id = -1;
     } DrmModeInfo_t;
 
+    typedef struct DrmPlaneUpdate {
+        const DrmModeInfo_t *info;
+        int32_t crtc_x;
+        int32_t crtc_y;
+        uint32_t crtc_w;
+        uint32_t crtc_h;
+    } DrmPlaneUpdate_t;
+
+    // front is most recently used
+    std::list<FbCacheEntry_t> mFbCache;
+    size_t mFbCacheCapacity = DEFAULT_FB_CACHE_SIZE;
+    size_t mFbCacheConfigured = DEFAULT_FB_CACHE_SIZE;
+    size_t mFbCacheReserved = 0;
+    uint64_t mFbCacheHits = 0;
+    uint64_t mFbCacheMisses = 0;
+    uint64_t mFbCacheEvictions = 0;
+
+    int commitPlanes(const std::vector<DrmPlaneUpdate_t> &updates, int fb_id,
+        int32_t src_w, int32_t src_h, int *outFence, nsecs_t captureTime);
+    void handleDrmEvents();
+    static void pageFlipHandler(int fd, unsigned int sequence, unsigned int tv_sec,
+        unsigned int tv_usec, unsigned int crtc_id, void *user_data);
+
+    // capture time of the commit in flight, cleared by its first flip event
+    nsecs_t mInflightCaptureTime = 0;
+    bool mInflightFlip = false;
+    PresentStats_t mPresentStats;
+    void setPlanesLegacy(const std::vector<DrmPlaneUpdate_t> &updates, int fb_id,
+        int32_t src_w, int32_t src_h);
+
     struct DrmOutput {
         //drmModeConnectorPtr connector;
         //drmModeEncoderPtr encoder;
@@ -161,11 +241,18 @@ private:
     bool mEnableSkipFrame = false;
     nsecs_t mSkipFrameStartTime = 0;
     int mDrmFd;
+    // DRM_CLIENT_CAP_ATOMIC accepted, else every present is a legacy setplane
+    bool mHasAtomic = false;
    // Mutex mLock;
     const gralloc_module_t *gralloc_;
     int mDebugLevel = 0;
     bool mEnableOverScan = false;
     int mSidebandPlaneId;
+    // plane_id in mDrmModeInfos is valid until the next detect/clear
+    bool mSidebandPlaneCached = false;
+    sp<DrmHotplugMonitor> mHotplugMonitor;
+    // fence of the last nonblocking commit, a new one is refused until it lands
+    int mLastCommitFence = -1;
 };
 
 } // namespace android
@@ -23,6 +23,7 @@
 
 #include "RTSidebandWindow.h"
 #include "log/log.h"
+#include <errno.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <utils/Timers.h>
@@ -30,12 +31,16 @@
 #include <ui/GraphicBufferAllocator.h>
 
 #include "DrmVopRender.h"
+#include "common/GraphicBufferPool.h"
+#include "common/PixelConvert.h"
+#include <algorithm>
 
 namespace android {
 
 #define MIN_BUFFER_COUNT_UNDEQUEUE      0
 
-static uint64_t g_session_id;
+// shared by the windows of every input
+static std::atomic<uint64_t> g_session_id(0);
 
 RTSidebandWindow::RTSidebandWindow()
         : mBuffMgr(nullptr),
@@ -46,12 +51,15 @@ RTSidebandWindow::RTSidebandWindow()
           mThreadRunning(false),
           mMessageQueue("RenderThread", static_cast<int>(MESSAGE_ID_MAX)),
           mMessageThread(nullptr),
-          mDebugLevel(0) {
+          mDebugLevel(0),
+          mBufferPool(NULL) {
     memset(&mSidebandInfo, 0, sizeof(mSidebandInfo));
 }
 
 RTSidebandWindow::~RTSidebandWindow() {
     DEBUG_PRINT(mDebugLevel, "%s %d in", __FUNCTION__, __LINE__);
+    delete mVopRender;
+    mVopRender = NULL;
 }
 
 status_t RTSidebandWindow::init(const vt_win_attr_t *attr, int sidebandType) {
@@ -72,7 +80,10 @@ status_t RTSidebandWindow::init(const vt_win_attr_t *attr, int sidebandType) {
         mSidebandInfo.width, mSidebandInfo.height, mSidebandInfo.format, (long long)mSidebandInfo.usage, sidebandType);
 
     if (mSidebandType & TYPE_SIDEBAND_WINDOW) {
-        mVopRender = android::DrmVopRender::GetInstance();
+        // not shared, stopping this window must not blank another input
+        if (mVopRender == NULL) {
+            mVopRender = new android::DrmVopRender();
+        }
         if (!mVopRender->mInitialized) {
             ready = mVopRender->initialize();
             if (ready) {
@@ -131,16 +142,17 @@ status_t RTSidebandWindow::release() {
         }
     } while (0);
     mRenderingCnt = 0;
+    mMapper.clear();
 
     return 0;
 }
 
 status_t RTSidebandWindow::stop() {
     DEBUG_PRINT(3, "%s %d in", __FUNCTION__, __LINE__);
+    // preview buffers imported from the app stay mapped until here
+    mMapper.clear();
     if (mVopRender) {
         mVopRender->deinitialize();
-        //delete mVopRender;
-        //mVopRender = NULL;
     }
     return 0;
 }
@@ -185,7 +197,7 @@ status_t RTSidebandWindow::allocateSidebandHandle(buffer_handle_t *handle,
 
     memset(&info, 0, sizeof(vt_sideband_data_t));
 
-    g_session_id++;
+    uint64_t sessionId = ++g_session_id;
     info.version        = sizeof(vt_sideband_data_t);
     info.tunnel_id      = VTId > -1 ? VTId : mVTID;
     info.crop.left      = mSidebandInfo.left;
@@ -199,7 +211,7 @@ status_t RTSidebandWindow::allocateSidebandHandle(buffer_handle_t *handle,
     info.usage          = mSidebandInfo.usage;
     info.data_space     = mSidebandInfo.data_space;
     info.compress_mode  = mSidebandInfo.compress_mode;
-    info.session_id     = g_session_id;
+    info.session_id     = sessionId;
 
     temp_buffer = native_handle_create(0, sizeof(vt_sideband_data_t) / sizeof(int));
     temp_buffer->version = sizeof(native_handle_t);
@@ -228,19 +240,10 @@ status_t RTSidebandWindow::allocateBuffer(vt_buffer_t **buffer) {
 
 status_t RTSidebandWindow::allocateBuffer(vt_buffer_t **buffer,
         int width, int32_t height, int32_t format, uint64_t usage) {
-    GraphicBufferAllocator &allocator = GraphicBufferAllocator::get();
     buffer_handle_t temp_buffer = NULL;
-    uint32_t outStride = 0;
     vt_buffer_t *vtBuffer = NULL;
 
-    status_t err = allocator.allocate(width, height,
-                                      format,
-                                      1,
-                                      usage,
-                                      &temp_buffer,
-                                      &outStride,
-                                      0,
-                                      std::move("videotunnel"));
+    status_t err = allocateHandle(width, height, format, usage, "videotunnel", &temp_buffer);
     if (err != NO_ERROR) {
         return err;
     }
@@ -256,12 +259,10 @@ status_t RTSidebandWindow::allocateBuffer(vt_buffer_t **buffer,
 }
 
 status_t RTSidebandWindow::freeBuffer(vt_buffer_t **buffer) {
-    GraphicBufferAllocator &allocator = GraphicBufferAllocator::get();
-
     ALOGI("free buffer: fd-0[%d] wxh[%d %d] fmt[0x%x] usage[%p]",
            (*buffer)->handle->data[0], mSidebandInfo.width, mSidebandInfo.height,
            mSidebandInfo.format, (void *)mSidebandInfo.usage);
-    allocator.free((*buffer)->handle);
+    freeHandle((*buffer)->handle);
     (*buffer)->handle = NULL;
     rk_vt_buffer_free(buffer);
     *buffer = NULL;
@@ -352,19 +353,14 @@ status_t RTSidebandWindow::allocateBuffer(buffer_handle_t *buffer) {
 
 status_t RTSidebandWindow::allocateSidebandHandle(buffer_handle_t *handle,
         int width, int32_t height, int32_t format, uint64_t usage) {
-    GraphicBufferAllocator &allocator = GraphicBufferAllocator::get();
     buffer_handle_t temp_buffer = NULL;
-    uint32_t outStride = 0;
 
-    status_t err = allocator.allocate(-1 == width?mSidebandInfo.width:width,
+    status_t err = allocateHandle(-1 == width?mSidebandInfo.width:width,
                         -1 == height?mSidebandInfo.height:height,
                         -1 == format?mSidebandInfo.format:format,
-                        1,
                         -1 == usage?0:usage,
-                        &temp_buffer,
-                        &outStride,
-                        0,
-                        std::move("tif_allocate"));
+                        "tif_allocate",
+                        &temp_buffer);
     if (!temp_buffer) {
         DEBUG_PRINT(3, "allocate failed !!!");
     } else {
@@ -376,11 +372,38 @@ status_t RTSidebandWindow::allocateSidebandHandle(buffer_handle_t *handle,
 
 status_t RTSidebandWindow::freeBuffer(buffer_handle_t *buffer, int type) {
     DEBUG_PRINT(3, "%s in type = %d", __FUNCTION__, type);
-    GraphicBufferAllocator &allocator = GraphicBufferAllocator::get();
-    allocator.free(*buffer);
+    freeHandle(*buffer);
     return 0;
 }
 
+status_t RTSidebandWindow::allocateHandle(int32_t width, int32_t height, int32_t format,
+        uint64_t usage, const char *requestor, buffer_handle_t *handle) {
+    status_t err;
+    if (mBufferPool) {
+        err = mBufferPool->acquire(width, height, format, usage, requestor, handle);
+    } else {
+        uint32_t outStride = 0;
+        err = GraphicBufferAllocator::get().allocate(width, height, format, 1, usage,
+            handle, &outStride, 0, std::string(requestor));
+    }
+    if (err == NO_ERROR && *handle) {
+        // the per-frame Get*() queries are answered from this from now on
+        mBuffMgr->CacheMetadata(*handle);
+    }
+    return err;
+}
+
+void RTSidebandWindow::freeHandle(buffer_handle_t handle) {
+    // the mapping would keep the dmabuf alive
+    mMapper.forget(handle);
+    mBuffMgr->ForgetMetadata(handle);
+    if (mBufferPool) {
+        mBufferPool->release(handle);
+    } else {
+        GraphicBufferAllocator::get().free(handle);
+    }
+}
+
 status_t RTSidebandWindow::setBufferGeometry(int32_t width, int32_t height, int32_t format) {
     DEBUG_PRINT(mDebugLevel, "%s %d width=%d height=%d in", __FUNCTION__, __LINE__, width, height);
     mSidebandInfo.width = width;
@@ -460,14 +483,49 @@ status_t RTSidebandWindow::handleRenderRequest(Message &msg) {
     return 0;
 }
 
-status_t RTSidebandWindow::show(buffer_handle_t handle, int displayRatio, int hdmiInType) {
+status_t RTSidebandWindow::show(buffer_handle_t handle, int displayRatio, int hdmiInType, int *releaseFence,
+        nsecs_t captureTime) {
+    if (releaseFence) {
+        *releaseFence = -1;
+    }
     if (mVopRender) {
-        mVopRender->SetDrmPlane(0, mSidebandInfo.right - mSidebandInfo.left, mSidebandInfo.bottom - mSidebandInfo.top,
-            handle, displayRatio, hdmiInType);
+        bool busy = false;
+        if (!mVopRender->SetDrmPlane(0, mSidebandInfo.right - mSidebandInfo.left, mSidebandInfo.bottom - mSidebandInfo.top,
+                handle, displayRatio, hdmiInType, releaseFence, captureTime, &busy)) {
+            return busy ? -EBUSY : -1;
+        }
     }
     return 0;
 }
 
+bool RTSidebandWindow::isPresentPending() {
+    return mVopRender && mVopRender->isCommitPending();
+}
+
+int RTSidebandWindow::getPresentFence() {
+    return mVopRender ? mVopRender->dupCommitFence() : -1;
+}
+
+status_t RTSidebandWindow::getPresentStats(struct PresentStats *stats) {
+    if (!mVopRender) {
+        return -1;
+    }
+    mVopRender->getPresentStats(stats);
+    return 0;
+}
+
+void RTSidebandWindow::reserveFbCache(size_t count) {
+    if (mVopRender) {
+        mVopRender->reserveFbCache(count);
+    }
+}
+
+void RTSidebandWindow::prepareFb(buffer_handle_t handle, int hdmiInType) {
+    if (mVopRender && handle) {
+        mVopRender->preRegisterFb(handle, hdmiInType);
+    }
+}
+
 void RTSidebandWindow::setDebugLevel(int debugLevel) {
     if (mDebugLevel != debugLevel && mVopRender) {
         mDebugLevel = debugLevel;
@@ -517,6 +575,22 @@ int RTSidebandWindow::getBufferLength(buffer_handle_t buffer) {
     return mBuffMgr->GetHandleBufferSize(buffer);
 }
 
+int RTSidebandWindow::getBufferStride(buffer_handle_t buffer) {
+    if (!buffer) {
+        DEBUG_PRINT(3, "%s param buffer is NULL.", __FUNCTION__);
+        return -1;
+    }
+    return (int)mBuffMgr->GetPlaneStride(buffer, 0);
+}
+
+status_t RTSidebandWindow::setContentSize(buffer_handle_t buffer, int width, int height) {
+    if (!buffer) {
+        DEBUG_PRINT(3, "%s param buffer is NULL.", __FUNCTION__);
+        return -1;
+    }
+    return mBuffMgr->SetContentSize(buffer, width, height);
+}
+
 int RTSidebandWindow::importHidlHandleBufferLocked(buffer_handle_t& rawHandle) {
     ALOGD("%s rawBuffer :%p", __FUNCTION__, rawHandle);
     if (rawHandle) {
@@ -534,96 +608,72 @@ int RTSidebandWindow::buffDataTransfer(buffer_handle_t srcHandle, buffer_handle_
     std::string file1 = "/data/system/tv_input_src_dump.yuv";
     std::string file2 = "/data/system/tv_input_result_dump.yuv";
     if (srcHandle && dstHandle) {
-        void *tmpSrcPtr = NULL, *tmpDstPtr = NULL;
-        int srcDatasize = -1;
-            int lockMode = GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK | GRALLOC_USAGE_HW_CAMERA_MASK;
-            mBuffMgr->Lock(srcHandle, lockMode, 0, 0, mBuffMgr->GetWidth(srcHandle), mBuffMgr->GetHeight(srcHandle), &tmpSrcPtr);
-            for (int i = 0; i < mBuffMgr->GetNumPlanes(srcHandle); i++) {
-                srcDatasize += mBuffMgr->GetPlaneSize(srcHandle, i);
-            }
-             writeData2File(file1.c_str(), tmpSrcPtr, srcDatasize);
-            ALOGD("data tmpSrcPtr ptr = %p, srcDatasize=%d", tmpSrcPtr, srcDatasize);
-            mBuffMgr->LockLocked(dstHandle, lockMode, 0, 0, mBuffMgr->GetWidth(dstHandle), mBuffMgr->GetHeight(dstHandle), &tmpDstPtr);
-            ALOGD("data tmpDstPtr ptr = %p, width=%d, height=%d", tmpDstPtr, mBuffMgr->GetWidth(dstHandle), mBuffMgr->GetHeight(dstHandle));
-            std::memcpy(tmpDstPtr, tmpSrcPtr, srcDatasize);
-             writeData2File(file2.c_str(), tmpDstPtr, srcDatasize);
-            mBuffMgr->UnlockLocked(dstHandle);
-            mBuffMgr->Unlock(srcHandle);
-            ALOGD("%s end", __FUNCTION__);
-            return 0;
-    }
-    return -1;
-}
-
-int RTSidebandWindow::buffDataTransfer2(buffer_handle_t srcHandle, buffer_handle_t dstHandle) {
-    if (srcHandle && dstHandle) {
-        unsigned char* tmpSrcPtr = NULL;
-        unsigned char* tmpDstPtr = NULL;
-        int srcDatasize = -1;
-        int lockMode = GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK | GRALLOC_USAGE_HW_CAMERA_MASK;
-        mBuffMgr->Lock(srcHandle, lockMode, 0, 0, mBuffMgr->GetWidth(srcHandle), mBuffMgr->GetHeight(srcHandle), (void**)&tmpSrcPtr);
+        size_t srcDatasize = 0;
         for (int i = 0; i < mBuffMgr->GetNumPlanes(srcHandle); i++) {
             srcDatasize += mBuffMgr->GetPlaneSize(srcHandle, i);
         }
-        mBuffMgr->LockLocked(dstHandle, lockMode, 0, 0, mBuffMgr->GetWidth(dstHandle), mBuffMgr->GetHeight(dstHandle), (void**)&tmpDstPtr);
-        int dstDatesize = -1;
-        for (int i = 0; i < mBuffMgr->GetNumPlanes(dstHandle); i++) {
-            dstDatesize += mBuffMgr->GetPlaneSize(dstHandle, i);
+        tvinput::DmaBufMapper::Access src(mMapper, srcHandle, DMA_BUF_SYNC_READ, 0, srcDatasize);
+        tvinput::DmaBufMapper::Access dst(mMapper, dstHandle, DMA_BUF_SYNC_RW, 0, srcDatasize);
+        if (!src.data() || !dst.data()) {
+            return -1;
         }
-        //ALOGD("%s %d %d", __FUNCTION__, srcDatasize, dstDatesize);
-
-        std::memcpy(tmpDstPtr, tmpSrcPtr, dstDatesize);
-
-        mBuffMgr->UnlockLocked(dstHandle);
-        mBuffMgr->Unlock(srcHandle);
-
+        srcDatasize = std::min(srcDatasize, std::min(src.size(), dst.size()));
+        writeData2File(file1.c_str(), src.data(), srcDatasize);
+        ALOGD("data src ptr = %p, srcDatasize=%zu", src.data(), srcDatasize);
+        std::memcpy(dst.data(), src.data(), srcDatasize);
+        writeData2File(file2.c_str(), dst.data(), srcDatasize);
+        ALOGD("%s end", __FUNCTION__);
         return 0;
     }
     return -1;
 }
 
-int RTSidebandWindow::NV24ToNV12(buffer_handle_t srcHandle, buffer_handle_t dstHandle, int width, int height) {
+int RTSidebandWindow::buffDataTransfer2(buffer_handle_t srcHandle, buffer_handle_t dstHandle) {
     if (srcHandle && dstHandle) {
-        //void *tmpSrcPtr = NULL, *tmpDstPtr = NULL;
-        unsigned char* tmpSrcPtr = NULL;
-        unsigned char* tmpDstPtr = NULL;
-        int srcDatasize = -1;
-        int lockMode = GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK | GRALLOC_USAGE_HW_CAMERA_MASK;
-        //DEBUG_PRINT(3, "%d %d", mBuffMgr->GetHandleBufferSize(srcHandle), mBuffMgr->GetHandleBufferSize(dstHandle));
-        mBuffMgr->Lock(srcHandle, lockMode, 0, 0, mBuffMgr->GetWidth(srcHandle), mBuffMgr->GetHeight(srcHandle), (void**)&tmpSrcPtr);
-        for (int i = 0; i < mBuffMgr->GetNumPlanes(srcHandle); i++) {
-            srcDatasize += mBuffMgr->GetPlaneSize(srcHandle, i);
+        size_t dstDatesize = 0;
+        for (int i = 0; i < mBuffMgr->GetNumPlanes(dstHandle); i++) {
+            dstDatesize += mBuffMgr->GetPlaneSize(dstHandle, i);
         }
-        //ALOGD("data tmpSrcPtr ptr = %p, srcDatasize=%d", tmpSrcPtr, srcDatasize);
-        mBuffMgr->LockLocked(dstHandle, lockMode, 0, 0, mBuffMgr->GetWidth(dstHandle), mBuffMgr->GetHeight(dstHandle), (void**)&tmpDstPtr);
-        //ALOGD("data tmpDstPtr ptr = %p, width=%d, height=%d", tmpDstPtr, mBuffMgr->GetWidth(dstHandle), mBuffMgr->GetHeight(dstHandle));
-
-        int i,j;
-        int width_uv_out = width / 2;
-        int height_uv_out = height / 2;
-
-        int uIn = width * height;
-        int uOut = width * height;
-        //ALOGD("==============start================%dX%d, %dX%d", width_uv_out, height_uv_out, width, height);
-        std::memcpy(tmpDstPtr, tmpSrcPtr, width*height);
-
-        for(i = 0; i < height_uv_out; i++) {
-            for(j = 0; j < width_uv_out; j++) {
-                int dstPos = uOut + i*width + j*2;
-                int srcPos = uIn + i*4*width + j*4;
-                std::memcpy(tmpDstPtr+dstPos, tmpSrcPtr+srcPos, 2);
-            }
+        tvinput::DmaBufMapper::Access src(mMapper, srcHandle, DMA_BUF_SYNC_READ, 0, dstDatesize);
+        tvinput::DmaBufMapper::Access dst(mMapper, dstHandle, DMA_BUF_SYNC_WRITE, 0, dstDatesize);
+        if (!src.data() || !dst.data()) {
+            return -1;
         }
-
-        mBuffMgr->UnlockLocked(dstHandle);
-        mBuffMgr->Unlock(srcHandle);
-        //ALOGD("==============end================");
-
+        std::memcpy(dst.data(), src.data(), std::min(dstDatesize, std::min(src.size(), dst.size())));
         return 0;
     }
     return -1;
 }
 
+int RTSidebandWindow::convertBuffer(buffer_handle_t srcHandle, uint32_t srcFormat,
+        buffer_handle_t dstHandle, uint32_t dstFormat, int width, int height, int dstWidthStride,
+        int dstHeightStride) {
+    if (!srcHandle || !dstHandle || !tvinput::PixelConvert::isSupported(srcFormat, dstFormat)) {
+        return -1;
+    }
+    // capture buffers are allocated unpadded
+    size_t srcSize = tvinput::PixelConvert::frameSize(srcFormat, width, height);
+    size_t dstSize = tvinput::PixelConvert::frameSize(dstFormat, dstWidthStride, dstHeightStride);
+    tvinput::DmaBufMapper::Access srcAccess(mMapper, srcHandle, DMA_BUF_SYNC_READ, 0, srcSize);
+    tvinput::DmaBufMapper::Access dstAccess(mMapper, dstHandle, DMA_BUF_SYNC_WRITE, 0, dstSize);
+    if (!srcAccess.data() || !dstAccess.data()
+            || srcAccess.size() < srcSize || dstAccess.size() < dstSize) {
+        DEBUG_PRINT(3, "%s buffers too small or not mapped", __FUNCTION__);
+        return -1;
+    }
+    tvinput::PixelConvert::Image src = tvinput::PixelConvert::layout(srcFormat, srcAccess.data(),
+        width, height);
+    tvinput::PixelConvert::Image dst = tvinput::PixelConvert::layout(dstFormat, dstAccess.data(),
+        dstWidthStride, dstHeightStride);
+    if (!mConvertWorkers.isInitialized()) {
+        mConvertWorkers.init(property_get_int32(TV_INPUT_CONVERT_THREADS, 1));
+    }
+    mConvertWorkers.run(tvinput::PixelConvert::rowCount(height), [&](int rowBegin, int rowEnd) {
+        tvinput::PixelConvert::convert(srcFormat, src, dstFormat, dst, width, height, rowBegin, rowEnd);
+    });
+    return 0;
+}
+
 void RTSidebandWindow::readDataFromFile(const char *file_path, buffer_handle_t dstHandle) {
     FILE* fp = fopen(file_path, "rb");
     if(fp == NULL) {
@@ -640,15 +690,12 @@ void RTSidebandWindow::readDataFromFile(const char *file_path, buffer_handle_t d
     ALOGD("%s(%d) size of file :%s size is :\t%u bytes\n",
         __func__, __LINE__, file_path, filesize);
 
-    unsigned char* tmpDstPtr = NULL;
-    int lockMode = GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK | GRALLOC_USAGE_HW_CAMERA_MASK;
-    mBuffMgr->LockLocked(dstHandle, lockMode, 0, 0, mBuffMgr->GetWidth(dstHandle), mBuffMgr->GetHeight(dstHandle), (void**)&tmpDstPtr);
-
-    unsigned int num_read = fread(tmpDstPtr, filesize, 1,fp);
-    ALOGD("fread num is %u\n", num_read);
+    tvinput::DmaBufMapper::Access dst(mMapper, dstHandle, DMA_BUF_SYNC_WRITE);
+    if (dst.data()) {
+        unsigned int num_read = fread(dst.data(), std::min((size_t)filesize, dst.size()), 1, fp);
+        ALOGD("fread num is %u\n", num_read);
+    }
     fclose(fp);
-
-    mBuffMgr->UnlockLocked(dstHandle);
 }
 
 int RTSidebandWindow::writeData2File(const char *fileName, void *data, int dataSize) {
@@ -678,40 +725,25 @@ int RTSidebandWindow::dumpImage(buffer_handle_t handle, char* fileName, int mode
     }
     ALOGD("%s handle :%p", __FUNCTION__, handle);
     FILE* fp = NULL;
-    void *dataPtr = NULL;
     int dataSize = 0;
     fp = fopen(fileName, "wb+");
     if (fp != NULL) {
-        struct android_ycbcr ycbrData;
-        int lockMode = GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK | GRALLOC_USAGE_HW_CAMERA_MASK;
-        if (mode == 1) {
-            mBuffMgr->LockYCbCr(handle, lockMode, 0, 0, mBuffMgr->GetWidth(handle), mBuffMgr->GetHeight(handle), &ycbrData);
-            dataPtr = ycbrData.y;
-        } else {
-            ALOGD("width = %d", mBuffMgr->GetWidth(handle));
-            ALOGD("height = %d", mBuffMgr->GetHeight(handle));
-            mBuffMgr->LockLocked(handle, lockMode, 0, 0, mBuffMgr->GetWidth(handle), mBuffMgr->GetHeight(handle), &dataPtr);
-        }
-        ALOGD("planesNum = %d", mBuffMgr->GetNumPlanes(handle));
+        ALOGD("planesNum = %d mode = %d", mBuffMgr->GetNumPlanes(handle), mode);
         for (int i = 0; i < mBuffMgr->GetNumPlanes(handle); i++) {
         ALOGD("planesSize = %zu", mBuffMgr->GetPlaneSize(handle, i));
             dataSize += mBuffMgr->GetPlaneSize(handle, i);
         }
-        if (dataSize <= 0) {
+        tvinput::DmaBufMapper::Access src(mMapper, handle, DMA_BUF_SYNC_READ, 0, dataSize);
+        if (dataSize <= 0 || !src.data()) {
             ALOGE("dataSize <= 0 , it can't write file.");
             ret = -1;
         } else {
-            if (fwrite(dataPtr, dataSize, 1, fp) <= 0) {
+            if (fwrite(src.data(), std::min((size_t)dataSize, src.size()), 1, fp) <= 0) {
                 ALOGE("fwrite %s failed.", fileName);
                 ret = -1;
             }
         }
         fclose(fp);
-	if (mode == 0) {
-            mBuffMgr->UnlockLocked(handle);
-        } else {
-            mBuffMgr->Unlock(handle);
-        }
         ALOGI("Write data success to %s",fileName);
         ret = 0;
     } else {
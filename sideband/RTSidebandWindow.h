@@ -40,6 +40,9 @@
 #include <inttypes.h>
 #include "rt_type.h"   // NOLINT
 #include "common/Utils.h"
+#include "common/RowWorkerPool.h"
+#include "common/DmaBufMapper.h"
+#include "common/StageBackends.h"
 #include "video_tunnel.h"
 
 #ifdef LOG_TAG
@@ -50,7 +53,11 @@
 namespace android {
 
 class DrmVopRender;
-class RTSidebandWindow : public RefBase, IMessageHandler {
+struct PresentStats;
+namespace tvinput {
+class GraphicBufferPool;
+}
+class RTSidebandWindow : public RefBase, IMessageHandler, public tvinput::DisplaySink {
  public:
     RTSidebandWindow();
     virtual ~RTSidebandWindow();
@@ -90,6 +97,9 @@ class RTSidebandWindow : public RefBase, IMessageHandler {
         int32_t format, uint64_t usage);
     int getBufferHandleFd(buffer_handle_t buffer);
     int getBufferLength(buffer_handle_t buffer);
+    int getBufferStride(buffer_handle_t buffer);
+    // the frame is smaller than the buffer, see TvInputBufferManager
+    status_t setContentSize(buffer_handle_t buffer, int width, int height);
 
     status_t setBufferGeometry(int32_t width, int32_t height, int32_t format);
     status_t setCrop(int32_t left, int32_t top, int32_t right, int32_t bottom);
@@ -103,17 +113,33 @@ class RTSidebandWindow : public RefBase, IMessageHandler {
     int importHidlHandleBufferLocked(/*in&out*/buffer_handle_t& rawHandle);
     int buffDataTransfer(buffer_handle_t srcHandle, buffer_handle_t dstRawHandle);
     int buffDataTransfer2(buffer_handle_t srcHandle, buffer_handle_t dstRawHandle);
-    int NV24ToNV12(buffer_handle_t srcHandle, buffer_handle_t dstHandle, int width, int height);
-    status_t show(buffer_handle_t buffer, int displayRadio, int hdmiInType);
+    // cpu conversion through PixelConvert, same size only, formats are v4l2 fourccs.
+    // srcFormat == dstFormat copies row by row into the padded dst
+    int convertBuffer(buffer_handle_t srcHandle, uint32_t srcFormat, buffer_handle_t dstHandle,
+        uint32_t dstFormat, int width, int height, int dstWidthStride, int dstHeightStride);
+    // -EBUSY while the last commit is in flight, nothing is shown then
+    status_t show(buffer_handle_t buffer, int displayRadio, int hdmiInType, int *releaseFence = NULL,
+        nsecs_t captureTime = 0);
+    bool isPresentPending();
+    // caller owns the returned fd
+    int getPresentFence();
+    status_t getPresentStats(struct PresentStats *stats);
     status_t clearVopArea();
+    void reserveFbCache(size_t count);
+    void prepareFb(buffer_handle_t handle, int hdmiInType);
     void setDebugLevel(int debugLevel);
     int getSidebandPlaneId();
+    // gralloc buffers come from and go back to pool, NULL allocates directly
+    void setBufferPool(tvinput::GraphicBufferPool *pool) { mBufferPool = pool; }
 
  private:
     RTSidebandWindow(const RTSidebandWindow& other);
     RTSidebandWindow& operator=(const RTSidebandWindow& other);
     status_t allocateBuffer(vt_buffer_t **buffer);
     int writeData2File(const char *fileName, void *data, int dataSize);
+    status_t allocateHandle(int32_t width, int32_t height, int32_t format, uint64_t usage,
+        const char *requestor, buffer_handle_t *handle);
+    void freeHandle(buffer_handle_t handle);
 
     virtual void messageThreadLoop();
     virtual status_t requestExitAndWait();
@@ -140,6 +166,11 @@ class RTSidebandWindow : public RefBase, IMessageHandler {
     android::Condition                  mBufferAvailCondition;
     int mDebugLevel;
     int mSidebandType;
+    tvinput::GraphicBufferPool          *mBufferPool;
+    // convertBuffer rows, capture thread only
+    tvinput::RowWorkerPool              mConvertWorkers;
+    // cpu views of the buffers touched by the copy/convert/dump helpers
+    tvinput::DmaBufMapper               mMapper;
 };
 
 }
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "BufferContextRegistry.h"
+
+namespace common {
+
+namespace {
+
+constexpr int kHandles = 256;
+
+class BufferContextRegistryTest : public ::testing::Test {
+ protected:
+    void SetUp() override {
+        for (int i = 0; i < kHandles; i++) {
+            handles_.push_back(native_handle_create(0, 0));
+        }
+    }
+
+    void TearDown() override {
+        for (native_handle_t* handle : handles_) {
+            native_handle_delete(handle);
+        }
+    }
+
+    // every field derived from |i|, a torn read cannot pass Matches()
+    static std::unique_ptr<BufferContext> MakeContext(int i) {
+        std::unique_ptr<BufferContext> context(new BufferContext());
+        context->buffer_id = i;
+        context->type = GRALLOC;
+        context->usage = 0;
+        context->has_metadata = true;
+        BufferMetadata& metadata = context->metadata;
+        metadata.width = i;
+        metadata.height = i * 2;
+        metadata.alloc_width = i;
+        metadata.alloc_height = i * 2;
+        metadata.hal_format = i + 1;
+        metadata.allocation_size = i * 3;
+        metadata.buffer_id = i;
+        metadata.fd = i;
+        metadata.layout_count = BufferMetadata::kMaxPlanes;
+        for (size_t p = 0; p < BufferMetadata::kMaxPlanes; p++) {
+            metadata.plane_stride[p] = i + p;
+            metadata.plane_size[p] = i * p;
+        }
+        return context;
+    }
+
+    static bool Matches(const BufferContext& context, int i) {
+        const BufferMetadata& metadata = context.metadata;
+        bool ok = context.buffer_id == (uint64_t)i && context.has_metadata
+            && metadata.width == (uint64_t)i && metadata.height == (uint64_t)i * 2
+            && metadata.alloc_width == (uint64_t)i && metadata.alloc_height == (uint64_t)i * 2
+            && metadata.hal_format == i + 1 && metadata.allocation_size == (uint64_t)i * 3
+            && metadata.buffer_id == (uint64_t)i && metadata.fd == i
+            && metadata.layout_count == BufferMetadata::kMaxPlanes;
+        for (size_t p = 0; ok && p < BufferMetadata::kMaxPlanes; p++) {
+            ok = metadata.plane_stride[p] == (int64_t)(i + p)
+                && metadata.plane_size[p] == (int64_t)(i * p);
+        }
+        return ok;
+    }
+
+    std::vector<native_handle_t*> handles_;
+};
+
+}  // namespace
+
+TEST_F(BufferContextRegistryTest, FindsWhatWasInserted) {
+    BufferContextRegistry registry;
+    BufferContext context;
+    EXPECT_FALSE(registry.Find(handles_[0], &context));
+    for (int i = 0; i < kHandles; i++) {
+        registry.Insert(handles_[i], MakeContext(i));
+    }
+    for (int i = 0; i < kHandles; i++) {
+        ASSERT_TRUE(registry.Find(handles_[i], &context));
+        EXPECT_TRUE(Matches(context, i));
+    }
+    registry.Edit(handles_[7], [&](BufferContextCache& contexts) { contexts.erase(handles_[7]); });
+    EXPECT_FALSE(registry.Find(handles_[7], &context));
+    EXPECT_TRUE(registry.Find(handles_[8], &context));
+}
+
+// buffers allocated and freed under per-frame lookups from other threads
+TEST_F(BufferContextRegistryTest, LookupsDuringInsertAndErase) {
+    BufferContextRegistry registry;
+    std::atomic<bool> stop(false);
+    std::atomic<long> hits(0);
+    std::atomic<long> torn(0);
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 2; w++) {
+        writers.emplace_back([&, w] {
+            unsigned seed = w;
+            for (int n = 0; n < 50000; n++) {
+                int i = rand_r(&seed) % kHandles;
+                buffer_handle_t handle = handles_[i];
+                if (rand_r(&seed) & 1) {
+                    registry.Insert(handle, MakeContext(i));
+                } else {
+                    registry.Edit(handle, [&](BufferContextCache& contexts) {
+                        contexts.erase(handle);
+                    });
+                }
+            }
+        });
+    }
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 6; r++) {
+        readers.emplace_back([&, r] {
+            unsigned seed = 100 + r;
+            while (!stop) {
+                int i = rand_r(&seed) % kHandles;
+                BufferContext context;
+                if (registry.Find(handles_[i], &context)) {
+                    hits++;
+                    if (!Matches(context, i)) {
+                        torn++;
+                    }
+                }
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    stop = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    EXPECT_GT(hits.load(), 0);
+    EXPECT_EQ(0, torn.load());
+}
+
+// Register()/Deregister() reference counting racing on the same handles
+TEST_F(BufferContextRegistryTest, EditCountsReferencesExactly) {
+    BufferContextRegistry registry;
+    constexpr int kThreads = 8;
+    constexpr int kRounds = 2000;
+    std::atomic<bool> stop(false);
+    std::atomic<long> unreferenced(0);
+    std::thread reader([&] {
+        unsigned seed = 1;
+        while (!stop) {
+            BufferContext context;
+            if (registry.Find(handles_[rand_r(&seed) % kHandles], &context) && !context.usage) {
+                unreferenced++;
+            }
+        }
+    });
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&, t] {
+            for (int n = 0; n < kRounds; n++) {
+                buffer_handle_t handle = handles_[(t + n) % kHandles];
+                registry.Edit(handle, [&](BufferContextCache& contexts) {
+                    auto& context = contexts[handle];
+                    if (!context) {
+                        context = MakeContext(0);
+                    }
+                    context->usage++;
+                });
+            }
+            for (int n = 0; n < kRounds; n++) {
+                buffer_handle_t handle = handles_[(t + n) % kHandles];
+                registry.Edit(handle, [&](BufferContextCache& contexts) {
+                    auto context_it = contexts.find(handle);
+                    ASSERT_NE(contexts.end(), context_it);
+                    if (!--context_it->second->usage) {
+                        contexts.erase(context_it);
+                    }
+                });
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    stop = true;
+    reader.join();
+    EXPECT_EQ(0, unreferenced.load());
+    for (int i = 0; i < kHandles; i++) {
+        BufferContext context;
+        EXPECT_FALSE(registry.Find(handles_[i], &context)) << i;
+    }
+}
+
+}  // namespace common
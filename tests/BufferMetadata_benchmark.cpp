@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+/*
+ * Per call cost of the TvInputBufferManager getters on a real gralloc4
+ * buffer, decoded through IMapper::get() (metadata forgotten) against
+ * answered from the BufferContext cache. Runs on the device, it needs
+ * the allocator and mapper services.
+ */
+
+#include <benchmark/benchmark.h>
+#include <hardware/gralloc.h>
+#include <hardware/hardware_rockchip.h>
+
+#include "TvInput_Buffer_Manager.h"
+
+namespace {
+
+using common::TvInputBufferManager;
+
+// a 1080p NV12 capture buffer, allocated once, arg 0 is the IMapper path
+// and arg 1 the cached one
+class BufferMetadataFixture : public benchmark::Fixture {
+ public:
+    void SetUp(const benchmark::State &state) override {
+        mManager = TvInputBufferManager::GetInstance();
+        uint32_t stride = 0;
+        mBuffer = NULL;
+        mManager->Allocate(1920, 1080, HAL_PIXEL_FORMAT_YCrCb_NV12,
+            GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_HW_COMPOSER, common::GRALLOC,
+            &mBuffer, &stride);
+        if (state.range(0)) {
+            mManager->CacheMetadata(mBuffer);
+        } else {
+            mManager->ForgetMetadata(mBuffer);
+        }
+    }
+
+    void TearDown(const benchmark::State &) override {
+        if (mBuffer) {
+            mManager->Free(mBuffer);
+            mBuffer = NULL;
+        }
+    }
+
+ protected:
+    bool ready(benchmark::State &state) {
+        if (!mBuffer) {
+            state.SkipWithError("allocating the buffer failed");
+            return false;
+        }
+        state.SetLabel(state.range(0) ? "cached" : "imapper");
+        return true;
+    }
+
+    TvInputBufferManager *mManager;
+    buffer_handle_t mBuffer;
+};
+
+BENCHMARK_DEFINE_F(BufferMetadataFixture, GetWidth)(benchmark::State &state) {
+    if (!ready(state)) {
+        return;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mManager->GetWidth(mBuffer));
+    }
+}
+BENCHMARK_REGISTER_F(BufferMetadataFixture, GetWidth)->Arg(0)->Arg(1);
+
+BENCHMARK_DEFINE_F(BufferMetadataFixture, GetHalPixelFormat)(benchmark::State &state) {
+    if (!ready(state)) {
+        return;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mManager->GetHalPixelFormat(mBuffer));
+    }
+}
+BENCHMARK_REGISTER_F(BufferMetadataFixture, GetHalPixelFormat)->Arg(0)->Arg(1);
+
+BENCHMARK_DEFINE_F(BufferMetadataFixture, GetHandleBufferSize)(benchmark::State &state) {
+    if (!ready(state)) {
+        return;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mManager->GetHandleBufferSize(mBuffer));
+    }
+}
+BENCHMARK_REGISTER_F(BufferMetadataFixture, GetHandleBufferSize)->Arg(0)->Arg(1);
+
+BENCHMARK_DEFINE_F(BufferMetadataFixture, GetPlaneStride)(benchmark::State &state) {
+    if (!ready(state)) {
+        return;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(TvInputBufferManager::GetPlaneStride(mBuffer, 0));
+    }
+}
+BENCHMARK_REGISTER_F(BufferMetadataFixture, GetPlaneStride)->Arg(0)->Arg(1);
+
+// the queries of one DrmVopRender::getFbid() and buffDataTransfer2() frame
+BENCHMARK_DEFINE_F(BufferMetadataFixture, PerFrameQueries)(benchmark::State &state) {
+    if (!ready(state)) {
+        return;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mManager->GetWidth(mBuffer));
+        benchmark::DoNotOptimize(mManager->GetHeight(mBuffer));
+        benchmark::DoNotOptimize(mManager->GetHalPixelFormat(mBuffer));
+        benchmark::DoNotOptimize(TvInputBufferManager::GetPlaneStride(mBuffer, 0));
+        uint32_t planes = TvInputBufferManager::GetNumPlanes(mBuffer);
+        for (uint32_t i = 0; i < planes; i++) {
+            benchmark::DoNotOptimize(TvInputBufferManager::GetPlaneSize(mBuffer, i));
+        }
+        benchmark::DoNotOptimize(mManager->GetHandleBufferSize(mBuffer));
+    }
+}
+BENCHMARK_REGISTER_F(BufferMetadataFixture, PerFrameQueries)->Arg(0)->Arg(1);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <benchmark/benchmark.h>
+
+#include "DmaBufMapper.h"
+#include "MemfdBuffer.h"
+
+namespace android {
+namespace tvinput {
+
+namespace {
+
+// a 1080p NV12 frame, the arg of each benchmark is the bytes read per access
+constexpr size_t FRAME_SIZE = 1920 * 1080 * 3 / 2;
+
+}  // namespace
+
+// a fresh mmap and whole buffer sync per access, what a gralloc lock/unlock did
+static void BM_MapPerAccess(benchmark::State &state) {
+    MemfdBuffer buffer;
+    buffer.allocate(FRAME_SIZE);
+    size_t touched = state.range(0);
+    for (auto _ : state) {
+        void *base = mmap(NULL, FRAME_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, buffer.fd(), 0);
+        struct dma_buf_sync sync = { DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ };
+        ioctl(buffer.fd(), DMA_BUF_IOCTL_SYNC, &sync);
+        benchmark::DoNotOptimize(memchr(base, 1, touched));
+        sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+        ioctl(buffer.fd(), DMA_BUF_IOCTL_SYNC, &sync);
+        munmap(base, FRAME_SIZE);
+    }
+    state.SetBytesProcessed(state.iterations() * touched);
+}
+
+static void BM_DmaBufMapperAccess(benchmark::State &state) {
+    MemfdBuffer buffer;
+    buffer.allocate(FRAME_SIZE);
+    DmaBufMapper mapper;
+    size_t touched = state.range(0);
+    for (auto _ : state) {
+        DmaBufMapper::Access access(mapper, buffer.handle(), DMA_BUF_SYNC_READ, 0, touched);
+        benchmark::DoNotOptimize(memchr(access.data(), 1, touched));
+    }
+    state.SetBytesProcessed(state.iterations() * touched);
+}
+
+// a line for a dump header, the luma plane, the whole frame
+BENCHMARK(BM_MapPerAccess)->Arg(1920)->Arg(1920 * 1080)->Arg(FRAME_SIZE);
+BENCHMARK(BM_DmaBufMapperAccess)->Arg(1920)->Arg(1920 * 1080)->Arg(FRAME_SIZE);
+
+// capture, pq and record threads reading their buffers through one mapper
+static void BM_DmaBufMapperShared(benchmark::State &state) {
+    static DmaBufMapper *mapper;
+    static MemfdBuffer *buffers;
+    if (state.thread_index() == 0) {
+        mapper = new DmaBufMapper();
+        buffers = new MemfdBuffer[state.threads()];
+        for (int i = 0; i < state.threads(); i++) {
+            buffers[i].allocate(FRAME_SIZE);
+        }
+    }
+    for (auto _ : state) {
+        DmaBufMapper::Access access(*mapper, buffers[state.thread_index()].handle(),
+            DMA_BUF_SYNC_READ, 0, 1920);
+        benchmark::DoNotOptimize(access.data());
+    }
+    if (state.thread_index() == 0) {
+        delete mapper;
+        delete[] buffers;
+    }
+}
+BENCHMARK(BM_DmaBufMapperShared)->ThreadRange(1, 4);
+
+}  // namespace tvinput
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#include <string.h>
+#include <gtest/gtest.h>
+
+#include "DmaBufMapper.h"
+#include "MemfdBuffer.h"
+
+namespace android {
+namespace tvinput {
+
+TEST(DmaBufMapperTest, MapsOncePerBuffer) {
+    MemfdBuffer buffer;
+    ASSERT_TRUE(buffer.allocate(4096));
+    DmaBufMapper mapper;
+    uint8_t *first;
+    {
+        DmaBufMapper::Access access(mapper, buffer.handle(), DMA_BUF_SYNC_WRITE);
+        ASSERT_NE(nullptr, access.data());
+        EXPECT_EQ(4096u, access.size());
+        memset(access.data(), 0x5a, access.size());
+        first = access.data();
+    }
+    {
+        DmaBufMapper::Access access(mapper, buffer.handle(), DMA_BUF_SYNC_READ, 1024, 16);
+        EXPECT_EQ(first, access.data());
+        EXPECT_EQ(0x5a, access.data()[1024]);
+    }
+    EXPECT_EQ(1u, mapper.count());
+}
+
+TEST(DmaBufMapperTest, RemapsARecycledHandle) {
+    MemfdBuffer buffer;
+    ASSERT_TRUE(buffer.allocate(4096));
+    DmaBufMapper mapper;
+    {
+        DmaBufMapper::Access access(mapper, buffer.handle(), DMA_BUF_SYNC_WRITE);
+        ASSERT_NE(nullptr, access.data());
+        access.data()[0] = 1;
+    }
+    // another buffer behind the same handle and fd number, only the inode differs
+    int fd = buffer.fd();
+    MemfdBuffer other;
+    ASSERT_TRUE(other.allocate(8192));
+    ASSERT_EQ(fd, dup2(other.fd(), fd));
+    {
+        DmaBufMapper::Access access(mapper, buffer.handle(), DMA_BUF_SYNC_READ);
+        ASSERT_NE(nullptr, access.data());
+        EXPECT_EQ(8192u, access.size());
+        EXPECT_EQ(0, access.data()[0]);
+    }
+    EXPECT_EQ(1u, mapper.count());
+}
+
+TEST(DmaBufMapperTest, AccessOutlivesForget) {
+    MemfdBuffer buffer;
+    ASSERT_TRUE(buffer.allocate(4096));
+    DmaBufMapper mapper;
+    DmaBufMapper::Access access(mapper, buffer.handle(), DMA_BUF_SYNC_RW);
+    ASSERT_NE(nullptr, access.data());
+    mapper.forget(buffer.handle());
+    buffer.release();
+    EXPECT_EQ(0u, mapper.count());
+    // still mapped through the mapping's own fd
+    memset(access.data(), 0, access.size());
+}
+
+TEST(DmaBufMapperTest, RejectsHandlesWithoutFd) {
+    DmaBufMapper mapper;
+    DmaBufMapper::Access none(mapper, NULL, DMA_BUF_SYNC_READ);
+    EXPECT_EQ(nullptr, none.data());
+    EXPECT_EQ(0u, none.size());
+    native_handle_t *empty = native_handle_create(0, 0);
+    DmaBufMapper::Access noFd(mapper, empty, DMA_BUF_SYNC_READ);
+    EXPECT_EQ(nullptr, noFd.data());
+    native_handle_delete(empty);
+    EXPECT_EQ(0u, mapper.count());
+}
+
+}  // namespace tvinput
+}  // namespace android
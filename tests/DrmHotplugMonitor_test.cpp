@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <string>
+#include <gtest/gtest.h>
+
+#include "DrmHotplugMonitor.h"
+
+namespace android {
+
+namespace {
+
+// NUL separated KEY=VALUE, the way the kernel sends a uevent
+std::string uevent(std::initializer_list<const char *> fields) {
+    std::string msg;
+    for (const char *field : fields) {
+        msg.append(field);
+        msg.push_back('\0');
+    }
+    return msg;
+}
+
+const std::string kDrmHotplug = uevent({
+    "change@/devices/platform/display-subsystem/drm/card0",
+    "ACTION=change",
+    "DEVPATH=/devices/platform/display-subsystem/drm/card0",
+    "SUBSYSTEM=drm",
+    "MINOR=0",
+    "DEVNAME=dri/card0",
+    "DEVTYPE=drm_minor",
+    "HOTPLUG=1",
+});
+
+const std::string kUsbAdd = uevent({
+    "add@/devices/platform/usbhost/usb1/1-1",
+    "ACTION=add",
+    "SUBSYSTEM=usb",
+    "HOTPLUG=1",
+});
+
+const std::string kDrmChange = uevent({
+    "change@/devices/platform/display-subsystem/drm/card0",
+    "ACTION=change",
+    "SUBSYSTEM=drm",
+});
+
+// the monitor reads one uevent per datagram from mSource[1]
+class DrmHotplugMonitorTest : public ::testing::Test {
+ protected:
+    void SetUp() override {
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, mSource));
+        mMonitor = new DrmHotplugMonitor();
+    }
+
+    void TearDown() override {
+        mMonitor->stop();
+        mMonitor.clear();
+        for (int fd : mSource) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    void send(const std::string &msg) {
+        ASSERT_EQ((ssize_t)msg.size(), write(mSource[0], msg.data(), msg.size()));
+    }
+
+    // the monitor thread handles a uevent some time after send()
+    template <typename Predicate>
+    static bool waitFor(Predicate predicate) {
+        for (int i = 0; i < 200; i++) {
+            if (predicate()) {
+                return true;
+            }
+            usleep(5000);
+        }
+        return predicate();
+    }
+
+    int mSource[2] = {-1, -1};
+    sp<DrmHotplugMonitor> mMonitor;
+};
+
+}  // namespace
+
+TEST_F(DrmHotplugMonitorTest, ParsesOnlyDrmHotplug) {
+    EXPECT_TRUE(mMonitor->handleUevent(kDrmHotplug.data(), kDrmHotplug.size()));
+    mMonitor->clearDirty();
+    EXPECT_FALSE(mMonitor->handleUevent(kUsbAdd.data(), kUsbAdd.size()));
+    EXPECT_FALSE(mMonitor->handleUevent(kDrmChange.data(), kDrmChange.size()));
+    EXPECT_FALSE(mMonitor->isDirty());
+    // HOTPLUG=1 is the last field, cut off it is not a hotplug
+    EXPECT_FALSE(mMonitor->handleUevent(kDrmHotplug.data(), kDrmHotplug.size() - 10));
+}
+
+TEST_F(DrmHotplugMonitorTest, HotplugMarksDirty) {
+    ASSERT_TRUE(mMonitor->start(mSource[1]));
+    EXPECT_TRUE(mMonitor->isListening());
+    send(kUsbAdd);
+    send(kDrmChange);
+    send(kDrmHotplug);
+    ASSERT_TRUE(waitFor([&] { return mMonitor->isDirty(); }));
+    nsecs_t first = mMonitor->lastEventTime();
+    EXPECT_GT(first, 0);
+
+    mMonitor->clearDirty();
+    send(kUsbAdd);
+    send(kDrmHotplug);
+    ASSERT_TRUE(waitFor([&] { return mMonitor->isDirty(); }));
+    EXPECT_GE(mMonitor->lastEventTime(), first);
+}
+
+TEST_F(DrmHotplugMonitorTest, OtherEventsLeaveItClean) {
+    ASSERT_TRUE(mMonitor->start(mSource[1]));
+    for (int i = 0; i < 16; i++) {
+        send(kUsbAdd);
+        send(kDrmChange);
+    }
+    // the hotplug sent last tells when everything before it was read
+    send(kDrmHotplug);
+    ASSERT_TRUE(waitFor([&] { return mMonitor->isDirty(); }));
+    mMonitor->clearDirty();
+    send(kUsbAdd);
+    usleep(20000);
+    EXPECT_FALSE(mMonitor->isDirty());
+}
+
+TEST_F(DrmHotplugMonitorTest, SourceClosedStopsListening) {
+    ASSERT_TRUE(mMonitor->start(mSource[1]));
+    close(mSource[0]);
+    mSource[0] = -1;
+    EXPECT_TRUE(waitFor([&] { return !mMonitor->isListening(); }));
+}
+
+TEST_F(DrmHotplugMonitorTest, StopJoinsTheThread) {
+    ASSERT_TRUE(mMonitor->start(mSource[1]));
+    mMonitor->stop();
+    EXPECT_FALSE(mMonitor->isListening());
+    // the caller's fd is left open
+    EXPECT_GE(fcntl(mSource[1], F_GETFD), 0);
+    // and a second start works on it again
+    ASSERT_TRUE(mMonitor->start(mSource[1]));
+    send(kDrmHotplug);
+    EXPECT_TRUE(waitFor([&] { return mMonitor->isDirty(); }));
+}
+
+}  // namespace android
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "FrameDumper.h"
+#include "MemfdBuffer.h"
+
+namespace android {
+namespace tvinput {
+
+namespace {
+
+class FrameDumperTest : public ::testing::Test {
+ protected:
+    void SetUp() override {
+        char dir[] = "/tmp/tv_input_dump_test_XXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(dir));
+        mDir = dir;
+        ASSERT_TRUE(mFrame.allocate(4096));
+    }
+
+    void TearDown() override {
+        for (const std::string &name : list()) {
+            unlink((mDir + "/" + name).c_str());
+        }
+        rmdir(mDir.c_str());
+    }
+
+    std::vector<std::string> list() {
+        std::vector<std::string> names;
+        DIR *d = opendir(mDir.c_str());
+        if (!d) {
+            return names;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(d)) != NULL) {
+            if (entry->d_name[0] != '.') {
+                names.push_back(entry->d_name);
+            }
+        }
+        closedir(d);
+        return names;
+    }
+
+    // a dump left by an earlier session, age in seconds sets its mtime
+    void addOldDump(const std::string &name, int age) {
+        std::string path = mDir + "/" + name;
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        ASSERT_GE(fd, 0);
+        close(fd);
+        struct timeval times[2];
+        gettimeofday(&times[0], NULL);
+        times[0].tv_sec -= age;
+        times[1] = times[0];
+        ASSERT_EQ(0, utimes(path.c_str(), times));
+    }
+
+    void dumpSession(FrameDumper &dumper, int frames) {
+        ASSERT_TRUE(dumper.begin(mDir.c_str(), 64, 32, 0, 4096, frames));
+        for (int i = 0; i < frames; i++) {
+            dumper.submit(mFrame.fd(), 4096, i, i);
+        }
+        dumper.stop();
+    }
+
+    std::string mDir;
+    MemfdBuffer mFrame;
+};
+
+}  // namespace
+
+TEST_F(FrameDumperTest, WritesOneFilePerSession) {
+    FrameDumper dumper;
+    dumpSession(dumper, 1);
+    std::vector<std::string> names = list();
+    ASSERT_EQ(1u, names.size());
+    EXPECT_EQ(0, names[0].compare(0, 20, "tv_input_dump_64x32_"));
+    EXPECT_EQ(1u, dumper.written() + dumper.dropped());
+}
+
+TEST_F(FrameDumperTest, KeepsTheNewestDumps) {
+    for (int i = 0; i < FrameDumper::MAX_KEPT_FILES + 2; i++) {
+        addOldDump("tv_input_dump_16x16_" + std::to_string(i) + ".bin", 100 - i);
+    }
+    addOldDump("unrelated.bin", 1000);
+    FrameDumper dumper;
+    dumpSession(dumper, 1);
+    std::vector<std::string> names = list();
+    // the oldest dumps made room for the new one, other files stay
+    EXPECT_EQ((size_t)FrameDumper::MAX_KEPT_FILES + 1, names.size());
+    for (int i = 0; i < 3; i++) {
+        std::string name = "tv_input_dump_16x16_" + std::to_string(i) + ".bin";
+        EXPECT_EQ(names.end(), std::find(names.begin(), names.end(), name)) << name;
+    }
+    EXPECT_NE(names.end(), std::find(names.begin(), names.end(), "unrelated.bin"));
+}
+
+TEST_F(FrameDumperTest, RepeatedSessionsStayBounded) {
+    FrameDumper dumper;
+    for (int i = 0; i < FrameDumper::MAX_KEPT_FILES * 2; i++) {
+        dumpSession(dumper, 1);
+        // file names are unique per millisecond
+        usleep(2000);
+    }
+    EXPECT_EQ((size_t)FrameDumper::MAX_KEPT_FILES, list().size());
+}
+
+}  // namespace tvinput
+}  // namespace android
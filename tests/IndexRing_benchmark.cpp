@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+
+#include "IndexRing.h"
+
+namespace android {
+namespace tvinput {
+
+// one buffer through a queue of |depth| entries, what the pq/iep threads do per frame
+static void BM_IndexRingHandoff(benchmark::State &state) {
+    int depth = state.range(0);
+    IndexRing ring(depth);
+    for (int i = 0; i < depth - 1; i++) {
+        ring.push_back(i);
+    }
+    int next = depth - 1;
+    for (auto _ : state) {
+        ring.push_back(next);
+        next = ring.front();
+        ring.pop_front();
+        benchmark::DoNotOptimize(next);
+    }
+}
+BENCHMARK(BM_IndexRingHandoff)->Arg(4)->Arg(8);
+
+// the std::vector erase(begin()) lists the rings replaced
+static void BM_VectorHandoff(benchmark::State &state) {
+    int depth = state.range(0);
+    std::vector<int> list;
+    for (int i = 0; i < depth - 1; i++) {
+        list.push_back(i);
+    }
+    int next = depth - 1;
+    for (auto _ : state) {
+        list.push_back(next);
+        next = list.front();
+        list.erase(list.begin());
+        benchmark::DoNotOptimize(next);
+    }
+}
+BENCHMARK(BM_VectorHandoff)->Arg(4)->Arg(8);
+
+static void BM_IndexRingRemove(benchmark::State &state) {
+    int depth = state.range(0);
+    IndexRing ring(depth);
+    for (int i = 0; i < depth; i++) {
+        ring.push_back(i);
+    }
+    int victim = depth / 2;
+    for (auto _ : state) {
+        ring.remove(victim);
+        ring.push_back(victim);
+        victim = ring[depth / 2];
+    }
+}
+BENCHMARK(BM_IndexRingRemove)->Arg(4)->Arg(8);
+
+// producer and consumer on two threads under one lock, as capture -> pq
+static void BM_IndexRingCrossThread(benchmark::State &state) {
+    Mutex lock;
+    Condition cond;
+    IndexRing ring(state.range(0));
+    bool done = false;
+    std::thread consumer([&]() {
+        Mutex::Autolock autoLock(lock);
+        while (true) {
+            while (ring.empty() && !done) {
+                cond.wait(lock);
+            }
+            if (ring.empty()) {
+                break;
+            }
+            ring.pop_front();
+            cond.broadcast();
+        }
+    });
+    int next = 0;
+    for (auto _ : state) {
+        Mutex::Autolock autoLock(lock);
+        while (ring.full()) {
+            cond.wait(lock);
+        }
+        ring.push_back(next++ % ring.capacity());
+        cond.broadcast();
+    }
+    {
+        Mutex::Autolock autoLock(lock);
+        done = true;
+        cond.broadcast();
+    }
+    consumer.join();
+}
+BENCHMARK(BM_IndexRingCrossThread)->Arg(4)->UseRealTime();
+
+}  // namespace tvinput
+}  // namespace android
+
+BENCHMARK_MAIN();
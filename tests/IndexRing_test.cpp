@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#include <gtest/gtest.h>
+
+#include "IndexRing.h"
+
+namespace android {
+namespace tvinput {
+
+TEST(IndexRingTest, KeepsFifoOrder) {
+    IndexRing ring(4);
+    EXPECT_TRUE(ring.empty());
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(ring.push_back(i));
+    }
+    EXPECT_TRUE(ring.full());
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(i, ring.front());
+        EXPECT_TRUE(ring.pop_front());
+    }
+    EXPECT_TRUE(ring.empty());
+    EXPECT_FALSE(ring.pop_front());
+}
+
+TEST(IndexRingTest, RefusesPushWhenFull) {
+    IndexRing ring(2);
+    EXPECT_TRUE(ring.push_back(7));
+    EXPECT_TRUE(ring.push_back(8));
+    EXPECT_FALSE(ring.push_back(9));
+    EXPECT_EQ(2, ring.size());
+    EXPECT_EQ(7, ring[0]);
+    EXPECT_EQ(8, ring[1]);
+}
+
+TEST(IndexRingTest, WrapsAround) {
+    IndexRing ring(3);
+    int next = 0;
+    int expected = 0;
+    // the head walks the storage many times over
+    for (int round = 0; round < 100; round++) {
+        while (!ring.full()) {
+            ring.push_back(next++);
+        }
+        for (int i = 0; i < ring.size(); i++) {
+            EXPECT_EQ(expected + i, ring[i]);
+        }
+        ring.pop_front();
+        expected++;
+        ring.pop_front();
+        expected++;
+    }
+}
+
+TEST(IndexRingTest, RemoveKeepsOrderOfTheRest) {
+    IndexRing ring(5);
+    ring.push_back(9);
+    ring.pop_front();
+    for (int i = 0; i < 5; i++) {
+        ring.push_back(i);
+    }
+    EXPECT_TRUE(ring.remove(2));
+    EXPECT_FALSE(ring.remove(2));
+    ASSERT_EQ(4, ring.size());
+    EXPECT_EQ(0, ring[0]);
+    EXPECT_EQ(1, ring[1]);
+    EXPECT_EQ(3, ring[2]);
+    EXPECT_EQ(4, ring[3]);
+    EXPECT_TRUE(ring.remove(0));
+    EXPECT_TRUE(ring.remove(4));
+    EXPECT_EQ(1, ring.front());
+    EXPECT_EQ(2, ring.size());
+}
+
+TEST(IndexRingTest, ResetResizes) {
+    IndexRing ring(2);
+    ring.push_back(1);
+    ring.reset(6);
+    EXPECT_TRUE(ring.empty());
+    EXPECT_EQ(6, ring.capacity());
+    for (int i = 0; i < 6; i++) {
+        EXPECT_TRUE(ring.push_back(i));
+    }
+    EXPECT_TRUE(ring.full());
+    ring.clear();
+    EXPECT_TRUE(ring.empty());
+    EXPECT_EQ(6, ring.capacity());
+    ring.reset(0);
+    EXPECT_EQ(1, ring.capacity());
+}
+
+}  // namespace tvinput
+}  // namespace android
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#ifndef _TVINPUT_HAL_TESTS_MEMFD_BUFFER_H_
+#define _TVINPUT_HAL_TESTS_MEMFD_BUFFER_H_
+
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/memfd.h>
+#include <cutils/native_handle.h>
+
+namespace android {
+namespace tvinput {
+
+/*
+ * memfd stand-in for a gralloc buffer on the host. data[0] of the handle
+ * is the fd like in a gralloc handle, so DmaBufMapper and the replay
+ * backend take it as is. The dma-buf sync ioctls fail on it, which only
+ * costs the failed syscall.
+ */
+class MemfdBuffer {
+ public:
+    MemfdBuffer() : mHandle(NULL), mSize(0) {}
+    ~MemfdBuffer() { release(); }
+
+    bool allocate(size_t size) {
+        release();
+        // the host glibc may predate the memfd_create() wrapper
+        int fd = (int)syscall(__NR_memfd_create, "tv_input_test", MFD_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        if (ftruncate(fd, size) != 0) {
+            close(fd);
+            return false;
+        }
+        mHandle = native_handle_create(1, 0);
+        mHandle->data[0] = fd;
+        mSize = size;
+        return true;
+    }
+
+    void release() {
+        if (mHandle) {
+            close(mHandle->data[0]);
+            native_handle_delete(mHandle);
+            mHandle = NULL;
+        }
+        mSize = 0;
+    }
+
+    int fd() const { return mHandle ? mHandle->data[0] : -1; }
+    buffer_handle_t handle() const { return mHandle; }
+    size_t size() const { return mSize; }
+
+ private:
+    MemfdBuffer(const MemfdBuffer& other);
+    MemfdBuffer& operator=(const MemfdBuffer& other);
+
+    native_handle_t *mHandle;
+    size_t mSize;
+};
+
+}  // namespace tvinput
+}  // namespace android
+
+#endif  // _TVINPUT_HAL_TESTS_MEMFD_BUFFER_H_
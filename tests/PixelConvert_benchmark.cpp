@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "PixelConvert.h"
+
+namespace android {
+namespace tvinput {
+
+// one full frame on the calling thread, bytes are source plus destination
+static void convertFrame(benchmark::State &state, uint32_t srcFormat, uint32_t dstFormat) {
+    int width = state.range(0);
+    int height = state.range(1);
+    std::vector<uint8_t> src(PixelConvert::frameSize(srcFormat, width, height), 0x5a);
+    std::vector<uint8_t> dst(PixelConvert::frameSize(dstFormat, width, height));
+    PixelConvert::Image s = PixelConvert::layout(srcFormat, src.data(), width, height);
+    PixelConvert::Image d = PixelConvert::layout(dstFormat, dst.data(), width, height);
+    int rows = PixelConvert::rowCount(height);
+    for (auto _ : state) {
+        PixelConvert::convert(srcFormat, s, dstFormat, d, width, height, 0, rows);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * (int64_t)(src.size() + dst.size()));
+    state.SetLabel(PixelConvert::kernelName());
+}
+
+#define PIXEL_CONVERT_BENCHMARK(name, srcFormat, dstFormat) \
+    static void BM_##name(benchmark::State &state) { \
+        convertFrame(state, srcFormat, dstFormat); \
+    } \
+    BENCHMARK(BM_##name)->Args({1920, 1080})->Args({3840, 2160})->Unit(benchmark::kMicrosecond)
+
+PIXEL_CONVERT_BENCHMARK(NV24ToNV12, V4L2_PIX_FMT_NV24, V4L2_PIX_FMT_NV12);
+PIXEL_CONVERT_BENCHMARK(NV24ToNV16, V4L2_PIX_FMT_NV24, V4L2_PIX_FMT_NV16);
+PIXEL_CONVERT_BENCHMARK(NV16ToNV12, V4L2_PIX_FMT_NV16, V4L2_PIX_FMT_NV12);
+PIXEL_CONVERT_BENCHMARK(YUYVToNV12, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_NV12);
+PIXEL_CONVERT_BENCHMARK(BGR24ToNV12, V4L2_PIX_FMT_BGR24, V4L2_PIX_FMT_NV12);
+PIXEL_CONVERT_BENCHMARK(NV12ToBGR24, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_BGR24);
+PIXEL_CONVERT_BENCHMARK(NV15ToP010, V4L2_PIX_FMT_NV15, V4L2_PIX_FMT_P010);
+PIXEL_CONVERT_BENCHMARK(NV15ToNV12, V4L2_PIX_FMT_NV15, V4L2_PIX_FMT_NV12);
+
+// a byte at a time, the way yuyv_to_nv12 in enc/Tools.cpp did
+static void BM_YUYVToNV12Bytewise(benchmark::State &state) {
+    int width = state.range(0);
+    int height = state.range(1);
+    std::vector<uint8_t> src((size_t)width * height * 2, 0x5a);
+    std::vector<uint8_t> dst((size_t)width * height * 3 / 2);
+    for (auto _ : state) {
+        const uint8_t *s = src.data();
+        uint8_t *y = dst.data();
+        uint8_t *uv = dst.data() + width * height;
+        for (int i = 0; i < height; i++) {
+            for (int j = 0; j < width * 2; j += 4) {
+                *y++ = s[j];
+                *y++ = s[j + 2];
+                if (i % 2 == 0) {
+                    *uv++ = s[j + 1];
+                    *uv++ = s[j + 3];
+                }
+            }
+            s += width * 2;
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * (int64_t)(src.size() + dst.size()));
+}
+BENCHMARK(BM_YUYVToNV12Bytewise)->Args({1920, 1080})->Args({3840, 2160})->Unit(benchmark::kMicrosecond);
+
+}  // namespace tvinput
+}  // namespace android
+
+BENCHMARK_MAIN();
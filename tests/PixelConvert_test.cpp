@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "PixelConvert.h"
+
+namespace android {
+namespace tvinput {
+
+namespace {
+
+typedef PixelConvert::Image Image;
+
+/*
+ * Per pixel references written from the format definitions. Whatever
+ * kernel PixelConvert picked (neon, sse2 or scalar) must match them byte
+ * for byte, padding included.
+ */
+typedef void (*Reference)(const Image &src, const Image &dst, int width, int height);
+
+uint8_t clamp255(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// chroma row pair r reads luma rows 2r and 2r + 1, 2r twice on an odd last row
+int lowerRow(int y, int height) {
+    return y + 1 < height ? y + 1 : y;
+}
+
+void nv24ToNv12(const Image &src, const Image &dst, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        memcpy(dst.y + y * dst.yStride, src.y + y * src.yStride, width);
+    }
+    for (int y = 0; y < height; y += 2) {
+        const uint8_t *s0 = src.uv + y * src.uvStride;
+        const uint8_t *s1 = src.uv + lowerRow(y, height) * src.uvStride;
+        for (int x = 0; x < width / 2 * 2; x++) {
+            int pixel = x / 2 * 2;
+            int c = x % 2;
+            int sum = s0[pixel * 2 + c] + s0[pixel * 2 + 2 + c] + s1[pixel * 2 + c] + s1[pixel * 2 + 2 + c];
+            dst.uv[y / 2 * dst.uvStride + x] = (sum + 2) / 4;
+        }
+    }
+}
+
+void nv24ToNv16(const Image &src, const Image &dst, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        memcpy(dst.y + y * dst.yStride, src.y + y * src.yStride, width);
+        const uint8_t *s = src.uv + y * src.uvStride;
+        for (int x = 0; x < width / 2 * 2; x++) {
+            int pixel = x / 2 * 2;
+            int c = x % 2;
+            dst.uv[y * dst.uvStride + x] = (s[pixel * 2 + c] + s[pixel * 2 + 2 + c] + 1) / 2;
+        }
+    }
+}
+
+void nv16ToNv12(const Image &src, const Image &dst, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        memcpy(dst.y + y * dst.yStride, src.y + y * src.yStride, width);
+    }
+    for (int y = 0; y < height; y += 2) {
+        for (int x = 0; x < width / 2 * 2; x++) {
+            int sum = src.uv[y * src.uvStride + x] + src.uv[lowerRow(y, height) * src.uvStride + x];
+            dst.uv[y / 2 * dst.uvStride + x] = (sum + 1) / 2;
+        }
+    }
+}
+
+void yuyvToNv12(const Image &src, const Image &dst, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            dst.y[y * dst.yStride + x] = src.y[y * src.yStride + x * 2];
+        }
+    }
+    for (int y = 0; y < height; y += 2) {
+        for (int x = 0; x < width / 2 * 2; x++) {
+            // U at byte 1, V at byte 3 of each Y0 U Y1 V group
+            int offset = x / 2 * 4 + 1 + x % 2 * 2;
+            int sum = src.y[y * src.yStride + offset] + src.y[lowerRow(y, height) * src.yStride + offset];
+            dst.uv[y / 2 * dst.uvStride + x] = (sum + 1) / 2;
+        }
+    }
+}
+
+void bgr24ToNv12(const Image &src, const Image &dst, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const uint8_t *p = src.y + y * src.yStride + x * 3;
+            dst.y[y * dst.yStride + x] = ((66 * p[2] + 129 * p[1] + 25 * p[0] + 128) >> 8) + 16;
+        }
+    }
+    for (int y = 0; y < height; y += 2) {
+        for (int x = 0; x < width / 2; x++) {
+            int bgr[3];
+            for (int c = 0; c < 3; c++) {
+                const uint8_t *p0 = src.y + y * src.yStride + x * 6 + c;
+                const uint8_t *p1 = src.y + lowerRow(y, height) * src.yStride + x * 6 + c;
+                bgr[c] = (p0[0] + p0[3] + p1[0] + p1[3] + 2) >> 2;
+            }
+            uint8_t *d = dst.uv + y / 2 * dst.uvStride + x * 2;
+            d[0] = ((-38 * bgr[2] - 74 * bgr[1] + 112 * bgr[0] + 128) >> 8) + 128;
+            d[1] = ((112 * bgr[2] - 94 * bgr[1] - 18 * bgr[0] + 128) >> 8) + 128;
+        }
+    }
+}
+
+void nv12ToBgr24(const Image &src, const Image &dst, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int c = 298 * (src.y[y * src.yStride + x] - 16);
+            int u = src.uv[y / 2 * src.uvStride + x / 2 * 2] - 128;
+            int v = src.uv[y / 2 * src.uvStride + x / 2 * 2 + 1] - 128;
+            uint8_t *p = dst.y + y * dst.yStride + x * 3;
+            p[0] = clamp255((c + 516 * u + 128) >> 8);
+            p[1] = clamp255((c - 100 * u - 208 * v + 128) >> 8);
+            p[2] = clamp255((c + 409 * v + 128) >> 8);
+        }
+    }
+}
+
+// sample k of a 10-bit packed row sits at bit 10k, little endian
+int sample10(const uint8_t *row, int k) {
+    int bit = k * 10;
+    return ((row[bit / 8] | row[bit / 8 + 1] << 8) >> (bit % 8)) & 0x3ff;
+}
+
+void nv15Plane(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int samples,
+        int rows, bool to16) {
+    for (int y = 0; y < rows; y++) {
+        for (int k = 0; k < samples; k++) {
+            int v = sample10(src + y * srcStride, k);
+            if (to16) {
+                uint16_t p010 = v << 6;
+                memcpy(dst + y * dstStride + k * 2, &p010, sizeof(p010));
+            } else {
+                dst[y * dstStride + k] = v >> 2;
+            }
+        }
+    }
+}
+
+void nv15ToP010(const Image &src, const Image &dst, int width, int height) {
+    nv15Plane(src.y, src.yStride, dst.y, dst.yStride, width, height, true);
+    nv15Plane(src.uv, src.uvStride, dst.uv, dst.uvStride, width / 2 * 2,
+        PixelConvert::rowCount(height), true);
+}
+
+void nv15ToNv12(const Image &src, const Image &dst, int width, int height) {
+    nv15Plane(src.y, src.yStride, dst.y, dst.yStride, width, height, false);
+    nv15Plane(src.uv, src.uvStride, dst.uv, dst.uvStride, width / 2 * 2,
+        PixelConvert::rowCount(height), false);
+}
+
+struct Case {
+    uint32_t src;
+    uint32_t dst;
+    Reference reference;
+    const char *name;
+};
+
+const Case kCases[] = {
+    { V4L2_PIX_FMT_NV24,  V4L2_PIX_FMT_NV12,  nv24ToNv12,  "NV24ToNV12" },
+    { V4L2_PIX_FMT_NV24,  V4L2_PIX_FMT_NV16,  nv24ToNv16,  "NV24ToNV16" },
+    { V4L2_PIX_FMT_NV16,  V4L2_PIX_FMT_NV12,  nv16ToNv12,  "NV16ToNV12" },
+    { V4L2_PIX_FMT_YUYV,  V4L2_PIX_FMT_NV12,  yuyvToNv12,  "YUYVToNV12" },
+    { V4L2_PIX_FMT_BGR24, V4L2_PIX_FMT_NV12,  bgr24ToNv12, "BGR24ToNV12" },
+    { V4L2_PIX_FMT_NV12,  V4L2_PIX_FMT_BGR24, nv12ToBgr24, "NV12ToBGR24" },
+    { V4L2_PIX_FMT_NV15,  V4L2_PIX_FMT_P010,  nv15ToP010,  "NV15ToP010" },
+    { V4L2_PIX_FMT_NV15,  V4L2_PIX_FMT_NV12,  nv15ToNv12,  "NV15ToNV12" },
+};
+
+class PixelConvertTest : public ::testing::TestWithParam<Case> {};
+
+}  // namespace
+
+TEST_P(PixelConvertTest, MatchesReference) {
+    const Case &c = GetParam();
+    ASSERT_TRUE(PixelConvert::isSupported(c.src, c.dst));
+    // widths off the vector sizes leave scalar tails, odd heights a single last row
+    for (int width : {2, 6, 16, 34, 66, 100, 1920}) {
+        for (int height : {1, 2, 5, 8, 33}) {
+            // padded strides, a multiple of 4 pixels keeps NV15 rows whole bytes
+            int widthStride = (width + 15) / 16 * 16 + 16;
+            int heightStride = height + 2;
+            std::vector<uint8_t> src(PixelConvert::frameSize(c.src, widthStride, heightStride));
+            srand(width * 100 + height);
+            for (auto &b : src) {
+                b = rand();
+            }
+            size_t dstSize = PixelConvert::frameSize(c.dst, widthStride, heightStride);
+            std::vector<uint8_t> expected(dstSize, 0xcd);
+            std::vector<uint8_t> actual(dstSize, 0xcd);
+            Image s = PixelConvert::layout(c.src, src.data(), widthStride, heightStride);
+            c.reference(s, PixelConvert::layout(c.dst, expected.data(), widthStride, heightStride),
+                width, height);
+
+            // in two row ranges, like split across a RowWorkerPool
+            Image d = PixelConvert::layout(c.dst, actual.data(), widthStride, heightStride);
+            int rows = PixelConvert::rowCount(height);
+            ASSERT_EQ(0, PixelConvert::convert(c.src, s, c.dst, d, width, height, 0, rows / 2));
+            ASSERT_EQ(0, PixelConvert::convert(c.src, s, c.dst, d, width, height, rows / 2, rows));
+            ASSERT_EQ(expected, actual) << c.name << " " << width << "x" << height << " "
+                << PixelConvert::kernelName();
+        }
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Kernels, PixelConvertTest, ::testing::ValuesIn(kCases),
+    [](const ::testing::TestParamInfo<Case> &info) { return std::string(info.param.name); });
+
+TEST(PixelConvertLayoutTest, RejectsUnsupportedPairs) {
+    EXPECT_FALSE(PixelConvert::isSupported(V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_NV24));
+    Image image = {NULL, NULL, 0, 0};
+    EXPECT_EQ(-1, PixelConvert::convert(V4L2_PIX_FMT_NV12, image, V4L2_PIX_FMT_NV24, image,
+        16, 16, 0, 8));
+}
+
+// an unpadded capture frame into a padded display buffer
+TEST(PixelConvertLayoutTest, SameFormatCopyKeepsRowsApart) {
+    const uint32_t formats[] = {
+        V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_NV16, V4L2_PIX_FMT_NV24, V4L2_PIX_FMT_NV15,
+        V4L2_PIX_FMT_P010, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_BGR24,
+    };
+    for (uint32_t format : formats) {
+        ASSERT_TRUE(PixelConvert::isSupported(format, format));
+        for (int height : {1, 5, 8}) {
+            int width = 36;
+            int widthStride = 64;
+            int heightStride = height + 3;
+            std::vector<uint8_t> src(PixelConvert::frameSize(format, width, height));
+            for (size_t i = 0; i < src.size(); i++) {
+                src[i] = i * 7 + 1;
+            }
+            std::vector<uint8_t> dst(PixelConvert::frameSize(format, widthStride, heightStride), 0xcd);
+            Image s = PixelConvert::layout(format, src.data(), width, height);
+            Image d = PixelConvert::layout(format, dst.data(), widthStride, heightStride);
+            int rows = PixelConvert::rowCount(height);
+            ASSERT_EQ(0, PixelConvert::convert(format, s, format, d, width, height, 0, rows / 2));
+            ASSERT_EQ(0, PixelConvert::convert(format, s, format, d, width, height, rows / 2, rows));
+
+            // every source row lands at its own dst row, the padding is untouched
+            int chromaRows = 0;
+            if (s.uv) {
+                bool full = format == V4L2_PIX_FMT_NV16 || format == V4L2_PIX_FMT_NV24;
+                chromaRows = full ? height : rows;
+            }
+            std::vector<uint8_t> expected(dst.size(), 0xcd);
+            Image e = PixelConvert::layout(format, expected.data(), widthStride, heightStride);
+            for (int y = 0; y < height; y++) {
+                memcpy(e.y + y * e.yStride, s.y + y * s.yStride, s.yStride);
+            }
+            for (int y = 0; y < chromaRows; y++) {
+                memcpy(e.uv + y * e.uvStride, s.uv + y * s.uvStride, s.uvStride);
+            }
+            ASSERT_EQ(expected, dst) << std::hex << format << std::dec << " " << height;
+        }
+    }
+    EXPECT_FALSE(PixelConvert::isSupported(V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_GREY));
+}
+
+TEST(PixelConvertLayoutTest, UnpacksNv15Samples) {
+    // 0x3ff then 0, 0x155, 0x2aa
+    uint8_t nv15[5];
+    uint64_t bits = 0x3ffULL | 0x155ULL << 20 | 0x2aaULL << 30;
+    for (int i = 0; i < 5; i++) {
+        nv15[i] = bits >> (i * 8);
+    }
+    uint16_t p010[4];
+    Image src = {nv15, nv15, 5, 5};
+    Image dst = {(uint8_t *)p010, (uint8_t *)p010, 8, 8};
+    ASSERT_EQ(0, PixelConvert::convert(V4L2_PIX_FMT_NV15, src, V4L2_PIX_FMT_P010, dst, 4, 1, 0, 1));
+    EXPECT_EQ(0xffc0, p010[0]);
+    EXPECT_EQ(0x0000, p010[1]);
+    EXPECT_EQ(0x5540, p010[2]);
+    EXPECT_EQ(0xaa80, p010[3]);
+}
+
+}  // namespace tvinput
+}  // namespace android
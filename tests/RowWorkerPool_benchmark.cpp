@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#include <string.h>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "PixelConvert.h"
+#include "RowWorkerPool.h"
+
+namespace android {
+namespace tvinput {
+
+// what NV24ToNV12 did before, one 2 byte memcpy per output chroma pair
+static void BM_Nv24ToNv12Memcpy(benchmark::State &state) {
+    int width = state.range(0);
+    int height = state.range(1);
+    std::vector<uint8_t> src(PixelConvert::frameSize(V4L2_PIX_FMT_NV24, width, height), 0x80);
+    std::vector<uint8_t> dst(PixelConvert::frameSize(V4L2_PIX_FMT_NV12, width, height));
+    for (auto _ : state) {
+        uint8_t *s = src.data();
+        uint8_t *d = dst.data();
+        memcpy(d, s, (size_t)width * height);
+        for (int i = 0; i < height / 2; i++) {
+            for (int j = 0; j < width / 2; j++) {
+                memcpy(d + width * height + i * width + j * 2, s + width * height + i * 4 * width + j * 4, 2);
+            }
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// args are width, height and the pool threads
+static void BM_Nv24ToNv12(benchmark::State &state) {
+    int width = state.range(0);
+    int height = state.range(1);
+    RowWorkerPool pool;
+    pool.init(state.range(2));
+    std::vector<uint8_t> src(PixelConvert::frameSize(V4L2_PIX_FMT_NV24, width, height), 0x80);
+    std::vector<uint8_t> dst(PixelConvert::frameSize(V4L2_PIX_FMT_NV12, width, height));
+    PixelConvert::Image s = PixelConvert::layout(V4L2_PIX_FMT_NV24, src.data(), width, height);
+    PixelConvert::Image d = PixelConvert::layout(V4L2_PIX_FMT_NV12, dst.data(), width, height);
+    for (auto _ : state) {
+        pool.run(PixelConvert::rowCount(height), [&](int rowBegin, int rowEnd) {
+            PixelConvert::convert(V4L2_PIX_FMT_NV24, s, V4L2_PIX_FMT_NV12, d, width, height,
+                rowBegin, rowEnd);
+        });
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(PixelConvert::kernelName());
+}
+
+// frames per second is items_per_second
+BENCHMARK(BM_Nv24ToNv12Memcpy)
+    ->Args({1280, 720})->Args({1920, 1080})->Args({3840, 2160})
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_Nv24ToNv12)
+    ->ArgsProduct({{1280}, {720}, {1, 2, 4}})
+    ->ArgsProduct({{1920}, {1080}, {1, 2, 4}})
+    ->ArgsProduct({{3840}, {2160}, {1, 2, 4}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+}  // namespace tvinput
+}  // namespace android
+
+BENCHMARK_MAIN();
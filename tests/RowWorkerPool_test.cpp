@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+#include <stdlib.h>
+#include <atomic>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "PixelConvert.h"
+#include "RowWorkerPool.h"
+
+namespace android {
+namespace tvinput {
+
+namespace {
+
+// the 2x2 decimation NV24ToNV12 must produce, the last row alone on odd heights
+std::vector<uint8_t> referenceNv24ToNv12(const std::vector<uint8_t> &src, int width, int height) {
+    const uint8_t *luma = src.data();
+    const uint8_t *chroma = src.data() + (size_t)width * height;
+    int rows = PixelConvert::rowCount(height);
+    std::vector<uint8_t> dst((size_t)width * height + (size_t)width * rows);
+    std::copy(luma, luma + (size_t)width * height, dst.begin());
+    uint8_t *uv = dst.data() + (size_t)width * height;
+    for (int r = 0; r < rows; r++) {
+        const uint8_t *s0 = chroma + (size_t)2 * r * width * 2;
+        const uint8_t *s1 = 2 * r + 1 < height ? s0 + width * 2 : s0;
+        for (int j = 0; j < width / 2; j++) {
+            for (int c = 0; c < 2; c++) {
+                int sum = s0[j * 4 + c] + s0[j * 4 + 2 + c] + s1[j * 4 + c] + s1[j * 4 + 2 + c];
+                uv[(size_t)r * width + j * 2 + c] = (sum + 2) >> 2;
+            }
+        }
+    }
+    return dst;
+}
+
+void fillRandom(std::vector<uint8_t> *buffer, unsigned seed) {
+    srand(seed);
+    for (auto &b : *buffer) {
+        b = rand();
+    }
+}
+
+}  // namespace
+
+TEST(RowWorkerPoolTest, RunsEveryRowOnce) {
+    for (int threads = 1; threads <= 4; threads++) {
+        RowWorkerPool pool;
+        ASSERT_TRUE(pool.init(threads));
+        // below, at and above the rows it takes to wake the workers
+        for (int rows : {1, 15, 64, 127, 540, 1080}) {
+            std::vector<std::atomic<int>> hits(rows);
+            pool.run(rows, [&](int rowBegin, int rowEnd) {
+                for (int r = rowBegin; r < rowEnd; r++) {
+                    hits[r]++;
+                }
+            });
+            for (int r = 0; r < rows; r++) {
+                ASSERT_EQ(1, hits[r].load()) << "threads " << threads << " rows " << rows
+                    << " row " << r;
+            }
+        }
+        pool.deinit();
+        EXPECT_FALSE(pool.isInitialized());
+    }
+}
+
+TEST(RowWorkerPoolTest, RunsBackToBack) {
+    RowWorkerPool pool;
+    ASSERT_TRUE(pool.init(4));
+    std::atomic<int> total(0);
+    for (int i = 0; i < 1000; i++) {
+        pool.run(256, [&](int rowBegin, int rowEnd) { total += rowEnd - rowBegin; });
+    }
+    EXPECT_EQ(256 * 1000, total.load());
+}
+
+TEST(RowWorkerPoolTest, Nv24ToNv12MatchesReference) {
+    RowWorkerPool pool;
+    ASSERT_TRUE(pool.init(4));
+    // widths off the vector size leave a scalar tail, odd heights a single last row
+    for (int width : {2, 18, 34, 720, 1922}) {
+        for (int height : {1, 2, 7, 64, 481}) {
+            std::vector<uint8_t> src(PixelConvert::frameSize(V4L2_PIX_FMT_NV24, width, height));
+            std::vector<uint8_t> dst(PixelConvert::frameSize(V4L2_PIX_FMT_NV12, width, height), 0xcd);
+            fillRandom(&src, width * 1000 + height);
+            PixelConvert::Image s = PixelConvert::layout(V4L2_PIX_FMT_NV24, src.data(), width, height);
+            PixelConvert::Image d = PixelConvert::layout(V4L2_PIX_FMT_NV12, dst.data(), width, height);
+            pool.run(PixelConvert::rowCount(height), [&](int rowBegin, int rowEnd) {
+                PixelConvert::convert(V4L2_PIX_FMT_NV24, s, V4L2_PIX_FMT_NV12, d, width, height,
+                    rowBegin, rowEnd);
+            });
+            ASSERT_EQ(referenceNv24ToNv12(src, width, height), dst)
+                << width << "x" << height << " " << PixelConvert::kernelName();
+        }
+    }
+}
+
+}  // namespace tvinput
+}  // namespace android
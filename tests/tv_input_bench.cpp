@@ -0,0 +1,1009 @@
+/*
+ * Copyright (c) 2021 Rockchip Electronics Co., Ltd
+ */
+
+/*
+ * End to end benchmark of the shipped HinDevImpl pipeline. workThread,
+ * the pq/iep threads, the record handoff and the sideband/vtunnel/app
+ * buffer present paths run as in the HAL, fed by ReplayCaptureBackend.
+ * The per frame calls to the display, rkpq/rkiep and the encoder go to
+ * stand-ins (common/StageBackends.h) that hold a frame for a hardware
+ * time scaled by its size without burning cpu. Buffer allocation and the
+ * rkpq/rkiep setup stay real, so this runs on the device.
+ *
+ * Latency is capture timestamp to the vsync the display stand-in latches
+ * the frame at, or to the app callback for the buffer producer. cpu per
+ * frame is the time of the HAL threads, the replay producer stands for
+ * the capture dma and is not counted. Drops come from the HAL's own
+ * stats, see the "stats" priv command.
+ *
+ * Each case runs at every capture ring depth of kDepths, set per stream
+ * through set_buffer_depths(), so latency and drops can be weighed
+ * against the depth. The sideband mode and rkpq properties are set per
+ * case and restored.
+ *
+ *   tv_input_bench [-t seconds] [-m window|vtunnel|producer] [-s 1080p|4k] [-d depth]
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <linux/videodev2.h>
+#include <cutils/properties.h>
+#include <hardware/tv_input.h>
+#include <ui/GraphicBuffer.h>
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+
+#include "HinDev.h"
+#include "common/IndexRing.h"
+#include "common/PipelineStats.h"
+#include "common/ReplayCaptureBackend.h"
+#include "common/StageBackends.h"
+#include "common/Utils.h"
+
+namespace {
+
+// operator new calls, for allocations per frame
+std::atomic<uint64_t> gAllocs(0);
+
+}  // namespace
+
+void *operator new(size_t size) {
+    gAllocs.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+namespace android {
+namespace tvinput {
+
+namespace {
+
+constexpr int BENCH_FPS = 60;
+constexpr nsecs_t VSYNC_PERIOD = 1000000000LL / BENCH_FPS;
+// pqBufferThread builds rkpq and the pq buffers on its first frames
+constexpr nsecs_t WARMUP_TIME = 1000000000LL;
+// HinDevImpl::stop() does not join its threads, they leave on their next idle wait
+constexpr nsecs_t TEARDOWN_TIME = 500000000LL;
+// stand-in hardware time for a 1080p frame, scaled by the pixel count
+constexpr nsecs_t PQ_COST_1080P = 3000000;
+constexpr nsecs_t IEP_COST_1080P = 2000000;
+constexpr nsecs_t ENCODE_COST_1080P = 3000000;
+// capture, pq, iep and the no-signal buffer of one stream
+constexpr int MAX_VT_BUFFERS = 4 * TV_INPUT_MAX_BUFF_CNT;
+
+enum BenchStages {
+    STAGES_NONE = 0,
+    STAGES_PQ,
+    STAGES_IEP,
+    STAGES_RECORD,
+    STAGES_COUNT,
+};
+
+const char *const kStageNames[STAGES_COUNT] = { "-", "pq", "iep", "record" };
+
+struct BenchMode {
+    int frameType;
+    const char *name;
+    const char *option;
+};
+
+const BenchMode kModes[] = {
+    { TYPE_SIDEBAND_WINDOW, "sideband-window", "window" },
+    { TYPE_SIDEBAND_VTUNNEL, "sideband-vtunnel", "vtunnel" },
+    { TYPE_STREAM_BUFFER_PRODUCER, "stream-producer", "producer" },
+};
+
+struct BenchSize {
+    int width;
+    int height;
+    const char *option;
+};
+
+const BenchSize kSizes[] = {
+    { 1920, 1080, "1080p" },
+    { 3840, 2160, "4k" },
+};
+
+// capture ring depths, 2 is the low latency (game mode) ring
+const int kDepths[] = { 2, 3, 4, 6 };
+
+struct BenchCase {
+    const BenchMode *mode;
+    const BenchSize *size;
+    int stages;
+    int depth;
+};
+
+// record only runs on the sideband window, the producer always goes
+// through dopq and has no pq switch
+bool hasStages(int frameType, int stages) {
+    switch (frameType) {
+    case TYPE_SIDEBAND_WINDOW:
+        return true;
+    case TYPE_SIDEBAND_VTUNNEL:
+        return stages != STAGES_RECORD;
+    default:
+        return stages == STAGES_NONE;
+    }
+}
+
+// the app sets the producer's depth, pq/iep need a capture ring of 3
+bool hasDepth(int frameType, int stages, int depth) {
+    if (frameType == TYPE_STREAM_BUFFER_PRODUCER) {
+        return depth == APP_PREVIEW_BUFF_CNT;
+    }
+    if (stages == STAGES_PQ || stages == STAGES_IEP) {
+        return depth >= 3;
+    }
+    return true;
+}
+
+void holdFor(nsecs_t duration) {
+    struct timespec ts;
+    ts.tv_sec = duration / 1000000000LL;
+    ts.tv_nsec = duration % 1000000000LL;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+nsecs_t hardwareCost(nsecs_t cost1080p, int width, int height) {
+    return cost1080p * width / 1920 * height / 1080;
+}
+
+// the HAL's threads: "tif work thread", "tif pq buffer t..", Tif_Rows*
+bool isHalThread(const char *comm) {
+    if (!strncmp(comm, "tif ", 4)) {
+        return true;
+    }
+    return !strncmp(comm, "Tif_", 4) && strncmp(comm, "Tif_Replay", 10);
+}
+
+// on cpu time per HAL thread, from /proc/self/task/<tid>/schedstat
+void halCpuTimes(std::map<int, nsecs_t> *times) {
+    times->clear();
+    DIR *dir = opendir("/proc/self/task");
+    if (!dir) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char path[64];
+        char comm[32] = {0};
+        snprintf(path, sizeof(path), "/proc/self/task/%s/comm", entry->d_name);
+        FILE *file = fopen(path, "re");
+        if (!file) {
+            continue;
+        }
+        bool hal = fgets(comm, sizeof(comm), file) != NULL && isHalThread(comm);
+        fclose(file);
+        if (!hal) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/self/task/%s/schedstat", entry->d_name);
+        file = fopen(path, "re");
+        if (!file) {
+            continue;
+        }
+        unsigned long long runTime = 0;
+        if (fscanf(file, "%llu", &runTime) == 1) {
+            (*times)[atoi(entry->d_name)] = (nsecs_t)runTime;
+        }
+        fclose(file);
+    }
+    closedir(dir);
+}
+
+// sum of the "drops" object of a PipelineStats json dump
+uint64_t parseDrops(const char *path) {
+    FILE *file = fopen(path, "re");
+    if (!file) {
+        return 0;
+    }
+    char json[4096] = {0};
+    size_t length = fread(json, 1, sizeof(json) - 1, file);
+    fclose(file);
+    json[length] = '\0';
+    const char *p = strstr(json, "\"drops\":{");
+    uint64_t drops = 0;
+    while (p && (p = strpbrk(p + 1, ":}")) != NULL && *p == ':') {
+        drops += strtoull(p + 1, NULL, 10);
+    }
+    return drops;
+}
+
+}  // namespace
+
+// v4l2 timestamp of the frame a dmabuf holds, the stand-ins carry it
+// from the capture buffer to the pq/iep outputs
+class FrameClock {
+ public:
+    FrameClock() {
+        for (std::atomic<nsecs_t> &time : mIndexTimes) {
+            time.store(0);
+        }
+    }
+
+    void set(int fd, nsecs_t time) {
+        Mutex::Autolock autoLock(mLock);
+        mTimes[fd] = time;
+    }
+    nsecs_t get(int fd) {
+        Mutex::Autolock autoLock(mLock);
+        auto it = mTimes.find(fd);
+        return it != mTimes.end() ? it->second : 0;
+    }
+    // by v4l2 index, the producer maps it to the app buffer
+    void setIndex(uint32_t index, nsecs_t time) {
+        if (index < TV_INPUT_MAX_BUFF_CNT) {
+            mIndexTimes[index].store(time, std::memory_order_relaxed);
+        }
+    }
+    nsecs_t getIndex(uint32_t index) const {
+        return index < TV_INPUT_MAX_BUFF_CNT ? mIndexTimes[index].load(std::memory_order_relaxed) : 0;
+    }
+
+ private:
+    FrameClock(const FrameClock& other);
+    FrameClock& operator=(const FrameClock& other);
+
+    Mutex mLock;
+    std::unordered_map<int, nsecs_t> mTimes;
+    std::atomic<nsecs_t> mIndexTimes[TV_INPUT_MAX_BUFF_CNT];
+};
+
+// the replay node, notes the capture time of every dequeued buffer
+class TimedCapture : public CaptureBackend {
+ public:
+    TimedCapture(ReplayCaptureBackend *replay, FrameClock *clock)
+        : mReplay(replay), mClock(clock) {}
+
+    int fd() const override { return mReplay->fd(); }
+    bool isReplay() const override { return true; }
+    int ioctl(unsigned long request, void *arg) override {
+        int ret = mReplay->ioctl(request, arg);
+        if (ret == 0 && request == VIDIOC_DQBUF) {
+            struct v4l2_buffer *buf = (struct v4l2_buffer *)arg;
+            nsecs_t time = (nsecs_t)buf->timestamp.tv_sec * 1000000000LL
+                + (nsecs_t)buf->timestamp.tv_usec * 1000LL;
+            mClock->setIndex(buf->index, time);
+            if (buf->m.planes && buf->length > 0) {
+                mClock->set(buf->m.planes[0].m.fd, time);
+            }
+        }
+        return ret;
+    }
+
+ private:
+    TimedCapture(const TimedCapture& other);
+    TimedCapture& operator=(const TimedCapture& other);
+
+    std::unique_ptr<ReplayCaptureBackend> mReplay;
+    FrameClock *mClock;
+};
+
+/*
+ * VOP plane or vtunnel consumer refreshing at BENCH_FPS. The sideband
+ * window gets one nonblocking commit in flight, its fences are eventfds
+ * that become readable at the vsync the commit lands on, which is what
+ * sync_wait() and the HAL's epoll look for. vtunnel latches the queued
+ * buffers in order, one per vsync, the buffer it replaces goes back to
+ * dequeueBuffer().
+ */
+class BenchDisplay : public DisplaySink {
+ public:
+    BenchDisplay(FrameClock *clock, bool tunnel)
+        : mClock(clock),
+          mTunnel(tunnel),
+          mRunning(false),
+          mNextVsync(0),
+          mCommitFence(-1),
+          mCommitFd(-1),
+          mSlotCount(0),
+          mQueued(MAX_VT_BUFFERS),
+          mShown(-1),
+          mReleased(MAX_VT_BUFFERS),
+          mPresented(0) {
+        memset(mSlots, 0, sizeof(mSlots));
+        memset(mSlotFds, 0, sizeof(mSlotFds));
+    }
+    ~BenchDisplay() override { stop(); }
+
+    bool start() {
+        mRunning = true;
+        mNextVsync = systemTime(SYSTEM_TIME_MONOTONIC) + VSYNC_PERIOD;
+        mThread = new VsyncThread(this);
+        return mThread->run("bench_vsync", PRIORITY_DISPLAY) == NO_ERROR;
+    }
+
+    void stop() {
+        {
+            Mutex::Autolock autoLock(mLock);
+            mRunning = false;
+            mReleasedCond.broadcast();
+        }
+        if (mThread != NULL) {
+            mThread->requestExitAndWait();
+            mThread.clear();
+        }
+        Mutex::Autolock autoLock(mLock);
+        signalCommitLocked();
+    }
+
+    uint64_t presented() const { return mPresented.load(); }
+    LatencyHistogram &latency() { return mLatency; }
+
+    status_t show(buffer_handle_t buffer, int displayRatio, int hdmiInType,
+                  int *releaseFence, nsecs_t captureTime) override {
+        if (releaseFence) {
+            *releaseFence = -1;
+        }
+        Mutex::Autolock autoLock(mLock);
+        if (mCommitFence >= 0) {
+            return -EBUSY;
+        }
+        mCommitFence = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (mCommitFence < 0) {
+            return -errno;
+        }
+        mCommitFd = buffer ? buffer->data[0] : -1;
+        // frees the buffer on screen once this commit replaces it
+        if (releaseFence) {
+            *releaseFence = dup(mCommitFence);
+        }
+        return 0;
+    }
+
+    bool isPresentPending() override {
+        Mutex::Autolock autoLock(mLock);
+        return mCommitFence >= 0;
+    }
+
+    int getPresentFence() override {
+        Mutex::Autolock autoLock(mLock);
+        return mCommitFence >= 0 ? dup(mCommitFence) : -1;
+    }
+
+    status_t queueBuffer(vt_buffer_t *buffer, int fence, int64_t expectedPresentTime) override {
+        if (fence >= 0) {
+            close(fence);
+        }
+        Mutex::Autolock autoLock(mLock);
+        int slot = slotOfLocked(buffer);
+        if (slot < 0 || !mQueued.push_back(slot)) {
+            return -ENOMEM;
+        }
+        // the HAL may free the buffer once it has it back, keep the fd only
+        mSlotFds[slot] = buffer->handle ? buffer->handle->data[0] : -1;
+        return 0;
+    }
+
+    status_t dequeueBuffer(vt_buffer_t **buffer, int timeoutMs, int *fence) override {
+        *fence = -1;
+        Mutex::Autolock autoLock(mLock);
+        nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + ms2ns(timeoutMs);
+        while (mRunning && mReleased.empty()) {
+            nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            if (timeoutMs >= 0 && now >= deadline) {
+                break;
+            }
+            mReleasedCond.waitRelative(mLock, timeoutMs >= 0 ? deadline - now : VSYNC_PERIOD);
+        }
+        if (mReleased.empty()) {
+            return -ETIMEDOUT;
+        }
+        *buffer = mSlots[mReleased.front()];
+        mReleased.pop_front();
+        return 0;
+    }
+
+ private:
+    BenchDisplay(const BenchDisplay& other);
+    BenchDisplay& operator=(const BenchDisplay& other);
+
+    class VsyncThread : public Thread {
+     public:
+        explicit VsyncThread(BenchDisplay *display) : Thread(false), mDisplay(display) {}
+        bool threadLoop() override { return mDisplay->vsync(); }
+     private:
+        BenchDisplay *mDisplay;
+    };
+
+    bool vsync() {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (now < mNextVsync) {
+            holdFor(mNextVsync - now);
+        }
+        mNextVsync += VSYNC_PERIOD;
+        Mutex::Autolock autoLock(mLock);
+        if (!mRunning) {
+            return false;
+        }
+        now = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (!mTunnel) {
+            if (mCommitFence >= 0) {
+                latched(mCommitFd, now);
+                signalCommitLocked();
+            }
+        } else if (!mQueued.empty()) {
+            int slot = mQueued.front();
+            mQueued.pop_front();
+            if (mShown >= 0) {
+                mReleased.push_back(mShown);
+                mReleasedCond.signal();
+            }
+            mShown = slot;
+            latched(mSlotFds[slot], now);
+        }
+        return true;
+    }
+
+    void signalCommitLocked() {
+        if (mCommitFence >= 0) {
+            eventfd_write(mCommitFence, 1);
+            close(mCommitFence);
+            mCommitFence = -1;
+        }
+    }
+
+    // frames the clock knows, the no-signal frame is not counted
+    void latched(int fd, nsecs_t now) {
+        nsecs_t captureTime = fd >= 0 ? mClock->get(fd) : 0;
+        if (captureTime > 0) {
+            mLatency.record(now - captureTime);
+            mPresented.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    int slotOfLocked(vt_buffer_t *buffer) {
+        for (int i = 0; i < mSlotCount; i++) {
+            if (mSlots[i] == buffer) {
+                return i;
+            }
+        }
+        if (mSlotCount == MAX_VT_BUFFERS) {
+            return -1;
+        }
+        mSlots[mSlotCount] = buffer;
+        return mSlotCount++;
+    }
+
+    FrameClock *mClock;
+    bool mTunnel;
+    Mutex mLock;
+    Condition mReleasedCond;
+    bool mRunning;
+    nsecs_t mNextVsync;
+    // sideband window, the commit in flight and the buffer it shows
+    int mCommitFence;
+    int mCommitFd;
+    // vtunnel, buffers by slot, queued, on screen and given back
+    vt_buffer_t *mSlots[MAX_VT_BUFFERS];
+    int mSlotFds[MAX_VT_BUFFERS];
+    int mSlotCount;
+    IndexRing mQueued;
+    int mShown;
+    IndexRing mReleased;
+    sp<VsyncThread> mThread;
+    LatencyHistogram mLatency;
+    std::atomic<uint64_t> mPresented;
+};
+
+// rkpq/rkiep, the output takes the capture time of its newest source
+class BenchPq : public PqProcessor {
+ public:
+    BenchPq(FrameClock *clock, int width, int height)
+        : mClock(clock),
+          mPqCost(hardwareCost(PQ_COST_1080P, width, height)),
+          mIepCost(hardwareCost(IEP_COST_1080P, width, height)) {}
+
+    void pq(int srcFd, int dstFd, int pqMode) override {
+        holdFor(mPqCost);
+        mClock->set(dstFd, mClock->get(srcFd));
+    }
+
+    void iep(int src0Fd, int src1Fd, int src2Fd, int dstFd, int dst2Fd, int *dilOrder) override {
+        holdFor(mIepCost);
+        nsecs_t time = mClock->get(src0Fd);
+        time = std::max(time, mClock->get(src1Fd));
+        time = std::max(time, mClock->get(src2Fd));
+        mClock->set(dstFd, time);
+        mClock->set(dst2Fd, time);
+    }
+
+ private:
+    BenchPq(const BenchPq& other);
+    BenchPq& operator=(const BenchPq& other);
+
+    FrameClock *mClock;
+    nsecs_t mPqCost;
+    nsecs_t mIepCost;
+};
+
+// an encoder thread taking the record buffers in order
+class BenchEncoder : public RecordEncoder {
+ public:
+    BenchEncoder()
+        : mRunning(false), mCost(0), mCallback(NULL), mUser(NULL), mPending(TV_INPUT_MAX_BUFF_CNT) {}
+    ~BenchEncoder() override { stop(); }
+
+    bool start(int width, int height, int fps, InputAvailable callback, void *user) override {
+        Mutex::Autolock autoLock(mLock);
+        mCost = hardwareCost(ENCODE_COST_1080P, width, height);
+        mCallback = callback;
+        mUser = user;
+        mPending.clear();
+        if (mThread == NULL) {
+            mThread = new EncodeThread(this);
+            if (mThread->run("bench_encode", PRIORITY_DISPLAY) != NO_ERROR) {
+                mThread.clear();
+                return false;
+            }
+        }
+        mRunning = true;
+        return true;
+    }
+
+    void stop() override {
+        sp<EncodeThread> thread;
+        {
+            Mutex::Autolock autoLock(mLock);
+            mRunning = false;
+            mCond.broadcast();
+            thread = mThread;
+            mThread.clear();
+        }
+        if (thread != NULL) {
+            thread->requestExitAndWait();
+        }
+    }
+
+    bool isRunning() override {
+        Mutex::Autolock autoLock(mLock);
+        return mRunning;
+    }
+
+    bool sendFrame(int fd, int index, size_t size, nsecs_t pts) override {
+        Mutex::Autolock autoLock(mLock);
+        if (!mRunning || !mPending.push_back(index)) {
+            return false;
+        }
+        mCond.signal();
+        return true;
+    }
+
+ private:
+    BenchEncoder(const BenchEncoder& other);
+    BenchEncoder& operator=(const BenchEncoder& other);
+
+    class EncodeThread : public Thread {
+     public:
+        explicit EncodeThread(BenchEncoder *encoder) : Thread(false), mEncoder(encoder) {}
+        bool threadLoop() override { return mEncoder->encodeLoop(); }
+     private:
+        BenchEncoder *mEncoder;
+    };
+
+    bool encodeLoop() {
+        int index;
+        nsecs_t cost;
+        {
+            Mutex::Autolock autoLock(mLock);
+            while (mRunning && mPending.empty()) {
+                mCond.waitRelative(mLock, ms2ns(100));
+            }
+            if (!mRunning) {
+                return false;
+            }
+            index = mPending.front();
+            mPending.pop_front();
+            cost = mCost;
+        }
+        holdFor(cost);
+        mCallback(mUser, index);
+        return true;
+    }
+
+    Mutex mLock;
+    Condition mCond;
+    bool mRunning;
+    nsecs_t mCost;
+    InputAvailable mCallback;
+    void *mUser;
+    IndexRing mPending;
+    sp<EncodeThread> mThread;
+};
+
+// one HinDevImpl stream of a bench case, opened the way tv_input.cpp does
+class BenchRun {
+ public:
+    BenchRun(const BenchCase &benchCase, const char *replayPath);
+    ~BenchRun();
+
+    bool start();
+    void stop();
+    // the measured window starts here
+    void resetCounters();
+    void report(nsecs_t elapsed);
+
+ private:
+    BenchRun(const BenchRun& other);
+    BenchRun& operator=(const BenchRun& other);
+
+    static void onPreview(void *user, tv_input_capture_result_t result, uint64_t buffId);
+    void setProperty(const char *name, const char *value);
+    void restoreProperties();
+    bool allocatePreviewBuffers();
+    LatencyHistogram &latency();
+    uint64_t presented();
+
+    BenchCase mCase;
+    int mWidth;
+    int mHeight;
+    bool mProducer;
+    const char *mReplayPath;
+    FrameClock mClock;
+    BenchDisplay mDisplay;
+    BenchPq mPq;
+    BenchEncoder mEncoder;
+    HinDevImpl *mDev;
+    bool mStarted;
+    std::vector<std::pair<std::string, std::string>> mSavedProperties;
+
+    // the app side of the buffer producer, the last one is the no-signal buffer
+    sp<GraphicBuffer> mPreview[APP_PREVIEW_BUFF_CNT + 1];
+    LatencyHistogram mPreviewLatency;
+    std::atomic<uint64_t> mPreviewed;
+
+    uint64_t mPresentedBase;
+    uint64_t mAllocsBase;
+    std::map<int, nsecs_t> mCpuBase;
+    char mStatsPath[PATH_MAX];
+};
+
+BenchRun::BenchRun(const BenchCase &benchCase, const char *replayPath)
+    : mCase(benchCase),
+      mWidth(benchCase.size->width),
+      mHeight(benchCase.size->height),
+      mProducer(benchCase.mode->frameType == TYPE_STREAM_BUFFER_PRODUCER),
+      mReplayPath(replayPath),
+      mDisplay(&mClock, benchCase.mode->frameType == TYPE_SIDEBAND_VTUNNEL),
+      mPq(&mClock, mWidth, mHeight),
+      mDev(NULL),
+      mStarted(false),
+      mPreviewed(0),
+      mPresentedBase(0),
+      mAllocsBase(0) {
+    snprintf(mStatsPath, sizeof(mStatsPath), "%s.stats", replayPath);
+}
+
+BenchRun::~BenchRun() {
+    stop();
+}
+
+void BenchRun::setProperty(const char *name, const char *value) {
+    char old[PROPERTY_VALUE_MAX] = {0};
+    property_get(name, old, "");
+    mSavedProperties.push_back(std::make_pair(std::string(name), std::string(old)));
+    property_set(name, value);
+}
+
+void BenchRun::restoreProperties() {
+    for (auto it = mSavedProperties.rbegin(); it != mSavedProperties.rend(); ++it) {
+        property_set(it->first.c_str(), it->second.c_str());
+    }
+    mSavedProperties.clear();
+}
+
+bool BenchRun::allocatePreviewBuffers() {
+    for (int i = 0; i <= APP_PREVIEW_BUFF_CNT; i++) {
+        mPreview[i] = new GraphicBuffer(mWidth, mHeight, HAL_PIXEL_FORMAT_YCrCb_NV12, 1,
+            STREAM_BUFFER_GRALLOC_USAGE, "tv_input_bench");
+        if (mPreview[i]->initCheck() != NO_ERROR) {
+            return false;
+        }
+        // preview buffers first, set_preview_buffer() takes the next one as the signal buffer
+        mDev->set_preview_buffer(mPreview[i]->handle, i + 1);
+    }
+    return true;
+}
+
+bool BenchRun::start() {
+    bool pq = mCase.stages == STAGES_PQ || mCase.stages == STAGES_IEP;
+    setProperty(SIDEBAND_MODE_TYPE, mCase.mode->frameType == TYPE_SIDEBAND_VTUNNEL ? "1" : "0");
+    setProperty(TV_INPUT_PQ_ENABLE, pq ? "1" : "0");
+    char resolution[PROPERTY_VALUE_MAX] = {0};
+    property_get(TV_INPUT_RESOLUTION_MAIN, resolution, "");
+    if (pq && resolution[0] == '\0') {
+        // check_zme() asks rkpq for the panel before it exists otherwise
+        snprintf(resolution, sizeof(resolution), "%dx%d", mWidth, mHeight);
+        setProperty(TV_INPUT_RESOLUTION_MAIN, resolution);
+    }
+
+    mDev = new HinDevImpl();
+    StageBackends backends;
+    backends.display = &mDisplay;
+    backends.pq = &mPq;
+    backends.encoder = &mEncoder;
+    mDev->set_stage_backends(backends);
+
+    ReplayCaptureBackend *replay = new ReplayCaptureBackend(mReplayPath, mWidth, mHeight,
+        V4L2_PIX_FMT_NV12, BENCH_FPS);
+    // an interlaced source sends pq frames through rkiep
+    replay->setInterlaced(mCase.stages == STAGES_IEP);
+    if (!replay->open()) {
+        delete replay;
+        return false;
+    }
+    int width = 0, height = 0, format = 0;
+    if (mDev->openCapture(new TimedCapture(replay, &mClock), width, height, format) != 0) {
+        return false;
+    }
+    tv_buffer_depths_t depths;
+    depths.capture = mCase.depth;
+    // only lowers the capture minimum to 2, the HAL ignores it with pq on
+    depths.lowLatency = true;
+    mDev->set_buffer_depths(depths);
+    int streamType = mProducer ? TV_STREAM_TYPE_BUFFER_PRODUCER : TV_STREAM_TYPE_INDEPENDENT_VIDEO_SOURCE;
+    if (mDev->init(0, streamType, width, height, format) != 0) {
+        return false;
+    }
+    mDev->set_preview_info(0, 0, width, height);
+    if (mProducer) {
+        if (!allocatePreviewBuffers()) {
+            return false;
+        }
+        mDev->set_preview_callback(onPreview, this);
+    }
+    if (mDev->set_format(width, height, format) != 0) {
+        return false;
+    }
+    int dstWidth = 0, dstHeight = 0;
+    if (mDev->check_zme(width, height, &dstWidth, &dstHeight)) {
+        mDev->set_crop(0, 0, dstWidth, dstHeight);
+    } else {
+        mDev->set_crop(0, 0, width, height);
+    }
+    if (!mDisplay.start() || mDev->start() != NO_ERROR) {
+        return false;
+    }
+    mStarted = true;
+    if (mProducer) {
+        // the first request only arms the capture, the callbacks keep it going
+        mDev->request_capture(mPreview[0]->handle, 1);
+    }
+    if (mCase.stages == STAGES_RECORD) {
+        map<string, string> data;
+        data.insert({"status", "1"});
+        mDev->deal_priv_message("record", data);
+    }
+    return true;
+}
+
+void BenchRun::stop() {
+    if (mDev) {
+        if (mStarted) {
+            mDev->stop();
+            mStarted = false;
+        }
+        holdFor(TEARDOWN_TIME);
+        delete mDev;
+        mDev = NULL;
+    }
+    mDisplay.stop();
+    mEncoder.stop();
+    unlink(mStatsPath);
+    restoreProperties();
+}
+
+// the app got buffId back, it takes the frame and asks for the next one
+void BenchRun::onPreview(void *user, tv_input_capture_result_t result, uint64_t buffId) {
+    BenchRun *run = (BenchRun *)user;
+    if (buffId < 1 || buffId > APP_PREVIEW_BUFF_CNT) {
+        return;
+    }
+    nsecs_t captureTime = run->mClock.getIndex(buffId - 1);
+    if (captureTime > 0) {
+        run->mPreviewLatency.record(systemTime(SYSTEM_TIME_MONOTONIC) - captureTime);
+        run->mPreviewed.fetch_add(1, std::memory_order_relaxed);
+    }
+    run->mDev->request_capture(run->mPreview[buffId - 1]->handle, buffId);
+}
+
+LatencyHistogram &BenchRun::latency() {
+    return mProducer ? mPreviewLatency : mDisplay.latency();
+}
+
+uint64_t BenchRun::presented() {
+    return mProducer ? mPreviewed.load() : mDisplay.presented();
+}
+
+void BenchRun::resetCounters() {
+    map<string, string> data;
+    data.insert({"reset", "1"});
+    mDev->deal_priv_message("stats", data);
+    latency().reset();
+    mPresentedBase = presented();
+    halCpuTimes(&mCpuBase);
+    mAllocsBase = gAllocs.load();
+}
+
+void BenchRun::report(nsecs_t elapsed) {
+    uint64_t allocs = gAllocs.load() - mAllocsBase;
+    uint64_t frames = presented() - mPresentedBase;
+    std::map<int, nsecs_t> cpuTimes;
+    halCpuTimes(&cpuTimes);
+    nsecs_t cpu = 0;
+    for (const auto &it : cpuTimes) {
+        auto base = mCpuBase.find(it.first);
+        cpu += it.second - (base != mCpuBase.end() ? base->second : 0);
+    }
+    map<string, string> data;
+    data.insert({"path", mStatsPath});
+    mDev->deal_priv_message("stats", data);
+    uint64_t drops = parseDrops(mStatsPath);
+
+    uint64_t perFrame = frames > 0 ? frames : 1;
+    printf("%-17s %-10s %-7s %5d %7.2f %8.2f %8.2f %10.1f %9.2f %6" PRIu64 "\n",
+        mCase.mode->name, mCase.size->option, kStageNames[mCase.stages], mCase.depth,
+        frames * 1e9 / elapsed,
+        latency().percentileUs(0.5) / 1000.0, latency().percentileUs(0.99) / 1000.0,
+        cpu / 1000.0 / perFrame, (double)allocs / perFrame, drops);
+}
+
+// a few frames of an nv12 gradient, moving so consecutive frames differ
+static bool writeReplayFile(const char *path, int width, int height) {
+    size_t size = ReplayCaptureBackend::frameSize(V4L2_PIX_FMT_NV12, width, height);
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    uint8_t *frame = (uint8_t *)malloc(size);
+    bool ok = frame != NULL;
+    for (int f = 0; ok && f < 4; f++) {
+        for (size_t i = 0; i < size; i++) {
+            frame[i] = (uint8_t)(i / width + f * 16 + i % width);
+        }
+        ok = fwrite(frame, size, 1, file) == 1;
+    }
+    free(frame);
+    fclose(file);
+    return ok;
+}
+
+}  // namespace tvinput
+}  // namespace android
+
+using namespace android::tvinput;
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-t seconds] [-m window|vtunnel|producer] [-s 1080p|4k] [-d depth]\n",
+        name);
+}
+
+int main(int argc, char **argv) {
+    int seconds = 3;
+    const char *modeFilter = NULL;
+    const char *sizeFilter = NULL;
+    int depthFilter = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:m:s:d:h")) != -1) {
+        switch (opt) {
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        case 'm':
+            modeFilter = optarg;
+            break;
+        case 's':
+            sizeFilter = optarg;
+            break;
+        case 'd':
+            depthFilter = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (seconds <= 0 || depthFilter < 0 || depthFilter > TV_INPUT_MAX_BUFF_CNT) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::vector<int> depths(std::begin(kDepths), std::end(kDepths));
+    if (depthFilter > 0) {
+        depths.assign(1, depthFilter);
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/data/local/tmp/tv_input_bench_%d.nv12", getpid());
+
+    printf("%-17s %-10s %-7s %5s %7s %8s %8s %10s %9s %6s\n", "mode", "size", "stages", "depth",
+        "fps", "p50(ms)", "p99(ms)", "cpu(us/f)", "allocs/f", "drops");
+    int failed = 0;
+    for (const BenchSize &size : kSizes) {
+        if (sizeFilter && strcmp(sizeFilter, size.option)) {
+            continue;
+        }
+        if (!writeReplayFile(path, size.width, size.height)) {
+            fprintf(stderr, "cannot write %s\n", path);
+            return 1;
+        }
+        for (const BenchMode &mode : kModes) {
+            if (modeFilter && strcmp(modeFilter, mode.option)) {
+                continue;
+            }
+            for (int stages = 0; stages < STAGES_COUNT; stages++) {
+                if (!hasStages(mode.frameType, stages)) {
+                    continue;
+                }
+                for (int depth : depths) {
+                    if (!hasDepth(mode.frameType, stages, depth)) {
+                        continue;
+                    }
+                    BenchCase benchCase = { &mode, &size, stages, depth };
+                    BenchRun run(benchCase, path);
+                    if (!run.start()) {
+                        printf("%-17s %-10s %-7s %5d failed to start\n", mode.name, size.option,
+                            kStageNames[stages], depth);
+                        failed++;
+                        continue;
+                    }
+                    holdFor(WARMUP_TIME);
+                    run.resetCounters();
+                    nsecs_t begin = systemTime(SYSTEM_TIME_MONOTONIC);
+                    holdFor(s2ns(seconds));
+                    run.report(systemTime(SYSTEM_TIME_MONOTONIC) - begin);
+                    run.stop();
+                }
+            }
+        }
+        unlink(path);
+    }
+    return failed ? 1 : 0;
+}
@@ -5,6 +5,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <malloc.h>
+#include <stdlib.h>
 
 #include <cutils/native_handle.h>
 #include <log/log.h>
@@ -45,29 +46,48 @@ typedef enum tv_input_source_type {
     SOURCE_MAX,
 } tv_input_source_t;
 
-typedef struct tv_input_private {
-    tv_input_device_t device;
+typedef struct tv_input_request_info {
+    int deviceId;
+    int streamId;
+    int seq;
+} tv_input_request_info_t;
 
-    // Callback related data
-    const tv_input_callback_ops_ext_t* callback;
+#define NUM_OF_CONFIGS_DEFAULT 2
+
+// state of one capture input, handed to HinDevImpl callbacks as user data
+typedef struct tv_input_port {
+    struct tv_input_private *priv;
+    // id events of this input are reported with
+    int eventDeviceId;
     HinDevImpl* mDev;
     int mStreamType;
     bool isOpened;
     bool isInitialized;
-} tv_input_private_t;
+    int streamWidth;
+    int streamHeight;
+    int streamFormat;
+    int streamInterlaced;
+    tv_input_request_info_t requestInfo;
+    tv_stream_config_ext configs[NUM_OF_CONFIGS_DEFAULT];
+    native_handle_t* outBuffer;
+    native_handle_t* outCancelBuffer;
+} tv_input_port_t;
 
-typedef struct tv_input_request_info {
-    int deviceId;
-    int streamId;
-    int seq;
-} tv_input_request_info_t;
+typedef struct tv_input_private {
+    tv_input_device_t device;
+
+    // Callback related data
+    const tv_input_callback_ops_ext_t* callback;
+    // one per device id, each runs its own HinDevImpl
+    tv_input_port_t ports[SOURCE_MAX];
+    // set_preview_buffer has no device id, it follows set_preview_info
+    int previewDeviceId;
+    // capture/pq/iep buffers survive close_stream and input switches here
+    android::tvinput::GraphicBufferPool *bufferPool;
+} tv_input_private_t;
 
+// the hal entry points without a device argument reach the device through this
 static tv_input_private_t *s_TvInputPriv;
-static tv_input_request_info_t requestInfo;
-static int s_HinDevStreamWidth = 1280;
-static int s_HinDevStreamHeight = 720;
-static int s_HinDevStreamFormat = DEFAULT_TVHAL_STREAM_FORMAT;
-static int s_HinDevStreamInterlaced = 0;
 //static unsigned int gHinDevOpened = 0;
 //static Mutex gHinDevOpenLock;
 //static HinDevImpl* gHinHals[MAX_HIN_DEVICE_SUPPORTED];
@@ -95,41 +115,92 @@ tv_input_module_t HAL_MODULE_INFO_SYM = {
     }
 };
 
-V4L2EventCallBack hinDevEventCallback(int event_type) {
+static tv_input_port_t* getPort(int deviceId) {
+    if (!s_TvInputPriv || deviceId < 0 || deviceId >= SOURCE_MAX) {
+        return NULL;
+    }
+    return &s_TvInputPriv->ports[deviceId];
+}
+
+// capture input behind a device id, -1 if it has none. SOURCE_DTV is the
+// first input as before, a second rk_hdmirx/HDMI-MIPI shows up as SOURCE_HDMI2
+static int getCaptureInput(int deviceId) {
+    switch (deviceId) {
+    case SOURCE_DTV:
+        return 0;
+    case SOURCE_HDMI2:
+        return 1;
+    default:
+        return -1;
+    }
+}
+
+// commands without a device id go to the input the app drives the preview of
+static tv_input_port_t* getPreviewPort() {
+    return s_TvInputPriv ? getPort(s_TvInputPriv->previewDeviceId) : NULL;
+}
+
+static void initPort(tv_input_private_t *priv, tv_input_port_t *port, int deviceId) {
+    memset(port, 0, sizeof(*port));
+    port->priv = priv;
+    // the first input has always reported its events as SOURCE_HDMI1
+    port->eventDeviceId = deviceId == SOURCE_DTV ? SOURCE_HDMI1 : deviceId;
+    port->streamWidth = 1280;
+    port->streamHeight = 720;
+    port->streamFormat = DEFAULT_TVHAL_STREAM_FORMAT;
+}
+
+static void hinDevEventCallback(void *user, int event_type) {
     ALOGD("%s event type: %d", __FUNCTION__,event_type);
+    tv_input_port_t *port = (tv_input_port_t *)user;
     bool isHdmiIn;
     tv_input_event_ext_t event;
-    if (s_TvInputPriv && !s_TvInputPriv->isOpened) {
+    if (!port->isOpened) {
        ALOGE("%s The device is not open ", __FUNCTION__);
-       return 0;
+       return;
     }
     switch (event_type) {
 	case V4L2_EVENT_CTRL:
-             isHdmiIn = s_TvInputPriv->mDev->get_HdmiIn(false);
+             isHdmiIn = port->mDev->get_HdmiIn(false);
 	     /*if(!isHdmiIn)
 		event.type = TV_INPUT_EVENT_DEVICE_UNAVAILABLE;
 	     else
 		event.type = TV_INPUT_EVENT_DEVICE_AVAILABLE;
              */
         if (!isHdmiIn) {
-            if (s_TvInputPriv->mDev) {
+            if (port->mDev) {
             std::map<std::string, std::string> data;
-            s_TvInputPriv->mDev->deal_priv_message("hdmiinout", data);
+            port->mDev->deal_priv_message("hdmiinout", data);
             event.base_event.type = TV_INPUT_EVENT_PRIV_CMD_TO_APP;
             event.priv_app_cmd.action = "hdmiinout";
             }
         }
              break;
-        case V4L2_EVENT_SOURCE_CHANGE:
-             isHdmiIn = s_TvInputPriv->mDev->get_current_sourcesize(s_HinDevStreamWidth, s_HinDevStreamHeight,s_HinDevStreamFormat);
-             s_HinDevStreamInterlaced = s_TvInputPriv->mDev->check_interlaced();
-             ALOGD("s_HinDevStreamInterlaced %d ", s_HinDevStreamInterlaced);
+        case V4L2_EVENT_SOURCE_CHANGE: {
+             int ret = port->mDev->reconfigure(port->streamWidth, port->streamHeight, port->streamFormat);
+             if (ret == NO_ERROR) {
+                 // the running stream already follows the new timing, no reopen needed
+                 port->streamInterlaced = port->mDev->check_interlaced();
+                 ALOGD("%s reconfigured in place %dx%d", __FUNCTION__, port->streamWidth, port->streamHeight);
+                 return;
+             }
+             if (ret == DEAD_OBJECT) {
+                 // reconfigure dropped the stream half way, have the app reopen it
+                 isHdmiIn = false;
+                 event.base_event.type = TV_INPUT_EVENT_PRIV_CMD_TO_APP;
+                 event.priv_app_cmd.action = "hdmiinreset";
+                 break;
+             }
+             isHdmiIn = port->mDev->get_current_sourcesize(port->streamWidth, port->streamHeight, port->streamFormat);
+             port->streamInterlaced = port->mDev->check_interlaced();
+             ALOGD("streamInterlaced %d ", port->streamInterlaced);
              event.base_event.type = TV_INPUT_EVENT_STREAM_CONFIGURATIONS_CHANGED;
              break;
+        }
         case RK_HDMIRX_V4L2_EVENT_SIGNAL_LOST:
-             if (s_TvInputPriv->mDev) {
+             if (port->mDev) {
              std::map<std::string, std::string> data;
-             s_TvInputPriv->mDev->deal_priv_message("hdmiinout", data);
+             port->mDev->deal_priv_message("hdmiinout", data);
              event.base_event.type = TV_INPUT_EVENT_PRIV_CMD_TO_APP;
              event.priv_app_cmd.action = "hdmiinout";
              }
@@ -139,19 +210,18 @@ V4L2EventCallBack hinDevEventCallback(int event_type) {
              event.priv_app_cmd.action = "hdmiinreset";
              break;
     }
-    ALOGE("%s width:%d,height:%d,format:0x%x,%d", __FUNCTION__,s_HinDevStreamWidth,s_HinDevStreamHeight,s_HinDevStreamFormat,isHdmiIn);
-    event.base_event.device_info.device_id = SOURCE_HDMI1;
+    ALOGE("%s width:%d,height:%d,format:0x%x,%d", __FUNCTION__,port->streamWidth,port->streamHeight,port->streamFormat,isHdmiIn);
+    event.base_event.device_info.device_id = port->eventDeviceId;
     event.base_event.device_info.type = TV_INPUT_TYPE_HDMI;
     event.base_event.device_info.audio_type = AUDIO_DEVICE_NONE;
     event.base_event.device_info.audio_address = NULL;
     if(event.base_event.type > 0) {
-      s_TvInputPriv->callback->notify_ext(nullptr, &event, nullptr);
+      port->priv->callback->notify_ext(nullptr, &event, nullptr);
     }
-    return 0;
 }
-NotifyCommandCallback commandCallback(tv_input_command command) {
-    hinDevEventCallback(command.command_id);
-    return 0;
+
+static void commandCallback(void *user, tv_input_command command) {
+    hinDevEventCallback(user, command.command_id);
 }
 
 static int getHdmiPortID(tv_input_source_t source_type) {
@@ -173,30 +243,31 @@ static int hin_dev_open(int deviceId, int type)
 {   
     ALOGD("hin_dev_open deviceId:=%d",deviceId); 
     HinDevImpl* hinDevImpl = NULL;
+    tv_input_port_t *port = getPort(deviceId);
+    int input = getCaptureInput(deviceId);
     //Mutex::Autolock lock(gHinDevOpenLock);
-    if (!s_TvInputPriv->isOpened && deviceId == SOURCE_DTV) {
-        if (deviceId >=  MAX_HIN_DEVICE_SUPPORTED) {
-            ALOGD("provided device id out of bounds , deviceid = %d .\n" , deviceId);
-            return -EINVAL;
-        }
-        if (!s_TvInputPriv->mDev) {
+    if (port && !port->isOpened && input >= 0) {
+        if (!port->mDev) {
             hinDevImpl = new HinDevImpl;
             if (!hinDevImpl) {
                 ALOGE("no memory to new hinDevImpl");
                 return -ENOMEM;
             }
-            s_TvInputPriv->mDev = hinDevImpl;
-            s_TvInputPriv->mDev->set_data_callback((V4L2EventCallBack)hinDevEventCallback);
-            s_TvInputPriv->mDev->set_command_callback((NotifyCommandCallback)commandCallback);
-            if (s_TvInputPriv->mDev->findDevice(deviceId, s_HinDevStreamWidth, s_HinDevStreamHeight,s_HinDevStreamFormat)!= 0) {
+            port->mDev = hinDevImpl;
+            if (s_TvInputPriv) {
+                port->mDev->set_buffer_pool(s_TvInputPriv->bufferPool);
+            }
+            port->mDev->set_data_callback(hinDevEventCallback, port);
+            port->mDev->set_command_callback(commandCallback, port);
+            if (port->mDev->findDevice(input, port->streamWidth, port->streamHeight, port->streamFormat)!= 0) {
                 ALOGE("hinDevImpl->findDevice %d failed!", deviceId);
-                delete s_TvInputPriv->mDev;
-	        s_TvInputPriv->mDev = nullptr;
+                delete port->mDev;
+	        port->mDev = nullptr;
                 return -1;
             }
-            ALOGD("hinDevImpl->findDevice %d ,%d,0x%x,0x%x!", s_HinDevStreamWidth,s_HinDevStreamHeight,s_HinDevStreamFormat,DEFAULT_V4L2_STREAM_FORMAT);
-            s_TvInputPriv->mDev->set_interlaced(s_HinDevStreamInterlaced);
-            s_TvInputPriv->isOpened = true;
+            ALOGD("hinDevImpl->findDevice %d ,%d,0x%x,0x%x!", port->streamWidth,port->streamHeight,port->streamFormat,DEFAULT_V4L2_STREAM_FORMAT);
+            port->mDev->set_interlaced(port->streamInterlaced);
+            port->isOpened = true;
         }
     }
     return 0;
@@ -237,18 +308,22 @@ void findTvDevices(tv_input_private_t *priv) {
     generateEvent(priv, SOURCE_HDMI1, TV_INPUT_EVENT_STREAM_CONFIGURATIONS_CHANGED);
     generateEvent(priv, SOURCE_DTV, TV_INPUT_EVENT_DEVICE_AVAILABLE);
     generateEvent(priv, SOURCE_DTV, TV_INPUT_EVENT_STREAM_CONFIGURATIONS_CHANGED);
+    if (HinDevImpl::countInputs() > getCaptureInput(SOURCE_HDMI2)) {
+        generateEvent(priv, SOURCE_HDMI2, TV_INPUT_EVENT_DEVICE_AVAILABLE);
+        generateEvent(priv, SOURCE_HDMI2, TV_INPUT_EVENT_STREAM_CONFIGURATIONS_CHANGED);
+    }
 }
 
-#define NUM_OF_CONFIGS_DEFAULT 2
-static tv_stream_config_ext mconfig[NUM_OF_CONFIGS_DEFAULT];
-static native_handle_t* out_buffer;
-static native_handle_t* out_cancel_buffer = nullptr;
-
 static int tv_input_get_stream_configurations_ext(
         const struct tv_input_device *dev, int device_id, int *num_of_configs, const tv_stream_config_ext **configs)
 {
     ALOGD("%s called device_id=%d,s_TvInputPriv=%p", __func__, device_id,s_TvInputPriv);
     UNUSED(dev);
+    tv_input_port_t *port = getPort(device_id);
+    if (!port) {
+        return -EINVAL;
+    }
+    tv_stream_config_ext *mconfig = port->configs;
     if (device_id == -1) {
         *num_of_configs = -1;
     }
@@ -263,26 +338,26 @@ static int tv_input_get_stream_configurations_ext(
     case SOURCE_HDMI2:
         mconfig[0].base_config.stream_id = STREAM_ID_GENERIC;
         mconfig[0].base_config.type = TV_STREAM_TYPE_BUFFER_PRODUCER;
-        mconfig[0].base_config.max_video_width = s_HinDevStreamWidth;
-        mconfig[0].base_config.max_video_height = s_HinDevStreamHeight;
-        mconfig[0].format = s_HinDevStreamFormat;//DEFAULT_TVHAL_STREAM_FORMAT;
-        mconfig[0].width = s_HinDevStreamWidth;
-        mconfig[0].height = s_HinDevStreamHeight;
+        mconfig[0].base_config.max_video_width = port->streamWidth;
+        mconfig[0].base_config.max_video_height = port->streamHeight;
+        mconfig[0].format = port->streamFormat;//DEFAULT_TVHAL_STREAM_FORMAT;
+        mconfig[0].width = port->streamWidth;
+        mconfig[0].height = port->streamHeight;
         mconfig[0].usage = RK_GRALLOC_USAGE_STRIDE_ALIGN_64;//|GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN;//STREAM_BUFFER_GRALLOC_USAGE;
         mconfig[0].buffCount = APP_PREVIEW_BUFF_CNT;
 
         mconfig[1].base_config.stream_id = STREAM_ID_FRAME_CAPTURE;
         mconfig[1].base_config.type = TV_STREAM_TYPE_INDEPENDENT_VIDEO_SOURCE;
-        mconfig[1].base_config.max_video_width = s_HinDevStreamWidth;
-        mconfig[1].base_config.max_video_height = s_HinDevStreamHeight;
-        mconfig[1].format = s_HinDevStreamFormat;//DEFAULT_TVHAL_STREAM_FORMAT;
-        mconfig[1].width = s_HinDevStreamWidth;
-        mconfig[1].height = s_HinDevStreamWidth;
+        mconfig[1].base_config.max_video_width = port->streamWidth;
+        mconfig[1].base_config.max_video_height = port->streamHeight;
+        mconfig[1].format = port->streamFormat;//DEFAULT_TVHAL_STREAM_FORMAT;
+        mconfig[1].width = port->streamWidth;
+        mconfig[1].height = port->streamWidth;
         mconfig[1].usage = RK_GRALLOC_USAGE_STRIDE_ALIGN_64;//|GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN;//STREAM_BUFFER_GRALLOC_USAGE;
         mconfig[1].buffCount = APP_PREVIEW_BUFF_CNT;
         *num_of_configs = NUM_OF_CONFIGS_DEFAULT;
         *configs = mconfig;
-        ALOGE("config device_id=%d, %d ,%d,0x%x,0x%x!", device_id, s_HinDevStreamWidth,s_HinDevStreamHeight,s_HinDevStreamFormat,DEFAULT_V4L2_STREAM_FORMAT);
+        ALOGE("config device_id=%d, %d ,%d,0x%x,0x%x!", device_id, port->streamWidth,port->streamHeight,port->streamFormat,DEFAULT_V4L2_STREAM_FORMAT);
         break;
     default:
         break;
@@ -293,23 +368,24 @@ static int tv_input_get_stream_configurations_ext(
 static int tv_input_close_stream(struct tv_input_device *dev, int device_id, int stream_id)
 {
     ALOGD("func: %s, device_id: %d, stream_id: %d", __func__, device_id, stream_id);
-    if (s_TvInputPriv) {
-        if (s_TvInputPriv->mDev) {
-            if (out_buffer) {
-                native_handle_close(out_buffer);
-                native_handle_delete(out_buffer);
-                out_buffer=NULL;
+    tv_input_port_t *port = getPort(device_id);
+    if (port) {
+        if (port->mDev) {
+            if (port->outBuffer) {
+                native_handle_close(port->outBuffer);
+                native_handle_delete(port->outBuffer);
+                port->outBuffer = NULL;
             }
-            if (out_cancel_buffer) {
-                native_handle_close(out_cancel_buffer);
-                native_handle_delete(out_cancel_buffer);
-                out_cancel_buffer = nullptr;
+            if (port->outCancelBuffer) {
+                native_handle_close(port->outCancelBuffer);
+                native_handle_delete(port->outCancelBuffer);
+                port->outCancelBuffer = nullptr;
             }
-            s_TvInputPriv->mDev->stop();
-            s_TvInputPriv->isInitialized = false;
-            s_TvInputPriv->isOpened = false;
-            //delete s_TvInputPriv->mDev;
-            s_TvInputPriv->mDev = nullptr;
+            port->mDev->stop();
+            port->isInitialized = false;
+            port->isOpened = false;
+            delete port->mDev;
+            port->mDev = nullptr;
             if (device_id < 0 && stream_id == 0) {
                 ALOGD("func: %s,invail device_id: %d, stream_id: %d return -EINVAL",
                     __func__, device_id, stream_id);
@@ -330,50 +406,52 @@ static int tv_input_open_stream(struct tv_input_device *dev, int device_id, tv_s
 static int tv_input_open_stream_ext(struct tv_input_device *dev, int device_id, tv_stream_ext_t *stream)
 {
     ALOGD("func: %s, device_id: %d, stream_id=%d, type=%d", __func__, device_id, stream->base_stream.stream_id, stream->base_stream.type);
-    if (s_TvInputPriv) {
-        if (s_TvInputPriv->mDev && s_TvInputPriv->isInitialized) {
-            int width = s_HinDevStreamWidth;
-            int height = s_HinDevStreamHeight;
-            requestInfo.streamId = stream->base_stream.stream_id;
-
-            if(s_TvInputPriv->mDev->set_format(width, height, s_HinDevStreamFormat)) {
+    tv_input_port_t *port = getPort(device_id);
+    if (port) {
+        if (port->mDev && port->isInitialized) {
+            int width = port->streamWidth;
+            int height = port->streamHeight;
+            port->requestInfo.streamId = stream->base_stream.stream_id;
+
+            if(port->mDev->set_format(width, height, port->streamFormat)) {
                 ALOGE("%s set_format failed! force release", __func__);
-                tv_input_close_stream(dev, device_id, requestInfo.streamId);
+                tv_input_close_stream(dev, device_id, port->requestInfo.streamId);
                 return -EINVAL;
             }
             int dst_width = 0, dst_height = 0;
-            bool use_zme = s_TvInputPriv->mDev->check_zme(width, height, &dst_width, &dst_height);
+            bool use_zme = port->mDev->check_zme(width, height, &dst_width, &dst_height);
             if(use_zme) {
-                s_TvInputPriv->mDev->set_crop(0, 0, dst_width, dst_height);
+                port->mDev->set_crop(0, 0, dst_width, dst_height);
             } else {
-                s_TvInputPriv->mDev->set_crop(0, 0, width, height);
+                port->mDev->set_crop(0, 0, width, height);
             }
             if (stream->base_stream.type & TYPE_SIDEBAND_WINDOW) {
                 ALOGD("stream->base_stream.type & TYPE_SIDEBAND_WINDOW");
-                s_TvInputPriv->mStreamType = TV_STREAM_TYPE_INDEPENDENT_VIDEO_SOURCE;
-                stream->base_stream.sideband_stream_source_handle = native_handle_clone(s_TvInputPriv->mDev->getSindebandBufferHandle());
-                out_buffer = stream->base_stream.sideband_stream_source_handle;
-                if (s_TvInputPriv->mDev->getSindebandCancelBufferHandle() == NULL) {
+                port->mStreamType = TV_STREAM_TYPE_INDEPENDENT_VIDEO_SOURCE;
+                stream->base_stream.sideband_stream_source_handle = native_handle_clone(port->mDev->getSindebandBufferHandle());
+                port->outBuffer = stream->base_stream.sideband_stream_source_handle;
+                if (port->mDev->getSindebandCancelBufferHandle() == NULL) {
                     ALOGD("%s cancel buffer handle is NULL", __FUNCTION__);
                 } else {
-                    stream->sideband_cancel_stream_source_handle = native_handle_clone(s_TvInputPriv->mDev->getSindebandCancelBufferHandle());
-                    out_cancel_buffer = stream->sideband_cancel_stream_source_handle;
+                    stream->sideband_cancel_stream_source_handle = native_handle_clone(port->mDev->getSindebandCancelBufferHandle());
+                    port->outCancelBuffer = stream->sideband_cancel_stream_source_handle;
                 }
             }
-            s_TvInputPriv->mDev->start();
+            port->mDev->start();
         }
         return 0;
     }
     return -EINVAL;
 }
 
-NotifyQueueDataCallback dataCallback(tv_input_capture_result_t result, uint64_t buff_id) {
+static void dataCallback(void *user, tv_input_capture_result_t result, uint64_t buff_id) {
+    tv_input_port_t *port = (tv_input_port_t *)user;
     //ALOGV("%s req:%u ,%u in result.buff_id=%" PRIu64, __FUNCTION__,
-    //    requestInfo.seq, result.seq, buff_id);
+    //    port->requestInfo.seq, result.seq, buff_id);
     tv_input_event_ext_t event;
-    event.base_event.capture_result.device_id = requestInfo.deviceId;
-    event.base_event.capture_result.stream_id = requestInfo.streamId;
-    event.base_event.capture_result.seq = requestInfo.seq++;
+    event.base_event.capture_result.device_id = port->requestInfo.deviceId;
+    event.base_event.capture_result.stream_id = port->requestInfo.streamId;
+    event.base_event.capture_result.seq = port->requestInfo.seq++;
     if (buff_id != -1) {
         event.base_event.type = TV_INPUT_EVENT_CAPTURE_SUCCEEDED;
         event.buff_id = buff_id;
@@ -381,26 +459,34 @@ NotifyQueueDataCallback dataCallback(tv_input_capture_result_t result, uint64_t
     } else {
         event.base_event.type = TV_INPUT_EVENT_CAPTURE_FAILED;
     }
-    s_TvInputPriv->callback->notify_ext(nullptr, &event, nullptr);
-    return 0;
+    port->priv->callback->notify_ext(nullptr, &event, nullptr);
 }
 
-static int tv_input_priv_cmd_from_app(const std::string action, const std::map<std::string, std::string> data) {
-    ALOGV("%s called", __func__);
-    if (s_TvInputPriv && s_TvInputPriv->isInitialized && s_TvInputPriv->mDev) {
-        s_TvInputPriv->mDev->deal_priv_message(action, data);
+static int priv_cmd_from_app(tv_input_port_t *port, const std::string &action,
+        const std::map<std::string, std::string> &data) {
+    if (port && port->isInitialized && port->mDev) {
+        port->mDev->deal_priv_message(action, data);
         return 0;
     }
     return -EINVAL;
 }
 
+static int tv_input_priv_cmd_from_app(const std::string action, const std::map<std::string, std::string> data) {
+    ALOGV("%s called", __func__);
+    // apps driving more than one input name it, older ones mean the preview
+    auto it = data.find("device_id");
+    tv_input_port_t *port = it != data.end() ? getPort(atoi(it->second.c_str())) : getPreviewPort();
+    return priv_cmd_from_app(port, action, data);
+}
+
 static int tv_input_request_capture_ext(struct tv_input_device* dev, int device_id,
             int stream_id, uint64_t buff_id, buffer_handle_t buffer, uint32_t seq) {
     ALOGV("%s called,req=%u", __func__,seq);
-    if (s_TvInputPriv && s_TvInputPriv->isInitialized && s_TvInputPriv->mDev && buffer != nullptr) {
-        //requestInfo.seq = seq;
-        s_TvInputPriv->mDev->set_preview_callback((NotifyQueueDataCallback)dataCallback);
-        s_TvInputPriv->mDev->request_capture(buffer, buff_id);
+    tv_input_port_t *port = getPort(device_id);
+    if (port && port->isInitialized && port->mDev && buffer != nullptr) {
+        //port->requestInfo.seq = seq;
+        port->mDev->set_preview_callback(dataCallback, port);
+        port->mDev->request_capture(buffer, buff_id);
         return 0;
     }
 
@@ -416,47 +502,65 @@ static int tv_input_cancel_capture(struct tv_input_device*, int, int, uint32_t)
 static int tv_input_set_preview_info(int32_t deviceId, int32_t streamId,
             int32_t top, int32_t left, int32_t width, int32_t height, int32_t extInfo)
 {
-    ALOGD("%s device id %d,called,%p", __func__,deviceId,s_TvInputPriv->mDev);
-    if (s_TvInputPriv && s_TvInputPriv->mDev && !s_TvInputPriv->isInitialized) {
-        if (s_TvInputPriv->mDev->init(deviceId, extInfo,
-                s_HinDevStreamWidth, s_HinDevStreamHeight,s_HinDevStreamFormat)!= 0) {
+    tv_input_port_t *port = getPort(deviceId);
+    if (!port) {
+        return -1;
+    }
+    ALOGD("%s device id %d,called,%p", __func__,deviceId,port->mDev);
+    if (port->mDev && !port->isInitialized) {
+        if (port->mDev->init(deviceId, extInfo,
+                port->streamWidth, port->streamHeight,port->streamFormat)!= 0) {
             ALOGE("hinDevImpl->init %d failed!", deviceId);
             return -1;
         }
-        s_TvInputPriv->isInitialized = true;
-        requestInfo.deviceId = deviceId;
+        port->isInitialized = true;
+        port->requestInfo.deviceId = deviceId;
     }
-    if(s_TvInputPriv->isInitialized){
-    	requestInfo.deviceId = deviceId;
-    	s_TvInputPriv->mDev->set_preview_info(top, left, width, height);
+    if(port->isInitialized){
+    	port->requestInfo.deviceId = deviceId;
+    	s_TvInputPriv->previewDeviceId = deviceId;
+    	port->mDev->set_preview_info(top, left, width, height);
     	return 0;
     }
     return -1;
 }
 
-static int tv_input_set_preview_buffer(buffer_handle_t rawHandle, uint64_t bufferId)
+static int set_preview_buffer(tv_input_port_t *port, buffer_handle_t rawHandle, uint64_t bufferId)
 {
-    ALOGD("%s called", __func__);
-    if (!s_TvInputPriv->isInitialized || !s_TvInputPriv->mDev) {
+    if (!port || !port->isInitialized || !port->mDev) {
     	return -EINVAL;
     }
-    s_TvInputPriv->mDev->set_preview_buffer(rawHandle, bufferId);
+    port->mDev->set_preview_buffer(rawHandle, bufferId);
     return 0;
 }
 
+static int tv_input_set_preview_buffer(buffer_handle_t rawHandle, uint64_t bufferId)
+{
+    ALOGD("%s called", __func__);
+    return set_preview_buffer(getPreviewPort(), rawHandle, bufferId);
+}
 /*****************************************************************************/
 
 static int tv_input_device_close(struct hw_device_t *dev)
 {
     ALOGD("%s called", __func__);
-    if (s_TvInputPriv) {
-        if (s_TvInputPriv->mDev) {
-            delete s_TvInputPriv->mDev;
-            s_TvInputPriv->mDev = nullptr;
+    tv_input_private_t *priv = (tv_input_private_t *)dev;
+    if (priv) {
+        for (int i = 0; i < SOURCE_MAX; i++) {
+            tv_input_port_t *port = &priv->ports[i];
+            if (port->mDev) {
+                delete port->mDev;
+                port->mDev = nullptr;
+            }
+            port->isOpened = false;
+            port->isInitialized = false;
+        }
+        delete priv->bufferPool;
+        priv->bufferPool = NULL;
+        if (s_TvInputPriv == priv) {
+            s_TvInputPriv = NULL;
         }
-        s_TvInputPriv->isOpened = false;
-        s_TvInputPriv->isInitialized = false;
-        free(s_TvInputPriv);
+        free(priv);
     }
     return 0;
 }
@@ -469,12 +573,12 @@ static int tv_input_initialize_ext(struct tv_input_device* dev,
         return -EINVAL;
     }
     s_TvInputPriv = (tv_input_private_t*)dev;
-//memset(s_TvInputPriv->mDev,0,sizeof(s_TvInputPriv->mDev));
-    s_TvInputPriv->mDev = NULL;
-    s_TvInputPriv->isOpened = false;
-    s_TvInputPriv->isInitialized = false;
+    for (int i = 0; i < SOURCE_MAX; i++) {
+        initPort(s_TvInputPriv, &s_TvInputPriv->ports[i], i);
+    }
+    s_TvInputPriv->previewDeviceId = SOURCE_DTV;
     s_TvInputPriv->callback = callback;
-    
+
     findTvDevices(s_TvInputPriv);
     return 0;
 }
@@ -515,6 +619,9 @@ static int tv_input_device_open(const struct hw_module_t* module,
 
         /* initialize our state here */
         memset(dev, 0, sizeof(*dev));
+        int poolMb = property_get_int32(TV_INPUT_BUFFER_POOL_MB, 128);
+        dev->bufferPool = new android::tvinput::GraphicBufferPool(
+            poolMb > 0 ? (size_t)poolMb << 20 : 0);
 
         /* initialize the procs */
         dev->device.common.tag = HARDWARE_DEVICE_TAG;